@@ -0,0 +1,46 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+class BenchReport;
+
+struct BenchOptions
+{
+    int iterations{ 20 };
+    // Sections to run, e.g. "convert" or "record", empty runs all of them
+    std::vector<std::string> sections;
+    // Mock compositor binary for the macro benchmarks, empty skips them
+    std::string compositor;
+    // Session frames every macro benchmark captures
+    int frames{ 300 };
+    // Where the tables go, stderr when the JSON report is on stdout
+    std::FILE *out{ stdout };
+
+    bool wants(const char *section) const;
+};
+
+// Mean milliseconds per call, after one warm-up call
+inline double measureMs(int iterations, const std::function<void()> &function)
+{
+    function();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        function();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::milli>(elapsed).count() / iterations;
+}
+
+// Kernels and building blocks on synthetic data, no compositor needed.
+// Both return false if any result didn't match its reference.
+bool runMicroBenchmarks(const BenchOptions &options, BenchReport *report);
+// Starts the mock compositor, connects to it and captures through the
+// regular capture classes. Benchmarks needing a Wayland connection, like
+// SHM buffer acquisition, run here too.
+bool runMacroBenchmarks(const BenchOptions &options, BenchReport *report, int &argc, char *argv[]);
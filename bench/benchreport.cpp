@@ -0,0 +1,109 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "benchreport.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+std::string quoted(const std::string &text)
+{
+    std::string result = "\"";
+    for (const char c : text) {
+        switch (c) {
+        case '"':
+            result += "\\\"";
+            break;
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                result += escaped;
+            } else {
+                result += c;
+            }
+        }
+    }
+    return result + "\"";
+}
+
+std::string number(double value)
+{
+    // JSON has no NaN or infinity
+    if (!std::isfinite(value))
+        return "null";
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+}
+
+} // namespace
+
+void BenchReport::setProperty(const std::string &key, const std::string &value)
+{
+    for (auto &property : m_properties) {
+        if (property.first == key) {
+            property.second = value;
+            return;
+        }
+    }
+    m_properties.emplace_back(key, value);
+}
+
+void BenchReport::add(const std::string &suite, const std::string &name, Values values)
+{
+    m_results.push_back({ suite, name, std::move(values), {} });
+}
+
+void BenchReport::fail(const std::string &suite,
+                       const std::string &name,
+                       Values values,
+                       const std::string &error)
+{
+    m_results.push_back({ suite, name, std::move(values), error });
+}
+
+void BenchReport::skip(const std::string &suite, const std::string &name, const std::string &reason)
+{
+    m_results.push_back({ suite, name, {}, "skipped: " + reason });
+}
+
+std::string BenchReport::toJson() const
+{
+    std::string json = "{\n";
+    for (const auto &property : m_properties)
+        json += "  " + quoted(property.first) + ": " + quoted(property.second) + ",\n";
+    json += "  \"results\": [\n";
+    for (size_t i = 0; i < m_results.size(); ++i) {
+        const auto &result = m_results[i];
+        json += "    { \"suite\": " + quoted(result.suite) + ", \"name\": " + quoted(result.name);
+        for (const auto &value : result.values)
+            json += ", " + quoted(value.first) + ": " + number(value.second);
+        if (!result.error.empty())
+            json += ", \"error\": " + quoted(result.error);
+        json += i + 1 < m_results.size() ? " },\n" : " }\n";
+    }
+    json += "  ]\n}\n";
+    return json;
+}
+
+bool BenchReport::writeJson(const std::string &path) const
+{
+    const std::string json = toJson();
+    if (path == "-")
+        return std::fwrite(json.data(), 1, json.size(), stdout) == json.size();
+
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    const bool written = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+    return std::fclose(file) == 0 && written;
+}
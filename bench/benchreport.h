@@ -0,0 +1,46 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Collects benchmark results for the JSON report. Results are written in
+// the order they were added, one per line, and their names are stable
+// across runs, so reports of two commits can be compared with plain diff.
+class BenchReport
+{
+public:
+    using Values = std::vector<std::pair<std::string, double>>;
+
+    struct Result
+    {
+        std::string suite;
+        // Path like "convert/XRGB8888/I420/avx2"
+        std::string name;
+        Values values;
+        // Set when the result is wrong or the benchmark couldn't run
+        std::string error;
+    };
+
+    void setProperty(const std::string &key, const std::string &value);
+    void add(const std::string &suite, const std::string &name, Values values);
+    // A benchmark that ran but whose output didn't match the reference
+    void fail(const std::string &suite, const std::string &name, Values values, const std::string &error);
+    void skip(const std::string &suite, const std::string &name, const std::string &reason);
+
+    inline const std::vector<Result> &results() const
+    {
+        return m_results;
+    }
+
+    std::string toJson() const;
+    // "-" writes to stdout
+    bool writeJson(const std::string &path) const;
+
+private:
+    std::vector<std::pair<std::string, std::string>> m_properties;
+    std::vector<Result> m_results;
+};
@@ -0,0 +1,565 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+// End-to-end benchmarks: the mock compositor is the synthetic frame source
+// and the regular capture classes consume it over a real Wayland connection,
+// the same way the application does.
+
+#include "benchmarks.h"
+#include "benchreport.h"
+#include "capture.h"
+#include "captureburst.h"
+#include "capturemetrics.h"
+#include "rawframefile.h"
+#include "rawrecorder.h"
+#include "recorder.h"
+#include "shmbufferpool.h"
+
+#include <private/qguiapplication_p.h>
+#include <private/qwaylanddisplay_p.h>
+#include <private/qwaylandintegration_p.h>
+#include <private/qwaylandshm_p.h>
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QTemporaryDir>
+#include <QTimer>
+
+#include <wayland-client-protocol.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr const char *Suite = "macro";
+constexpr int FrameWidth = 1920;
+constexpr int FrameHeight = 1080;
+// Faster than any of the pipelines, so they are measured and not the source
+constexpr int SourceFps = 500;
+// Frames painted into a buffer before it comes around again
+constexpr int SwapchainLength = 3;
+constexpr int StartTimeoutMs = 5000;
+
+// The mock compositor as a child process, stopped with SIGTERM
+class MockCompositorProcess
+{
+public:
+    ~MockCompositorProcess()
+    {
+        stop();
+    }
+
+    // Empty on success, otherwise what went wrong
+    std::string start(const std::string &binary, const std::vector<std::string> &arguments)
+    {
+        int output[2];
+        if (::pipe2(output, O_CLOEXEC) != 0)
+            return std::string("pipe failed: ") + strerror(errno);
+
+        std::vector<char *> argv;
+        argv.push_back(const_cast<char *>(binary.c_str()));
+        for (const auto &argument : arguments)
+            argv.push_back(const_cast<char *>(argument.c_str()));
+        argv.push_back(nullptr);
+
+        m_pid = ::fork();
+        if (m_pid == 0) {
+            ::dup2(output[1], STDOUT_FILENO);
+            ::execv(binary.c_str(), argv.data());
+            ::_exit(127);
+        }
+        ::close(output[1]);
+        if (m_pid < 0) {
+            ::close(output[0]);
+            return std::string("fork failed: ") + strerror(errno);
+        }
+
+        // The socket name is printed once the compositor listens
+        std::string line;
+        pollfd readable = { output[0], POLLIN, 0 };
+        while (line.find('\n') == std::string::npos && ::poll(&readable, 1, StartTimeoutMs) > 0) {
+            char buffer[256];
+            const ssize_t count = ::read(output[0], buffer, sizeof(buffer));
+            if (count <= 0)
+                break;
+            line.append(buffer, size_t(count));
+        }
+        ::close(output[0]);
+        if (line.find('\n') == std::string::npos) {
+            stop();
+            return "the mock compositor didn't start";
+        }
+        m_socketName = line.substr(0, line.find('\n'));
+        return {};
+    }
+
+    void stop()
+    {
+        if (m_pid <= 0)
+            return;
+        ::kill(m_pid, SIGTERM);
+        ::waitpid(m_pid, nullptr, 0);
+        m_pid = -1;
+    }
+
+    inline const std::string &socketName() const
+    {
+        return m_socketName;
+    }
+
+private:
+    pid_t m_pid{ -1 };
+    std::string m_socketName;
+};
+
+// Runs the event loop until done() or the timeout, false on timeout
+bool waitFor(const std::function<bool()> &done, int timeoutMs)
+{
+    if (done())
+        return true;
+    QEventLoop loop;
+    QTimer poll;
+    poll.setInterval(2);
+    QObject::connect(&poll, &QTimer::timeout, &loop, [&] {
+        if (done())
+            loop.quit();
+    });
+    QTimer::singleShot(timeoutMs, &loop, &QEventLoop::quit);
+    poll.start();
+    loop.exec();
+    return done();
+}
+
+int frameTimeoutMs(const BenchOptions &options)
+{
+    return std::max(10000, options.frames * 50);
+}
+
+double toMs(uint64_t ns)
+{
+    return double(ns) / 1e6;
+}
+
+// A context with its source selected, nullptr if the compositor refused
+TreelandCaptureContext *selectSource()
+{
+    auto context = TreelandCaptureManager::instance()->createContext();
+    if (!context)
+        return nullptr;
+    bool ready = false;
+    bool failed = false;
+    QObject::connect(context, &TreelandCaptureContext::sourceReady, context, [&] {
+        ready = true;
+    });
+    QObject::connect(context, &TreelandCaptureContext::sourceFailed, context, [&] {
+        failed = true;
+    });
+    context->selectSource(TreelandCaptureContext::source_type_output, false, false, nullptr);
+    waitFor([&] { return ready || failed; }, StartTimeoutMs);
+    context->disconnect(context);
+    if (!ready) {
+        delete context;
+        return nullptr;
+    }
+    return context;
+}
+
+// Session frames received, read every time the session is ready
+class FrameCounter : public QObject
+{
+public:
+    explicit FrameCounter(TreelandCaptureSession *session)
+    {
+        connect(session, &TreelandCaptureSession::ready, this, [this] {
+            if (!m_count++)
+                m_clock.start();
+        });
+    }
+
+    inline int count() const
+    {
+        return m_count;
+    }
+
+    // Since the first frame, which is spent on buffer setup
+    inline double seconds() const
+    {
+        return m_clock.isValid() ? m_clock.nsecsElapsed() / 1e9 : 0;
+    }
+
+private:
+    int m_count{ 0 };
+    QElapsedTimer m_clock;
+};
+
+// Receiving frames with nothing consuming them: how fast and how late the
+// ready events arrive, and how evenly.
+void benchSession(const BenchOptions &options, BenchReport *report)
+{
+    const std::string name = "session/1080p";
+    auto context = selectSource();
+    if (!context) {
+        report->skip(Suite, name, "source selection failed");
+        return;
+    }
+    auto session = context->ensureSession();
+    FrameCounter counter(session);
+    session->start();
+    const bool complete = waitFor([&] { return counter.count() > options.frames; }, frameTimeoutMs(options));
+    const double fps = counter.seconds() > 0 ? (counter.count() - 1) / counter.seconds() : 0.0;
+
+    const auto latency = session->metrics()->histogram(CaptureMetrics::CompositorToReceive);
+    const auto jitter = session->metrics()->histogram(CaptureMetrics::FrameJitter);
+    std::fprintf(options.out,
+                 "%-24s %10.1f %10.3f %10.3f %10.3f\n",
+                 "session 1080p",
+                 fps,
+                 toMs(latency.percentile(50)),
+                 toMs(latency.percentile(99)),
+                 toMs(jitter.percentile(99)));
+    BenchReport::Values values = { { "fps", fps },
+                                   { "receive_p50_ms", toMs(latency.percentile(50)) },
+                                   { "receive_p99_ms", toMs(latency.percentile(99)) },
+                                   { "jitter_p99_ms", toMs(jitter.percentile(99)) } };
+    if (complete)
+        report->add(Suite, name, std::move(values));
+    else
+        report->fail(Suite, name, std::move(values), "timed out waiting for frames");
+    delete context;
+}
+
+// The capture -> convert -> encode pipeline with CPU conversion into y4m
+void benchRecorder(const BenchOptions &options, BenchReport *report, const QString &directory)
+{
+    const std::string name = "record/y4m/1080p";
+    auto context = selectSource();
+    if (!context) {
+        report->skip(Suite, name, "source selection failed");
+        return;
+    }
+    auto session = context->ensureSession();
+    Recorder recorder;
+    QString failure;
+    QObject::connect(&recorder, &Recorder::error, &recorder, [&](const QString &message) {
+        failure = message;
+    });
+    QElapsedTimer clock;
+    if (!recorder.start(session, directory + QStringLiteral("/record.") + recorder.fileSuffix())) {
+        report->skip(Suite, name, "the recorder didn't start");
+        delete context;
+        return;
+    }
+    session->start();
+    clock.start();
+    const bool complete = waitFor(
+        [&] {
+            return !failure.isEmpty() || recorder.statistics().captured >= quint64(options.frames);
+        },
+        frameTimeoutMs(options));
+    recorder.stop();
+    const double seconds = clock.nsecsElapsed() / 1e9;
+
+    const auto statistics = recorder.statistics();
+    const double fps = statistics.encoded / seconds;
+    const double droppedPercent =
+        statistics.captured ? double(statistics.dropped) / statistics.captured * 100.0 : 0.0;
+    // Frames of a static source are left out as duplicates, not encoded
+    const double duplicatePercent =
+        statistics.captured ? double(statistics.duplicates) / statistics.captured * 100.0 : 0.0;
+    std::fprintf(options.out,
+                 "%-24s %10.1f %10llu %10.1f\n",
+                 "record y4m 1080p",
+                 fps,
+                 static_cast<unsigned long long>(statistics.encoded),
+                 droppedPercent);
+    BenchReport::Values values = { { "encoded_fps", fps },
+                                   { "dropped_percent", droppedPercent },
+                                   { "duplicate_percent", duplicatePercent } };
+    if (!failure.isEmpty())
+        report->fail(Suite, name, std::move(values), failure.toStdString());
+    else if (!complete)
+        report->fail(Suite, name, std::move(values), "timed out waiting for frames");
+    else
+        report->add(Suite, name, std::move(values));
+    delete context;
+}
+
+// What the mock compositor paints into frame sequence of an XRGB8888
+// session: a band of rows in a colour of its own.
+struct MockBand
+{
+    uint32_t firstRow;
+    uint32_t rows;
+    uint32_t colour;
+};
+
+MockBand mockBand(uint64_t sequence, uint32_t height)
+{
+    const uint32_t rows = std::min<uint32_t>(height, 32);
+    return { uint32_t(sequence * 8 % (height - rows + 1)),
+             rows,
+             0xff000000u | uint32_t(sequence * 2654435761u) >> 8 };
+}
+
+// Frames of a dump that don't hold what the compositor had painted when
+// they were ready: rows of their own band in another colour, or the band of
+// a later frame painted into the same buffer.
+int countCorruptFrames(const RawFrameReader &reader)
+{
+    int corrupt = 0;
+    for (size_t index = 0; index < reader.frameCount(); ++index) {
+        RawFrameReader::Frame frame;
+        if (!reader.frame(index, &frame) || frame.fourcc != 0x34325258 || frame.planeCount != 1 || frame.sequence == 0) {
+            ++corrupt;
+            continue;
+        }
+        const auto &plane = frame.planes[0];
+        if (plane.size < size_t(plane.stride) * frame.height) {
+            ++corrupt;
+            continue;
+        }
+        const MockBand own = mockBand(frame.sequence, frame.height);
+        bool intact = true;
+        for (int later = 0; later <= 2 && intact; ++later) {
+            const MockBand band = later ? mockBand(frame.sequence + later * SwapchainLength, frame.height) : own;
+            for (uint32_t y = band.firstRow; y < band.firstRow + band.rows && intact; ++y) {
+                if (later && y >= own.firstRow && y < own.firstRow + own.rows)
+                    continue;
+                auto row = reinterpret_cast<const uint32_t *>(plane.data + size_t(plane.stride) * y);
+                for (uint32_t x = 0; x < frame.width && intact; ++x)
+                    intact = later ? row[x] != band.colour : row[x] == band.colour;
+            }
+        }
+        if (!intact)
+            ++corrupt;
+    }
+    return corrupt;
+}
+
+// Unconverted frames through the raw dump writer, read back afterwards.
+// Every frame's pixels are checked against what the mock compositor painted.
+void benchRawRecorder(const BenchOptions &options, BenchReport *report, const QString &directory)
+{
+    const std::string name = "record/raw/1080p";
+    auto context = selectSource();
+    if (!context) {
+        report->skip(Suite, name, "source selection failed");
+        return;
+    }
+    auto session = context->ensureSession();
+    const QString path = directory + QStringLiteral("/record.") + RawRecorder::fileSuffix();
+    RawRecorder recorder;
+    QString failure;
+    QObject::connect(&recorder, &RawRecorder::error, &recorder, [&](const QString &message) {
+        failure = message;
+    });
+    FrameCounter counter(session);
+    if (!recorder.start(session, path)) {
+        report->skip(Suite, name, "the raw recorder didn't start");
+        delete context;
+        return;
+    }
+    session->start();
+    const bool complete = waitFor([&] { return !failure.isEmpty() || counter.count() > options.frames; },
+                                  frameTimeoutMs(options));
+    const double seconds = counter.seconds();
+    recorder.stop();
+    delete context;
+
+    RawFrameReader reader;
+    const bool readable = reader.open(path.toStdString()) && !reader.recovered();
+    const int corrupt = readable ? countCorruptFrames(reader) : 0;
+    const double written = double(reader.frameCount());
+    const double fps = written / seconds;
+    const double megabytes = QFileInfo(path).size() / 1e6;
+    const double droppedPercent = counter.count() ? (1.0 - written / counter.count()) * 100.0 : 0.0;
+    std::fprintf(options.out,
+                 "%-24s %10.1f %10.0f %10.1f %10.1f\n",
+                 "record raw 1080p",
+                 fps,
+                 written,
+                 droppedPercent,
+                 megabytes / seconds);
+    BenchReport::Values values = { { "written_fps", fps },
+                                   { "dropped_percent", droppedPercent },
+                                   { "mb_per_s", megabytes / seconds },
+                                   { "corrupt_frames", double(corrupt) } };
+    if (!failure.isEmpty())
+        report->fail(Suite, name, std::move(values), failure.toStdString());
+    else if (!readable)
+        report->fail(Suite, name, std::move(values), "the dump doesn't read back");
+    else if (corrupt)
+        report->fail(Suite,
+                     name,
+                     std::move(values),
+                     std::to_string(corrupt) + " frames don't hold what the compositor painted");
+    else if (!complete)
+        report->fail(Suite, name, std::move(values), "timed out waiting for frames");
+    else
+        report->add(Suite, name, std::move(values));
+}
+
+// Screenshots through wl_shm frames, encoded to PNG on the worker pool
+void benchBurst(const BenchOptions &options, BenchReport *report, const QString &directory, int inFlight)
+{
+    const std::string name = "burst/png/1080p/in-flight-" + std::to_string(inFlight);
+    auto context = selectSource();
+    if (!context) {
+        report->skip(Suite, name, "source selection failed");
+        return;
+    }
+    const int count = std::max(10, options.frames / 10);
+    CaptureBurst burst(context, directory + QStringLiteral("/burst.png"));
+    burst.setCount(count);
+    burst.setInFlight(inFlight);
+    bool finished = false;
+    QObject::connect(&burst, &CaptureBurst::finished, &burst, [&] {
+        finished = true;
+    });
+    QElapsedTimer clock;
+    clock.start();
+    burst.start();
+    waitFor([&] { return finished; }, std::max(10000, count * 500));
+    const double seconds = clock.nsecsElapsed() / 1e9;
+    const double rate = burst.savedCount() / seconds;
+    std::fprintf(options.out,
+                 "%-24s %10.1f %10d %10d\n",
+                 ("burst png in-flight " + std::to_string(inFlight)).c_str(),
+                 rate,
+                 burst.savedCount(),
+                 burst.failedCount());
+    BenchReport::Values values = { { "shots_per_s", rate } };
+    if (!finished)
+        report->fail(Suite, name, std::move(values), "timed out waiting for screenshots");
+    else if (burst.failedCount())
+        report->fail(Suite, name, std::move(values), "screenshots failed");
+    else
+        report->add(Suite, name, std::move(values));
+    delete context;
+}
+
+// Getting a wl_shm buffer for a screenshot, from the pool and from scratch.
+// Reading a byte per page includes the faults a fresh buffer costs.
+void benchShmAcquire(const BenchOptions &options, BenchReport *report)
+{
+    auto integration = dynamic_cast<QtWaylandClient::QWaylandIntegration *>(
+        QGuiApplicationPrivate::platformIntegration());
+    auto display = integration ? integration->display() : nullptr;
+    if (!display || !display->shm()) {
+        report->skip(Suite, "shm/1080p/acquire", "no wl_shm");
+        return;
+    }
+
+    auto pool = TreelandShmBufferPool::instance();
+    ::wl_shm *shm = display->shm()->object();
+    const QSize size(FrameWidth, FrameHeight);
+    const uint32_t stride = FrameWidth * 4;
+    volatile uint32_t sink = 0;
+    auto acquire = [&] {
+        auto buffer = pool->acquire(shm, WL_SHM_FORMAT_XRGB8888, size, stride);
+        if (!buffer)
+            return;
+        for (size_t offset = 0; offset < buffer->byteCount(); offset += 4096)
+            sink = sink + buffer->data()[offset];
+    };
+
+    const double pooledMs = measureMs(options.iterations, acquire);
+    const double freshMs = measureMs(options.iterations, [&] {
+        pool->clear();
+        acquire();
+    });
+    pool->clear();
+    // The wl_buffer requests pile up otherwise
+    display->flushRequests();
+
+    std::fprintf(options.out, "\n%-24s %10s\n", "shm acquire", "ms/frame");
+    std::fprintf(options.out, "%-24s %10.3f\n", "pooled 1080p", pooledMs);
+    std::fprintf(options.out, "%-24s %10.3f\n", "fresh 1080p", freshMs);
+    report->add(Suite, "shm/1080p/acquire-pooled", { { "ms_per_frame", pooledMs } });
+    report->add(Suite, "shm/1080p/acquire-fresh", { { "ms_per_frame", freshMs } });
+}
+
+} // namespace
+
+bool runMacroBenchmarks(const BenchOptions &options, BenchReport *report, int &argc, char *argv[])
+{
+    if (options.compositor.empty()) {
+        std::fprintf(options.out, "\nNo mock compositor, pass --compositor to run the macro benchmarks\n");
+        report->skip(Suite, "all", "no mock compositor");
+        return true;
+    }
+    if (!std::getenv("XDG_RUNTIME_DIR")) {
+        report->skip(Suite, "all", "XDG_RUNTIME_DIR is not set");
+        return true;
+    }
+
+    MockCompositorProcess compositor;
+    const std::string problem = compositor.start(
+        options.compositor,
+        { "--socket", "test-capture-bench-" + std::to_string(::getpid()),
+          "--size", std::to_string(FrameWidth) + "x" + std::to_string(FrameHeight),
+          "--fps", std::to_string(SourceFps), "--swapchain", std::to_string(SwapchainLength) });
+    if (!problem.empty()) {
+        std::fprintf(options.out, "\n%s\n", problem.c_str());
+        report->skip(Suite, "all", problem);
+        return true;
+    }
+
+    qputenv("WAYLAND_DISPLAY", QByteArray::fromStdString(compositor.socketName()));
+    qputenv("QT_QPA_PLATFORM", QByteArrayLiteral("wayland"));
+    QGuiApplication application(argc, argv);
+
+    auto manager = TreelandCaptureManager::instance();
+    if (!waitFor([manager] { return manager->isActive(); }, StartTimeoutMs)) {
+        report->skip(Suite, "all", "treeland_capture_manager_v1 not bound");
+        return true;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        manager->shutdown();
+        report->skip(Suite, "all", "no temporary directory");
+        return true;
+    }
+
+    if (options.wants("shm"))
+        benchShmAcquire(options, report);
+
+    if (options.wants("session")) {
+        std::fprintf(options.out, "\n%-24s %10s %10s %10s %10s\n", "session", "fps", "p50 ms", "p99 ms",
+                     "jitter p99");
+        benchSession(options, report);
+    }
+    if (options.wants("record")) {
+        std::fprintf(options.out, "\n%-24s %10s %10s %10s %10s\n", "recording", "fps", "frames",
+                     "% dropped", "MB/s");
+        benchRecorder(options, report, directory.path());
+        benchRawRecorder(options, report, directory.path());
+    }
+    if (options.wants("burst")) {
+        std::fprintf(options.out, "\n%-24s %10s %10s %10s\n", "screenshots", "shots/s", "saved", "failed");
+        for (const int inFlight : { 1, 4 })
+            benchBurst(options, report, directory.path(), inFlight);
+    }
+
+    // The Wayland connection goes away with the application
+    manager->shutdown();
+
+    // Skipped benchmarks don't count as failures
+    bool ok = true;
+    for (const auto &result : report->results()) {
+        if (result.suite == Suite && !result.error.empty() && result.error.rfind("skipped", 0) != 0)
+            ok = false;
+    }
+    return ok;
+}
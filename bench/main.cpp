@@ -0,0 +1,117 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+// Benchmarks of the capture and conversion hot paths:
+//
+//   test-capture-bench [--iterations N] [--only convert,png,...]
+//                      [--compositor PATH] [--frames N] [--json FILE|-]
+//
+// Micro sections: convert, tilehash, blend, framering, queue, png, dmabuf,
+// shm. Macro sections: session, record, burst. The macro benchmarks and
+// shm need the mock compositor. The exit code is 1 if any result was wrong,
+// e.g. a SIMD kernel that didn't match the scalar one.
+
+#include "benchmarks.h"
+#include "benchreport.h"
+#include "cpufeatures.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace {
+
+void usage(const char *program)
+{
+    std::printf("Usage: %s [options] [iterations]\n"
+                "  --iterations N     Runs of every micro benchmark (default: 20)\n"
+                "  --only A,B,...     Run only these sections\n"
+                "  --compositor PATH  Mock compositor for the macro benchmarks\n"
+                "  --frames N         Frames every macro benchmark captures (default: 300)\n"
+                "  --json FILE        Write the results as JSON, - for stdout\n",
+                program);
+}
+
+std::vector<std::string> split(const std::string &list)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= list.size()) {
+        const size_t end = list.find(',', start);
+        const std::string part = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        if (!part.empty())
+            parts.push_back(part);
+        if (end == std::string::npos)
+            break;
+        start = end + 1;
+    }
+    return parts;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+#ifdef TEST_CAPTURE_MOCK_COMPOSITOR
+    options.compositor = TEST_CAPTURE_MOCK_COMPOSITOR;
+#endif
+    std::string jsonPath;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *argument = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        auto takes = [&](const char *name) {
+            if (std::strcmp(argument, name) != 0)
+                return false;
+            if (!value) {
+                std::fprintf(stderr, "%s needs a value\n", name);
+                std::exit(EXIT_FAILURE);
+            }
+            ++i;
+            return true;
+        };
+
+        if (std::strcmp(argument, "--help") == 0) {
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (takes("--iterations")) {
+            options.iterations = std::max(1, std::atoi(value));
+        } else if (takes("--only")) {
+            options.sections = split(value);
+        } else if (takes("--compositor")) {
+            options.compositor = value;
+        } else if (takes("--frames")) {
+            options.frames = std::max(1, std::atoi(value));
+        } else if (takes("--json")) {
+            jsonPath = value;
+        } else if (argument[0] != '-') {
+            options.iterations = std::max(1, std::atoi(argument));
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (jsonPath == "-")
+        options.out = stderr;
+
+    BenchReport report;
+    report.setProperty("simd", simdLevelName(simdLevel()));
+    report.setProperty("threads", std::to_string(std::thread::hardware_concurrency()));
+    report.setProperty("iterations", std::to_string(options.iterations));
+    report.setProperty("frames", std::to_string(options.frames));
+
+    bool ok = runMicroBenchmarks(options, &report);
+    if (options.wants("shm") || options.wants("session") || options.wants("record")
+        || options.wants("burst")) {
+        ok = runMacroBenchmarks(options, &report, argc, argv) && ok;
+    }
+
+    if (!jsonPath.empty() && !report.writeJson(jsonPath)) {
+        std::fprintf(stderr, "Failed to write %s\n", jsonPath.c_str());
+        return EXIT_FAILURE;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,747 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+// Micro benchmarks of the per-frame building blocks. Every available SIMD
+// level of the pixel kernels runs on the same padded, misaligned 1080p frame
+// and its output is checked against the scalar kernel.
+
+#include "benchmarks.h"
+#include "benchreport.h"
+#include "dmabufcache.h"
+#include "framering.h"
+#include "pixelconvert.h"
+#include "pngwriter.h"
+#include "spscqueue.h"
+#include "tilehash.h"
+
+#include <QBuffer>
+#include <QImage>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <libdrm/drm_fourcc.h>
+#include <linux/udmabuf.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr const char *Suite = "micro";
+constexpr uint32_t FrameWidth = 1920;
+constexpr uint32_t FrameHeight = 1080;
+// Padded like a GPU allocation and not 16 byte aligned
+constexpr size_t SourceStride = FrameWidth * 4 + 256;
+constexpr size_t SourceOffset = 4;
+constexpr size_t PageSize = 4096;
+
+const double Megapixels = double(FrameWidth) * FrameHeight / 1e6;
+
+struct Format
+{
+    uint32_t fourcc;
+    const char *name;
+};
+
+const Format Formats[] = {
+    { DRM_FORMAT_XRGB8888, "XRGB8888" },       { DRM_FORMAT_ARGB8888, "ARGB8888" },
+    { DRM_FORMAT_XBGR8888, "XBGR8888" },       { DRM_FORMAT_ABGR8888, "ABGR8888" },
+    { DRM_FORMAT_RGBX8888, "RGBX8888" },       { DRM_FORMAT_BGRA8888, "BGRA8888" },
+    { DRM_FORMAT_XRGB2101010, "XRGB2101010" }, { DRM_FORMAT_ABGR2101010, "ABGR2101010" },
+};
+
+struct Output
+{
+    const char *name;
+    size_t size;
+    std::function<bool(SimdLevel, uint32_t, const uint8_t *, uint8_t *)> convert;
+};
+
+std::vector<SimdLevel> availableLevels()
+{
+    std::vector<SimdLevel> levels{ SimdLevel::Scalar };
+    switch (simdLevel()) {
+    case SimdLevel::Avx2:
+        levels.push_back(SimdLevel::Sse41);
+        levels.push_back(SimdLevel::Avx2);
+        break;
+    case SimdLevel::Sse41:
+        levels.push_back(SimdLevel::Sse41);
+        break;
+    case SimdLevel::Neon:
+        levels.push_back(SimdLevel::Neon);
+        break;
+    case SimdLevel::Scalar:
+        break;
+    }
+    return levels;
+}
+
+std::string path(std::initializer_list<const char *> parts)
+{
+    std::string result;
+    for (const char *part : parts) {
+        if (!result.empty())
+            result += '/';
+        result += part;
+    }
+    return result;
+}
+
+// Adds a kernel result, or a failure when it didn't match the reference
+void addKernel(BenchReport *report, const std::string &name, double ms, bool identical)
+{
+    BenchReport::Values values = { { "ms_per_frame", ms }, { "mpix_per_s", Megapixels / (ms / 1000.0) } };
+    if (identical)
+        report->add(Suite, name, std::move(values));
+    else
+        report->fail(Suite, name, std::move(values), "output differs from the scalar kernel");
+}
+
+bool benchConversion(const BenchOptions &options, BenchReport *report, const uint8_t *pixels)
+{
+    const size_t lumaSize = size_t(FrameWidth) * FrameHeight;
+    const std::vector<Output> outputs = {
+        { "RGBA", lumaSize * 4,
+          [&](SimdLevel level, uint32_t format, const uint8_t *src, uint8_t *dst) {
+              return convertToRgba(level, format, src, SourceStride, FrameWidth, FrameHeight, dst,
+                                   FrameWidth * 4);
+          } },
+        { "BGRA", lumaSize * 4,
+          [&](SimdLevel level, uint32_t format, const uint8_t *src, uint8_t *dst) {
+              return convertToBgra(level, format, src, SourceStride, FrameWidth, FrameHeight, dst,
+                                   FrameWidth * 4);
+          } },
+        { "I420", lumaSize * 3 / 2,
+          [&](SimdLevel level, uint32_t format, const uint8_t *src, uint8_t *dst) {
+              uint8_t *u = dst + lumaSize;
+              uint8_t *v = u + lumaSize / 4;
+              return convertToI420(level, format, src, SourceStride, FrameWidth, FrameHeight, dst,
+                                   FrameWidth, u, FrameWidth / 2, v, FrameWidth / 2);
+          } },
+        { "NV12", lumaSize * 3 / 2,
+          [&](SimdLevel level, uint32_t format, const uint8_t *src, uint8_t *dst) {
+              return convertToNv12(level, format, src, SourceStride, FrameWidth, FrameHeight, dst,
+                                   FrameWidth, dst + lumaSize, FrameWidth);
+          } },
+    };
+
+    bool ok = true;
+    std::fprintf(options.out, "%-12s %-5s %-7s %10s %10s\n", "format", "to", "level", "ms/frame", "Mpix/s");
+    for (const auto &format : Formats) {
+        for (const auto &output : outputs) {
+            std::vector<uint8_t> reference(output.size);
+            output.convert(SimdLevel::Scalar, format.fourcc, pixels, reference.data());
+
+            for (const auto level : availableLevels()) {
+                std::vector<uint8_t> result(output.size);
+                const double ms = measureMs(options.iterations, [&] {
+                    output.convert(level, format.fourcc, pixels, result.data());
+                });
+                const bool identical = result == reference;
+                ok = ok && identical;
+                std::fprintf(options.out,
+                             "%-12s %-5s %-7s %10.3f %10.1f%s\n",
+                             format.name,
+                             output.name,
+                             simdLevelName(level),
+                             ms,
+                             Megapixels / (ms / 1000.0),
+                             identical ? "" : "  MISMATCH");
+                addKernel(report,
+                          path({ "convert", format.name, output.name, simdLevelName(level) }),
+                          ms,
+                          identical);
+            }
+        }
+    }
+    return ok;
+}
+
+bool benchTileHash(const BenchOptions &options, BenchReport *report, const uint8_t *pixels)
+{
+    bool ok = true;
+    std::fprintf(options.out, "\n%-24s %-7s %10s %10s\n", "tile hash", "level", "ms/frame", "Mpix/s");
+    const uint32_t columns = (FrameWidth + TileDamageTracker::TileSize - 1) / TileDamageTracker::TileSize;
+    std::vector<uint64_t> reference(columns);
+    std::vector<uint64_t> hashes(columns);
+    for (const auto level : availableLevels()) {
+        const double ms = measureMs(options.iterations, [&] {
+            for (uint32_t y = 0; y < FrameHeight; y += TileDamageTracker::TileSize) {
+                const uint32_t rows = std::min(TileDamageTracker::TileSize, FrameHeight - y);
+                hashTileStrip(level, pixels + SourceStride * y, SourceStride, FrameWidth, rows,
+                              hashes.data());
+            }
+        });
+        hashTileStrip(SimdLevel::Scalar, pixels, SourceStride, FrameWidth,
+                      TileDamageTracker::TileSize, reference.data());
+        hashTileStrip(level, pixels, SourceStride, FrameWidth, TileDamageTracker::TileSize,
+                      hashes.data());
+        const bool identical = hashes == reference;
+        ok = ok && identical;
+        std::fprintf(options.out,
+                     "%-24s %-7s %10.3f %10.1f%s\n",
+                     "64x64 tiles",
+                     simdLevelName(level),
+                     ms,
+                     Megapixels / (ms / 1000.0),
+                     identical ? "" : "  MISMATCH");
+        addKernel(report, path({ "tilehash", "64x64", simdLevelName(level) }), ms, identical);
+    }
+    return ok;
+}
+
+// Watermark burn-in, a premultiplied overlay with varying alpha over the
+// whole frame in place, restored before every pass.
+bool benchBlend(const BenchOptions &options, BenchReport *report, const uint8_t *pixels)
+{
+    bool ok = true;
+    std::fprintf(options.out, "\n%-24s %-7s %10s %10s\n", "premultiplied blend", "level", "ms/frame", "Mpix/s");
+    const size_t blendSize = size_t(FrameWidth) * FrameHeight * 4;
+    std::mt19937 random(7);
+    std::vector<uint8_t> overlay(blendSize);
+    std::vector<uint8_t> inverseAlpha(blendSize);
+    for (size_t i = 0; i < blendSize; i += 4) {
+        const uint8_t alpha = uint8_t(random());
+        for (size_t c = 0; c < 4; ++c) {
+            overlay[i + c] = uint8_t(pixels[i + c] * alpha / 255);
+            inverseAlpha[i + c] = uint8_t(255 - alpha);
+        }
+    }
+    std::vector<uint8_t> blendReference(pixels, pixels + blendSize);
+    blendPremultiplied(SimdLevel::Scalar, blendReference.data(), overlay.data(), inverseAlpha.data(),
+                       blendSize);
+    for (const auto level : availableLevels()) {
+        std::vector<uint8_t> target(blendSize);
+        const double ms = measureMs(options.iterations, [&] {
+            std::copy(pixels, pixels + blendSize, target.begin());
+            blendPremultiplied(level, target.data(), overlay.data(), inverseAlpha.data(), blendSize);
+        });
+        const bool identical = target == blendReference;
+        ok = ok && identical;
+        std::fprintf(options.out,
+                     "%-24s %-7s %10.3f %10.1f%s\n",
+                     "RGBA 1080p",
+                     simdLevelName(level),
+                     ms,
+                     Megapixels / (ms / 1000.0),
+                     identical ? "" : "  MISMATCH");
+        addKernel(report, path({ "blend", "RGBA", simdLevelName(level) }), ms, identical);
+    }
+    return ok;
+}
+
+struct RingConsumerResult
+{
+    uint64_t read{ 0 };
+    uint64_t torn{ 0 };
+    uint64_t corrupt{ 0 };
+};
+
+// Publishes frames into a frame ring as fast as possible while consumer
+// threads read every frame they catch completely, in place. Each frame is
+// stamped with its number at both ends, an intact read must see it twice.
+// Returns false if a consumer saw a corrupt frame.
+bool benchFrameRing(const BenchOptions &options,
+                    BenchReport *report,
+                    const uint8_t *pixels,
+                    size_t frameBytes,
+                    int frames,
+                    int consumers)
+{
+    const std::string name = "framering/1080p/readers-" + std::to_string(consumers);
+    FrameRingProducer producer;
+    if (!producer.create(4, frameBytes)) {
+        std::fprintf(options.out, "%-24s %7d  memfd_create failed\n", "frame ring", consumers);
+        report->skip(Suite, name, "memfd_create failed");
+        return true;
+    }
+
+    std::atomic_int attached{ 0 };
+    std::vector<RingConsumerResult> results(static_cast<size_t>(consumers));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < consumers; ++i) {
+        threads.emplace_back([&, i] {
+            FrameRingConsumer consumer;
+            consumer.attach(::dup(producer.fd()));
+            ++attached;
+            auto &result = results[size_t(i)];
+            uint64_t last = 0;
+            while (consumer.waitForFrame(last, 1000) && !consumer.closed()) {
+                FrameRingConsumer::View view;
+                last = consumer.latest();
+                if (!consumer.acquire(last, &view)) {
+                    ++result.torn;
+                    continue;
+                }
+                uint64_t head;
+                uint64_t tail;
+                uint64_t sum = 0;
+                std::memcpy(&head, view.data, sizeof(head));
+                for (size_t offset = 0; offset + 8 <= view.frame.size; offset += 8) {
+                    uint64_t word;
+                    std::memcpy(&word, view.data + offset, sizeof(word));
+                    sum += word;
+                }
+                std::memcpy(&tail, view.data + view.frame.size - sizeof(tail), sizeof(tail));
+                if (!consumer.isIntact(view)) {
+                    ++result.torn;
+                    continue;
+                }
+                ++result.read;
+                if (head != view.number || tail != view.number || !sum)
+                    ++result.corrupt;
+            }
+        });
+    }
+    while (attached < consumers)
+        std::this_thread::yield();
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; ++i) {
+        uint8_t *slot = producer.beginFrame();
+        std::memcpy(slot, pixels, frameBytes);
+        const uint64_t number = uint64_t(i) + 1;
+        std::memcpy(slot, &number, sizeof(number));
+        std::memcpy(slot + frameBytes - sizeof(number), &number, sizeof(number));
+        producer.publish({ number, 0, FrameWidth, FrameHeight, DRM_FORMAT_XRGB8888,
+                           FrameWidth * 4, frameBytes });
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    producer.close();
+    for (auto &thread : threads)
+        thread.join();
+
+    const double ms = std::chrono::duration<double, std::milli>(elapsed).count() / frames;
+    RingConsumerResult total;
+    for (const auto &result : results) {
+        total.read += result.read;
+        total.torn += result.torn;
+        total.corrupt += result.corrupt;
+    }
+    const double readPercent = consumers ? double(total.read) / consumers / frames * 100.0 : 0.0;
+    std::fprintf(options.out,
+                 "%-24s %7d %10.3f %10.2f %10.1f %8llu%s\n",
+                 "frame ring 1080p",
+                 consumers,
+                 ms,
+                 double(frameBytes) / (ms / 1000.0) / 1e9,
+                 readPercent,
+                 static_cast<unsigned long long>(total.torn),
+                 total.corrupt ? "  CORRUPT" : "");
+    // Torn and read shares depend on scheduling, only the copy rate is
+    // comparable across runs
+    BenchReport::Values values = { { "ms_per_frame", ms },
+                                   { "gb_per_s", double(frameBytes) / (ms / 1000.0) / 1e9 },
+                                   { "read_percent", readPercent } };
+    if (total.corrupt)
+        report->fail(Suite, name, std::move(values), "consumers read corrupt frames");
+    else
+        report->add(Suite, name, std::move(values));
+    return total.corrupt == 0;
+}
+
+// Hand-off between two threads as the recorder stages do it: throughput
+// with the producer never waiting for anything but a full queue, and the
+// latency of one hop measured as half a ping-pong round trip. Waiting sides
+// yield, with more threads than cores spinning would only measure time slices.
+void benchQueue(const BenchOptions &options, BenchReport *report)
+{
+    std::fprintf(options.out, "\n%-24s %8s %12s %12s\n", "queue hand-off", "capacity", "Mitems/s", "ns/hop");
+    const uint64_t items = uint64_t(options.iterations) * 50000;
+    for (const size_t capacity : { size_t(8), size_t(1024) }) {
+        SpscQueue<uint64_t> queue(capacity);
+        uint64_t sum = 0;
+        const auto start = std::chrono::steady_clock::now();
+        std::thread consumer([&] {
+            uint64_t value;
+            for (uint64_t received = 0; received < items;) {
+                if (queue.tryPop(value)) {
+                    sum += value;
+                    ++received;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        for (uint64_t i = 0; i < items;) {
+            if (queue.tryPush(uint64_t(i)))
+                ++i;
+            else
+                std::this_thread::yield();
+        }
+        consumer.join();
+        const double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const uint64_t roundTrips = items / 10;
+        SpscQueue<uint64_t> ping(capacity);
+        SpscQueue<uint64_t> pong(capacity);
+        const auto pingStart = std::chrono::steady_clock::now();
+        std::thread echo([&] {
+            uint64_t value;
+            for (uint64_t i = 0; i < roundTrips; ++i) {
+                while (!ping.tryPop(value))
+                    std::this_thread::yield();
+                while (!pong.tryPush(uint64_t(value)))
+                    std::this_thread::yield();
+            }
+        });
+        for (uint64_t i = 0; i < roundTrips; ++i) {
+            uint64_t value;
+            while (!ping.tryPush(uint64_t(i)))
+                std::this_thread::yield();
+            while (!pong.tryPop(value))
+                std::this_thread::yield();
+        }
+        echo.join();
+        const double hopNs = std::chrono::duration<double, std::nano>(
+                                 std::chrono::steady_clock::now() - pingStart)
+                                 .count()
+            / roundTrips / 2;
+
+        const bool complete = sum == items * (items - 1) / 2;
+        const double rate = items / seconds / 1e6;
+        std::fprintf(options.out,
+                     "%-24s %8zu %12.1f %12.1f%s\n",
+                     "uint64",
+                     capacity,
+                     rate,
+                     hopNs,
+                     complete ? "" : "  LOST ITEMS");
+        BenchReport::Values values = { { "mitems_per_s", rate }, { "ns_per_hop", hopNs } };
+        const std::string name = "queue/capacity-" + std::to_string(capacity);
+        if (complete)
+            report->add(Suite, name, std::move(values));
+        else
+            report->fail(Suite, name, std::move(values), "items lost in the queue");
+    }
+}
+
+// Something like a desktop: flat panels and windows, gradients, and a
+// noisy photo-like patch, compression ratios on pure noise mean nothing.
+QImage desktopImage()
+{
+    QImage image(int(FrameWidth), int(FrameHeight), QImage::Format_RGB32);
+    std::mt19937 random(11);
+    for (int y = 0; y < image.height(); ++y) {
+        auto *line = reinterpret_cast<uint32_t *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            uint32_t pixel = 0xff000000 | (uint32_t(y * 255 / image.height()) << 8) | 0x30;
+            if (y < 32)
+                pixel = 0xff202020;
+            else if (x >= 200 && x < 1100 && y >= 120 && y < 800)
+                pixel = (x / 8 + y / 16) % 7 ? 0xfff0f0f0 : 0xff303030;
+            else if (x >= 1200 && x < 1712 && y >= 300 && y < 812)
+                pixel = 0xff000000 | (random() & 0xffffff);
+            line[x] = pixel;
+        }
+    }
+    return image;
+}
+
+// Qt maps quality to the zlib level, 0 compresses hardest. The strip writer
+// gets the same level, on every worker thread.
+void benchPng(const BenchOptions &options, BenchReport *report)
+{
+    std::fprintf(options.out, "\n%-24s %8s %10s %10s %8s\n", "PNG encoding", "quality", "ms/frame", "Mpix/s", "ratio");
+    const QImage image = desktopImage();
+    const double rawBytes = double(image.sizeInBytes());
+    const int iterations = std::max(1, options.iterations / 4);
+    for (const int quality : { -1, 0, 50, 90 }) {
+        const std::string suffix = "/1080p/quality-" + (quality < 0 ? std::string("default") : std::to_string(quality));
+        for (const bool strips : { false, true }) {
+            const char *label = strips ? "strips 1080p" : "desktop 1080p";
+            const std::string name = (strips ? "png-strips" : "png") + suffix;
+            PngWriteOptions png;
+            if (quality >= 0)
+                png.level = (100 - quality) * 9 / 91;
+            QByteArray encoded;
+            bool saved = true;
+            const double ms = measureMs(iterations, [&] {
+                encoded.clear();
+                QBuffer buffer(&encoded);
+                buffer.open(QIODevice::WriteOnly);
+                saved = (strips ? writePng(image, &buffer, png) : image.save(&buffer, "PNG", quality)) && saved;
+            });
+            if (!saved) {
+                std::fprintf(options.out, "%-24s %8d  encoding failed\n", label, quality);
+                report->skip(Suite, name, strips ? "strip writer failed" : "no PNG support in QImage");
+                continue;
+            }
+            const double ratio = rawBytes / std::max<qsizetype>(1, encoded.size());
+            std::fprintf(options.out,
+                         "%-24s %8d %10.3f %10.1f %8.1f\n",
+                         label,
+                         quality,
+                         ms,
+                         Megapixels / (ms / 1000.0),
+                         ratio);
+            report->add(Suite,
+                        name,
+                        { { "ms_per_frame", ms },
+                          { "mpix_per_s", Megapixels / (ms / 1000.0) },
+                          { "compression_ratio", ratio } });
+        }
+    }
+}
+
+// A real dma-buf over a filled memfd through /dev/udmabuf, like the mock
+// compositor hands out. -1 if the kernel has no udmabuf.
+int createDmaBuf(const uint8_t *pixels, size_t size)
+{
+    const int memfd = ::memfd_create("bench-dmabuf", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0)
+        return -1;
+    void *data = MAP_FAILED;
+    if (::ftruncate(memfd, off_t(size)) == 0)
+        data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (data == MAP_FAILED) {
+        ::close(memfd);
+        return -1;
+    }
+    std::memcpy(data, pixels, size);
+    ::munmap(data, size);
+    // udmabuf refuses memfds that could still shrink
+    ::fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK);
+
+    int dmabuf = -1;
+    const int device = ::open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (device >= 0) {
+        udmabuf_create create{};
+        create.memfd = uint32_t(memfd);
+        create.flags = UDMABUF_FLAGS_CLOEXEC;
+        create.offset = 0;
+        create.size = size;
+        dmabuf = ::ioctl(device, UDMABUF_CREATE, &create);
+        ::close(device);
+    }
+    ::close(memfd);
+    return dmabuf;
+}
+
+// Surfaceless EGL on the default GPU, enough to import dma-bufs
+class EglImporter
+{
+public:
+    ~EglImporter()
+    {
+        if (m_display == EGL_NO_DISPLAY)
+            return;
+        if (m_context != EGL_NO_CONTEXT) {
+            eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(m_display, m_context);
+        }
+        eglTerminate(m_display);
+    }
+
+    // Empty on success, otherwise why importing isn't possible
+    std::string initialize()
+    {
+        auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (!getPlatformDisplay)
+            return "no eglGetPlatformDisplayEXT";
+        m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, nullptr, nullptr)) {
+            m_display = EGL_NO_DISPLAY;
+            return "no surfaceless EGL display";
+        }
+        const std::string extensions = eglQueryString(m_display, EGL_EXTENSIONS);
+        if (extensions.find("EGL_EXT_image_dma_buf_import") == std::string::npos
+            || extensions.find("EGL_KHR_surfaceless_context") == std::string::npos
+            || extensions.find("EGL_KHR_no_config_context") == std::string::npos) {
+            return "EGL can't import dma-bufs without a surface";
+        }
+
+        eglBindAPI(EGL_OPENGL_ES_API);
+        const EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+        m_context = eglCreateContext(m_display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs);
+        if (m_context == EGL_NO_CONTEXT
+            || !eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context)) {
+            return "no GLES2 context";
+        }
+
+        m_createImage =
+            reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(eglGetProcAddress("eglCreateImageKHR"));
+        m_destroyImage =
+            reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(eglGetProcAddress("eglDestroyImageKHR"));
+        m_imageTargetTexture = reinterpret_cast<PFNGLEGLIMAGETARGETTEXTURE2DOESPROC>(
+            eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+        if (!m_createImage || !m_destroyImage || !m_imageTargetTexture)
+            return "no EGLImage functions";
+        return {};
+    }
+
+    // What the preview does for a buffer it hasn't seen yet
+    bool import(int fd, uint32_t width, uint32_t height, uint32_t stride)
+    {
+        const EGLint attribs[] = {
+            EGL_WIDTH,
+            EGLint(width),
+            EGL_HEIGHT,
+            EGLint(height),
+            EGL_LINUX_DRM_FOURCC_EXT,
+            EGLint(DRM_FORMAT_XRGB8888),
+            EGL_DMA_BUF_PLANE0_FD_EXT,
+            fd,
+            EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+            0,
+            EGL_DMA_BUF_PLANE0_PITCH_EXT,
+            EGLint(stride),
+            EGL_NONE,
+        };
+        EGLImageKHR image =
+            m_createImage(m_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attribs);
+        if (image == EGL_NO_IMAGE_KHR)
+            return false;
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        m_imageTargetTexture(GL_TEXTURE_2D, static_cast<GLeglImageOES>(image));
+        const bool bound = glGetError() == GL_NO_ERROR;
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDeleteTextures(1, &texture);
+        glFinish();
+        m_destroyImage(m_display, image);
+        return bound;
+    }
+
+private:
+    EGLDisplay m_display{ EGL_NO_DISPLAY };
+    EGLContext m_context{ EGL_NO_CONTEXT };
+    PFNEGLCREATEIMAGEKHRPROC m_createImage{ nullptr };
+    PFNEGLDESTROYIMAGEKHRPROC m_destroyImage{ nullptr };
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC m_imageTargetTexture{ nullptr };
+};
+
+// Getting at the pixels of a session buffer: a fresh mapping every frame,
+// the cached mapping the session keeps for recycled buffers, and a GPU
+// import. The CPU paths touch every page, which is where a fresh mapping
+// pays for its page faults.
+void benchDmaBuf(const BenchOptions &options, BenchReport *report, const uint8_t *pixels)
+{
+    std::fprintf(options.out, "\n%-24s %10s\n", "dma-buf access", "ms/frame");
+    const uint32_t stride = FrameWidth * 4;
+    const size_t size = (size_t(stride) * FrameHeight + PageSize - 1) & ~(PageSize - 1);
+    std::vector<uint8_t> content(size);
+    std::memcpy(content.data(), pixels, size_t(stride) * FrameHeight);
+
+    const int fd = createDmaBuf(content.data(), size);
+    if (fd < 0) {
+        std::fprintf(options.out, "%-24s  no /dev/udmabuf\n", "1080p XRGB8888");
+        for (const char *name : { "dmabuf/1080p/mmap", "dmabuf/1080p/mmap-cached", "dmabuf/1080p/egl-import" })
+            report->skip(Suite, name, "no /dev/udmabuf");
+        return;
+    }
+
+    auto touch = [](const uint8_t *data, size_t length) {
+        uint32_t sum = 0;
+        for (size_t offset = 0; offset < length; offset += PageSize)
+            sum += data[offset];
+        return sum;
+    };
+    volatile uint32_t sink = 0;
+
+    bool mapped = true;
+    const double mmapMs = measureMs(options.iterations, [&] {
+        void *data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            mapped = false;
+            return;
+        }
+        sink = sink + touch(static_cast<const uint8_t *>(data), size);
+        ::munmap(data, size);
+    });
+
+    DmaBufMappingCache cache;
+    const auto identity = DmaBufMappingCache::identify(0, fd);
+    const double cachedMs = measureMs(options.iterations, [&] {
+        auto mapping = cache.map(identity, fd, size);
+        if (mapping)
+            sink = sink + touch(mapping->data(), mapping->size());
+        else
+            mapped = false;
+    });
+
+    if (mapped) {
+        std::fprintf(options.out, "%-24s %10.3f\n", "mmap per frame", mmapMs);
+        std::fprintf(options.out, "%-24s %10.3f\n", "mmap cached", cachedMs);
+        report->add(Suite, "dmabuf/1080p/mmap", { { "ms_per_frame", mmapMs } });
+        report->add(Suite, "dmabuf/1080p/mmap-cached", { { "ms_per_frame", cachedMs } });
+    } else {
+        std::fprintf(options.out, "%-24s  mmap failed\n", "1080p XRGB8888");
+        report->skip(Suite, "dmabuf/1080p/mmap", "mmap failed");
+        report->skip(Suite, "dmabuf/1080p/mmap-cached", "mmap failed");
+    }
+
+    EglImporter importer;
+    std::string problem = importer.initialize();
+    if (problem.empty() && !importer.import(fd, FrameWidth, FrameHeight, stride))
+        problem = "the dma-buf import failed";
+    if (problem.empty()) {
+        const double importMs = measureMs(options.iterations, [&] {
+            importer.import(fd, FrameWidth, FrameHeight, stride);
+        });
+        std::fprintf(options.out, "%-24s %10.3f\n", "EGL import per frame", importMs);
+        report->add(Suite, "dmabuf/1080p/egl-import", { { "ms_per_frame", importMs } });
+    } else {
+        std::fprintf(options.out, "%-24s  %s\n", "EGL import per frame", problem.c_str());
+        report->skip(Suite, "dmabuf/1080p/egl-import", problem);
+    }
+    ::close(fd);
+}
+
+} // namespace
+
+bool BenchOptions::wants(const char *section) const
+{
+    return sections.empty() || std::find(sections.begin(), sections.end(), section) != sections.end();
+}
+
+bool runMicroBenchmarks(const BenchOptions &options, BenchReport *report)
+{
+    std::vector<uint8_t> source(SourceOffset + SourceStride * FrameHeight);
+    std::mt19937 random(42);
+    for (auto &byte : source)
+        byte = uint8_t(random());
+    const uint8_t *pixels = source.data() + SourceOffset;
+
+    bool ok = true;
+    if (options.wants("convert"))
+        ok = benchConversion(options, report, pixels) && ok;
+    if (options.wants("tilehash"))
+        ok = benchTileHash(options, report, pixels) && ok;
+    if (options.wants("blend"))
+        ok = benchBlend(options, report, pixels) && ok;
+
+    // Shared memory publishing, producer copy rate and the share of frames
+    // each consumer got to read before they were overwritten
+    if (options.wants("framering")) {
+        std::fprintf(options.out, "\n%-24s %7s %10s %10s %10s %8s\n", "frame ring", "readers", "ms/frame",
+                     "GB/s", "% read", "torn");
+        for (const int consumers : { 0, 1, 3 }) {
+            ok = benchFrameRing(options, report, pixels, size_t(FrameWidth) * FrameHeight * 4,
+                                options.iterations * 10, consumers)
+                && ok;
+        }
+    }
+
+    if (options.wants("queue"))
+        benchQueue(options, report);
+    if (options.wants("png"))
+        benchPng(options, report);
+    if (options.wants("dmabuf"))
+        benchDmaBuf(options, report, pixels);
+    return ok;
+}
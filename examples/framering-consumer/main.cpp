@@ -0,0 +1,112 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+// Minimal frame ring consumer: follows the newest frame of a ring published
+// with `test-capture --record --publish NAME` and prints once a second how
+// many frames it read and the mean brightness of the last one. Frames are
+// read in place from the shared memory, never copied.
+
+#include "framering.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace {
+
+volatile std::sig_atomic_t s_quit = 0;
+
+void handleSignal(int)
+{
+    s_quit = 1;
+}
+
+// Sampled, good enough to see the screen change. Packed 32 bit formats
+// only, the fourcc tells where the channels are but the sum doesn't care.
+double meanBrightness(const FrameRingConsumer::View &view)
+{
+    const auto &frame = view.frame;
+    if (frame.stride < frame.width * 4 || size_t(frame.stride) * frame.height > frame.size)
+        return 0;
+    uint64_t sum = 0;
+    uint64_t samples = 0;
+    for (uint32_t y = 0; y < frame.height; y += 8) {
+        const uint8_t *row = view.data + size_t(frame.stride) * y;
+        for (uint32_t x = 0; x < frame.width; x += 8) {
+            const uint8_t *pixel = row + size_t(x) * 4;
+            sum += pixel[0] + pixel[1] + pixel[2];
+            ++samples;
+        }
+    }
+    return samples ? double(sum) / (samples * 3) : 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2 || std::strcmp(argv[1], "--help") == 0) {
+        std::printf("Usage: %s NAME\n", argv[0]);
+        return argc == 2 ? 0 : 1;
+    }
+    const std::string socketPath = FrameRingProducer::socketPath(argv[1]);
+
+    struct sigaction action = {};
+    action.sa_handler = handleSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    FrameRingConsumer consumer;
+    uint64_t last = 0;
+    uint64_t read = 0;
+    uint64_t torn = 0;
+    double brightness = 0;
+    auto reportTime = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+    while (!s_quit) {
+        if (!consumer.isAttached() || consumer.closed()) {
+            // The producer is gone or replaced the ring, pick up the new one
+            consumer.detach();
+            if (!consumer.attach(FrameRingConsumer::receiveFd(socketPath))) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                continue;
+            }
+            std::fprintf(stderr, "Attached to %s\n", socketPath.c_str());
+            last = 0;
+        }
+
+        if (consumer.waitForFrame(last, 100) && !consumer.closed()) {
+            // Always the newest, frames in between are skipped
+            last = consumer.latest();
+            FrameRingConsumer::View view;
+            if (consumer.acquire(last, &view)) {
+                const double value = meanBrightness(view);
+                // Overwritten while we looked, the value is garbage
+                if (consumer.isIntact(view)) {
+                    brightness = value;
+                    ++read;
+                } else {
+                    ++torn;
+                }
+            }
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= reportTime) {
+            std::printf("frame %llu: read %llu/s, torn %llu, brightness %.1f\n",
+                        static_cast<unsigned long long>(last),
+                        static_cast<unsigned long long>(read),
+                        static_cast<unsigned long long>(torn),
+                        brightness);
+            std::fflush(stdout);
+            read = 0;
+            torn = 0;
+            reportTime = now + std::chrono::seconds(1);
+        }
+    }
+    return 0;
+}
@@ -2,12 +2,28 @@
 // SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
 
 #include "capture.h"
+#include "capturescheduler.h"
+#include "capturetrace.h"
+#include "pngwriter.h"
+#include "watermark.h"
 
 #include <private/qguiapplication_p.h>
 #include <private/qwaylanddisplay_p.h>
 #include <private/qwaylandintegration_p.h>
+#include <private/qwaylandshm_p.h>
 
+#include <QCoreApplication>
 #include <QPointer>
+#include <QSaveFile>
+#include <QThreadPool>
+
+#include <wayland-client-core.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <libdrm/drm_fourcc.h>
+#include <unistd.h>
 
 inline QtWaylandClient::QWaylandIntegration *waylandIntegration()
 {
@@ -20,6 +36,68 @@ inline QPointer<QtWaylandClient::QWaylandDisplay> waylandDisplay()
     return waylandIntegration()->display();
 }
 
+static QThreadPool *captureWorkerPool()
+{
+    return CaptureScheduler::instance()->workerPool();
+}
+
+static QRecursiveMutex *dispatchMutex()
+{
+    return TreelandCaptureManager::instance()->dispatchMutex();
+}
+
+static bool isPngFormat(const QString &path, const CaptureFileOptions &options)
+{
+    if (!options.format.isEmpty())
+        return options.format.compare("png", Qt::CaseInsensitive) == 0;
+    return path.endsWith(QStringLiteral(".png"), Qt::CaseInsensitive);
+}
+
+static bool writeImage(const QImage &image,
+                       const QString &path,
+                       const CaptureFileOptions &options,
+                       TreelandCaptureContext::ImageAccess access)
+{
+    if (image.isNull())
+        return false;
+    CAPTURE_TRACE_SCOPE("write image");
+
+    // A crop is just a view of the pixels
+    QImage output = image;
+    if (!options.crop.isEmpty()) {
+        const QRect crop = options.crop & image.rect();
+        if (crop.isEmpty())
+            return false;
+        output = QImage(image.constBits() + image.bytesPerLine() * crop.y()
+                            + crop.x() * (image.depth() / 8),
+                        crop.width(),
+                        crop.height(),
+                        image.bytesPerLine(),
+                        image.format());
+    }
+    if (options.watermark && options.watermark->isEnabled()) {
+        // Exclusive pixels may be a read-only wrapper of the shm buffer,
+        // bits() would copy those as well
+        uchar *pixels = access == TreelandCaptureContext::ImageAccess::Exclusive
+            ? const_cast<uchar *>(output.constBits())
+            : output.bits();
+        options.watermark->blend(pixels, output.bytesPerLine(), output.size(), output.format());
+    }
+
+    if (isPngFormat(path, options) && isPngWriteSupported(output.format())) {
+        PngWriteOptions png;
+        // Same mapping as QImage, quality 0 compresses hardest
+        if (options.quality >= 0)
+            png.level = (100 - qMin(options.quality, 100)) * 9 / 91;
+        png.threads = options.threads;
+        QSaveFile file(path);
+        return file.open(QIODevice::WriteOnly) && writePng(output, &file, png) && file.commit();
+    }
+    return output.save(path,
+                       options.format.isEmpty() ? nullptr : options.format.constData(),
+                       options.quality);
+}
+
 TreelandCaptureManager *TreelandCaptureManager::instance()
 {
     static TreelandCaptureManager manager;
@@ -32,40 +110,86 @@ TreelandCaptureManager::TreelandCaptureManager()
 {
     qInfo() << "TreelandCaptureManager created.";
     connect(this, &TreelandCaptureManager::activeChanged, this, [this] {
-        if (!isActive() && m_context) {
-            delete m_context;
+        if (!isActive()) {
+            qDeleteAll(std::exchange(m_contexts, {}));
+            return;
         }
+        // The manager has no events of its own, everything created from it
+        // inherits the queue.
+        if (m_events.start(waylandDisplay()->wl_display())) {
+            wl_proxy_set_queue(reinterpret_cast<::wl_proxy *>(object()), m_events.queue());
+        } else {
+            qWarning() << "Failed to start the capture event thread, dispatching on the GUI thread";
+        }
+    });
+    // Like a compositor that went away: the contexts fail what is pending,
+    // later ones are dispatched on the GUI thread.
+    m_events.setFailureHandler(this, [this] {
+        qDeleteAll(std::exchange(m_contexts, {}));
+        if (isInitialized())
+            wl_proxy_set_queue(reinterpret_cast<::wl_proxy *>(object()), nullptr);
+        m_events.stop();
     });
+    connect(qApp, &QCoreApplication::aboutToQuit, this, &TreelandCaptureManager::shutdown);
 }
 
 TreelandCaptureManager::~TreelandCaptureManager()
 {
-    if (m_context)
-        delete m_context;
+    shutdown();
     destroy();
 }
 
+void TreelandCaptureManager::shutdown()
+{
+    // Contexts fail their pending captures before the event thread goes
+    qDeleteAll(std::exchange(m_contexts, {}));
+    // Idle wl_buffers go while the display is still there, the pool itself
+    // is a static that outlives it.
+    TreelandShmBufferPool::instance()->clear();
+    // Also after the thread stopped on an error
+    if (!m_events.queue())
+        return;
+    if (isInitialized())
+        wl_proxy_set_queue(reinterpret_cast<::wl_proxy *>(object()), nullptr);
+    m_events.stop();
+}
+
 TreelandCaptureContext *TreelandCaptureManager::ensureContext()
 {
     if (m_context)
         return m_context;
-    auto context = get_context();
-    m_context = new TreelandCaptureContext(context, this);
-    connect(m_context, &TreelandCaptureContext::destroyed, this, [this] {
-        m_context = nullptr;
-        Q_EMIT contextChanged();
-    });
+    m_context = createContext();
     Q_EMIT contextChanged();
     return m_context;
 }
 
+TreelandCaptureContext *TreelandCaptureManager::createContext()
+{
+    QMutexLocker locker(dispatchMutex());
+    auto context = new TreelandCaptureContext(get_context(), ++m_lastContextId, this);
+    m_contexts.append(context);
+    connect(context, &TreelandCaptureContext::destroyed, this, [this, context] {
+        m_contexts.removeOne(context);
+        Q_EMIT contextRemoved(context);
+        if (context == m_context) {
+            m_context = nullptr;
+            Q_EMIT contextChanged();
+        }
+    });
+    Q_EMIT contextAdded(context);
+    return context;
+}
+
 void TreelandCaptureContext::treeland_capture_context_v1_source_ready(int32_t region_x,
                                                                       int32_t region_y,
                                                                       uint32_t region_width,
                                                                       uint32_t region_height,
                                                                       uint32_t source_type)
 {
-    m_captureRegion = QRect(region_x, region_y, region_width, region_height);
+    {
+        QMutexLocker locker(&m_stateMutex);
+        m_captureRegion = QRect(region_x, region_y, region_width, region_height);
+    }
     Q_EMIT captureRegionChanged();
     Q_EMIT sourceReady(QRect(region_x, region_y, region_width, region_height), source_type);
 }
@@ -75,13 +199,27 @@ void TreelandCaptureContext::treeland_capture_context_v1_source_failed(uint32_t
     Q_EMIT sourceFailed(reason);
 }
 
+QRectF TreelandCaptureContext::captureRegion() const
+{
+    QMutexLocker locker(&m_stateMutex);
+    return m_captureRegion;
+}
+
 TreelandCaptureFrame *TreelandCaptureContext::ensureFrame()
 {
-    if (m_frame)
+    QMutexLocker locker(dispatchMutex());
+    if (m_frame && !m_frame->isFinished())
         return m_frame;
+    // A frame object only delivers once, a spent one can't capture again.
+    // Deferred, its image may still be in use by whoever got ready().
+    if (m_frame)
+        m_frame->deleteLater();
     auto object = QtWayland::treeland_capture_context_v1::capture();
-    m_frame = new TreelandCaptureFrame(object, this);
-    connect(m_frame, &TreelandCaptureFrame::destroyed, this, [this] {
+    auto frame = new TreelandCaptureFrame(object, this);
+    m_frame = frame;
+    connect(frame, &TreelandCaptureFrame::destroyed, this, [this, frame] {
+        if (m_frame != frame)
+            return;
         m_frame = nullptr;
         Q_EMIT frameChanged();
     });
@@ -89,15 +227,93 @@ TreelandCaptureFrame *TreelandCaptureContext::ensureFrame()
     return m_frame;
 }
 
+QFuture<QImage> TreelandCaptureContext::captureImage()
+{
+    auto promise = std::make_shared<QPromise<QImage>>();
+    promise->start();
+    auto future = promise->future();
+
+    // The promise is fulfilled right on the event thread, continuations pick
+    // their own thread. The frame isn't a child of the context, a delivered
+    // one lives as long as its image.
+    QMutexLocker locker(dispatchMutex());
+    auto frame = new TreelandCaptureFrame(QtWayland::treeland_capture_context_v1::capture());
+    m_pendingCaptures.append({ frame, promise });
+    connect(frame, &TreelandCaptureFrame::ready, frame, [this, frame](QImage image) {
+        QImage shared(image.constBits(),
+                      image.width(),
+                      image.height(),
+                      image.bytesPerLine(),
+                      image.format(),
+                      [](void *info) {
+                          static_cast<TreelandCaptureFrame *>(info)->deleteLater();
+                      },
+                      frame);
+        finishCapture(frame, shared);
+    }, Qt::DirectConnection);
+    connect(frame, &TreelandCaptureFrame::failed, frame, [this, frame] {
+        finishCapture(frame, QImage());
+        frame->deleteLater();
+    }, Qt::DirectConnection);
+    return future;
+}
+
+void TreelandCaptureContext::finishCapture(TreelandCaptureFrame *frame, const QImage &image)
+{
+    auto pending = std::find_if(m_pendingCaptures.begin(),
+                                m_pendingCaptures.end(),
+                                [frame](const PendingCapture &capture) {
+                                    return capture.frame == frame;
+                                });
+    if (pending == m_pendingCaptures.end())
+        return;
+    const auto promise = pending->promise;
+    m_pendingCaptures.erase(pending);
+    promise->addResult(image);
+    promise->finish();
+}
+
+QFuture<bool> TreelandCaptureContext::captureToFile(const QString &path,
+                                                    const CaptureFileOptions &options)
+{
+    return captureImage().then(captureWorkerPool(), [path, options](const QImage &image) {
+        return writeImage(image, path, options, ImageAccess::Exclusive);
+    });
+}
+
+QFuture<bool> TreelandCaptureContext::saveImage(const QImage &image,
+                                                const QString &path,
+                                                const CaptureFileOptions &options,
+                                                ImageAccess access)
+{
+    auto promise = std::make_shared<QPromise<bool>>();
+    promise->start();
+    auto future = promise->future();
+    captureWorkerPool()->start([promise, image, path, options, access] {
+        promise->addResult(writeImage(image, path, options, access));
+        promise->finish();
+    });
+    return future;
+}
+
 TreelandCaptureContext::TreelandCaptureContext(::treeland_capture_context_v1 *object,
+                                               int id,
                                                QObject *parent)
     : QObject(parent)
     , QtWayland::treeland_capture_context_v1(object)
+    , m_id(id)
 {
 }
 
 TreelandCaptureContext::~TreelandCaptureContext()
 {
+    QMutexLocker locker(dispatchMutex());
+    // Nothing answers them any more, waiting callers get a failed capture
+    for (const auto &capture : std::exchange(m_pendingCaptures, {})) {
+        capture.promise->addResult(QImage());
+        capture.promise->finish();
+        delete capture.frame;
+    }
     if (m_frame)
         delete m_frame;
     if (m_session)
@@ -115,10 +331,11 @@ void TreelandCaptureContext::selectSource(uint32_t sourceHint,
 
 TreelandCaptureSession *TreelandCaptureContext::ensureSession()
 {
+    QMutexLocker locker(dispatchMutex());
     if (m_session)
         return m_session;
     auto object = create_session();
-    m_session = new TreelandCaptureSession(object, this);
+    m_session = new TreelandCaptureSession(object, QStringLiteral("context%1-session").arg(m_id), this);
     connect(m_session, &TreelandCaptureSession::destroyed, this, [this] {
         m_session = nullptr;
         Q_EMIT sessionChanged();
@@ -130,15 +347,15 @@ TreelandCaptureSession *TreelandCaptureContext::ensureSession()
 TreelandCaptureFrame::TreelandCaptureFrame(::treeland_capture_frame_v1 *object, QObject *parent)
     : QObject(parent)
     , QtWayland::treeland_capture_frame_v1(object)
-    , m_shmBuffer(nullptr)
-    , m_pendingShmBuffer(nullptr)
 {
 }
 
 TreelandCaptureFrame::~TreelandCaptureFrame()
 {
-    delete m_shmBuffer;
-    delete m_pendingShmBuffer;
+    QMutexLocker locker(dispatchMutex());
+    // Buffers go back to the pool for the next capture of the same size.
+    m_shmBuffer.reset();
+    m_pendingShmBuffer.reset();
     destroy();
 }
 
@@ -147,19 +364,47 @@ void TreelandCaptureFrame::treeland_capture_frame_v1_buffer(uint32_t format,
                                                             uint32_t height,
                                                             uint32_t stride)
 {
-    if (stride != width * 4) {
-        qDebug() << "Receive a buffer format which is not compatible with "
-                    "QWaylandShmBuffer."
+    const uint32_t minimumStride =
+        width * (TreelandShmBuffer::imageFormat(format) == QImage::Format_RGB16 ? 2 : 4);
+    if (TreelandShmBufferPool::formatRank(format) < 0 || stride < minimumStride) {
+        qDebug() << "Receive a buffer format which is not compatible with QImage."
                  << "format:" << format << "width:" << width << "height:" << height
                  << "stride:" << stride;
         return;
     }
-    if (m_pendingShmBuffer)
-        return; // We only need one supported format
-    m_pendingShmBuffer = new QtWaylandClient::QWaylandShmBuffer(
-        waylandDisplay(),
-        QSize(width, height),
-        QtWaylandClient::QWaylandShm::formatFrom(static_cast<::wl_shm_format>(format)));
+
+    // All offers arrive back to back, pick one once the whole burst is seen.
+    if (m_offers.isEmpty() && !m_pendingShmBuffer) {
+        TreelandCaptureManager::instance()->eventThread()->callAfterDispatch(this, [this] {
+            copyToBestOffer();
+        });
+    }
+    m_offers.append({ format, QSize(width, height), stride });
+}
+
+void TreelandCaptureFrame::copyToBestOffer()
+{
+    if (m_offers.isEmpty() || m_pendingShmBuffer)
+        return;
+
+    // formatRank() ranks every format it accepts differently
+    auto best = std::min_element(m_offers.cbegin(),
+                                 m_offers.cend(),
+                                 [](const BufferOffer &a, const BufferOffer &b) {
+                                     return TreelandShmBufferPool::formatRank(a.format)
+                                         < TreelandShmBufferPool::formatRank(b.format);
+                                 });
+
+    m_pendingShmBuffer = TreelandShmBufferPool::instance()->acquire(waylandDisplay()->shm()->object(),
+                                                                    best->format,
+                                                                    best->size,
+                                                                    best->stride);
+    m_offers.clear();
+    if (!m_pendingShmBuffer) {
+        m_finished = true;
+        Q_EMIT failed();
+        return;
+    }
     copy(m_pendingShmBuffer->buffer());
 }
 
@@ -170,26 +415,152 @@ void TreelandCaptureFrame::treeland_capture_frame_v1_flags(uint32_t flags)
 
 void TreelandCaptureFrame::treeland_capture_frame_v1_ready()
 {
-    if (m_shmBuffer)
-        delete m_shmBuffer;
-    m_shmBuffer = m_pendingShmBuffer;
-    m_pendingShmBuffer = nullptr;
-    Q_EMIT ready(*m_shmBuffer->image());
+    CAPTURE_TRACE_SCOPE("frame ready");
+    m_finished = true;
+    m_shmBuffer = std::move(m_pendingShmBuffer);
+    if (!m_shmBuffer) {
+        Q_EMIT failed();
+        return;
+    }
+    Q_EMIT ready(m_shmBuffer->image());
 }
 
 void TreelandCaptureFrame::treeland_capture_frame_v1_failed()
 {
+    m_finished = true;
     Q_EMIT failed();
 }
 
 TreelandCaptureSession::TreelandCaptureSession(::treeland_capture_session_v1 *object,
+                                               const QString &metricsName,
                                                QObject *parent)
     : QObject(parent)
     , QtWayland::treeland_capture_session_v1(object)
+    , m_metrics(CaptureMetricsRegistry::instance()->create(metricsName.toStdString()))
+{
+}
+
+TreelandCaptureSession::~TreelandCaptureSession()
+{
+    // Not while a ready handler is still reading the frame
+    QMutexLocker locker(dispatchMutex());
+    TreelandCaptureManager::instance()->eventThread()->cancelOutsideDispatch(&m_deliveryMutex);
+    QMutexLocker deliveryLocker(&m_deliveryMutex);
+    QMutexLocker stateLocker(&m_stateMutex);
+    m_pendingFrame.reset();
+    m_frame.reset();
+}
+
+FrameRef TreelandCaptureSession::frame() const
 {
+    QMutexLocker locker(&m_stateMutex);
+    return m_frame;
+}
+
+std::shared_ptr<const DmaBufMapping> TreelandCaptureSession::mapObject(const FrameDescriptor &frame,
+                                                                      const FrameObject &object)
+{
+    CAPTURE_TRACE_SCOPE("map object");
+    size_t size = object.size;
+    if (size == 0)
+        size = size_t(object.offset) + size_t(object.stride) * frame.height;
+    bool created = false;
+    auto mapping = m_mappings.map(object.identity, object.fd.get(), size, &created);
+    if (created)
+        m_metrics->add(CaptureMetrics::BytesMapped, size);
+    return mapping;
 }
 
-TreelandCaptureSession::~TreelandCaptureSession() { }
+void TreelandCaptureSession::retainDamageTracking()
+{
+    // Hashes from before are stale, the event thread drops them
+    if (m_damageTrackingUsers.fetch_add(1) == 0)
+        m_damageResetPending = true;
+}
+
+void TreelandCaptureSession::releaseDamageTracking()
+{
+    const int users = m_damageTrackingUsers.fetch_sub(1);
+    Q_ASSERT(users > 0);
+    Q_UNUSED(users);
+}
+
+QList<QRect> TreelandCaptureSession::damageSince(quint64 since) const
+{
+    QMutexLocker locker(&m_stateMutex);
+    const QRect bounds(0, 0, int(m_bufferWidth), int(m_bufferHeight));
+    if (m_damageTrackingUsers == 0 || since == 0 || m_damageSequence != m_frameSequence)
+        return { bounds };
+
+    QList<QRect> damage;
+    for (const auto &rect : m_damageView.damageSince(since))
+        damage.append(QRect(int(rect.x), int(rect.y), int(rect.width), int(rect.height)));
+    return damage;
+}
+
+static bool isPacked32Format(uint32_t format)
+{
+    switch (format) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_ABGR8888:
+    case DRM_FORMAT_RGBX8888:
+    case DRM_FORMAT_RGBA8888:
+    case DRM_FORMAT_BGRX8888:
+    case DRM_FORMAT_BGRA8888:
+    case DRM_FORMAT_XRGB2101010:
+    case DRM_FORMAT_ARGB2101010:
+    case DRM_FORMAT_XBGR2101010:
+    case DRM_FORMAT_ABGR2101010:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void TreelandCaptureSession::updateDamage()
+{
+    if (m_damageTrackingUsers == 0)
+        return;
+    CAPTURE_TRACE_SCOPE("damage hash");
+    if (m_damageResetPending.exchange(false))
+        m_damage.reset();
+
+    // Tiled layouts and multi-planar formats aren't worth hashing through
+    // mmap, every frame of those counts as fully damaged.
+    const auto objects = m_frame->objects();
+    const auto modifier = m_frame->modifier;
+    const bool hashable = objects.size() == 1 && objects.first().planeIndex == 0
+        && isPacked32Format(m_frame->format)
+        && (modifier == DRM_FORMAT_MOD_LINEAR || modifier == DRM_FORMAT_MOD_INVALID);
+    std::shared_ptr<const DmaBufMapping> mapping;
+    if (hashable)
+        mapping = mapObject(*m_frame, objects.first());
+
+    const auto &object = objects.first();
+    if (!mapping
+        || size_t(object.offset) + size_t(object.stride) * m_bufferHeight > mapping->size()
+        || object.stride < m_bufferWidth * 4) {
+        m_damage.invalidate(m_frameSequence, m_bufferWidth, m_bufferHeight);
+    } else {
+        // Reads the whole buffer, what every consumer saves by converting or
+        // copying only the damage is paid here once.
+        DmaBufReadAccess access(object.fd.get());
+        const size_t changed = m_damage.update(m_frameSequence,
+                                               mapping->data() + object.offset,
+                                               m_bufferWidth,
+                                               m_bufferHeight,
+                                               object.stride);
+        m_metrics->add(CaptureMetrics::TilesHashed, m_damage.tileCount());
+        m_metrics->add(CaptureMetrics::TilesDirty, changed);
+    }
+
+    // The tile grid is a few KiB, cheap to copy under the lock
+    QMutexLocker locker(&m_stateMutex);
+    m_damageView = m_damage;
+    m_damageSequence = m_frameSequence;
+}
 
 void TreelandCaptureSession::start()
 {
@@ -209,17 +580,50 @@ void TreelandCaptureSession::treeland_capture_session_v1_frame(int32_t offset_x,
                                                                uint32_t mod_low,
                                                                uint32_t num_objects)
 {
+    CAPTURE_TRACE_SCOPE("session frame");
     Q_EMIT invalid();
-    m_objects.clear();
-    m_objects.reserve(num_objects);
-    m_offset = { offset_x, offset_y };
-    m_bufferWidth = width;
-    m_bufferHeight = height;
-    m_bufferFlags = buffer_flags;
-    m_bufferFormat = format;
-    m_flags = static_cast<QtWayland::treeland_capture_session_v1::flags>(flags);
-    m_modifierUnion.modLow = mod_low;
-    m_modifierUnion.modHigh = mod_high;
+    // Consumers still holding the previous frame keep its fds open
+    {
+        QMutexLocker locker(&m_stateMutex);
+        m_frame.reset();
+    }
+    m_pendingFrame = FrameDescriptorPool::instance()->acquire();
+    if (num_objects > uint32_t(FrameDescriptor::MaxObjects))
+        qWarning() << "Frame has" << num_objects << "objects, only"
+                   << FrameDescriptor::MaxObjects << "are supported";
+
+    ModifierUnion modifierUnion;
+    modifierUnion.modLow = mod_low;
+    modifierUnion.modHigh = mod_high;
+    if (width != m_bufferWidth || height != m_bufferHeight || format != m_bufferFormat
+        || modifierUnion.modifier != m_modifierUnion.modifier) {
+        ++m_bufferGeneration;
+        m_mappings.clear();
+        m_damage.reset();
+        Q_EMIT buffersInvalidated();
+    }
+
+    {
+        QMutexLocker locker(&m_stateMutex);
+        m_offset = { offset_x, offset_y };
+        m_bufferWidth = width;
+        m_bufferHeight = height;
+        m_bufferFlags = buffer_flags;
+        m_bufferFormat = format;
+        m_flags = static_cast<QtWayland::treeland_capture_session_v1::flags>(flags);
+        m_modifierUnion = modifierUnion;
+    }
+
+    auto &frame = *m_pendingFrame;
+    frame.offsetX = offset_x;
+    frame.offsetY = offset_y;
+    frame.width = width;
+    frame.height = height;
+    frame.format = format;
+    frame.modifier = modifierUnion.modifier;
+    frame.bufferFlags = buffer_flags;
+    frame.flags = flags;
+    frame.bufferGeneration = m_bufferGeneration;
 }
 
 void TreelandCaptureSession::treeland_capture_session_v1_object(uint32_t index,
@@ -229,21 +633,66 @@ void TreelandCaptureSession::treeland_capture_session_v1_object(uint32_t index,
                                                                 uint32_t stride,
                                                                 uint32_t plane_index)
 {
-    m_objects.push_back({ .index = index,
-                          .fd = fd,
-                          .size = size,
-                          .offset = offset,
-                          .stride = stride,
-                          .planeIndex = plane_index });
+    CAPTURE_TRACE_SCOPE("session object");
+    UniqueFd ownedFd(fd);
+    if (!m_pendingFrame)
+        return;
+
+    FrameObject object;
+    object.index = index;
+    object.identity = DmaBufMappingCache::identify(index, fd);
+    object.fd = std::move(ownedFd);
+    object.size = size;
+    object.offset = offset;
+    object.stride = stride;
+    object.planeIndex = plane_index;
+    m_pendingFrame->addObject(std::move(object));
 }
 
 void TreelandCaptureSession::treeland_capture_session_v1_ready(uint32_t tv_sec_hi,
                                                                uint32_t tv_sec_lo,
                                                                uint32_t tv_nsec)
 {
+    // Covers the ready handlers, they run directly from here
+    CAPTURE_TRACE_SCOPE("session ready");
+    // Nothing to deliver without a preceding frame event
+    if (!m_pendingFrame)
+        return;
+
     m_tvSecHi = tv_sec_hi;
     m_tvSecLo = tv_sec_lo;
-    m_tvUsec = tv_nsec;
+    m_tvNsec = tv_nsec;
+    const quint64 seconds = quint64(tv_sec_hi) << 32 | tv_sec_lo;
+    m_presentationTimeNs = seconds * 1000000000ull + tv_nsec;
+    m_receiveTimeNs = CaptureMetrics::monotonicNs();
+    m_metrics->frameReceived(m_receiveTimeNs, m_presentationTimeNs);
+    {
+        QMutexLocker locker(&m_stateMutex);
+        ++m_frameSequence;
+        m_pendingFrame->sequence = m_frameSequence;
+        m_pendingFrame->presentationTimeNs = m_presentationTimeNs;
+        m_pendingFrame->receiveTimeNs = m_receiveTimeNs;
+        m_frame = std::move(m_pendingFrame);
+    }
+
+    // Hashing and the consumers' copies run outside the dispatch. When
+    // several frames were read at once only the last one is delivered.
+    if (!m_deliveryPending) {
+        m_deliveryPending = true;
+        TreelandCaptureManager::instance()->eventThread()->callOutsideDispatch(&m_deliveryMutex, [this] {
+            deliverFrame();
+        });
+    }
+}
+
+void TreelandCaptureSession::deliverFrame()
+{
+    m_deliveryPending = false;
+    // Replaced by a frame event dispatched in the same batch
+    if (!m_frame)
+        return;
+    if (!m_frame->objects().isEmpty())
+        updateDamage();
     Q_EMIT ready();
 }
 
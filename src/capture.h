@@ -3,10 +3,38 @@
 
 #pragma once
 
+#include "captureeventthread.h"
+#include "capturemetrics.h"
+#include "dmabufcache.h"
+#include "framedescriptor.h"
+#include "shmbufferpool.h"
+#include "tilehash.h"
 #include "qwayland-treeland-capture-unstable-v1.h"
 
+#include <QFuture>
+#include <QImage>
+#include <QPromise>
+
 #include <private/qwaylandclientextension_p.h>
-#include <private/qwaylandshmbackingstore_p.h>
+
+#include <atomic>
+#include <memory>
+
+class Watermark;
+
+struct CaptureFileOptions
+{
+    // Empty picks the format from the file suffix
+    QByteArray format{ QByteArrayLiteral("PNG") };
+    // For PNG the zlib level as QImage maps it, lower is smaller but slower
+    int quality{ -1 };
+    // PNG only: strips compressed at once, 0 uses the whole worker pool
+    int threads{ 0 };
+    // Part of the image to keep, in image pixels. Empty keeps all of it.
+    QRect crop;
+    // Blended into the image before encoding while enabled
+    std::shared_ptr<const Watermark> watermark;
+};
 
 class TreelandCaptureFrame
     : public QObject
@@ -22,6 +50,17 @@ public:
         return m_flags;
     }
 
+    // The compositor answered with ready or failed, there is nothing more
+    inline bool isFinished() const
+    {
+        return m_finished;
+    }
+
+    inline const TreelandShmBufferPool::Handle &shmBuffer() const
+    {
+        return m_shmBuffer;
+    }
+
 Q_SIGNALS:
     void ready(QImage image);
     void failed();
@@ -36,19 +75,20 @@ protected:
     void treeland_capture_frame_v1_failed() override;
 
 private:
-    QtWaylandClient::QWaylandShmBuffer *m_shmBuffer{ nullptr };
-    QtWaylandClient::QWaylandShmBuffer *m_pendingShmBuffer{ nullptr };
-    uint m_flags;
-};
+    struct BufferOffer
+    {
+        uint32_t format;
+        QSize size;
+        uint32_t stride;
+    };
 
-struct FrameObject
-{
-    uint32_t index;
-    int32_t fd;
-    uint32_t size;
-    uint32_t offset;
-    uint32_t stride;
-    uint32_t planeIndex;
+    void copyToBestOffer();
+
+    QList<BufferOffer> m_offers;
+    TreelandShmBufferPool::Handle m_shmBuffer;
+    TreelandShmBufferPool::Handle m_pendingShmBuffer;
+    uint m_flags{ 0 };
+    bool m_finished{ false };
 };
 
 union ModifierUnion
@@ -70,8 +110,19 @@ class TreelandCaptureSession
     Q_PROPERTY(bool started READ started NOTIFY startedChanged FINAL)
 
 public:
-    explicit TreelandCaptureSession(::treeland_capture_session_v1 *object,
-                                    QObject *parent = nullptr);
+    // metricsName prefixes the session's entry in the CaptureMetricsRegistry
+    //
+    // Events are handled on the capture event thread, see
+    // TreelandCaptureManager. ready() is emitted there as well, but after
+    // the dispatch and holding deliveryMutex() instead of the dispatch
+    // mutex, so slow consumers don't hold up other threads creating or
+    // destroying capture objects. The buffer and frame accessors below
+    // describe the frame being received and are only consistent on the
+    // event thread, e.g. in a direct connection to ready(). Other threads
+    // take the frame() snapshot.
+    TreelandCaptureSession(::treeland_capture_session_v1 *object,
+                           const QString &metricsName,
+                           QObject *parent = nullptr);
     ~TreelandCaptureSession() override;
 
     inline uint bufferWidth() const
@@ -94,10 +145,10 @@ public:
         return m_bufferFlags;
     }
 
-    inline const QList<FrameObject> &objects() const
-    {
-        return m_objects;
-    }
+    // The current frame, null between a frame event and its ready event.
+    // Consumers may keep the reference for as long as they need the object
+    // fds, also on other threads.
+    FrameRef frame() const;
 
     inline ModifierUnion modifierUnion() const
     {
@@ -109,11 +160,74 @@ public:
         return m_started;
     }
 
+    // True between ready and the next frame event, frame() is set then.
+    inline bool frameReady() const
+    {
+        return bool(frame());
+    }
+
+    // Bumped whenever size, format or modifier change, every buffer imported
+    // or mapped under an older generation must be dropped.
+    inline uint bufferGeneration() const
+    {
+        return m_bufferGeneration;
+    }
+
+    // Increases with every ready event, consumers use it to tell frames apart.
+    inline quint64 frameSequence() const
+    {
+        return m_frameSequence;
+    }
+
+    // Compositor timestamp of the current frame, CLOCK_MONOTONIC nanoseconds.
+    inline quint64 presentationTimeNs() const
+    {
+        return m_presentationTimeNs;
+    }
+
+    // When the ready event of the current frame was dispatched.
+    inline quint64 receiveTimeNs() const
+    {
+        return m_receiveTimeNs;
+    }
+
+    inline CaptureMetrics *metrics() const
+    {
+        return m_metrics.get();
+    }
+
+    // For consumers that may outlive the session, like worker threads.
+    inline const std::shared_ptr<CaptureMetrics> &metricsHandle() const
+    {
+        return m_metrics;
+    }
+
+    // The object must belong to frame, which doesn't have to be the current one.
+    std::shared_ptr<const DmaBufMapping> mapObject(const FrameDescriptor &frame,
+                                                   const FrameObject &object);
+
+    // Held while ready() is delivered. Consumers connected directly take it
+    // before disconnecting, so no call is still running afterwards.
+    inline QRecursiveMutex *deliveryMutex()
+    {
+        return &m_deliveryMutex;
+    }
+
+    // Damage tracking hashes every frame on the event thread, so it only
+    // runs while at least one consumer holds a reference.
+    void retainDamageTracking();
+    void releaseDamageTracking();
+    // Parts of the current frame that changed after the frame with sequence
+    // since, in buffer coordinates. The whole buffer when tracking is off or
+    // the frame can't be hashed, empty when nothing changed.
+    QList<QRect> damageSince(quint64 since) const;
+
     void start();
 Q_SIGNALS:
     void invalid();
     void ready();
     void startedChanged();
+    void buffersInvalidated();
 
 protected:
     void treeland_capture_session_v1_frame(int32_t offset_x,
@@ -138,18 +252,39 @@ protected:
     void treeland_capture_session_v1_cancel(uint32_t reason) override;
 
 private:
+    void deliverFrame();
+    void updateDamage();
+
+    QRecursiveMutex m_deliveryMutex;
+    bool m_deliveryPending{ false };
+    // Guards what other threads read through frame() and damageSince()
+    mutable QMutex m_stateMutex;
     QPoint m_offset;
-    uint m_bufferWidth;
-    uint m_bufferHeight;
-    uint m_bufferFlags;
-    uint m_bufferFormat;
-    ModifierUnion m_modifierUnion;
-    QList<FrameObject> m_objects;
+    uint m_bufferWidth{ 0 };
+    uint m_bufferHeight{ 0 };
+    uint m_bufferFlags{ 0 };
+    uint m_bufferFormat{ 0 };
+    ModifierUnion m_modifierUnion{};
+    // Filled by the frame and object events, becomes m_frame on ready
+    FrameRef m_pendingFrame;
+    FrameRef m_frame;
     QtWayland::treeland_capture_session_v1::flags m_flags;
     bool m_started{ false };
-    uint32_t m_tvSecHi;
-    uint32_t m_tvSecLo;
-    uint32_t m_tvUsec;
+    uint m_bufferGeneration{ 0 };
+    DmaBufMappingCache m_mappings;
+    // Hashed without a lock, damageSince() reads the copy in m_damageView
+    TileDamageTracker m_damage;
+    TileDamageTracker m_damageView;
+    std::atomic_int m_damageTrackingUsers{ 0 };
+    std::atomic_bool m_damageResetPending{ false };
+    quint64 m_damageSequence{ 0 };
+    uint32_t m_tvSecHi{ 0 };
+    uint32_t m_tvSecLo{ 0 };
+    uint32_t m_tvNsec{ 0 };
+    quint64 m_frameSequence{ 0 };
+    quint64 m_presentationTimeNs{ 0 };
+    quint64 m_receiveTimeNs{ 0 };
+    std::shared_ptr<CaptureMetrics> m_metrics;
 };
 
 class TreelandCaptureContext
@@ -163,15 +298,19 @@ class TreelandCaptureContext
 
 public:
     using QtWayland::treeland_capture_context_v1::source_type;
-    explicit TreelandCaptureContext(struct ::treeland_capture_context_v1 *object,
-                                    QObject *parent = nullptr);
+    TreelandCaptureContext(struct ::treeland_capture_context_v1 *object,
+                           int id,
+                           QObject *parent = nullptr);
     ~TreelandCaptureContext() override;
 
-    inline QRectF captureRegion() const
+    // Unique per manager, names the context's metrics
+    inline int id() const
     {
-        return m_captureRegion;
+        return m_id;
     }
 
+    QRectF captureRegion() const;
+
     inline QtWayland::treeland_capture_context_v1::source_type sourceType() const
     {
         return m_sourceType;
@@ -188,9 +327,34 @@ public:
     }
 
     void selectSource(uint32_t sourceHint, bool freeze, bool withCursor, ::wl_surface *mask);
+    // The current frame, or a new one once it has delivered
     TreelandCaptureFrame *ensureFrame();
     TreelandCaptureSession *ensureSession();
 
+    // Every call requests its own frame, so several captures can be in flight.
+    // The image shares the frame's shm buffer, which is released together
+    // with the last copy of the image. A null image means the capture failed,
+    // also when the context is deleted before the frame arrived.
+    QFuture<QImage> captureImage();
+    // What saveImage() may do with the pixels of the image it's given
+    enum class ImageAccess {
+        // Others may still read them, a watermark goes into a copy
+        Shared,
+        // Nobody reads them any more, e.g. an image from captureImage() no
+        // one else was given, a watermark goes straight into them
+        Exclusive,
+    };
+
+    // Captures and encodes on the capture worker pool, never on the caller.
+    // The captured pixels are its own, a watermark goes into them.
+    QFuture<bool> captureToFile(const QString &path,
+                                const CaptureFileOptions &options = CaptureFileOptions());
+    // Same for an image that is already there.
+    static QFuture<bool> saveImage(const QImage &image,
+                                   const QString &path,
+                                   const CaptureFileOptions &options = CaptureFileOptions(),
+                                   ImageAccess access = ImageAccess::Shared);
+
 Q_SIGNALS:
     void sourceReady(QRect region, uint32_t sourceType);
     void sourceFailed(uint32_t reason);
@@ -207,12 +371,29 @@ protected:
     void treeland_capture_context_v1_source_failed(uint32_t reason) override;
 
 private:
+    struct PendingCapture
+    {
+        TreelandCaptureFrame *frame;
+        std::shared_ptr<QPromise<QImage>> promise;
+    };
+
+    void finishCapture(TreelandCaptureFrame *frame, const QImage &image);
+
+    int m_id{ 0 };
+    // Guards m_captureRegion, written on the event thread
+    mutable QMutex m_stateMutex;
     QRect m_captureRegion;
     QtWayland::treeland_capture_context_v1::source_type m_sourceType;
     TreelandCaptureFrame *m_frame{ nullptr };
     TreelandCaptureSession *m_session{ nullptr };
+    // Frames of captureImage() that haven't answered yet, guarded by the
+    // dispatch mutex
+    QList<PendingCapture> m_pendingCaptures;
 };
 
+// The manager and every context, frame and session created from it receive
+// their events on the capture event thread. Signals reach receivers living on
+// other threads queued, direct connections run on the event thread.
 class TreelandCaptureManager
     : public QWaylandClientExtensionTemplate<TreelandCaptureManager>
     , public QtWayland::treeland_capture_manager_v1
@@ -227,12 +408,23 @@ public:
 
     ~TreelandCaptureManager() override;
 
+    // The context the main window works with
     inline TreelandCaptureContext *context() const
     {
         return m_context;
     }
 
     TreelandCaptureContext *ensureContext();
+    // Another context next to the main one, e.g. to record a second output
+    // while taking window screenshots. Every context selects its own source
+    // and owns its frames and session, so they run fully independently. The
+    // manager owns them, delete one to end it early.
+    TreelandCaptureContext *createContext();
+
+    inline QList<TreelandCaptureContext *> contexts() const
+    {
+        return m_contexts;
+    }
 
     inline bool record() const
     {
@@ -242,8 +434,29 @@ public:
     void setRecord(bool newRecord);
     bool recordStarted() const;
 
+    // Held by the capture event thread while it dispatches, see
+    // CaptureEventThread. Consumers connected directly to capture signals
+    // other than TreelandCaptureSession::ready() take it before
+    // disconnecting, so no call is still running afterwards.
+    inline QRecursiveMutex *dispatchMutex()
+    {
+        return m_events.mutex();
+    }
+
+    inline CaptureEventThread *eventThread()
+    {
+        return &m_events;
+    }
+
+    // Deletes all contexts and stops the event thread. Called when the
+    // application quits, applications that drop the Wayland connection
+    // without running the event loop call it before that.
+    void shutdown();
+
 Q_SIGNALS:
     void contextChanged();
+    void contextAdded(TreelandCaptureContext *context);
+    void contextRemoved(TreelandCaptureContext *context);
     void recordChanged();
     void finishSelect();
     void recordStartedChanged();
@@ -252,5 +465,9 @@ private:
     TreelandCaptureManager();
 
     TreelandCaptureContext *m_context{ nullptr };
+    QList<TreelandCaptureContext *> m_contexts;
+    // Dispatches the events of the manager and everything created from it
+    CaptureEventThread m_events;
+    int m_lastContextId{ 0 };
     bool m_record{ false };
 };
\ No newline at end of file
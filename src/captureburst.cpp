@@ -0,0 +1,155 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "captureburst.h"
+
+#include <QFileInfo>
+#include <QTimer>
+
+CaptureBurst::CaptureBurst(TreelandCaptureContext *context, const QString &path, QObject *parent)
+    : QObject(parent)
+    , m_context(context)
+    , m_path(path)
+    , m_timer(new QTimer(this))
+{
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &CaptureBurst::requestFrames);
+}
+
+CaptureBurst::~CaptureBurst() = default;
+
+QString CaptureBurst::numberedPath(const QString &path, int index, int count)
+{
+    if (count <= 1)
+        return path;
+    const QString suffix = QFileInfo(path).suffix();
+    const QString base = suffix.isEmpty() ? path : path.left(path.size() - suffix.size() - 1);
+    const QString number =
+        QStringLiteral("%1").arg(index, int(QString::number(count).size()), 10, QLatin1Char('0'));
+    return base + QLatin1Char('-') + number
+        + (suffix.isEmpty() ? QString() : QStringLiteral(".") + suffix);
+}
+
+void CaptureBurst::setCount(int count)
+{
+    m_count = qMax(1, count);
+}
+
+void CaptureBurst::setInterval(int intervalMs)
+{
+    m_intervalMs = qMax(0, intervalMs);
+}
+
+void CaptureBurst::setInFlight(int inFlight)
+{
+    m_inFlightLimit = qMax(1, inFlight);
+}
+
+void CaptureBurst::setFileOptions(const CaptureFileOptions &options)
+{
+    m_fileOptions = options;
+}
+
+void CaptureBurst::setCrop(const QRect &crop, const QSize &logicalSize)
+{
+    m_crop = crop;
+    m_logicalSize = logicalSize;
+}
+
+void CaptureBurst::start()
+{
+    if (m_started)
+        return;
+    m_started = true;
+    m_clock.start();
+    requestFrames();
+}
+
+void CaptureBurst::cancel()
+{
+    m_cancelled = true;
+    m_timer->stop();
+    finishIfDone();
+}
+
+void CaptureBurst::requestFrames()
+{
+    if (!m_context)
+        m_cancelled = true;
+
+    while (!m_cancelled && m_requested < m_count && m_inFlight < m_inFlightLimit) {
+        if (m_intervalMs > 0 && m_requested > 0) {
+            const qint64 wait = m_lastRequestMs + m_intervalMs - m_clock.elapsed();
+            if (wait > 0) {
+                m_timer->start(int(wait));
+                return;
+            }
+        }
+
+        const int index = ++m_requested;
+        ++m_inFlight;
+        m_lastRequestMs = m_clock.elapsed();
+        m_context->captureImage().then(this, [this, index](const QImage &image) {
+            handleImage(index, image);
+        });
+    }
+    finishIfDone();
+}
+
+void CaptureBurst::finishIfDone()
+{
+    if (m_done || !m_started || m_inFlight > 0)
+        return;
+    if (m_requested < m_count && !m_cancelled)
+        return;
+    m_done = true;
+    Q_EMIT finished();
+}
+
+void CaptureBurst::handleImage(int index, const QImage &image)
+{
+    if (image.isNull()) {
+        handleDone(index, false);
+        return;
+    }
+    Q_EMIT frameCaptured(index);
+
+    // Frees the slot only once written, the image still pins its shm buffer.
+    // Only frameCaptured() went out, nobody else has the pixels.
+    const QString path = numberedPath(m_path, index, m_count);
+    TreelandCaptureContext::saveImage(image,
+                                      path,
+                                      optionsFor(image),
+                                      TreelandCaptureContext::ImageAccess::Exclusive)
+        .then(this, [this, index](bool saved) {
+            handleDone(index, saved);
+        });
+}
+
+void CaptureBurst::handleDone(int index, bool saved)
+{
+    --m_inFlight;
+    const QString path = numberedPath(m_path, index, m_count);
+    if (saved) {
+        ++m_saved;
+        Q_EMIT frameSaved(index, path);
+    } else {
+        ++m_failed;
+        Q_EMIT frameFailed(index, path);
+    }
+    requestFrames();
+}
+
+CaptureFileOptions CaptureBurst::optionsFor(const QImage &image) const
+{
+    CaptureFileOptions options = m_fileOptions;
+    options.crop = QRect();
+    if (!m_crop.isEmpty() && m_logicalSize.width() > 0) {
+        const qreal scale = qreal(image.width()) / m_logicalSize.width();
+        options.crop = QRect(qRound(m_crop.x() * scale),
+                             qRound(m_crop.y() * scale),
+                             qRound(m_crop.width() * scale),
+                             qRound(m_crop.height() * scale));
+    }
+    return options;
+}
@@ -0,0 +1,93 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "capture.h"
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointer>
+#include <QRect>
+
+class QTimer;
+
+// A numbered series of screenshots, e.g. for UI regression captures.
+// Up to inFlight captures are outstanding at once, counted from the frame
+// request until the file is written, so while one image is being encoded on
+// the capture worker pool the compositor is already copying the next ones.
+// Requests are at least interval apart. When all slots are busy the next
+// request waits for a free one instead of catching up afterwards.
+class CaptureBurst : public QObject
+{
+    Q_OBJECT
+
+public:
+    CaptureBurst(TreelandCaptureContext *context, const QString &path, QObject *parent = nullptr);
+    ~CaptureBurst() override;
+
+    // path with "-<index>" in front of the suffix, the index starts at 1 and
+    // is zero padded to the width of count. A single shot keeps path as is.
+    static QString numberedPath(const QString &path, int index, int count);
+
+    void setCount(int count);
+    void setInterval(int intervalMs);
+    void setInFlight(int inFlight);
+    // Format, quality and watermark for every file. The crop is replaced by
+    // the one from setCrop().
+    void setFileOptions(const CaptureFileOptions &options);
+    // In logical pixels of a source of logicalSize, scaled to every image.
+    void setCrop(const QRect &crop, const QSize &logicalSize);
+
+    inline int count() const
+    {
+        return m_count;
+    }
+
+    inline int savedCount() const
+    {
+        return m_saved;
+    }
+
+    inline int failedCount() const
+    {
+        return m_failed;
+    }
+
+    void start();
+    // Requests no more frames, the ones in flight still finish.
+    void cancel();
+
+Q_SIGNALS:
+    void frameCaptured(int index);
+    void frameSaved(int index, const QString &path);
+    void frameFailed(int index, const QString &path);
+    void finished();
+
+private:
+    void requestFrames();
+    void finishIfDone();
+    void handleImage(int index, const QImage &image);
+    void handleDone(int index, bool saved);
+    CaptureFileOptions optionsFor(const QImage &image) const;
+
+    QPointer<TreelandCaptureContext> m_context;
+    QString m_path;
+    int m_count{ 1 };
+    int m_intervalMs{ 0 };
+    int m_inFlightLimit{ 2 };
+    CaptureFileOptions m_fileOptions;
+    QRect m_crop;
+    QSize m_logicalSize;
+
+    QTimer *m_timer{ nullptr };
+    QElapsedTimer m_clock;
+    qint64 m_lastRequestMs{ 0 };
+    int m_requested{ 0 };
+    int m_inFlight{ 0 };
+    int m_saved{ 0 };
+    int m_failed{ 0 };
+    bool m_started{ false };
+    bool m_cancelled{ false };
+    bool m_done{ false };
+};
@@ -0,0 +1,565 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "capturecli.h"
+#include "capture.h"
+#include "captureburst.h"
+#include "capturetrace.h"
+#include "framepublisher.h"
+#include "player.h"
+#include "rawrecorder.h"
+#include "recorder.h"
+#include "watermark.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSocketNotifier>
+#include <QStandardPaths>
+#include <QTimer>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// Long enough for a busy compositor, short enough for scripts to notice
+constexpr int BindTimeoutMs = 5000;
+
+uint64_t s_processStartNs = 0;
+int s_signalPipe[2] = { -1, -1 };
+
+void handleSignal(int signal)
+{
+    const char byte = char(signal);
+    [[maybe_unused]] const auto written = ::write(s_signalPipe[1], &byte, 1);
+}
+
+bool hasArgument(int argc, char *argv[], const char *name)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], name) == 0)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+bool CaptureCli::isRequested(int argc, char *argv[])
+{
+    return hasArgument(argc, argv, "--screenshot") || hasArgument(argc, argv, "--record");
+}
+
+bool CaptureCli::needsWidgets(int argc, char *argv[])
+{
+    return hasArgument(argc, argv, "--preview");
+}
+
+void CaptureCli::markProcessStart()
+{
+    s_processStartNs = CaptureMetrics::monotonicNs();
+}
+
+CaptureCli::CaptureCli(QObject *parent)
+    : QObject(parent)
+{
+    markPhase(ApplicationReady);
+}
+
+CaptureCli::~CaptureCli()
+{
+    delete m_player;
+    if (m_signalNotifier) {
+        ::close(s_signalPipe[0]);
+        ::close(s_signalPipe[1]);
+        s_signalPipe[0] = s_signalPipe[1] = -1;
+    }
+}
+
+bool CaptureCli::parse(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Headless treeland screen capture"));
+    const auto helpOption = parser.addHelpOption();
+    const QCommandLineOption screenshotOption(QStringLiteral("screenshot"),
+                                              QStringLiteral("Save a single frame."));
+    const QCommandLineOption recordOption(QStringLiteral("record"),
+                                          QStringLiteral("Record until --duration or a signal."));
+    const QCommandLineOption sourceOption(
+        QStringLiteral("source"),
+        QStringLiteral("Source types the compositor may pick, comma separated: output, "
+                       "window, region. Defaults to output."),
+        QStringLiteral("types"),
+        QStringLiteral("output"));
+    const QCommandLineOption regionOption(
+        QStringLiteral("region"),
+        QStringLiteral("Keep only X,Y,WxH of the source, in logical pixels."),
+        QStringLiteral("rect"));
+    const QCommandLineOption outputOption(
+        QStringLiteral("output"),
+        QStringLiteral("File to write, defaults to the pictures or movies directory."),
+        QStringLiteral("path"));
+    const QCommandLineOption formatOption(
+        QStringLiteral("format"),
+        QStringLiteral("Screenshot image format, defaults to the output's suffix. With "
+                       "--record, raw dumps the frames unconverted."),
+        QStringLiteral("format"));
+    const QCommandLineOption qualityOption(QStringLiteral("quality"),
+                                           QStringLiteral("Screenshot quality, 0-100."),
+                                           QStringLiteral("quality"));
+    const QCommandLineOption burstOption(
+        QStringLiteral("burst"),
+        QStringLiteral("Take this many screenshots, numbered <output>-N."),
+        QStringLiteral("count"));
+    const QCommandLineOption intervalOption(
+        QStringLiteral("interval"),
+        QStringLiteral("Milliseconds between burst screenshots, default 0."),
+        QStringLiteral("ms"));
+    const QCommandLineOption inFlightOption(
+        QStringLiteral("in-flight"),
+        QStringLiteral("Burst screenshots captured or encoded at once, default 2."),
+        QStringLiteral("count"));
+    const QCommandLineOption durationOption(QStringLiteral("duration"),
+                                            QStringLiteral("Recording length in seconds."),
+                                            QStringLiteral("seconds"));
+    const QCommandLineOption fpsOption(QStringLiteral("fps"),
+                                       QStringLiteral("Recording frame rate, default 60."),
+                                       QStringLiteral("fps"));
+    const QCommandLineOption cursorOption(QStringLiteral("cursor"),
+                                          QStringLiteral("Include the cursor."));
+    const QCommandLineOption previewOption(QStringLiteral("preview"),
+                                           QStringLiteral("Show a preview window while recording."));
+    const QCommandLineOption watermarkOption(QStringLiteral("watermark"),
+                                             QStringLiteral("Burn the watermark into the output."));
+    const QCommandLineOption publishOption(
+        QStringLiteral("publish"),
+        QStringLiteral("Also share the recorded frames with local processes through the frame "
+                       "ring called name."),
+        QStringLiteral("name"));
+    parser.addOptions({ screenshotOption,
+                        recordOption,
+                        sourceOption,
+                        regionOption,
+                        outputOption,
+                        formatOption,
+                        qualityOption,
+                        burstOption,
+                        intervalOption,
+                        inFlightOption,
+                        durationOption,
+                        fpsOption,
+                        cursorOption,
+                        previewOption,
+                        watermarkOption,
+                        publishOption });
+
+    auto fail = [](const QString &message) {
+        std::fprintf(stderr, "%s\n", qPrintable(message));
+        return false;
+    };
+
+    if (!parser.parse(arguments))
+        return fail(parser.errorText());
+    if (parser.isSet(helpOption))
+        parser.showHelp(0);
+    if (parser.isSet(screenshotOption) == parser.isSet(recordOption))
+        return fail(QStringLiteral("Pass exactly one of --screenshot and --record"));
+    m_mode = parser.isSet(recordOption) ? Mode::Record : Mode::Screenshot;
+
+    m_sourceHint = 0;
+    const auto sources = parser.value(sourceOption).split(QLatin1Char(','), Qt::SkipEmptyParts);
+    for (const auto &source : sources) {
+        if (source == QLatin1String("output"))
+            m_sourceHint |= TreelandCaptureContext::source_type_output;
+        else if (source == QLatin1String("window"))
+            m_sourceHint |= TreelandCaptureContext::source_type_window;
+        else if (source == QLatin1String("region"))
+            m_sourceHint |= TreelandCaptureContext::source_type_region;
+        else
+            return fail(QStringLiteral("Unknown source type: %1").arg(source));
+    }
+    if (!m_sourceHint)
+        return fail(QStringLiteral("No source type given"));
+
+    if (parser.isSet(regionOption)) {
+        static const QRegularExpression pattern(QStringLiteral("^(-?\\d+),(-?\\d+),(\\d+)x(\\d+)$"));
+        const auto match = pattern.match(parser.value(regionOption));
+        if (!match.hasMatch())
+            return fail(QStringLiteral("--region takes X,Y,WxH"));
+        m_crop = QRect(match.captured(1).toInt(),
+                       match.captured(2).toInt(),
+                       match.captured(3).toInt(),
+                       match.captured(4).toInt());
+        if (m_crop.isEmpty())
+            return fail(QStringLiteral("--region is empty"));
+    }
+
+    m_output = parser.value(outputOption);
+    m_format = parser.value(formatOption).toLatin1();
+    if (m_format.isEmpty() && !m_output.isEmpty() && QFileInfo(m_output).suffix().isEmpty())
+        m_format = QByteArrayLiteral("PNG");
+
+    bool ok = true;
+    if (parser.isSet(qualityOption)) {
+        m_quality = parser.value(qualityOption).toInt(&ok);
+        if (!ok || m_quality < 0 || m_quality > 100)
+            return fail(QStringLiteral("--quality takes 0-100"));
+    }
+    if (parser.isSet(burstOption)) {
+        m_burstCount = parser.value(burstOption).toInt(&ok);
+        if (!ok || m_burstCount <= 0)
+            return fail(QStringLiteral("--burst takes a positive number"));
+    }
+    if (parser.isSet(intervalOption)) {
+        m_intervalMs = parser.value(intervalOption).toInt(&ok);
+        if (!ok || m_intervalMs < 0)
+            return fail(QStringLiteral("--interval takes milliseconds"));
+    }
+    if (parser.isSet(inFlightOption)) {
+        m_inFlight = parser.value(inFlightOption).toInt(&ok);
+        if (!ok || m_inFlight <= 0)
+            return fail(QStringLiteral("--in-flight takes a positive number"));
+    }
+    if (parser.isSet(durationOption)) {
+        const double seconds = parser.value(durationOption).toDouble(&ok);
+        if (!ok || seconds <= 0)
+            return fail(QStringLiteral("--duration takes a positive number of seconds"));
+        m_durationMs = qMax(1, qRound(seconds * 1000));
+    }
+    if (parser.isSet(fpsOption)) {
+        m_fps = parser.value(fpsOption).toInt(&ok);
+        if (!ok || m_fps <= 0)
+            return fail(QStringLiteral("--fps takes a positive number"));
+    }
+
+    m_withCursor = parser.isSet(cursorOption);
+    m_preview = parser.isSet(previewOption);
+    m_watermarkEnabled = parser.isSet(watermarkOption);
+    m_publishName = parser.value(publishOption);
+    if (m_preview && m_mode != Mode::Record)
+        return fail(QStringLiteral("--preview only works with --record"));
+    if (parser.isSet(publishOption) && (m_mode != Mode::Record || m_publishName.isEmpty()
+                                        || m_publishName.contains(QLatin1Char('/'))))
+        return fail(QStringLiteral("--publish takes a name and only works with --record"));
+    if ((parser.isSet(burstOption) || parser.isSet(intervalOption) || parser.isSet(inFlightOption))
+        && m_mode != Mode::Screenshot)
+        return fail(QStringLiteral("--burst, --interval and --in-flight only work with --screenshot"));
+    return true;
+}
+
+void CaptureCli::start()
+{
+    installSignalHandlers();
+
+    auto manager = TreelandCaptureManager::instance();
+    if (manager->isActive()) {
+        selectSource();
+        return;
+    }
+
+    connect(manager, &TreelandCaptureManager::activeChanged, this, [this, manager] {
+        if (manager->isActive())
+            selectSource();
+    });
+    m_bindTimeout = new QTimer(this);
+    m_bindTimeout->setSingleShot(true);
+    connect(m_bindTimeout, &QTimer::timeout, this, [this] {
+        std::fprintf(stderr, "The compositor doesn't offer treeland_capture_manager_v1\n");
+        finish(1);
+    });
+    m_bindTimeout->start(BindTimeoutMs);
+}
+
+void CaptureCli::markPhase(Phase phase)
+{
+    if (!m_phaseNs[phase])
+        m_phaseNs[phase] = qint64(CaptureMetrics::monotonicNs() - s_processStartNs);
+}
+
+void CaptureCli::reportTiming() const
+{
+    static const char *const names[PhaseCount] = {
+        "application", "bind", "source", "first pixel", "finished",
+    };
+    QStringList parts;
+    for (int phase = 0; phase < PhaseCount; ++phase) {
+        if (m_phaseNs[phase]) {
+            parts.append(QStringLiteral("%1 %2 ms")
+                             .arg(QLatin1String(names[phase]))
+                             .arg(m_phaseNs[phase] / 1e6, 0, 'f', 1));
+        }
+    }
+    // Cumulative since main(), so "first pixel" is the time to first pixel
+    std::fprintf(stderr, "capture timing: %s\n", qPrintable(parts.join(QStringLiteral(", "))));
+}
+
+void CaptureCli::selectSource()
+{
+    if (m_context)
+        return;
+    if (m_bindTimeout)
+        m_bindTimeout->stop();
+    markPhase(ManagerBound);
+
+    m_context = TreelandCaptureManager::instance()->ensureContext();
+    if (!m_context) {
+        finish(1);
+        return;
+    }
+    connect(m_context,
+            &TreelandCaptureContext::sourceReady,
+            this,
+            &CaptureCli::handleSourceReady,
+            Qt::SingleShotConnection);
+    connect(m_context, &TreelandCaptureContext::sourceFailed, this, [this](uint32_t reason) {
+        std::fprintf(stderr, "Source selection failed, reason %u\n", reason);
+        finish(1);
+    });
+    // No mask surface, there is no window to hide
+    m_context->selectSource(m_sourceHint, false, m_withCursor, nullptr);
+}
+
+void CaptureCli::handleSourceReady(const QRect &region)
+{
+    markPhase(SourceSelected);
+    m_region = region;
+
+    const QRect bounds(QPoint(0, 0), region.size());
+    if (!m_crop.isEmpty() && !m_crop.intersects(bounds)) {
+        std::fprintf(stderr, "--region is outside of the %dx%d source\n", region.width(), region.height());
+        finish(1);
+        return;
+    }
+    if (m_watermarkEnabled) {
+        m_watermark = std::make_shared<Watermark>(QImage(QStringLiteral(":/watermark.png")));
+        m_watermark->setLogicalSize(m_crop.isEmpty() ? region.size() : (m_crop & bounds).size());
+        m_watermark->setEnabled(true);
+    }
+    if (m_output.isEmpty())
+        m_output = defaultOutputPath();
+
+    if (m_mode == Mode::Screenshot)
+        takeScreenshots();
+    else
+        startRecording();
+}
+
+void CaptureCli::takeScreenshots()
+{
+    CaptureFileOptions options;
+    options.format = m_format;
+    options.quality = m_quality;
+    options.watermark = m_watermark;
+
+    m_burst = new CaptureBurst(m_context, m_output, this);
+    m_burst->setCount(m_burstCount);
+    m_burst->setInterval(m_intervalMs);
+    m_burst->setInFlight(m_inFlight);
+    m_burst->setFileOptions(options);
+    m_burst->setCrop(m_crop, m_region.size());
+    connect(m_burst, &CaptureBurst::frameCaptured, this, [this] {
+        markPhase(FirstPixel);
+    });
+    connect(m_burst, &CaptureBurst::frameSaved, this, [](int, const QString &path) {
+        std::printf("%s\n", qPrintable(path));
+        std::fflush(stdout);
+    });
+    connect(m_burst, &CaptureBurst::frameFailed, this, [](int, const QString &path) {
+        std::fprintf(stderr, "Failed to capture or save %s\n", qPrintable(path));
+    });
+    connect(m_burst, &CaptureBurst::finished, this, [this] {
+        if (m_interrupted)
+            finish(130);
+        else
+            finish(m_burst->failedCount() > 0 ? 1 : 0);
+    });
+    m_burst->start();
+}
+
+void CaptureCli::startRecording()
+{
+    auto session = m_context->ensureSession();
+    if (!m_publishName.isEmpty()) {
+        m_publisher = new FramePublisher(this);
+        connect(m_publisher, &FramePublisher::error, this, [](const QString &message) {
+            std::fprintf(stderr, "Publishing failed: %s\n", qPrintable(message));
+        });
+        if (!m_publisher->start(session, m_publishName)) {
+            finish(1);
+            return;
+        }
+    }
+
+    const bool raw = m_format.compare("raw", Qt::CaseInsensitive) == 0
+        || QFileInfo(m_output).suffix() == RawRecorder::fileSuffix();
+    if (raw) {
+        if (!startRawRecording(session)) {
+            finish(1);
+            return;
+        }
+        session->start();
+        return;
+    }
+
+    m_recorder = new Recorder(this);
+    m_recorder->setFrameRate(m_fps);
+    m_recorder->setCrop(m_crop, m_region.size());
+    m_recorder->setWatermark(m_watermark);
+    connect(m_recorder, &Recorder::error, this, [this](const QString &message) {
+        std::fprintf(stderr, "Recording failed: %s\n", qPrintable(message));
+        m_recorder->stop();
+        finish(1);
+    });
+    connect(session,
+            &TreelandCaptureSession::ready,
+            this,
+            &CaptureCli::handleFirstSessionFrame,
+            Qt::SingleShotConnection);
+    connect(session, &TreelandCaptureSession::destroyed, this, &CaptureCli::stopRecording);
+
+    if (QFileInfo(m_output).suffix().isEmpty())
+        m_output += QLatin1Char('.') + m_recorder->fileSuffix();
+    if (!m_recorder->start(session, m_output)) {
+        finish(1);
+        return;
+    }
+    session->start();
+}
+
+bool CaptureCli::startRawRecording(TreelandCaptureSession *session)
+{
+    m_rawRecorder = new RawRecorder(this);
+    connect(m_rawRecorder, &RawRecorder::error, this, [this](const QString &message) {
+        std::fprintf(stderr, "Recording failed: %s\n", qPrintable(message));
+        m_rawRecorder->stop();
+        finish(1);
+    });
+    connect(session,
+            &TreelandCaptureSession::ready,
+            this,
+            &CaptureCli::handleFirstSessionFrame,
+            Qt::SingleShotConnection);
+    connect(session, &TreelandCaptureSession::destroyed, this, &CaptureCli::stopRecording);
+
+    if (QFileInfo(m_output).suffix().isEmpty())
+        m_output += QLatin1Char('.') + RawRecorder::fileSuffix();
+    return m_rawRecorder->start(session, m_output);
+}
+
+void CaptureCli::handleFirstSessionFrame()
+{
+    markPhase(FirstPixel);
+    if (m_durationMs > 0)
+        QTimer::singleShot(m_durationMs, this, &CaptureCli::stopRecording);
+
+    if (m_preview && !m_player) {
+        m_player = new Player();
+        m_player->setCaptureContext(m_context);
+        m_player->show();
+    }
+}
+
+void CaptureCli::stopRecording()
+{
+    if (m_finished)
+        return;
+    if (m_recorder)
+        m_recorder->stop();
+    if (m_rawRecorder)
+        m_rawRecorder->stop();
+    if (m_publisher)
+        m_publisher->stop();
+    // Unless stopping failed and that was reported already
+    if (m_finished)
+        return;
+    std::printf("%s\n", qPrintable(m_output));
+    finish(0);
+}
+
+void CaptureCli::finish(int exitCode)
+{
+    if (m_finished)
+        return;
+    m_finished = true;
+    markPhase(Finished);
+    reportTiming();
+    // Also fine when called before the event loop runs
+    QTimer::singleShot(0, qApp, [exitCode] {
+        QCoreApplication::exit(exitCode);
+    });
+}
+
+void CaptureCli::installSignalHandlers()
+{
+    if (::pipe2(s_signalPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        qWarning() << "Failed to create the signal pipe:" << strerror(errno);
+        return;
+    }
+    m_signalNotifier = new QSocketNotifier(s_signalPipe[0], QSocketNotifier::Read, this);
+    connect(m_signalNotifier, &QSocketNotifier::activated, this, [this] {
+        char byte;
+        bool interrupted = false;
+        while (::read(s_signalPipe[0], &byte, 1) > 0) {
+            if (byte == SIGUSR1)
+                dumpTrace();
+            else
+                interrupted = true;
+        }
+        if (!interrupted)
+            return;
+        // A recording ends cleanly, anything else is just aborted
+        if (m_mode == Mode::Record
+            && ((m_recorder && m_recorder->recording())
+                || (m_rawRecorder && m_rawRecorder->recording()))) {
+            stopRecording();
+        } else if (m_burst && !m_interrupted) {
+            // Shots already requested are still written
+            m_interrupted = true;
+            m_burst->cancel();
+        } else {
+            finish(130);
+        }
+    });
+
+    struct sigaction action = {};
+    action.sa_handler = handleSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    // Writes the trace so far without stopping
+    if (CaptureTracer::instance()->isEnabled())
+        sigaction(SIGUSR1, &action, nullptr);
+}
+
+void CaptureCli::dumpTrace()
+{
+    const QString path = qEnvironmentVariable("TEST_CAPTURE_TRACE_FILE");
+    if (CaptureTracer::instance()->dumpToFile(path.toStdString()))
+        qInfo() << "Wrote the capture trace to" << path;
+    else
+        qWarning() << "Failed to write the capture trace to" << path;
+}
+
+QString CaptureCli::defaultOutputPath() const
+{
+    const bool record = m_mode == Mode::Record;
+    const QString directory = QStandardPaths::writableLocation(
+        record ? QStandardPaths::MoviesLocation : QStandardPaths::PicturesLocation);
+    QDir().mkpath(directory);
+    const QString name = (record ? QStringLiteral("portal recording - ")
+                                 : QStringLiteral("portal screenshot - "))
+        + QDateTime::currentDateTime().toString()
+        + (record ? QString() : QStringLiteral(".png"));
+    return QDir(directory).absoluteFilePath(name);
+}
@@ -0,0 +1,113 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <QObject>
+#include <QRect>
+#include <QString>
+
+#include <array>
+#include <memory>
+
+class CaptureBurst;
+class FramePublisher;
+class Player;
+class QSocketNotifier;
+class QTimer;
+class RawRecorder;
+class Recorder;
+class TreelandCaptureContext;
+class TreelandCaptureSession;
+class Watermark;
+
+// Headless capture from the command line, e.g. for scripts:
+//
+//   test-capture --screenshot --source output --output shot.png
+//   test-capture --screenshot --burst 100 --interval 50 --output ui.png
+//   test-capture --record --region 0,0,1280x720 --duration 10
+//   test-capture --record --format raw --output frames.tcraw
+//   test-capture --record --publish ocr
+//
+// Runs on a QGuiApplication without any window. Only --preview needs
+// widgets and GL, and those are created when the first frame arrives.
+// How long each startup phase took is reported on stderr.
+class CaptureCli : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Mode {
+        Screenshot,
+        Record,
+    };
+
+    // Both only look at argv, they run before any application object exists.
+    static bool isRequested(int argc, char *argv[]);
+    static bool needsWidgets(int argc, char *argv[]);
+    // Origin of the reported timings, call it first thing in main().
+    static void markProcessStart();
+
+    explicit CaptureCli(QObject *parent = nullptr);
+    ~CaptureCli() override;
+
+    // Prints the problem and returns false on invalid arguments.
+    bool parse(const QStringList &arguments);
+    // Starts capturing once the compositor's capture manager is bound, the
+    // application quits with the result when done.
+    void start();
+
+private:
+    enum Phase {
+        ApplicationReady,
+        ManagerBound,
+        SourceSelected,
+        FirstPixel,
+        Finished,
+        PhaseCount,
+    };
+
+    void markPhase(Phase phase);
+    void reportTiming() const;
+    void selectSource();
+    void handleSourceReady(const QRect &region);
+    void takeScreenshots();
+    void startRecording();
+    bool startRawRecording(TreelandCaptureSession *session);
+    void handleFirstSessionFrame();
+    void stopRecording();
+    void finish(int exitCode);
+    void installSignalHandlers();
+    void dumpTrace();
+    QString defaultOutputPath() const;
+
+    Mode m_mode{ Mode::Screenshot };
+    uint32_t m_sourceHint{ 0 };
+    QRect m_crop;
+    QString m_output;
+    QByteArray m_format;
+    int m_quality{ -1 };
+    int m_burstCount{ 1 };
+    int m_intervalMs{ 0 };
+    int m_inFlight{ 2 };
+    int m_durationMs{ 0 };
+    int m_fps{ 60 };
+    bool m_withCursor{ false };
+    bool m_preview{ false };
+    bool m_watermarkEnabled{ false };
+    QString m_publishName;
+
+    TreelandCaptureContext *m_context{ nullptr };
+    QRect m_region;
+    std::shared_ptr<Watermark> m_watermark;
+    CaptureBurst *m_burst{ nullptr };
+    Recorder *m_recorder{ nullptr };
+    RawRecorder *m_rawRecorder{ nullptr };
+    FramePublisher *m_publisher{ nullptr };
+    Player *m_player{ nullptr };
+    QTimer *m_bindTimeout{ nullptr };
+    QSocketNotifier *m_signalNotifier{ nullptr };
+    std::array<qint64, PhaseCount> m_phaseNs{};
+    bool m_interrupted{ false };
+    bool m_finished{ false };
+};
@@ -0,0 +1,205 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "captureeventthread.h"
+
+#include <QDebug>
+
+#include <wayland-client-core.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+CaptureEventThread::~CaptureEventThread()
+{
+    stop();
+}
+
+bool CaptureEventThread::start(::wl_display *display)
+{
+    if (m_thread.joinable())
+        return isRunning();
+    if (!display)
+        return false;
+
+    m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wakeFd < 0) {
+        qWarning() << "eventfd failed:" << strerror(errno);
+        return false;
+    }
+    m_queue = wl_display_create_queue(display);
+    if (!m_queue) {
+        ::close(m_wakeFd);
+        m_wakeFd = -1;
+        return false;
+    }
+
+    m_display = display;
+    m_running = true;
+    m_thread = std::thread(&CaptureEventThread::run, this);
+    return true;
+}
+
+void CaptureEventThread::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    m_running = false;
+    const uint64_t wake = 1;
+    if (::write(m_wakeFd, &wake, sizeof(wake)) < 0)
+        qWarning() << "Failed to wake the capture event thread:" << strerror(errno);
+    m_thread.join();
+
+    // Events still queued for proxies that are gone are dropped with it
+    wl_event_queue_destroy(m_queue);
+    m_queue = nullptr;
+    ::close(m_wakeFd);
+    m_wakeFd = -1;
+    m_display = nullptr;
+    m_afterDispatch.clear();
+    m_outsideDispatch.clear();
+}
+
+void CaptureEventThread::setFailureHandler(QObject *context, std::function<void()> handler)
+{
+    m_failureContext = context;
+    m_failureHandler = std::move(handler);
+}
+
+bool CaptureEventThread::isCurrentThread() const
+{
+    return m_thread.get_id() == std::this_thread::get_id();
+}
+
+void CaptureEventThread::callAfterDispatch(QObject *context, std::function<void()> function)
+{
+    if (!isCurrentThread()) {
+        QMetaObject::invokeMethod(context, std::move(function), Qt::QueuedConnection);
+        return;
+    }
+    m_afterDispatch.emplace_back(context, std::move(function));
+}
+
+void CaptureEventThread::callOutsideDispatch(QRecursiveMutex *lock, std::function<void()> function)
+{
+    // Dispatched by Qt on its own thread, nothing to get out of
+    if (!isCurrentThread()) {
+        QMutexLocker locker(lock);
+        function();
+        return;
+    }
+    m_outsideDispatch.emplace_back(lock, std::move(function));
+}
+
+void CaptureEventThread::cancelOutsideDispatch(QRecursiveMutex *lock)
+{
+    m_outsideDispatch.erase(std::remove_if(m_outsideDispatch.begin(),
+                                           m_outsideDispatch.end(),
+                                           [lock](const auto &call) {
+                                               return call.first == lock;
+                                           }),
+                            m_outsideDispatch.end());
+}
+
+void CaptureEventThread::runOutsideDispatch()
+{
+    for (;;) {
+        QMutexLocker locker(&m_mutex);
+        if (m_outsideDispatch.empty())
+            return;
+        auto call = std::move(m_outsideDispatch.front());
+        m_outsideDispatch.erase(m_outsideDispatch.begin());
+        // Taken before mutex() is released, whoever cancels under mutex()
+        // afterwards waits for the call on lock
+        QMutexLocker callLocker(call.first);
+        locker.unlock();
+        call.second();
+    }
+}
+
+bool CaptureEventThread::dispatchPending()
+{
+    if (wl_display_dispatch_queue_pending(m_display, m_queue) < 0)
+        return false;
+    // Calls may queue further calls
+    while (!m_afterDispatch.empty()) {
+        auto calls = std::move(m_afterDispatch);
+        m_afterDispatch.clear();
+        for (auto &call : calls) {
+            if (call.first)
+                call.second();
+        }
+    }
+    return true;
+}
+
+void CaptureEventThread::fail(const char *what, int error)
+{
+    qWarning() << "Capture event thread stopped," << what << "failed:" << strerror(error);
+    m_running = false;
+    if (m_failureContext && m_failureHandler)
+        QMetaObject::invokeMethod(m_failureContext.data(), m_failureHandler, Qt::QueuedConnection);
+}
+
+void CaptureEventThread::run()
+{
+    pthread_setname_np(pthread_self(), "capture-events");
+
+    pollfd fds[2] = {
+        { wl_display_get_fd(m_display), POLLIN, 0 },
+        { m_wakeFd, POLLIN, 0 },
+    };
+    while (m_running) {
+        // Calls outside dispatch run before the read is prepared, a prepared
+        // read holds up the other threads reading the display
+        for (;;) {
+            {
+                QMutexLocker locker(&m_mutex);
+                if (wl_display_prepare_read_queue(m_display, m_queue) == 0)
+                    break;
+                if (!dispatchPending())
+                    return fail("dispatch", errno);
+            }
+            runOutsideDispatch();
+        }
+        // Requests sent by event handlers, the GUI thread flushes its own.
+        // On EAGAIN the socket is full and the next flush picks them up.
+        if (wl_display_flush(m_display) < 0 && errno != EAGAIN) {
+            const int error = errno;
+            wl_display_cancel_read(m_display);
+            return fail("flush", error);
+        }
+
+        if (poll(fds, 2, -1) < 0) {
+            const int error = errno;
+            wl_display_cancel_read(m_display);
+            if (error == EINTR)
+                continue;
+            return fail("poll", error);
+        }
+        if (fds[0].revents & POLLIN) {
+            // Also reads events of the other queues, their threads are
+            // woken by libwayland
+            if (wl_display_read_events(m_display) < 0)
+                return fail("reading events", errno);
+        } else {
+            wl_display_cancel_read(m_display);
+            if (fds[0].revents & (POLLERR | POLLHUP))
+                return fail("polling the display", ECONNRESET);
+        }
+
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!dispatchPending())
+                return fail("dispatch", errno);
+        }
+        runOutsideDispatch();
+    }
+}
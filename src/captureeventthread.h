@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <QMutex>
+#include <QPointer>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+struct wl_display;
+struct wl_event_queue;
+
+// Reads and dispatches a private wl_event_queue on its own thread, so capture
+// events never wait for the GUI thread. Proxies created from a proxy on the
+// queue land on it too.
+//
+// The thread holds mutex() while it dispatches. Other threads take it while
+// they create or destroy proxies on the queue, so no event reaches a half
+// constructed or deleted wrapper. Handlers keep it short, anything slow is
+// handed to callOutsideDispatch() so those threads don't wait for it.
+class CaptureEventThread
+{
+public:
+    CaptureEventThread() = default;
+    ~CaptureEventThread();
+
+    CaptureEventThread(const CaptureEventThread &) = delete;
+    CaptureEventThread &operator=(const CaptureEventThread &) = delete;
+
+    bool start(::wl_display *display);
+    // Every proxy must be off the queue by now, it is destroyed. Also needed
+    // after the thread stopped on an error.
+    void stop();
+
+    // False once the thread stopped on an error, nothing on the queue is
+    // dispatched any more.
+    inline bool isRunning() const
+    {
+        return m_running;
+    }
+
+    // Queued to context when the thread stops on a display or poll error,
+    // not when stop() ends it.
+    void setFailureHandler(QObject *context, std::function<void()> handler);
+
+    inline ::wl_event_queue *queue() const
+    {
+        return m_queue;
+    }
+
+    inline QRecursiveMutex *mutex()
+    {
+        return &m_mutex;
+    }
+
+    bool isCurrentThread() const;
+
+    // Runs function on the event thread right after the events read so far
+    // are dispatched, still under mutex(), unless context is gone by then.
+    // Off the event thread it is queued to context instead.
+    void callAfterDispatch(QObject *context, std::function<void()> function);
+    // Runs function on the event thread once the events read so far are
+    // dispatched and mutex() is released, holding lock instead. Called
+    // under mutex(). The owner of lock cancels its calls under mutex() and
+    // then takes lock to wait for one already running. function must not
+    // take mutex(), that is ordered before lock.
+    void callOutsideDispatch(QRecursiveMutex *lock, std::function<void()> function);
+    void cancelOutsideDispatch(QRecursiveMutex *lock);
+
+private:
+    void run();
+    bool dispatchPending();
+    void runOutsideDispatch();
+    void fail(const char *what, int error);
+
+    ::wl_display *m_display{ nullptr };
+    ::wl_event_queue *m_queue{ nullptr };
+    int m_wakeFd{ -1 };
+    std::thread m_thread;
+    std::atomic_bool m_running{ false };
+    QRecursiveMutex m_mutex;
+    std::vector<std::pair<QPointer<QObject>, std::function<void()>>> m_afterDispatch;
+    std::vector<std::pair<QRecursiveMutex *, std::function<void()>>> m_outsideDispatch;
+    QPointer<QObject> m_failureContext;
+    std::function<void()> m_failureHandler;
+};
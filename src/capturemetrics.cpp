@@ -0,0 +1,257 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "capturemetrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <time.h>
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (auto &bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketIndex(uint64_t value)
+{
+    if (value < SubBuckets)
+        return int(value);
+    const int msb = 63 - __builtin_clzll(value);
+    const int shift = msb - SubBucketBits;
+    const int sub = int(value >> shift) - SubBuckets;
+    return (msb - SubBucketBits + 1) * SubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < SubBuckets)
+        return uint64_t(index);
+    const int msb = index / SubBuckets + SubBucketBits - 1;
+    const int sub = index % SubBuckets;
+    const int shift = msb - SubBucketBits;
+    const uint64_t next = uint64_t(SubBuckets + sub + 1);
+    if (shift + 64 - __builtin_clzll(next) > 64)
+        return UINT64_MAX;
+    return (next << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+    m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current = m_min.load(std::memory_order_relaxed);
+    while (value < current
+           && !m_min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+    current = m_max.load(std::memory_order_relaxed);
+    while (value > current
+           && !m_max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot snapshot;
+    for (int i = 0; i < BucketCount; ++i)
+        snapshot.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    snapshot.count = m_count.load(std::memory_order_relaxed);
+    snapshot.sum = m_sum.load(std::memory_order_relaxed);
+    snapshot.max = m_max.load(std::memory_order_relaxed);
+    const uint64_t min = m_min.load(std::memory_order_relaxed);
+    snapshot.min = snapshot.count ? min : 0;
+    return snapshot;
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_min.store(UINT64_MAX, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::Snapshot::mean() const
+{
+    return count ? double(sum) / double(count) : 0.0;
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double percent) const
+{
+    if (count == 0)
+        return 0;
+    const auto rank = uint64_t(std::ceil(std::clamp(percent, 0.0, 100.0) / 100.0 * double(count)));
+    uint64_t seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += buckets[i];
+        if (seen >= std::max<uint64_t>(rank, 1))
+            return std::clamp(bucketUpperBound(i), min, max);
+    }
+    return max;
+}
+
+CaptureMetrics::CaptureMetrics(std::string name)
+    : m_name(std::move(name))
+{
+    for (auto &counter : m_counters)
+        counter.store(0, std::memory_order_relaxed);
+}
+
+void CaptureMetrics::frameReceived(uint64_t receiveNs, uint64_t compositorNs)
+{
+    add(FramesReceived);
+    if (compositorNs && receiveNs >= compositorNs)
+        record(CompositorToReceive, receiveNs - compositorNs);
+
+    if (m_lastReceiveNs && receiveNs >= m_lastReceiveNs) {
+        const uint64_t interval = receiveNs - m_lastReceiveNs;
+        record(FrameInterval, interval);
+        if (m_lastIntervalNs) {
+            record(FrameJitter,
+                   interval > m_lastIntervalNs ? interval - m_lastIntervalNs
+                                               : m_lastIntervalNs - interval);
+        }
+        m_lastIntervalNs = interval;
+    }
+    m_lastReceiveNs = receiveNs;
+}
+
+void CaptureMetrics::reset()
+{
+    for (auto &counter : m_counters)
+        counter.store(0, std::memory_order_relaxed);
+    for (auto &histogram : m_histograms)
+        histogram.reset();
+    m_lastReceiveNs = 0;
+    m_lastIntervalNs = 0;
+}
+
+const char *CaptureMetrics::counterName(Counter counter)
+{
+    switch (counter) {
+    case FramesReceived:
+        return "framesReceived";
+    case FramesRendered:
+        return "framesRendered";
+    case FramesDropped:
+        return "framesDropped";
+    case BytesMapped:
+        return "bytesMapped";
+    case BytesCopied:
+        return "bytesCopied";
+    case TilesHashed:
+        return "tilesHashed";
+    case TilesDirty:
+        return "tilesDirty";
+    case CounterCount:
+        break;
+    }
+    return "unknown";
+}
+
+const char *CaptureMetrics::histogramName(Histogram histogram)
+{
+    switch (histogram) {
+    case CompositorToReceive:
+        return "compositorToReceiveNs";
+    case ReceiveToPresent:
+        return "receiveToPresentNs";
+    case FrameInterval:
+        return "frameIntervalNs";
+    case FrameJitter:
+        return "frameJitterNs";
+    case HistogramCount:
+        break;
+    }
+    return "unknown";
+}
+
+uint64_t CaptureMetrics::monotonicNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000ull + uint64_t(now.tv_nsec);
+}
+
+std::string CaptureMetrics::toJson() const
+{
+    std::string json = "{\"name\":\"" + m_name + "\",\"counters\":{";
+    for (int i = 0; i < CounterCount; ++i) {
+        if (i)
+            json += ',';
+        json += '"';
+        json += counterName(Counter(i));
+        json += "\":" + std::to_string(counter(Counter(i)));
+    }
+    json += "},\"histograms\":{";
+    for (int i = 0; i < HistogramCount; ++i) {
+        const auto snapshot = histogram(Histogram(i));
+        char buffer[320];
+        std::snprintf(buffer,
+                      sizeof(buffer),
+                      "%s\"%s\":{\"count\":%llu,\"min\":%llu,\"mean\":%.0f,\"p50\":%llu,"
+                      "\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                      i ? "," : "",
+                      histogramName(Histogram(i)),
+                      static_cast<unsigned long long>(snapshot.count),
+                      static_cast<unsigned long long>(snapshot.min),
+                      snapshot.mean(),
+                      static_cast<unsigned long long>(snapshot.percentile(50)),
+                      static_cast<unsigned long long>(snapshot.percentile(90)),
+                      static_cast<unsigned long long>(snapshot.percentile(99)),
+                      static_cast<unsigned long long>(snapshot.percentile(99.9)),
+                      static_cast<unsigned long long>(snapshot.max));
+        json += buffer;
+    }
+    json += "}}";
+    return json;
+}
+
+CaptureMetricsRegistry *CaptureMetricsRegistry::instance()
+{
+    static CaptureMetricsRegistry registry;
+    return &registry;
+}
+
+std::shared_ptr<CaptureMetrics> CaptureMetricsRegistry::create(const std::string &prefix)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto metrics = std::make_shared<CaptureMetrics>(prefix + '-' + std::to_string(m_nextId++));
+    m_metrics.push_back(metrics);
+    return metrics;
+}
+
+std::vector<std::shared_ptr<CaptureMetrics>> CaptureMetricsRegistry::metrics() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_metrics;
+}
+
+std::string CaptureMetricsRegistry::toJson() const
+{
+    std::string json = "[";
+    const auto all = metrics();
+    for (size_t i = 0; i < all.size(); ++i) {
+        if (i)
+            json += ",\n";
+        json += all[i]->toJson();
+    }
+    json += "]\n";
+    return json;
+}
+
+bool CaptureMetricsRegistry::dumpToFile(const std::string &path) const
+{
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    const std::string json = toJson();
+    const bool written = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+    return std::fclose(file) == 0 && written;
+}
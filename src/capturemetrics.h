@@ -0,0 +1,143 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Log-linear histogram of nanosecond values, 8 sub-buckets per power of two
+// (worst case 12.5% error). Recording is wait-free and safe from any thread.
+class LatencyHistogram
+{
+public:
+    static constexpr int SubBucketBits = 3;
+    static constexpr int SubBuckets = 1 << SubBucketBits;
+    static constexpr int BucketCount = (64 - SubBucketBits + 1) * SubBuckets;
+
+    struct Snapshot
+    {
+        uint64_t count{ 0 };
+        uint64_t sum{ 0 };
+        uint64_t min{ 0 };
+        uint64_t max{ 0 };
+        std::array<uint64_t, BucketCount> buckets{};
+
+        double mean() const;
+        uint64_t percentile(double percent) const;
+    };
+
+    LatencyHistogram();
+
+    void record(uint64_t value);
+    Snapshot snapshot() const;
+    void reset();
+
+    static int bucketIndex(uint64_t value);
+    static uint64_t bucketUpperBound(int index);
+
+private:
+    std::array<std::atomic<uint64_t>, BucketCount> m_buckets;
+    std::atomic<uint64_t> m_count{ 0 };
+    std::atomic<uint64_t> m_sum{ 0 };
+    std::atomic<uint64_t> m_min{ UINT64_MAX };
+    std::atomic<uint64_t> m_max{ 0 };
+};
+
+class CaptureMetrics
+{
+public:
+    enum Counter {
+        FramesReceived,
+        FramesRendered,
+        FramesDropped,
+        BytesMapped,
+        BytesCopied,
+        TilesHashed,
+        TilesDirty,
+        CounterCount,
+    };
+
+    enum Histogram {
+        // Compositor ready timestamp to the client seeing the ready event
+        CompositorToReceive,
+        // Ready event to the frame being on screen in the preview
+        ReceiveToPresent,
+        // Time between consecutive ready events
+        FrameInterval,
+        // Absolute change of FrameInterval from one frame to the next
+        FrameJitter,
+        HistogramCount,
+    };
+
+    explicit CaptureMetrics(std::string name);
+
+    inline const std::string &name() const
+    {
+        return m_name;
+    }
+
+    inline void add(Counter counter, uint64_t value = 1)
+    {
+        m_counters[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    inline uint64_t counter(Counter counter) const
+    {
+        return m_counters[counter].load(std::memory_order_relaxed);
+    }
+
+    inline void record(Histogram histogram, uint64_t value)
+    {
+        m_histograms[histogram].record(value);
+    }
+
+    inline LatencyHistogram::Snapshot histogram(Histogram histogram) const
+    {
+        return m_histograms[histogram].snapshot();
+    }
+
+    // Feeds FrameInterval and FrameJitter, called once per received frame
+    // from the thread dispatching the session.
+    void frameReceived(uint64_t receiveNs, uint64_t compositorNs);
+
+    void reset();
+    std::string toJson() const;
+
+    static const char *counterName(Counter counter);
+    static const char *histogramName(Histogram histogram);
+    static uint64_t monotonicNs();
+
+private:
+    std::string m_name;
+    std::array<std::atomic<uint64_t>, CounterCount> m_counters;
+    std::array<LatencyHistogram, HistogramCount> m_histograms;
+    uint64_t m_lastReceiveNs{ 0 };
+    uint64_t m_lastIntervalNs{ 0 };
+};
+
+// Keeps the metrics of every session, including finished ones, so they can
+// be queried at runtime and written out when the process exits.
+class CaptureMetricsRegistry
+{
+public:
+    static CaptureMetricsRegistry *instance();
+
+    std::shared_ptr<CaptureMetrics> create(const std::string &prefix);
+    std::vector<std::shared_ptr<CaptureMetrics>> metrics() const;
+
+    std::string toJson() const;
+    bool dumpToFile(const std::string &path) const;
+
+private:
+    CaptureMetricsRegistry() = default;
+
+    mutable std::mutex m_mutex;
+    std::vector<std::shared_ptr<CaptureMetrics>> m_metrics;
+    uint64_t m_nextId{ 0 };
+};
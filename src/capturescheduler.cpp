@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "capturescheduler.h"
+
+#include <QThread>
+#include <QtGlobal>
+
+namespace {
+
+constexpr size_t DefaultBufferBudget = size_t(1) << 30;
+
+} // namespace
+
+CaptureScheduler *CaptureScheduler::instance()
+{
+    static CaptureScheduler scheduler;
+    return &scheduler;
+}
+
+CaptureScheduler::CaptureScheduler()
+{
+    m_workerPool.setMaxThreadCount(QThread::idealThreadCount());
+    m_workerPool.setObjectName(QStringLiteral("CaptureWorkers"));
+
+    bool ok = false;
+    const qulonglong megabytes = qEnvironmentVariable("TEST_CAPTURE_BUFFER_BUDGET_MB").toULongLong(&ok);
+    m_budget = ok ? size_t(megabytes) << 20 : DefaultBufferBudget;
+}
+
+void CaptureScheduler::setBufferBudget(size_t bytes)
+{
+    m_budget.store(bytes, std::memory_order_relaxed);
+}
+
+bool CaptureScheduler::reserve(size_t size)
+{
+    const size_t budget = bufferBudget();
+    size_t usage = m_usage.load(std::memory_order_relaxed);
+    do {
+        if (budget && usage + size > budget)
+            return false;
+    } while (!m_usage.compare_exchange_weak(usage, usage + size, std::memory_order_relaxed));
+    return true;
+}
+
+void CaptureScheduler::release(size_t size)
+{
+    m_usage.fetch_sub(size, std::memory_order_relaxed);
+}
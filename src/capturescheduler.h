@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <QThreadPool>
+
+#include <atomic>
+#include <cstddef>
+
+// Process wide resources shared by every capture context. Image encoding
+// from all contexts runs on one worker pool sized to the machine, and the
+// memory captured frames hold (pooled shm buffers, recorder frame pools) is
+// accounted against one budget, so adding streams spreads their work over
+// the cores without letting their buffers grow without bound.
+class CaptureScheduler
+{
+public:
+    static CaptureScheduler *instance();
+
+    inline QThreadPool *workerPool()
+    {
+        return &m_workerPool;
+    }
+
+    // 0 means unlimited. Defaults to TEST_CAPTURE_BUFFER_BUDGET_MB or 1 GiB.
+    void setBufferBudget(size_t bytes);
+
+    inline size_t bufferBudget() const
+    {
+        return m_budget.load(std::memory_order_relaxed);
+    }
+
+    inline size_t bufferUsage() const
+    {
+        return m_usage.load(std::memory_order_relaxed);
+    }
+
+    // Accounts size bytes of new buffers, false if that would exceed the
+    // budget. Every successful reserve() needs a matching release().
+    bool reserve(size_t size);
+    void release(size_t size);
+
+private:
+    CaptureScheduler();
+
+    QThreadPool m_workerPool;
+    std::atomic<size_t> m_budget{ 0 };
+    std::atomic<size_t> m_usage{ 0 };
+};
@@ -0,0 +1,187 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "capturetrace.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t MaxFinishedRings = 32;
+
+void appendJsonString(std::string *json, const char *text)
+{
+    *json += '"';
+    for (; *text; ++text) {
+        const char c = *text;
+        if (c == '"' || c == '\\') {
+            *json += '\\';
+            *json += c;
+        } else if (uint8_t(c) < 0x20) {
+            *json += ' ';
+        } else {
+            *json += c;
+        }
+    }
+    *json += '"';
+}
+
+} // namespace
+
+// Written by its thread only. Every field is atomic so the export can read
+// while the thread keeps writing, spans that were overwritten during the
+// read are dropped by checking head again afterwards.
+struct CaptureTracer::Ring
+{
+    struct Span
+    {
+        std::atomic<const char *> name{ nullptr };
+        std::atomic<uint64_t> startNs{ 0 };
+        std::atomic<uint64_t> endNs{ 0 };
+    };
+
+    long tid{ 0 };
+    std::string threadName;
+    std::unique_ptr<Span[]> spans{ new Span[RingCapacity] };
+    std::atomic<uint64_t> head{ 0 };
+    std::atomic_bool finished{ false };
+};
+
+// Marks the ring finished when its thread exits
+struct ThreadRingHolder
+{
+    CaptureTracer::Ring *ring{ nullptr };
+
+    ~ThreadRingHolder()
+    {
+        if (ring)
+            ring->finished.store(true, std::memory_order_release);
+    }
+};
+
+static thread_local ThreadRingHolder t_ring;
+
+CaptureTracer *CaptureTracer::instance()
+{
+    static CaptureTracer tracer;
+    return &tracer;
+}
+
+void CaptureTracer::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled && isCompiledIn(), std::memory_order_relaxed);
+}
+
+CaptureTracer::Ring *CaptureTracer::createRing()
+{
+    auto ring = std::make_shared<Ring>();
+    ring->tid = long(::syscall(SYS_gettid));
+    char name[32] = {};
+    if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0)
+        ring->threadName = name;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t finished = size_t(std::count_if(m_rings.begin(), m_rings.end(), [](const auto &ring) {
+        return ring->finished.load(std::memory_order_acquire);
+    }));
+    // Threads come and go with recordings and the worker pool, drop the
+    // oldest finished rings
+    for (auto it = m_rings.begin(); it != m_rings.end() && finished > MaxFinishedRings;) {
+        if ((*it)->finished.load(std::memory_order_acquire)) {
+            it = m_rings.erase(it);
+            --finished;
+        } else {
+            ++it;
+        }
+    }
+    m_rings.push_back(ring);
+    return ring.get();
+}
+
+void CaptureTracer::record(const char *name, uint64_t startNs, uint64_t endNs)
+{
+    Ring *ring = t_ring.ring;
+    if (!ring)
+        ring = t_ring.ring = createRing();
+
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Ring::Span &span = ring->spans[head % RingCapacity];
+    span.name.store(name, std::memory_order_relaxed);
+    span.startNs.store(startNs, std::memory_order_relaxed);
+    span.endNs.store(endNs, std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+std::string CaptureTracer::toJson() const
+{
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        rings = m_rings;
+    }
+
+    const long pid = long(::getpid());
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    char buffer[160];
+    for (const auto &ring : rings) {
+        std::snprintf(buffer,
+                      sizeof(buffer),
+                      "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":",
+                      first ? "" : ",",
+                      pid,
+                      ring->tid);
+        json += buffer;
+        appendJsonString(&json, ring->threadName.empty() ? "thread" : ring->threadName.c_str());
+        json += "}}";
+        first = false;
+
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        const uint64_t begin = head > RingCapacity ? head - RingCapacity : 0;
+        std::vector<std::pair<uint64_t, std::string>> spans;
+        for (uint64_t i = begin; i < head; ++i) {
+            const Ring::Span &span = ring->spans[i % RingCapacity];
+            const char *name = span.name.load(std::memory_order_relaxed);
+            const uint64_t startNs = span.startNs.load(std::memory_order_relaxed);
+            const uint64_t endNs = span.endNs.load(std::memory_order_relaxed);
+            if (!name)
+                continue;
+            std::string event;
+            appendJsonString(&event, name);
+            std::snprintf(buffer,
+                          sizeof(buffer),
+                          ",\"cat\":\"capture\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld}",
+                          double(startNs) / 1000.0,
+                          double(endNs - startNs) / 1000.0,
+                          pid,
+                          ring->tid);
+            spans.emplace_back(i, ",\n{\"name\":" + event + buffer);
+        }
+
+        // Anything the thread wrapped around to while this was read may be
+        // torn
+        const uint64_t after = ring->head.load(std::memory_order_acquire);
+        const uint64_t valid = after > RingCapacity ? after - RingCapacity : 0;
+        for (const auto &span : spans) {
+            if (span.first >= valid)
+                json += span.second;
+        }
+    }
+    json += "\n]}\n";
+    return json;
+}
+
+bool CaptureTracer::dumpToFile(const std::string &path) const
+{
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    const std::string json = toJson();
+    const bool written = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+    return std::fclose(file) == 0 && written;
+}
@@ -0,0 +1,98 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "capturemetrics.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Spans of the pipeline stages, to see where a slow frame spent its time.
+// Every thread records into a ring of its own without locking, once the ring
+// is full the oldest spans are overwritten. The export is in the Chrome trace
+// event format, which chrome://tracing and ui.perfetto.dev load.
+//
+// Spans are only recorded when built with ENABLE_TRACING, which defines
+// TEST_CAPTURE_TRACING, and even then only while the tracer is enabled.
+// Otherwise CAPTURE_TRACE_SCOPE expands to nothing.
+class CaptureTracer
+{
+public:
+    static constexpr size_t RingCapacity = 16384;
+
+    static CaptureTracer *instance();
+
+    static constexpr bool isCompiledIn()
+    {
+#ifdef TEST_CAPTURE_TRACING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    inline bool isEnabled() const
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool enabled);
+
+    // name must outlive the tracer, i.e. be a string literal
+    void record(const char *name, uint64_t startNs, uint64_t endNs);
+
+    std::string toJson() const;
+    bool dumpToFile(const std::string &path) const;
+
+private:
+    struct Ring;
+    friend struct ThreadRingHolder;
+
+    CaptureTracer() = default;
+    Ring *createRing();
+
+    std::atomic_bool m_enabled{ false };
+    mutable std::mutex m_mutex;
+    // Rings of threads that exited are kept for the export, up to a limit
+    std::vector<std::shared_ptr<Ring>> m_rings;
+};
+
+class CaptureTraceScope
+{
+public:
+    inline explicit CaptureTraceScope(const char *name)
+        : m_name(CaptureTracer::instance()->isEnabled() ? name : nullptr)
+        , m_startNs(m_name ? CaptureMetrics::monotonicNs() : 0)
+    {
+    }
+
+    inline ~CaptureTraceScope()
+    {
+        if (m_name)
+            CaptureTracer::instance()->record(m_name, m_startNs, CaptureMetrics::monotonicNs());
+    }
+
+    CaptureTraceScope(const CaptureTraceScope &) = delete;
+    CaptureTraceScope &operator=(const CaptureTraceScope &) = delete;
+
+private:
+    const char *m_name;
+    uint64_t m_startNs;
+};
+
+#ifdef TEST_CAPTURE_TRACING
+#define CAPTURE_TRACE_CONCAT_(a, b) a##b
+#define CAPTURE_TRACE_CONCAT(a, b) CAPTURE_TRACE_CONCAT_(a, b)
+// Records the rest of the enclosing block as a span called name
+#define CAPTURE_TRACE_SCOPE(name) \
+    const CaptureTraceScope CAPTURE_TRACE_CONCAT(captureTraceScope, __LINE__)(name)
+#else
+#define CAPTURE_TRACE_SCOPE(name) \
+    do {                          \
+    } while (false)
+#endif
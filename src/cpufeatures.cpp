@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "cpufeatures.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+SimdLevel detectSimdLevel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::Avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SimdLevel::Sse41;
+    return SimdLevel::Scalar;
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+    return SimdLevel::Neon;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel requestedSimdLevel(SimdLevel detected)
+{
+    const char *value = std::getenv("TEST_CAPTURE_SIMD");
+    if (!value || !*value)
+        return detected;
+
+    if (std::strcmp(value, "scalar") == 0)
+        return SimdLevel::Scalar;
+    if (std::strcmp(value, "sse4.1") == 0 && detected == SimdLevel::Avx2)
+        return SimdLevel::Sse41;
+    // Never enable something the CPU doesn't have.
+    return detected;
+}
+
+} // namespace
+
+SimdLevel simdLevel()
+{
+    static const SimdLevel level = requestedSimdLevel(detectSimdLevel());
+    return level;
+}
+
+const char *simdLevelName(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::Scalar:
+        return "scalar";
+    case SimdLevel::Sse41:
+        return "sse4.1";
+    case SimdLevel::Avx2:
+        return "avx2";
+    case SimdLevel::Neon:
+        return "neon";
+    }
+    return "unknown";
+}
@@ -0,0 +1,18 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+// Instruction sets the pixel kernels are dispatched on. Kernels for every
+// level produce bit-identical results, the level only affects speed.
+enum class SimdLevel {
+    Scalar,
+    Sse41,
+    Avx2,
+    Neon,
+};
+
+// Detected once per process. TEST_CAPTURE_SIMD=scalar|sse4.1|avx2|neon caps
+// the level, e.g. to compare kernels on the same machine.
+SimdLevel simdLevel();
+const char *simdLevelName(SimdLevel level);
@@ -0,0 +1,112 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "dmabufcache.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool syncDmaBuf(int fd, uint64_t flags)
+{
+    dma_buf_sync sync = {};
+    sync.flags = flags | DMA_BUF_SYNC_READ;
+    int result;
+    do {
+        result = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    } while (result < 0 && (errno == EINTR || errno == EAGAIN));
+    return result == 0;
+}
+
+DmaBufMapping::DmaBufMapping(const DmaBufIdentity &identity, uint8_t *data, size_t size)
+    : m_identity(identity)
+    , m_data(data)
+    , m_size(size)
+{
+}
+
+DmaBufMapping::~DmaBufMapping()
+{
+    munmap(m_data, m_size);
+}
+
+DmaBufReadAccess::DmaBufReadAccess(int fd)
+    : m_fd(fd >= 0 && syncDmaBuf(fd, DMA_BUF_SYNC_START) ? fd : -1)
+{
+}
+
+DmaBufReadAccess::~DmaBufReadAccess()
+{
+    if (m_fd >= 0)
+        syncDmaBuf(m_fd, DMA_BUF_SYNC_END);
+}
+
+DmaBufMappingCache::DmaBufMappingCache(size_t maxEntries)
+    : m_maxEntries(std::max<size_t>(1, maxEntries))
+{
+}
+
+DmaBufIdentity DmaBufMappingCache::identify(uint32_t index, int fd)
+{
+    DmaBufIdentity identity;
+    identity.index = index;
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        identity.device = st.st_dev;
+        identity.inode = st.st_ino;
+    }
+    return identity;
+}
+
+std::shared_ptr<const DmaBufMapping>
+DmaBufMappingCache::map(const DmaBufIdentity &identity, int fd, size_t size, bool *created)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (created)
+        *created = false;
+
+    const uint64_t use = ++m_useCounter;
+    for (auto &entry : m_entries) {
+        if (entry.mapping->identity() == identity && entry.mapping->size() >= size) {
+            entry.lastUse = use;
+            return entry.mapping;
+        }
+    }
+
+    if (fd < 0 || size == 0)
+        return nullptr;
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+        return nullptr;
+    auto mapping = std::make_shared<const DmaBufMapping>(identity, static_cast<uint8_t *>(data), size);
+    if (created)
+        *created = true;
+
+    auto replaced = m_entries.end();
+    if (m_entries.size() >= m_maxEntries) {
+        replaced = std::min_element(m_entries.begin(),
+                                    m_entries.end(),
+                                    [](const Entry &a, const Entry &b) {
+                                        return a.lastUse < b.lastUse;
+                                    });
+    }
+
+    if (replaced != m_entries.end()) {
+        replaced->mapping = mapping;
+        replaced->lastUse = use;
+    } else {
+        m_entries.push_back({ mapping, use });
+    }
+    return mapping;
+}
+
+void DmaBufMappingCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+}
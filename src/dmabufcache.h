@@ -0,0 +1,105 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Identity of a compositor buffer. The session hands out a fresh fd for every
+// frame, but the object index together with the dev/inode of the dma-buf stays
+// the same while the compositor cycles through its swapchain.
+struct DmaBufIdentity
+{
+    uint32_t index{ 0 };
+    uint64_t device{ 0 };
+    uint64_t inode{ 0 };
+
+    inline bool operator==(const DmaBufIdentity &other) const
+    {
+        return index == other.index && device == other.device && inode == other.inode;
+    }
+
+    inline bool operator!=(const DmaBufIdentity &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+class DmaBufMapping
+{
+public:
+    DmaBufMapping(const DmaBufIdentity &identity, uint8_t *data, size_t size);
+    ~DmaBufMapping();
+
+    DmaBufMapping(const DmaBufMapping &) = delete;
+    DmaBufMapping &operator=(const DmaBufMapping &) = delete;
+
+    inline const DmaBufIdentity &identity() const
+    {
+        return m_identity;
+    }
+
+    inline const uint8_t *data() const
+    {
+        return m_data;
+    }
+
+    inline size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    DmaBufIdentity m_identity;
+    uint8_t *m_data;
+    size_t m_size;
+};
+
+// Brackets CPU reads of a mapped dma-buf with DMA_BUF_IOCTL_SYNC, so they see
+// what the GPU wrote. Only for the moment of the read, the compositor keeps
+// rendering into its buffers regardless. Fds that aren't dma-bufs, like the
+// memfds of a software compositor, don't support the ioctl and need none.
+class DmaBufReadAccess
+{
+public:
+    explicit DmaBufReadAccess(int fd);
+    ~DmaBufReadAccess();
+
+    DmaBufReadAccess(const DmaBufReadAccess &) = delete;
+    DmaBufReadAccess &operator=(const DmaBufReadAccess &) = delete;
+
+private:
+    int m_fd;
+};
+
+// Read-only CPU mappings of recycled buffers. A mapping stays valid after the
+// fd it was created from is closed and after it is evicted, for as long as a
+// consumer holds a reference to it.
+class DmaBufMappingCache
+{
+public:
+    explicit DmaBufMappingCache(size_t maxEntries = 8);
+
+    // created is set when the buffer wasn't mapped yet and mmap was called.
+    std::shared_ptr<const DmaBufMapping>
+    map(const DmaBufIdentity &identity, int fd, size_t size, bool *created = nullptr);
+    void clear();
+
+    static DmaBufIdentity identify(uint32_t index, int fd);
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const DmaBufMapping> mapping;
+        uint64_t lastUse{ 0 };
+    };
+
+    std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+    size_t m_maxEntries;
+    uint64_t m_useCounter{ 0 };
+};
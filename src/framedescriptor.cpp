@@ -0,0 +1,97 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "framedescriptor.h"
+
+#include <unistd.h>
+
+void UniqueFd::reset(int fd)
+{
+    if (m_fd >= 0 && m_fd != fd)
+        ::close(m_fd);
+    m_fd = fd;
+}
+
+FrameDescriptor::FrameDescriptor(FrameDescriptorPool *pool)
+    : m_pool(pool)
+{
+}
+
+bool FrameDescriptor::addObject(FrameObject &&object)
+{
+    if (m_objectCount >= MaxObjects) {
+        object.fd.reset();
+        return false;
+    }
+    m_objects[m_objectCount++] = std::move(object);
+    return true;
+}
+
+void FrameDescriptor::clear()
+{
+    for (int i = 0; i < m_objectCount; ++i)
+        m_objects[i] = FrameObject();
+    m_objectCount = 0;
+    offsetX = 0;
+    offsetY = 0;
+    width = 0;
+    height = 0;
+    format = 0;
+    modifier = 0;
+    bufferFlags = 0;
+    flags = 0;
+    bufferGeneration = 0;
+    sequence = 0;
+    presentationTimeNs = 0;
+    receiveTimeNs = 0;
+}
+
+void FrameRef::reset()
+{
+    if (!m_frame)
+        return;
+    FrameDescriptor *frame = m_frame;
+    m_frame = nullptr;
+    if (frame->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        frame->m_pool->recycle(frame);
+}
+
+FrameDescriptorPool::FrameDescriptorPool()
+{
+    // Returning a descriptor must never allocate
+    m_idle.reserve(m_maxIdle);
+}
+
+FrameDescriptorPool *FrameDescriptorPool::instance()
+{
+    static FrameDescriptorPool pool;
+    return &pool;
+}
+
+FrameRef FrameDescriptorPool::acquire()
+{
+    FrameDescriptor *frame = nullptr;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_idle.empty()) {
+            frame = m_idle.back().release();
+            m_idle.pop_back();
+        }
+    }
+    if (!frame)
+        frame = new FrameDescriptor(this);
+    frame->m_refs.store(1, std::memory_order_relaxed);
+    return FrameRef(frame);
+}
+
+void FrameDescriptorPool::recycle(FrameDescriptor *frame)
+{
+    // The fds are closed here, outside the lock
+    frame->clear();
+
+    QMutexLocker locker(&m_mutex);
+    if (m_idle.size() < m_maxIdle)
+        m_idle.emplace_back(frame);
+    else
+        delete frame;
+}
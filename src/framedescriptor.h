@@ -0,0 +1,267 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "dmabufcache.h"
+
+#include <QMutex>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Owns a file descriptor and closes it when destroyed or reset.
+class UniqueFd
+{
+public:
+    UniqueFd() = default;
+
+    explicit UniqueFd(int fd)
+        : m_fd(fd)
+    {
+    }
+
+    ~UniqueFd()
+    {
+        reset();
+    }
+
+    UniqueFd(UniqueFd &&other) noexcept
+        : m_fd(other.release())
+    {
+    }
+
+    UniqueFd &operator=(UniqueFd &&other) noexcept
+    {
+        if (this != &other)
+            reset(other.release());
+        return *this;
+    }
+
+    UniqueFd(const UniqueFd &) = delete;
+    UniqueFd &operator=(const UniqueFd &) = delete;
+
+    inline int get() const
+    {
+        return m_fd;
+    }
+
+    inline bool isValid() const
+    {
+        return m_fd >= 0;
+    }
+
+    // Gives up ownership without closing
+    inline int release()
+    {
+        const int fd = m_fd;
+        m_fd = -1;
+        return fd;
+    }
+
+    void reset(int fd = -1);
+
+private:
+    int m_fd{ -1 };
+};
+
+struct FrameObject
+{
+    uint32_t index{ 0 };
+    UniqueFd fd;
+    uint32_t size{ 0 };
+    uint32_t offset{ 0 };
+    uint32_t stride{ 0 };
+    uint32_t planeIndex{ 0 };
+    DmaBufIdentity identity;
+};
+
+class FrameDescriptorPool;
+
+// One frame of a capture session with its objects stored inline. The session
+// fills a descriptor while the frame and object events arrive and doesn't
+// touch it anymore once ready was received, so references can be handed to
+// other threads. The object fds are closed when the last reference is gone.
+class FrameDescriptor
+{
+public:
+    static constexpr int MaxObjects = 4;
+
+    class Objects
+    {
+    public:
+        Objects() = default;
+
+        Objects(const FrameObject *begin, int count)
+            : m_begin(begin)
+            , m_count(count)
+        {
+        }
+
+        inline const FrameObject *begin() const
+        {
+            return m_begin;
+        }
+
+        inline const FrameObject *end() const
+        {
+            return m_begin + m_count;
+        }
+
+        inline int size() const
+        {
+            return m_count;
+        }
+
+        inline bool isEmpty() const
+        {
+            return m_count == 0;
+        }
+
+        inline const FrameObject &first() const
+        {
+            return *m_begin;
+        }
+
+    private:
+        const FrameObject *m_begin{ nullptr };
+        int m_count{ 0 };
+    };
+
+    FrameDescriptor(const FrameDescriptor &) = delete;
+    FrameDescriptor &operator=(const FrameDescriptor &) = delete;
+
+    inline Objects objects() const
+    {
+        return Objects(m_objects, m_objectCount);
+    }
+
+    // Takes ownership of the object's fd. Objects beyond MaxObjects are closed
+    // and false is returned.
+    bool addObject(FrameObject &&object);
+    // Closes the objects and forgets everything about the frame.
+    void clear();
+
+    int32_t offsetX{ 0 };
+    int32_t offsetY{ 0 };
+    uint32_t width{ 0 };
+    uint32_t height{ 0 };
+    uint32_t format{ 0 };
+    uint64_t modifier{ 0 };
+    uint32_t bufferFlags{ 0 };
+    uint32_t flags{ 0 };
+    // See TreelandCaptureSession for the meaning of these
+    uint bufferGeneration{ 0 };
+    uint64_t sequence{ 0 };
+    uint64_t presentationTimeNs{ 0 };
+    uint64_t receiveTimeNs{ 0 };
+
+private:
+    friend class FrameDescriptorPool;
+    friend class FrameRef;
+
+    explicit FrameDescriptor(FrameDescriptorPool *pool);
+
+    FrameDescriptorPool *m_pool;
+    std::atomic_int m_refs{ 0 };
+    FrameObject m_objects[MaxObjects];
+    int m_objectCount{ 0 };
+};
+
+// Shared reference to a pooled FrameDescriptor. Copies only touch an atomic
+// counter, the last one returns the descriptor to its pool.
+class FrameRef
+{
+public:
+    FrameRef() = default;
+
+    FrameRef(const FrameRef &other)
+        : m_frame(other.m_frame)
+    {
+        if (m_frame)
+            m_frame->m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    FrameRef(FrameRef &&other) noexcept
+        : m_frame(other.m_frame)
+    {
+        other.m_frame = nullptr;
+    }
+
+    ~FrameRef()
+    {
+        reset();
+    }
+
+    FrameRef &operator=(const FrameRef &other)
+    {
+        FrameRef(other).swap(*this);
+        return *this;
+    }
+
+    FrameRef &operator=(FrameRef &&other) noexcept
+    {
+        FrameRef(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    inline void swap(FrameRef &other) noexcept
+    {
+        std::swap(m_frame, other.m_frame);
+    }
+
+    void reset();
+
+    inline FrameDescriptor *get() const
+    {
+        return m_frame;
+    }
+
+    inline FrameDescriptor *operator->() const
+    {
+        return m_frame;
+    }
+
+    inline FrameDescriptor &operator*() const
+    {
+        return *m_frame;
+    }
+
+    inline explicit operator bool() const
+    {
+        return m_frame != nullptr;
+    }
+
+private:
+    friend class FrameDescriptorPool;
+
+    explicit FrameRef(FrameDescriptor *frame)
+        : m_frame(frame)
+    {
+    }
+
+    FrameDescriptor *m_frame{ nullptr };
+};
+
+// Recycles descriptors so sessions don't allocate per frame. Released
+// descriptors can come back from any thread.
+class FrameDescriptorPool
+{
+public:
+    static FrameDescriptorPool *instance();
+
+    // A cleared descriptor with a single reference
+    FrameRef acquire();
+
+private:
+    friend class FrameRef;
+
+    FrameDescriptorPool();
+    void recycle(FrameDescriptor *frame);
+
+    QMutex m_mutex;
+    std::vector<std::unique_ptr<FrameDescriptor>> m_idle;
+    size_t m_maxIdle{ 32 };
+};
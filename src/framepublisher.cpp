@@ -0,0 +1,223 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "framepublisher.h"
+#include "capture.h"
+#include "capturescheduler.h"
+#include "capturetrace.h"
+
+#include <QDebug>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <sys/socket.h>
+
+namespace {
+
+// The slot being written, the one consumers are on and room for slow ones
+constexpr uint32_t RingSlots = 4;
+
+} // namespace
+
+FramePublisher::FramePublisher(QObject *parent)
+    : QObject(parent)
+{
+}
+
+FramePublisher::~FramePublisher()
+{
+    stop();
+}
+
+bool FramePublisher::start(TreelandCaptureSession *session, const QString &name)
+{
+    if (m_server)
+        return false;
+    if (!session) {
+        Q_EMIT error(QStringLiteral("No capture session"));
+        return false;
+    }
+
+    const QString path = QString::fromStdString(FrameRingProducer::socketPath(name.toStdString()));
+    m_server = new QLocalServer(this);
+    m_server->setSocketOptions(QLocalServer::UserAccessOption);
+    QLocalServer::removeServer(path);
+    if (!m_server->listen(path)) {
+        Q_EMIT error(QStringLiteral("Failed to listen on %1: %2").arg(path, m_server->errorString()));
+        delete m_server;
+        m_server = nullptr;
+        return false;
+    }
+    connect(m_server, &QLocalServer::newConnection, this, &FramePublisher::handleConnections);
+
+    m_session = session;
+    m_published = 0;
+    m_skipped = 0;
+    // Direct connection: the frame is copied while the session still holds
+    // its objects.
+    connect(session,
+            &TreelandCaptureSession::ready,
+            this,
+            &FramePublisher::handleSessionReady,
+            Qt::DirectConnection);
+    connect(session, &TreelandCaptureSession::destroyed, this, &FramePublisher::stop);
+    qInfo() << "Publishing frames on" << path;
+    return true;
+}
+
+void FramePublisher::stop()
+{
+    if (!m_server)
+        return;
+
+    if (m_session) {
+        QMutexLocker locker(m_session->deliveryMutex());
+        m_session->disconnect(this);
+    }
+    m_session = nullptr;
+    delete m_server;
+    m_server = nullptr;
+
+    QMutexLocker locker(&m_ringMutex);
+    for (const auto &socket : std::as_const(m_waiting)) {
+        if (socket)
+            socket->deleteLater();
+    }
+    m_waiting.clear();
+
+    m_ring.close();
+    CaptureScheduler::instance()->release(m_reservedBytes);
+    m_reservedBytes = 0;
+    locker.unlock();
+    qInfo() << "Frame publishing finished: published" << m_published << "skipped" << m_skipped;
+}
+
+void FramePublisher::handleSessionReady()
+{
+    if (!m_session)
+        return;
+    CAPTURE_TRACE_SCOPE("publish");
+
+    // Consumers get plain packed pixels, one plane in one object
+    const FrameRef captured = m_session->frame();
+    const auto objects = captured->objects();
+    if (objects.size() != 1 || objects.first().planeIndex != 0) {
+        if (!m_warnedUnsupported) {
+            qWarning() << "Can't publish frames with" << objects.size() << "objects";
+            m_warnedUnsupported = true;
+        }
+        ++m_skipped;
+        return;
+    }
+
+    const auto &object = objects.first();
+    const size_t frameBytes = size_t(object.stride) * captured->height;
+    auto mapping = m_session->mapObject(*captured, object);
+    QMutexLocker locker(&m_ringMutex);
+    if (!mapping || size_t(object.offset) + frameBytes > mapping->size() || !ensureRing(frameBytes)) {
+        ++m_skipped;
+        return;
+    }
+
+    uint8_t *slot = m_ring.beginFrame();
+    std::memcpy(slot, mapping->data() + object.offset, frameBytes);
+    FrameRingFrame frame;
+    frame.presentationTimeNs = captured->presentationTimeNs;
+    frame.modifier = captured->modifier;
+    frame.width = captured->width;
+    frame.height = captured->height;
+    frame.fourcc = captured->format;
+    frame.stride = object.stride;
+    frame.size = frameBytes;
+    m_ring.publish(frame);
+    locker.unlock();
+    ++m_published;
+    if (m_session->metrics())
+        m_session->metrics()->add(CaptureMetrics::BytesCopied, frameBytes);
+}
+
+bool FramePublisher::ensureRing(size_t frameBytes)
+{
+    if (m_ring.isValid() && frameBytes <= m_ring.slotSize())
+        return true;
+
+    // Closing tells the consumers of the old ring to reconnect
+    m_ring.close();
+    CaptureScheduler::instance()->release(m_reservedBytes);
+    m_reservedBytes = 0;
+
+    const size_t ringBytes = frameBytes * RingSlots;
+    if (!CaptureScheduler::instance()->reserve(ringBytes)) {
+        qWarning() << "The frame ring doesn't fit the capture buffer budget";
+        return false;
+    }
+    if (!m_ring.create(RingSlots, frameBytes)) {
+        CaptureScheduler::instance()->release(ringBytes);
+        Q_EMIT error(QStringLiteral("Failed to create the frame ring: %1").arg(strerror(errno)));
+        return false;
+    }
+    m_reservedBytes = ringBytes;
+
+    // The sockets belong to this thread, the ring may be replaced again
+    // before they are served, they then get the newer one.
+    if (!m_waiting.isEmpty()) {
+        QMetaObject::invokeMethod(
+            this,
+            [this, waiting = std::exchange(m_waiting, {})] {
+                for (const auto &socket : waiting) {
+                    if (socket)
+                        sendRing(socket);
+                }
+            },
+            Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void FramePublisher::handleConnections()
+{
+    while (QLocalSocket *socket = m_server->nextPendingConnection()) {
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        sendRing(socket);
+    }
+}
+
+void FramePublisher::sendRing(QLocalSocket *socket)
+{
+    // sendmsg duplicates the fd into the message, so the ring only has to
+    // stay open until it returns
+    QMutexLocker locker(&m_ringMutex);
+    if (!m_ring.isValid()) {
+        m_waiting.append(socket);
+        return;
+    }
+
+    char byte = 'R';
+    iovec vector = { &byte, 1 };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    const int fd = m_ring.fd();
+    std::memcpy(CMSG_DATA(header), &fd, sizeof(fd));
+
+    ssize_t sent;
+    do {
+        sent = ::sendmsg(int(socket->socketDescriptor()), &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    locker.unlock();
+    if (sent < 0)
+        qWarning() << "Failed to hand out the frame ring:" << strerror(errno);
+    // One fd per connection, consumers reconnect for a replaced ring
+    socket->disconnectFromServer();
+}
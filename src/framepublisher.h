@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "framering.h"
+
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QPointer>
+
+class QLocalServer;
+class QLocalSocket;
+class TreelandCaptureSession;
+
+// Publishes session frames into a frame ring for other local processes,
+// e.g. OCR or analytics, so they don't have to capture the screen again.
+// Consumers connect to FrameRingProducer::socketPath(name) and receive the
+// memfd with SCM_RIGHTS. The ring is created with the first frame and
+// replaced when frames outgrow its slots, the old one is marked closed.
+// Frames are copied on the capture event thread, sockets are served on the
+// publisher's thread.
+class FramePublisher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FramePublisher(QObject *parent = nullptr);
+    ~FramePublisher() override;
+
+    inline bool publishing() const
+    {
+        return m_server != nullptr;
+    }
+
+    bool start(TreelandCaptureSession *session, const QString &name);
+    void stop();
+
+Q_SIGNALS:
+    void error(const QString &message);
+
+private:
+    void handleSessionReady();
+    void handleConnections();
+    bool ensureRing(size_t frameBytes);
+    void sendRing(QLocalSocket *socket);
+
+    QPointer<TreelandCaptureSession> m_session;
+    QLocalServer *m_server{ nullptr };
+    // Guards the ring and m_waiting, the event thread replaces the ring while
+    // sockets get its fd here
+    QMutex m_ringMutex;
+    FrameRingProducer m_ring;
+    // Taken from the CaptureScheduler budget for the ring
+    size_t m_reservedBytes{ 0 };
+    // Connected before there was a ring to hand out
+    QList<QPointer<QLocalSocket>> m_waiting;
+    quint64 m_published{ 0 };
+    quint64 m_skipped{ 0 };
+    bool m_warnedUnsupported{ false };
+};
@@ -0,0 +1,309 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "framering.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t PageSize = 4096;
+constexpr unsigned RequiredSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+inline size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Not FUTEX_PRIVATE_FLAG, the word is shared between processes
+long futex(const std::atomic<uint32_t> *word, int op, uint32_t value, const timespec *timeout)
+{
+    return ::syscall(SYS_futex, reinterpret_cast<const uint32_t *>(word), op, value, timeout, nullptr, 0);
+}
+
+inline int64_t monotonicMs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+} // namespace
+
+FrameRingProducer::~FrameRingProducer()
+{
+    close();
+}
+
+std::string FrameRingProducer::socketPath(const std::string &name)
+{
+    const char *runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    return std::string(runtimeDir && *runtimeDir ? runtimeDir : "/tmp") + "/test-capture-ring-" + name;
+}
+
+bool FrameRingProducer::create(uint32_t slotCount, size_t slotSize)
+{
+    close();
+    if (slotCount < 2 || slotSize == 0)
+        return false;
+
+    m_slotCount = slotCount;
+    m_slotSize = alignUp(slotSize, PageSize);
+    const size_t slotsOffset = alignUp(sizeof(FrameRingHeader), PageSize);
+    const size_t payloadOffset = slotsOffset + alignUp(sizeof(FrameRingSlot) * slotCount, PageSize);
+    m_mappedSize = payloadOffset + m_slotSize * slotCount;
+
+    m_fd = ::memfd_create("test-capture-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (m_fd < 0)
+        return false;
+    if (::ftruncate(m_fd, off_t(m_mappedSize)) != 0 || ::fcntl(m_fd, F_ADD_SEALS, RequiredSeals) != 0) {
+        close();
+        return false;
+    }
+    void *data = ::mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        close();
+        return false;
+    }
+
+    // The memfd starts zeroed: nothing published, every slot empty
+    m_data = static_cast<uint8_t *>(data);
+    m_header = reinterpret_cast<FrameRingHeader *>(m_data);
+    m_slots = reinterpret_cast<FrameRingSlot *>(m_data + slotsOffset);
+    m_header->magic = FrameRingMagic;
+    m_header->version = FrameRingVersion;
+    m_header->slotCount = slotCount;
+    m_header->slotSize = m_slotSize;
+    m_header->slotsOffset = slotsOffset;
+    m_header->payloadOffset = payloadOffset;
+    m_writing = 0;
+    return true;
+}
+
+void FrameRingProducer::close()
+{
+    if (m_header) {
+        m_header->closed.store(1, std::memory_order_release);
+        m_header->wakeCounter.fetch_add(1, std::memory_order_release);
+        futex(&m_header->wakeCounter, FUTEX_WAKE, INT32_MAX, nullptr);
+    }
+    if (m_data)
+        ::munmap(m_data, m_mappedSize);
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_data = nullptr;
+    m_header = nullptr;
+    m_slots = nullptr;
+}
+
+uint8_t *FrameRingProducer::beginFrame()
+{
+    if (!m_header)
+        return nullptr;
+    m_writing = m_header->published.load(std::memory_order_relaxed) + 1;
+    const uint32_t slot = uint32_t((m_writing - 1) % m_slotCount);
+    m_slots[slot].sequence.store(m_writing * 2 - 1, std::memory_order_relaxed);
+    // Keeps the payload writes after the odd sequence
+    std::atomic_thread_fence(std::memory_order_release);
+    return m_data + m_header->payloadOffset + m_slotSize * slot;
+}
+
+void FrameRingProducer::publish(const FrameRingFrame &frame)
+{
+    if (!m_header || !m_writing)
+        return;
+    FrameRingSlot &slot = m_slots[(m_writing - 1) % m_slotCount];
+    slot.presentationTimeNs = frame.presentationTimeNs;
+    slot.modifier = frame.modifier;
+    slot.size = frame.size < m_slotSize ? frame.size : m_slotSize;
+    slot.width = frame.width;
+    slot.height = frame.height;
+    slot.fourcc = frame.fourcc;
+    slot.stride = frame.stride;
+    slot.sequence.store(m_writing * 2, std::memory_order_release);
+    m_header->published.store(m_writing, std::memory_order_release);
+    m_writing = 0;
+
+    // Consumers can't register as waiters on their read-only mapping, so
+    // every frame wakes. One syscall per frame is nothing at capture rates.
+    m_header->wakeCounter.fetch_add(1, std::memory_order_release);
+    futex(&m_header->wakeCounter, FUTEX_WAKE, INT32_MAX, nullptr);
+}
+
+FrameRingConsumer::~FrameRingConsumer()
+{
+    detach();
+}
+
+int FrameRingConsumer::receiveFd(const std::string &socketPath)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        return -1;
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    const int socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket < 0)
+        return -1;
+    if (::connect(socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        ::close(socket);
+        return -1;
+    }
+
+    char byte = 0;
+    iovec vector = { &byte, 1 };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    ::close(socket);
+    if (received <= 0)
+        return -1;
+
+    const cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS
+        || header->cmsg_len != CMSG_LEN(sizeof(int))) {
+        return -1;
+    }
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(header), sizeof(fd));
+    return fd;
+}
+
+bool FrameRingConsumer::attach(int fd)
+{
+    detach();
+    if (fd < 0)
+        return false;
+    m_fd = fd;
+
+    // Unsealed, the producer could shrink it and fault us with SIGBUS
+    struct stat status;
+    const int seals = ::fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (unsigned(seals) & RequiredSeals) != RequiredSeals || ::fstat(fd, &status) != 0
+        || size_t(status.st_size) < sizeof(FrameRingHeader)) {
+        detach();
+        return false;
+    }
+    void *data = ::mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        detach();
+        return false;
+    }
+    m_data = static_cast<const uint8_t *>(data);
+    m_mappedSize = size_t(status.st_size);
+
+    const auto header = reinterpret_cast<const FrameRingHeader *>(m_data);
+    const uint64_t slotCount = header->slotCount;
+    if (header->magic != FrameRingMagic || header->version != FrameRingVersion || slotCount < 2
+        || header->slotsOffset % PageSize || header->payloadOffset % PageSize
+        || header->slotsOffset < sizeof(FrameRingHeader)
+        || header->payloadOffset < header->slotsOffset + slotCount * sizeof(FrameRingSlot)
+        || header->payloadOffset > m_mappedSize
+        || header->slotSize > (m_mappedSize - header->payloadOffset) / slotCount) {
+        detach();
+        return false;
+    }
+    m_header = header;
+    m_slots = reinterpret_cast<const FrameRingSlot *>(m_data + header->slotsOffset);
+    return true;
+}
+
+void FrameRingConsumer::detach()
+{
+    if (m_data)
+        ::munmap(const_cast<uint8_t *>(m_data), m_mappedSize);
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_data = nullptr;
+    m_mappedSize = 0;
+    m_header = nullptr;
+    m_slots = nullptr;
+}
+
+bool FrameRingConsumer::closed() const
+{
+    return !m_header || m_header->closed.load(std::memory_order_acquire);
+}
+
+uint64_t FrameRingConsumer::latest() const
+{
+    return m_header ? m_header->published.load(std::memory_order_acquire) : 0;
+}
+
+bool FrameRingConsumer::waitForFrame(uint64_t number, int timeoutMs) const
+{
+    if (!m_header)
+        return false;
+    const int64_t deadline = monotonicMs() + timeoutMs;
+    for (;;) {
+        // Read before checking, a frame published in between changes it and
+        // the wait returns at once.
+        const uint32_t counter = m_header->wakeCounter.load(std::memory_order_acquire);
+        if (latest() > number || closed())
+            return true;
+        const int64_t left = deadline - monotonicMs();
+        if (left <= 0)
+            return false;
+        const timespec timeout = { time_t(left / 1000), long(left % 1000) * 1000000 };
+        futex(&m_header->wakeCounter, FUTEX_WAIT, counter, &timeout);
+    }
+}
+
+bool FrameRingConsumer::acquire(uint64_t number, View *view) const
+{
+    if (!m_header || number == 0)
+        return false;
+    const uint64_t published = latest();
+    const uint32_t slotCount = m_header->slotCount;
+    if (number > published || published - number >= slotCount)
+        return false;
+
+    const uint32_t index = uint32_t((number - 1) % slotCount);
+    const FrameRingSlot &slot = m_slots[index];
+    if (slot.sequence.load(std::memory_order_acquire) != number * 2)
+        return false;
+
+    view->number = number;
+    view->frame.presentationTimeNs = slot.presentationTimeNs;
+    view->frame.modifier = slot.modifier;
+    view->frame.width = slot.width;
+    view->frame.height = slot.height;
+    view->frame.fourcc = slot.fourcc;
+    view->frame.stride = slot.stride;
+    view->frame.size = size_t(slot.size < m_header->slotSize ? slot.size : m_header->slotSize);
+    view->data = m_data + m_header->payloadOffset + m_header->slotSize * index;
+    // The metadata too may have been overwritten while it was copied
+    return isIntact(*view);
+}
+
+bool FrameRingConsumer::isIntact(const View &view) const
+{
+    if (!m_header || !view.number)
+        return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const FrameRingSlot &slot = m_slots[(view.number - 1) % m_header->slotCount];
+    return slot.sequence.load(std::memory_order_relaxed) == view.number * 2;
+}
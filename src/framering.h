@@ -0,0 +1,171 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Captured frames shared with other local processes through one memfd.
+// A single producer writes frames round robin into a fixed number of slots
+// and any number of consumers map the memfd read-only and read the frames
+// in place. The producer never waits for consumers: every slot is guarded
+// by a sequence counter that is odd while the slot is written and 2 * n
+// once it holds frame n. A consumer checks the counter before and after
+// using a slot, a change in between means the frame was overwritten.
+//
+// Layout of the memfd, in host byte order:
+//
+//   FrameRingHeader, padded to a page
+//   slotCount FrameRingSlot, padded to a page
+//   slotCount payloads of slotSize bytes each, page aligned
+//
+// The memfd is sealed against resizing, consumers can trust its size.
+constexpr uint32_t FrameRingMagic = 0x47524354; // "TCRG"
+constexpr uint32_t FrameRingVersion = 1;
+
+struct FrameRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t reserved;
+    uint64_t slotSize;
+    uint64_t slotsOffset;
+    uint64_t payloadOffset;
+    // Number of the newest complete frame, 0 before the first one
+    std::atomic<uint64_t> published;
+    // Bumped with every frame, consumers wait on it as a futex
+    std::atomic<uint32_t> wakeCounter;
+    // Set when the producer is gone or replaced the ring, e.g. because the
+    // frames outgrew the slots. Consumers reconnect for the new one.
+    std::atomic<uint32_t> closed;
+};
+
+struct alignas(64) FrameRingSlot
+{
+    std::atomic<uint64_t> sequence;
+    uint64_t presentationTimeNs;
+    uint64_t modifier;
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t fourcc;
+    uint32_t stride;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(sizeof(FrameRingSlot) == 64);
+
+struct FrameRingFrame
+{
+    uint64_t presentationTimeNs{ 0 };
+    uint64_t modifier{ 0 };
+    uint32_t width{ 0 };
+    uint32_t height{ 0 };
+    uint32_t fourcc{ 0 };
+    uint32_t stride{ 0 };
+    size_t size{ 0 };
+};
+
+class FrameRingProducer
+{
+public:
+    FrameRingProducer() = default;
+    ~FrameRingProducer();
+
+    FrameRingProducer(const FrameRingProducer &) = delete;
+    FrameRingProducer &operator=(const FrameRingProducer &) = delete;
+
+    // Where the ring called name is handed out
+    static std::string socketPath(const std::string &name);
+
+    bool create(uint32_t slotCount, size_t slotSize);
+    // Marks the ring closed for its consumers and unmaps it
+    void close();
+
+    inline bool isValid() const
+    {
+        return m_header != nullptr;
+    }
+
+    // To pass to consumers, e.g. with SCM_RIGHTS
+    inline int fd() const
+    {
+        return m_fd;
+    }
+
+    inline size_t slotSize() const
+    {
+        return m_slotSize;
+    }
+
+    // Claims the next slot and returns its payload to write slotSize() bytes
+    // at most into, then publish() makes it visible. Consumers still reading
+    // the slot notice that it is being overwritten.
+    uint8_t *beginFrame();
+    void publish(const FrameRingFrame &frame);
+
+private:
+    int m_fd{ -1 };
+    uint8_t *m_data{ nullptr };
+    size_t m_mappedSize{ 0 };
+    FrameRingHeader *m_header{ nullptr };
+    FrameRingSlot *m_slots{ nullptr };
+    uint32_t m_slotCount{ 0 };
+    size_t m_slotSize{ 0 };
+    uint64_t m_writing{ 0 };
+};
+
+class FrameRingConsumer
+{
+public:
+    struct View
+    {
+        uint64_t number{ 0 };
+        FrameRingFrame frame;
+        const uint8_t *data{ nullptr };
+    };
+
+    FrameRingConsumer() = default;
+    ~FrameRingConsumer();
+
+    FrameRingConsumer(const FrameRingConsumer &) = delete;
+    FrameRingConsumer &operator=(const FrameRingConsumer &) = delete;
+
+    // Connects to the producer's socket and receives the memfd, -1 on error
+    static int receiveFd(const std::string &socketPath);
+
+    // Takes ownership of fd
+    bool attach(int fd);
+    void detach();
+
+    inline bool isAttached() const
+    {
+        return m_header != nullptr;
+    }
+
+    bool closed() const;
+    // Number of the newest frame, 0 if none yet
+    uint64_t latest() const;
+    // Blocks until a frame newer than number is published, the ring is
+    // closed or timeoutMs passed. False on timeout.
+    bool waitForFrame(uint64_t number, int timeoutMs) const;
+
+    // Frame number if the ring still holds it, the data points into the
+    // shared memory and is not copied. Check isIntact() after using it.
+    bool acquire(uint64_t number, View *view) const;
+    // False if the producer started overwriting the view's slot meanwhile,
+    // anything read from it since acquire() must be discarded then.
+    bool isIntact(const View &view) const;
+
+private:
+    int m_fd{ -1 };
+    const uint8_t *m_data{ nullptr };
+    size_t m_mappedSize{ 0 };
+    const FrameRingHeader *m_header{ nullptr };
+    const FrameRingSlot *m_slots{ nullptr };
+};
@@ -0,0 +1,481 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "gpuyuvconverter.h"
+#include "capturetrace.h"
+
+#include <QDebug>
+#include <QOpenGLContext>
+
+#include <cstring>
+
+namespace {
+
+constexpr GLuint PositionAttribute = 0;
+// Long enough for any frame, short enough not to hang on a lost context
+constexpr GLuint64 ReadbackTimeoutNs = 1000000000ull;
+
+const char *const VertexShader = R"(
+attribute vec2 position;
+
+void main()
+{
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+// Output row r is byte row r of the I420 image, glReadPixels returns the
+// bottom row first so no flip is needed.
+const char *const FragmentShader = R"(
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+
+uniform sampler2D source;
+// Premultiplied watermark covering overlayRect, in frame pixels
+uniform sampler2D overlay;
+uniform vec4 overlayRect;
+uniform bool hasOverlay;
+// Source buffer size in pixels
+uniform vec2 sourceSize;
+// Frame size rounded up to a multiple of (8, 4)
+uniform vec2 frameSize;
+
+vec3 fetch(vec2 pixel)
+{
+    vec3 rgb = texture2D(source, pixel / sourceSize).rgb;
+    if (hasOverlay) {
+        vec2 local = (pixel - overlayRect.xy) / overlayRect.zw;
+        if (all(greaterThanEqual(local, vec2(0.0))) && all(lessThanEqual(local, vec2(1.0)))) {
+            vec4 mark = texture2D(overlay, local);
+            rgb = mark.rgb + rgb * (1.0 - mark.a);
+        }
+    }
+    return rgb;
+}
+
+float luma(vec2 pixel)
+{
+    return dot(fetch(pixel), vec3(66.0, 129.0, 25.0) / 256.0) + 16.0 / 255.0;
+}
+
+// Sampling the corner shared by a 2x2 block averages it through GL_LINEAR
+vec2 chroma(vec2 block)
+{
+    vec3 rgb = fetch(block * 2.0 + 1.0);
+    return vec2(dot(rgb, vec3(-38.0, -74.0, 112.0) / 256.0),
+                dot(rgb, vec3(112.0, -94.0, -18.0) / 256.0)) + 128.0 / 255.0;
+}
+
+void main()
+{
+    vec2 texel = floor(gl_FragCoord.xy);
+    float x = texel.x * 4.0;
+    float row = texel.y;
+
+    if (row < frameSize.y) {
+        float y = row + 0.5;
+        gl_FragColor = vec4(luma(vec2(x + 0.5, y)),
+                            luma(vec2(x + 1.5, y)),
+                            luma(vec2(x + 2.5, y)),
+                            luma(vec2(x + 3.5, y)));
+        return;
+    }
+
+    // U then V, each half as wide, so two of their rows fit in one texel row
+    row -= frameSize.y;
+    float planeRows = frameSize.y / 4.0;
+    bool vPlane = row >= planeRows;
+    if (vPlane)
+        row -= planeRows;
+    float halfWidth = frameSize.x / 2.0;
+    float chromaRow = row * 2.0;
+    if (x >= halfWidth) {
+        x -= halfWidth;
+        chromaRow += 1.0;
+    }
+
+    vec2 c0 = chroma(vec2(x, chromaRow));
+    vec2 c1 = chroma(vec2(x + 1.0, chromaRow));
+    vec2 c2 = chroma(vec2(x + 2.0, chromaRow));
+    vec2 c3 = chroma(vec2(x + 3.0, chromaRow));
+    gl_FragColor = vPlane ? vec4(c0.y, c1.y, c2.y, c3.y) : vec4(c0.x, c1.x, c2.x, c3.x);
+}
+)";
+
+void copyPlane(const uint8_t *src, size_t srcStride, uint8_t *dst, size_t dstStride, size_t rows)
+{
+    for (size_t row = 0; row < rows; ++row)
+        std::memcpy(dst + dstStride * row, src + srcStride * row, dstStride);
+}
+
+} // namespace
+
+bool GpuYuvConverter::initialize(const Sink &sink)
+{
+    auto context = QOpenGLContext::currentContext();
+    if (!context) {
+        qWarning() << "No current OpenGL context for the YUV converter";
+        return false;
+    }
+    initializeOpenGLFunctions();
+    m_sink = sink;
+
+    auto compile = [this](GLenum type, const char *source) -> GLuint {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (!compiled) {
+            char log[1024] = {};
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            qWarning() << "Failed to compile YUV conversion shader:" << log;
+            glDeleteShader(shader);
+            return 0;
+        }
+        return shader;
+    };
+
+    const GLuint vertexShader = compile(GL_VERTEX_SHADER, VertexShader);
+    const GLuint fragmentShader = compile(GL_FRAGMENT_SHADER, FragmentShader);
+    if (!vertexShader || !fragmentShader) {
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return false;
+    }
+
+    m_program = glCreateProgram();
+    glAttachShader(m_program, vertexShader);
+    glAttachShader(m_program, fragmentShader);
+    glBindAttribLocation(m_program, PositionAttribute, "position");
+    glLinkProgram(m_program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char log[1024] = {};
+        glGetProgramInfoLog(m_program, sizeof(log), nullptr, log);
+        qWarning() << "Failed to link YUV conversion program:" << log;
+        release();
+        return false;
+    }
+
+    glUseProgram(m_program);
+    glUniform1i(glGetUniformLocation(m_program, "source"), 0);
+    glUniform1i(glGetUniformLocation(m_program, "overlay"), 1);
+    glUseProgram(0);
+    m_sourceSizeLocation = glGetUniformLocation(m_program, "sourceSize");
+    m_frameSizeLocation = glGetUniformLocation(m_program, "frameSize");
+    m_overlayRectLocation = glGetUniformLocation(m_program, "overlayRect");
+    m_hasOverlayLocation = glGetUniformLocation(m_program, "hasOverlay");
+
+    static const GLfloat quad[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+    glGenBuffers(1, &m_vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Pixel pack buffers and fences are core in GLES 3.0 and GL 3.2.
+    const auto format = context->format();
+    const int version = format.majorVersion() * 10 + format.minorVersion();
+    m_asyncReadback = context->isOpenGLES() ? version >= 30 : version >= 32;
+    if (m_asyncReadback) {
+        for (auto &readback : m_ring)
+            glGenBuffers(1, &readback.buffer);
+    }
+
+    qInfo() << "GPU YUV conversion ready, readback:"
+            << (m_asyncReadback ? "asynchronous PBO ring" : "synchronous glReadPixels");
+    return true;
+}
+
+void GpuYuvConverter::release()
+{
+    for (auto &readback : m_ring) {
+        if (readback.fence)
+            glDeleteSync(readback.fence);
+        if (readback.buffer)
+            glDeleteBuffers(1, &readback.buffer);
+        readback = Readback();
+    }
+    if (m_framebuffer)
+        glDeleteFramebuffers(1, &m_framebuffer);
+    if (m_targetTexture)
+        glDeleteTextures(1, &m_targetTexture);
+    if (m_overlayTexture)
+        glDeleteTextures(1, &m_overlayTexture);
+    if (m_vertexBuffer)
+        glDeleteBuffers(1, &m_vertexBuffer);
+    if (m_program)
+        glDeleteProgram(m_program);
+    m_framebuffer = 0;
+    m_targetTexture = 0;
+    m_overlayTexture = 0;
+    m_overlayKey = 0;
+    m_overlayRect = QRect();
+    m_vertexBuffer = 0;
+    m_program = 0;
+    m_targetSize = QSize();
+    m_nextReadback = 0;
+}
+
+bool GpuYuvConverter::ensureTarget(const QSize &paddedSize)
+{
+    const QSize targetSize(paddedSize.width() / 4, paddedSize.height() * 3 / 2);
+    if (targetSize == m_targetSize)
+        return true;
+
+    if (!m_targetTexture)
+        glGenTextures(1, &m_targetTexture);
+    glBindTexture(GL_TEXTURE_2D, m_targetTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_RGBA,
+                 targetSize.width(),
+                 targetSize.height(),
+                 0,
+                 GL_RGBA,
+                 GL_UNSIGNED_BYTE,
+                 nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    if (!m_framebuffer)
+        glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_targetTexture, 0);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, GLuint(previousFramebuffer));
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        qWarning() << "YUV conversion target incomplete:" << Qt::hex << status;
+        m_targetSize = QSize();
+        return false;
+    }
+    m_targetSize = targetSize;
+    return true;
+}
+
+bool GpuYuvConverter::convert(GLuint texture,
+                              const QSize &sourceSize,
+                              const QSize &frameSize,
+                              int64_t timestampNs)
+{
+    CAPTURE_TRACE_SCOPE("gpu convert");
+    if (!isInitialized() || !texture || frameSize.isEmpty() || frameSize.width() % 2
+        || frameSize.height() % 2) {
+        return false;
+    }
+
+    // The atlas packs 4 bytes per texel and two chroma rows per texel row.
+    const QSize paddedSize((frameSize.width() + 7) & ~7, (frameSize.height() + 3) & ~3);
+    if (!ensureTarget(paddedSize))
+        return false;
+
+    Readback *readback = nullptr;
+    if (m_asyncReadback) {
+        // The ring is full when the next slot is still in flight, it is the
+        // oldest one so waiting for it keeps the order.
+        readback = &m_ring[m_nextReadback];
+        if (readback->pending)
+            finish(readback, true);
+    }
+
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glViewport(0, 0, m_targetSize.width(), m_targetSize.height());
+    glDisable(GL_BLEND);
+
+    glUseProgram(m_program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glUniform2f(m_sourceSizeLocation, GLfloat(sourceSize.width()), GLfloat(sourceSize.height()));
+    glUniform2f(m_frameSizeLocation, GLfloat(paddedSize.width()), GLfloat(paddedSize.height()));
+    glUniform1i(m_hasOverlayLocation, m_overlayRect.isEmpty() ? 0 : 1);
+    if (!m_overlayRect.isEmpty()) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_overlayTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform4f(m_overlayRectLocation,
+                    GLfloat(m_overlayRect.x()),
+                    GLfloat(m_overlayRect.y()),
+                    GLfloat(m_overlayRect.width()),
+                    GLfloat(m_overlayRect.height()));
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glEnableVertexAttribArray(PositionAttribute);
+    glVertexAttribPointer(PositionAttribute, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDisableVertexAttribArray(PositionAttribute);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (!m_overlayRect.isEmpty()) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+
+    const size_t size = size_t(m_targetSize.width()) * m_targetSize.height() * 4;
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    if (readback) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+        if (readback->bufferSize != size) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(size), nullptr, GL_STREAM_READ);
+            readback->bufferSize = size;
+        }
+        glReadPixels(0,
+                     0,
+                     m_targetSize.width(),
+                     m_targetSize.height(),
+                     GL_RGBA,
+                     GL_UNSIGNED_BYTE,
+                     nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readback->frameSize = frameSize;
+        readback->paddedSize = paddedSize;
+        readback->timestampNs = timestampNs;
+        readback->pending = true;
+        m_nextReadback = (m_nextReadback + 1) % ReadbackRingSize;
+        // Get the work to the GPU now, collect() only polls the fences.
+        glFlush();
+    } else {
+        m_scratch.resize(size);
+        glReadPixels(0,
+                     0,
+                     m_targetSize.width(),
+                     m_targetSize.height(),
+                     GL_RGBA,
+                     GL_UNSIGNED_BYTE,
+                     m_scratch.data());
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, GLuint(previousFramebuffer));
+
+    if (readback)
+        collect(false);
+    else
+        deliver(m_scratch.data(), frameSize, paddedSize, timestampNs);
+    return true;
+}
+
+void GpuYuvConverter::setOverlay(const QImage &image, const QRect &rect)
+{
+    if (image.isNull() || rect.isEmpty()) {
+        m_overlayRect = QRect();
+        return;
+    }
+    m_overlayRect = rect;
+    // The watermark caches its images, so an unchanged key needs no upload.
+    if (m_overlayTexture && image.cacheKey() == m_overlayKey)
+        return;
+
+    const QImage pixels = image.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
+    if (!m_overlayTexture)
+        glGenTextures(1, &m_overlayTexture);
+    glBindTexture(GL_TEXTURE_2D, m_overlayTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_RGBA,
+                 pixels.width(),
+                 pixels.height(),
+                 0,
+                 GL_RGBA,
+                 GL_UNSIGNED_BYTE,
+                 pixels.constBits());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_overlayKey = image.cacheKey();
+}
+
+bool GpuYuvConverter::collect(bool wait)
+{
+    // Starting at the next slot to fill visits the readbacks oldest first.
+    for (int i = 0; i < ReadbackRingSize; ++i) {
+        auto &readback = m_ring[(m_nextReadback + i) % ReadbackRingSize];
+        if (!readback.pending)
+            continue;
+        if (!wait && glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return true;
+        finish(&readback, wait);
+    }
+    return false;
+}
+
+void GpuYuvConverter::finish(Readback *readback, bool wait)
+{
+    CAPTURE_TRACE_SCOPE("readback");
+    const GLenum status = wait
+        ? glClientWaitSync(readback->fence, GL_SYNC_FLUSH_COMMANDS_BIT, ReadbackTimeoutNs)
+        : glClientWaitSync(readback->fence, 0, 0);
+    glDeleteSync(readback->fence);
+    readback->fence = nullptr;
+    readback->pending = false;
+    // Whatever the buffer holds then isn't known to be this frame
+    if (status == GL_WAIT_FAILED) {
+        qWarning() << "Waiting for a YUV readback failed, the frame is lost";
+        if (m_sink.drop)
+            m_sink.drop();
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+    auto atlas = static_cast<const uint8_t *>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(readback->bufferSize), GL_MAP_READ_BIT));
+    if (atlas) {
+        deliver(atlas, readback->frameSize, readback->paddedSize, readback->timestampNs);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        qWarning() << "Failed to map a YUV readback buffer";
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void GpuYuvConverter::deliver(const uint8_t *atlas,
+                              const QSize &frameSize,
+                              const QSize &paddedSize,
+                              int64_t timestampNs)
+{
+    RecordYuvFrame *frame = m_sink.acquire ? m_sink.acquire() : nullptr;
+    if (!frame)
+        return;
+
+    const size_t width = size_t(frameSize.width());
+    const size_t height = size_t(frameSize.height());
+    frame->resize(uint32_t(width), uint32_t(height));
+    frame->timestampNs = timestampNs;
+
+    if (paddedSize == frameSize) {
+        std::memcpy(frame->data.data(), atlas, frame->data.size());
+    } else {
+        // Crop the padding away, each plane of the atlas has the padded pitch
+        const size_t paddedWidth = size_t(paddedSize.width());
+        const size_t paddedHeight = size_t(paddedSize.height());
+        const uint8_t *u = atlas + paddedWidth * paddedHeight;
+        const uint8_t *v = u + (paddedWidth / 2) * (paddedHeight / 2);
+        copyPlane(atlas, paddedWidth, frame->planeY(), width, height);
+        copyPlane(u, paddedWidth / 2, frame->planeU(), width / 2, height / 2);
+        copyPlane(v, paddedWidth / 2, frame->planeV(), width / 2, height / 2);
+    }
+
+    if (m_sink.submit)
+        m_sink.submit(frame);
+}
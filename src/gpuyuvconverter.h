@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "recordencoder.h"
+
+#include <QImage>
+#include <QOpenGLExtraFunctions>
+#include <QRect>
+#include <QSize>
+
+#include <array>
+#include <functional>
+#include <vector>
+
+// RGB to I420 conversion on the GPU. A GLES2 shader renders the source
+// texture into an RGBA target whose bytes are laid out exactly like the I420
+// image: 4 luma bytes per texel, followed by the U and V planes with two of
+// their rows per texel row. With GLES3 the readback goes through a ring of
+// pixel buffer objects, so reading frame N back overlaps rendering frame N+1.
+// Plain GLES2 (and llvmpipe without GLES3) reads back synchronously.
+//
+// Every call needs the context the converter was initialized on current.
+class GpuYuvConverter : protected QOpenGLExtraFunctions
+{
+public:
+    struct Sink
+    {
+        // Frame to fill, nullptr drops the readback
+        std::function<RecordYuvFrame *()> acquire;
+        std::function<void(RecordYuvFrame *)> submit;
+        // A converted frame that couldn't be read back
+        std::function<void()> drop;
+    };
+
+    GpuYuvConverter() = default;
+
+    GpuYuvConverter(const GpuYuvConverter &) = delete;
+    GpuYuvConverter &operator=(const GpuYuvConverter &) = delete;
+
+    bool initialize(const Sink &sink);
+    // Frees the GL objects, there is no destructor doing it since the
+    // context has to be current.
+    void release();
+
+    inline bool isInitialized() const
+    {
+        return m_program != 0;
+    }
+
+    inline bool asyncReadback() const
+    {
+        return m_asyncReadback;
+    }
+
+    // Converts texture, sourceSize pixels with GL_LINEAR filtering, to an
+    // I420 frame of frameSize, which must be even. Finished readbacks are
+    // handed to the sink in submission order.
+    bool convert(GLuint texture, const QSize &sourceSize, const QSize &frameSize, int64_t timestampNs);
+    // Composites image, premultiplied RGBA8888, over rect of the following
+    // frames before converting them. A null image removes the overlay.
+    void setOverlay(const QImage &image, const QRect &rect);
+    // Delivers readbacks that are done, or all of them when wait is set.
+    // Returns whether any are still in flight.
+    bool collect(bool wait = false);
+
+private:
+    struct Readback
+    {
+        GLuint buffer{ 0 };
+        GLsync fence{ nullptr };
+        size_t bufferSize{ 0 };
+        QSize frameSize;
+        QSize paddedSize;
+        int64_t timestampNs{ 0 };
+        bool pending{ false };
+    };
+
+    static constexpr int ReadbackRingSize = 3;
+
+    bool ensureTarget(const QSize &paddedSize);
+    void deliver(const uint8_t *atlas,
+                 const QSize &frameSize,
+                 const QSize &paddedSize,
+                 int64_t timestampNs);
+    void finish(Readback *readback, bool wait);
+
+    Sink m_sink;
+    bool m_asyncReadback{ false };
+    GLuint m_program{ 0 };
+    GLuint m_vertexBuffer{ 0 };
+    GLint m_sourceSizeLocation{ -1 };
+    GLint m_frameSizeLocation{ -1 };
+    GLint m_overlayRectLocation{ -1 };
+    GLint m_hasOverlayLocation{ -1 };
+    GLuint m_overlayTexture{ 0 };
+    qint64 m_overlayKey{ 0 };
+    QRect m_overlayRect;
+    GLuint m_targetTexture{ 0 };
+    GLuint m_framebuffer{ 0 };
+    QSize m_targetSize;
+    std::array<Readback, ReadbackRingSize> m_ring;
+    int m_nextReadback{ 0 };
+    std::vector<uint8_t> m_scratch;
+};
@@ -1,15 +1,64 @@
 #include "mainwindow.h"
 #include "capture.h"
+#include "capturecli.h"
+#include "capturetrace.h"
 
 #include <QApplication>
+#include <QDebug>
+
+#include <memory>
+
+static int runCli(int argc, char *argv[])
+{
+    // 只有预览需要控件，其余情况不创建任何窗口
+    std::unique_ptr<QGuiApplication> app;
+    if (CaptureCli::needsWidgets(argc, argv))
+        app = std::make_unique<QApplication>(argc, argv);
+    else
+        app = std::make_unique<QGuiApplication>(argc, argv);
+
+    CaptureCli cli;
+    if (!cli.parse(app->arguments()))
+        return 2;
+    cli.start();
+    return app->exec();
+}
 
 int main(int argc, char *argv[])
 {
+    CaptureCli::markProcessStart();
     QApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
-    QApplication app(argc, argv);
-    
-    MainWindow window;
-    window.show();
-    
-    return app.exec();
+
+    const QString traceFile = qEnvironmentVariable("TEST_CAPTURE_TRACE_FILE");
+    if (!traceFile.isEmpty()) {
+        if (CaptureTracer::isCompiledIn())
+            CaptureTracer::instance()->setEnabled(true);
+        else
+            qWarning() << "TEST_CAPTURE_TRACE_FILE is set, but tracing isn't built in (ENABLE_TRACING)";
+    }
+
+    int result = 0;
+    if (CaptureCli::isRequested(argc, argv)) {
+        result = runCli(argc, argv);
+    } else {
+        QApplication app(argc, argv);
+
+        MainWindow window;
+        window.show();
+
+        result = app.exec();
+    }
+
+    // 退出时导出采集指标
+    const QString metricsFile = qEnvironmentVariable("TEST_CAPTURE_METRICS_FILE");
+    if (!metricsFile.isEmpty()
+        && !CaptureMetricsRegistry::instance()->dumpToFile(metricsFile.toStdString())) {
+        qWarning() << "Failed to write capture metrics to" << metricsFile;
+    }
+    if (CaptureTracer::instance()->isEnabled()
+        && !CaptureTracer::instance()->dumpToFile(traceFile.toStdString())) {
+        qWarning() << "Failed to write the capture trace to" << traceFile;
+    }
+
+    return result;
 }
@@ -2,6 +2,8 @@
 #include "subwindow.h"
 #include "capture.h"
 #include "player.h"
+#include "recorder.h"
+#include "watermark.h"
 
 #include <private/qwaylandwindow_p.h>
 #include <private/qwaylanddisplay_p.h>
@@ -14,7 +16,6 @@
 #include <QStandardPaths>
 #include <QDateTime>
 #include <QDir>
-#include <QEventLoop>
 #include <QTimer>
 #include <QApplication>
 #include <QWindow>
@@ -43,6 +44,8 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    if (m_recorder)
+        m_recorder->stop();
     delete m_toolBar;
     delete m_player;
 }
@@ -56,10 +59,15 @@ void MainWindow::setupUI()
     m_watermark = new QLabel(this);
     m_watermark->setPixmap(QPixmap(":/watermark.png"));
     m_watermark->hide();
+    m_burnInWatermark = std::make_shared<Watermark>(QImage(":/watermark.png"));
+}
 
-    // 创建播放器窗口
-    m_player = new Player();
-    m_player->hide();
+Player *MainWindow::ensurePlayer()
+{
+    // 播放器会创建 OpenGL 上下文，截图用不到，录屏时才创建
+    if (!m_player)
+        m_player = new Player();
+    return m_player;
 }
 
 void MainWindow::setupConnections()
@@ -111,55 +119,69 @@ void MainWindow::handleCaptureFinish()
     if (manager->record()) {
         // 录屏模式
         auto session = captureContext->ensureSession();
+        startRecording(session);
         session->start();
-        m_player->setCaptureContext(captureContext);
+        ensurePlayer()->setCaptureContext(captureContext);
         QTimer::singleShot(1000, [manager] {
             Q_EMIT manager->recordStartedChanged();
         });
     } else {
         // 截图模式
-        auto frame = captureContext->ensureFrame();
-        QImage result;
-        QEventLoop loop;
-        
-        connect(frame, &TreelandCaptureFrame::ready,
-                this, [&result, &loop](QImage image) {
-                    result = image;
-                    loop.quit();
-                });
-                
-        connect(frame, &TreelandCaptureFrame::failed,
-                this, [&loop] {
-                    loop.quit();
-                });
-                
-        loop.exec();
-        
-        if (result.isNull()) {
-            qApp->exit(-1);
-            return;
-        }
-        
-        // 保存截图
         auto saveBasePath = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation);
         QDir saveBaseDir(saveBasePath);
         if (!saveBaseDir.exists()) {
             qApp->exit(-1);
             return;
         }
-        
-        QString picName = "portal screenshot - " + 
-                         QDateTime::currentDateTime().toString() + 
+
+        QString picName = "portal screenshot - " +
+                         QDateTime::currentDateTime().toString() +
                          ".png";
-                         
-        if (result.save(saveBaseDir.absoluteFilePath(picName), "PNG")) {
-            qDebug() << "Saved to:" << saveBaseDir.absoluteFilePath(picName);
-        } else {
-            qApp->exit(-1);
-        }
+        QString picPath = saveBaseDir.absoluteFilePath(picName);
+
+        // 异步截图，编码和写文件在线程池中完成
+        CaptureFileOptions options;
+        options.watermark = m_burnInWatermark;
+        captureContext->captureToFile(picPath, options).then(this, [picPath](bool saved) {
+            if (saved) {
+                qDebug() << "Saved to:" << picPath;
+            } else {
+                qApp->exit(-1);
+            }
+        });
     }
 }
 
+void MainWindow::startRecording(TreelandCaptureSession *session)
+{
+    if (!m_recorder) {
+        m_recorder = new Recorder(this);
+        connect(m_recorder, &Recorder::error, this, [](const QString &message) {
+            qWarning() << "Recording failed:" << message;
+        });
+        connect(qApp, &QCoreApplication::aboutToQuit, m_recorder, &Recorder::stop);
+    }
+
+    auto saveBasePath = QStandardPaths::writableLocation(QStandardPaths::MoviesLocation);
+    QDir saveBaseDir(saveBasePath);
+    if (!saveBaseDir.exists() && !saveBaseDir.mkpath(".")) {
+        qWarning() << "Record directory doesn't exist:" << saveBasePath;
+        return;
+    }
+
+    QString videoName = "portal recording - " +
+                        QDateTime::currentDateTime().toString() +
+                        "." + m_recorder->fileSuffix();
+
+    // 预览已经把帧导入为纹理，能用 GPU 转换 YUV 时就不再走 CPU
+    const bool gpuConversion = ensurePlayer()->initializeYuvConverter();
+    m_recorder->setConversion(gpuConversion ? Recorder::Conversion::Gpu
+                                            : Recorder::Conversion::Cpu);
+    m_player->setRecorder(gpuConversion ? m_recorder : nullptr);
+    m_recorder->setWatermark(m_burnInWatermark);
+    m_recorder->start(session, saveBaseDir.absoluteFilePath(videoName));
+}
+
 void MainWindow::slotRecoderShow()
 {
     if(m_player)
@@ -172,6 +194,7 @@ void MainWindow::onWatermarkToggled()
 {
     m_watermarkVisible = !m_watermarkVisible;
     m_watermark->setVisible(m_watermarkVisible);
+    m_burnInWatermark->setEnabled(m_watermarkVisible);
     m_watermarkBtn->setText(m_watermarkVisible ? "Hide watermark" : "Show watermark");
 }
 
@@ -194,6 +217,7 @@ void MainWindow::updateCaptureRegion()
     
     QRect region = context->captureRegion().toRect();
     m_watermark->setGeometry(region);
+    m_burnInWatermark->setLogicalSize(region.size());
 
 
     if(!m_toolBar)
@@ -7,6 +7,8 @@ class SubWindow;
 class QLabel;
 class QPushButton;
 class Player;
+class Recorder;
+class Watermark;
 
 class MainWindow : public QMainWindow
 {
@@ -29,12 +31,17 @@ private slots:
 private:
     void setupUI();
     void setupConnections();
+    void startRecording(TreelandCaptureSession *session);
+    Player *ensurePlayer();
 
     SubWindow *m_toolBar = nullptr;
     QLabel *m_watermark;
+    // 烧录进截图和录屏帧的水印，与 m_watermark 同步显示
+    std::shared_ptr<Watermark> m_burnInWatermark;
     QPushButton *m_watermarkBtn;
     QPushButton *m_recordBtn;
     QPushButton *m_finishBtn;
-    Player *m_player;
+    Player *m_player = nullptr;
+    Recorder *m_recorder = nullptr;
     bool m_watermarkVisible{false};
 };
@@ -0,0 +1,921 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "pixelconvert.h"
+
+#include <libdrm/drm_fourcc.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXELCONVERT_X86 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PIXELCONVERT_NEON 1
+#endif
+
+namespace {
+
+struct FormatInfo
+{
+    enum Kind {
+        Invalid,
+        Packed8888,
+        Packed2101010,
+    };
+
+    Kind kind{ Invalid };
+    // Packed8888: byte index of each channel within a pixel.
+    // Packed2101010: bit position of each 10 bit channel.
+    // alpha < 0 means the channel is padding and reads as opaque.
+    int red{ 0 };
+    int green{ 0 };
+    int blue{ 0 };
+    int alpha{ -1 };
+};
+
+FormatInfo formatInfo(uint32_t format)
+{
+    switch (format) {
+    case DRM_FORMAT_XRGB8888:
+        return { FormatInfo::Packed8888, 2, 1, 0, -1 };
+    case DRM_FORMAT_ARGB8888:
+        return { FormatInfo::Packed8888, 2, 1, 0, 3 };
+    case DRM_FORMAT_XBGR8888:
+        return { FormatInfo::Packed8888, 0, 1, 2, -1 };
+    case DRM_FORMAT_ABGR8888:
+        return { FormatInfo::Packed8888, 0, 1, 2, 3 };
+    case DRM_FORMAT_RGBX8888:
+        return { FormatInfo::Packed8888, 3, 2, 1, -1 };
+    case DRM_FORMAT_RGBA8888:
+        return { FormatInfo::Packed8888, 3, 2, 1, 0 };
+    case DRM_FORMAT_BGRX8888:
+        return { FormatInfo::Packed8888, 1, 2, 3, -1 };
+    case DRM_FORMAT_BGRA8888:
+        return { FormatInfo::Packed8888, 1, 2, 3, 0 };
+    case DRM_FORMAT_XRGB2101010:
+        return { FormatInfo::Packed2101010, 20, 10, 0, -1 };
+    case DRM_FORMAT_ARGB2101010:
+        return { FormatInfo::Packed2101010, 20, 10, 0, 30 };
+    case DRM_FORMAT_XBGR2101010:
+        return { FormatInfo::Packed2101010, 0, 10, 20, -1 };
+    case DRM_FORMAT_ABGR2101010:
+        return { FormatInfo::Packed2101010, 0, 10, 20, 30 };
+    default:
+        return {};
+    }
+}
+
+// Byte positions of red and blue in the unpacked output, green is always 1
+// and alpha always 3.
+struct OutputOrder
+{
+    int red;
+    int blue;
+};
+
+constexpr OutputOrder RgbaOrder{ 0, 2 };
+constexpr OutputOrder BgraOrder{ 2, 0 };
+
+inline uint32_t loadPixel(const uint8_t *src)
+{
+    uint32_t pixel;
+    std::memcpy(&pixel, src, sizeof(pixel));
+    return pixel;
+}
+
+// Scalar references, the vector kernels call them for the row tails.
+
+void unpack8888Scalar(const FormatInfo &info,
+                      OutputOrder order,
+                      const uint8_t *src,
+                      uint8_t *dst,
+                      uint32_t begin,
+                      uint32_t width)
+{
+    for (uint32_t x = begin; x < width; ++x) {
+        const uint8_t *s = src + size_t(x) * 4;
+        uint8_t *d = dst + size_t(x) * 4;
+        d[order.red] = s[info.red];
+        d[1] = s[info.green];
+        d[order.blue] = s[info.blue];
+        d[3] = info.alpha < 0 ? 0xff : s[info.alpha];
+    }
+}
+
+void unpack2101010Scalar(const FormatInfo &info,
+                         OutputOrder order,
+                         const uint8_t *src,
+                         uint8_t *dst,
+                         uint32_t begin,
+                         uint32_t width)
+{
+    for (uint32_t x = begin; x < width; ++x) {
+        const uint32_t pixel = loadPixel(src + size_t(x) * 4);
+        uint8_t *d = dst + size_t(x) * 4;
+        d[order.red] = uint8_t(pixel >> (info.red + 2));
+        d[1] = uint8_t(pixel >> (info.green + 2));
+        d[order.blue] = uint8_t(pixel >> (info.blue + 2));
+        d[3] = info.alpha < 0 ? 0xff : uint8_t((pixel >> 30) * 85);
+    }
+}
+
+inline uint8_t rgbToY(int r, int g, int b)
+{
+    return uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+inline uint8_t rgbToU(int r, int g, int b)
+{
+    return uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+inline uint8_t rgbToV(int r, int g, int b)
+{
+    return uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// Two RGBA rows to two luma rows and one chroma row. With Interleaved the
+// chroma goes to u as NV12 UV pairs and v is unused.
+template<bool Interleaved>
+void yuvRowScalar(const uint8_t *rgba0,
+                  const uint8_t *rgba1,
+                  uint32_t begin,
+                  uint32_t width,
+                  uint8_t *y0,
+                  uint8_t *y1,
+                  uint8_t *u,
+                  uint8_t *v)
+{
+    for (uint32_t x = begin; x < width; x += 2) {
+        const uint32_t x1 = x + 1 < width ? x + 1 : x;
+        const uint8_t *p[4] = { rgba0 + size_t(x) * 4,
+                                rgba0 + size_t(x1) * 4,
+                                rgba1 + size_t(x) * 4,
+                                rgba1 + size_t(x1) * 4 };
+        y0[x] = rgbToY(p[0][0], p[0][1], p[0][2]);
+        y1[x] = rgbToY(p[2][0], p[2][1], p[2][2]);
+        if (x1 != x) {
+            y0[x1] = rgbToY(p[1][0], p[1][1], p[1][2]);
+            y1[x1] = rgbToY(p[3][0], p[3][1], p[3][2]);
+        }
+
+        const int r = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+        const int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+        const int b = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+        if (Interleaved) {
+            u[x] = rgbToU(r, g, b);
+            u[x + 1] = rgbToV(r, g, b);
+        } else {
+            u[x / 2] = rgbToU(r, g, b);
+            v[x / 2] = rgbToV(r, g, b);
+        }
+    }
+}
+
+#ifdef PIXELCONVERT_X86
+
+void shuffleMask8888(const FormatInfo &info, OutputOrder order, uint8_t mask[16], uint8_t fill[16])
+{
+    for (int i = 0; i < 4; ++i) {
+        mask[i * 4 + order.red] = uint8_t(i * 4 + info.red);
+        mask[i * 4 + 1] = uint8_t(i * 4 + info.green);
+        mask[i * 4 + order.blue] = uint8_t(i * 4 + info.blue);
+        // 0x80 makes pshufb write a zero, the fill then sets it opaque
+        mask[i * 4 + 3] = info.alpha < 0 ? 0x80 : uint8_t(i * 4 + info.alpha);
+        for (int c = 0; c < 4; ++c)
+            fill[i * 4 + c] = c == 3 && info.alpha < 0 ? 0xff : 0;
+    }
+}
+
+__attribute__((target("sse4.1"))) void unpack8888Sse41(const FormatInfo &info,
+                                                        OutputOrder order,
+                                                        const uint8_t *src,
+                                                        uint8_t *dst,
+                                                        uint32_t width)
+{
+    alignas(16) uint8_t maskBytes[16];
+    alignas(16) uint8_t fillBytes[16];
+    shuffleMask8888(info, order, maskBytes, fillBytes);
+    const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i *>(maskBytes));
+    const __m128i fill = _mm_load_si128(reinterpret_cast<const __m128i *>(fillBytes));
+
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + size_t(x) * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + size_t(x) * 4),
+                         _mm_or_si128(_mm_shuffle_epi8(pixels, mask), fill));
+    }
+    unpack8888Scalar(info, order, src, dst, x, width);
+}
+
+__attribute__((target("avx2"))) void unpack8888Avx2(const FormatInfo &info,
+                                                     OutputOrder order,
+                                                     const uint8_t *src,
+                                                     uint8_t *dst,
+                                                     uint32_t width)
+{
+    alignas(16) uint8_t maskBytes[16];
+    alignas(16) uint8_t fillBytes[16];
+    shuffleMask8888(info, order, maskBytes, fillBytes);
+    // vpshufb works per 128 bit lane, which never splits a pixel
+    const __m256i mask = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(maskBytes)));
+    const __m256i fill = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(fillBytes)));
+
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i pixels =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + size_t(x) * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + size_t(x) * 4),
+                            _mm256_or_si256(_mm256_shuffle_epi8(pixels, mask), fill));
+    }
+    unpack8888Scalar(info, order, src, dst, x, width);
+}
+
+__attribute__((target("sse4.1"))) void unpack2101010Sse41(const FormatInfo &info,
+                                                           OutputOrder order,
+                                                           const uint8_t *src,
+                                                           uint8_t *dst,
+                                                           uint32_t width)
+{
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    const __m128i redShift = _mm_cvtsi32_si128(info.red + 2);
+    const __m128i greenShift = _mm_cvtsi32_si128(info.green + 2);
+    const __m128i blueShift = _mm_cvtsi32_si128(info.blue + 2);
+    const __m128i redPosition = _mm_cvtsi32_si128(order.red * 8);
+    const __m128i bluePosition = _mm_cvtsi32_si128(order.blue * 8);
+    const __m128i opaque = _mm_set1_epi32(int(0xff000000u));
+
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + size_t(x) * 4));
+        const __m128i red = _mm_and_si128(_mm_srl_epi32(pixels, redShift), byteMask);
+        const __m128i green = _mm_and_si128(_mm_srl_epi32(pixels, greenShift), byteMask);
+        const __m128i blue = _mm_and_si128(_mm_srl_epi32(pixels, blueShift), byteMask);
+        __m128i out = _mm_or_si128(_mm_sll_epi32(red, redPosition), _mm_slli_epi32(green, 8));
+        out = _mm_or_si128(out, _mm_sll_epi32(blue, bluePosition));
+        if (info.alpha < 0) {
+            out = _mm_or_si128(out, opaque);
+        } else {
+            // a * 85 for the 2 bit alpha is the bit pattern repeated 4 times
+            const __m128i a = _mm_srli_epi32(pixels, 30);
+            __m128i alpha = _mm_or_si128(a, _mm_slli_epi32(a, 2));
+            alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 4));
+            out = _mm_or_si128(out, _mm_slli_epi32(alpha, 24));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + size_t(x) * 4), out);
+    }
+    unpack2101010Scalar(info, order, src, dst, x, width);
+}
+
+__attribute__((target("avx2"))) void unpack2101010Avx2(const FormatInfo &info,
+                                                        OutputOrder order,
+                                                        const uint8_t *src,
+                                                        uint8_t *dst,
+                                                        uint32_t width)
+{
+    const __m256i byteMask = _mm256_set1_epi32(0xff);
+    const __m128i redShift = _mm_cvtsi32_si128(info.red + 2);
+    const __m128i greenShift = _mm_cvtsi32_si128(info.green + 2);
+    const __m128i blueShift = _mm_cvtsi32_si128(info.blue + 2);
+    const __m128i redPosition = _mm_cvtsi32_si128(order.red * 8);
+    const __m128i bluePosition = _mm_cvtsi32_si128(order.blue * 8);
+    const __m256i opaque = _mm256_set1_epi32(int(0xff000000u));
+
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i pixels =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + size_t(x) * 4));
+        const __m256i red = _mm256_and_si256(_mm256_srl_epi32(pixels, redShift), byteMask);
+        const __m256i green = _mm256_and_si256(_mm256_srl_epi32(pixels, greenShift), byteMask);
+        const __m256i blue = _mm256_and_si256(_mm256_srl_epi32(pixels, blueShift), byteMask);
+        __m256i out =
+            _mm256_or_si256(_mm256_sll_epi32(red, redPosition), _mm256_slli_epi32(green, 8));
+        out = _mm256_or_si256(out, _mm256_sll_epi32(blue, bluePosition));
+        if (info.alpha < 0) {
+            out = _mm256_or_si256(out, opaque);
+        } else {
+            const __m256i a = _mm256_srli_epi32(pixels, 30);
+            __m256i alpha = _mm256_or_si256(a, _mm256_slli_epi32(a, 2));
+            alpha = _mm256_or_si256(alpha, _mm256_slli_epi32(alpha, 4));
+            out = _mm256_or_si256(out, _mm256_slli_epi32(alpha, 24));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + size_t(x) * 4), out);
+    }
+    unpack2101010Scalar(info, order, src, dst, x, width);
+}
+
+// 8 luma values of 8 RGBA pixels held as 16 bit R, G, B lanes.
+__attribute__((target("sse4.1"))) inline __m128i lumaSse41(__m128i r, __m128i g, __m128i b)
+{
+    // The sum stays below 65536, so wrapping 16 bit math is exact.
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+    y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(y, _mm_set1_epi16(16));
+}
+
+// Chroma from 16 bit 2x2 sums, signed math stays within int16.
+__attribute__((target("sse4.1"))) inline void chromaSse41(__m128i rSum,
+                                                          __m128i gSum,
+                                                          __m128i bSum,
+                                                          __m128i *u,
+                                                          __m128i *v)
+{
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i r = _mm_srli_epi16(_mm_add_epi16(rSum, two), 2);
+    const __m128i g = _mm_srli_epi16(_mm_add_epi16(gSum, two), 2);
+    const __m128i b = _mm_srli_epi16(_mm_add_epi16(bSum, two), 2);
+    const __m128i round = _mm_set1_epi16(128);
+
+    __m128i uu = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(-38)),
+                               _mm_mullo_epi16(g, _mm_set1_epi16(-74)));
+    uu = _mm_add_epi16(uu, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)), round));
+    *u = _mm_add_epi16(_mm_srai_epi16(uu, 8), round);
+
+    __m128i vv = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)),
+                               _mm_mullo_epi16(g, _mm_set1_epi16(-94)));
+    vv = _mm_add_epi16(vv, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(-18)), round));
+    *v = _mm_add_epi16(_mm_srai_epi16(vv, 8), round);
+}
+
+// Splits 8 RGBA pixels into 16 bit R, G and B lanes in pixel order.
+__attribute__((target("sse4.1"))) inline void splitRgbSse41(const uint8_t *rgba,
+                                                            __m128i *r,
+                                                            __m128i *g,
+                                                            __m128i *b)
+{
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgba));
+    const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgba + 16));
+    *r = _mm_packs_epi32(_mm_and_si128(p0, byteMask), _mm_and_si128(p1, byteMask));
+    *g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), byteMask),
+                         _mm_and_si128(_mm_srli_epi32(p1, 8), byteMask));
+    *b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), byteMask),
+                         _mm_and_si128(_mm_srli_epi32(p1, 16), byteMask));
+}
+
+template<bool Interleaved>
+__attribute__((target("sse4.1"))) void yuvRowSse41(const uint8_t *rgba0,
+                                                   const uint8_t *rgba1,
+                                                   uint32_t width,
+                                                   uint8_t *y0,
+                                                   uint8_t *y1,
+                                                   uint8_t *u,
+                                                   uint8_t *v)
+{
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i r0, g0, b0, r1, g1, b1;
+        splitRgbSse41(rgba0 + size_t(x) * 4, &r0, &g0, &b0);
+        splitRgbSse41(rgba1 + size_t(x) * 4, &r1, &g1, &b1);
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(y0 + x),
+                         _mm_packus_epi16(lumaSse41(r0, g0, b0), _mm_setzero_si128()));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(y1 + x),
+                         _mm_packus_epi16(lumaSse41(r1, g1, b1), _mm_setzero_si128()));
+
+        // Vertical sums, then horizontal pairs land in the low 4 lanes
+        const __m128i rSum = _mm_add_epi16(r0, r1);
+        const __m128i gSum = _mm_add_epi16(g0, g1);
+        const __m128i bSum = _mm_add_epi16(b0, b1);
+        __m128i uu, vv;
+        chromaSse41(_mm_hadd_epi16(rSum, rSum),
+                    _mm_hadd_epi16(gSum, gSum),
+                    _mm_hadd_epi16(bSum, bSum),
+                    &uu,
+                    &vv);
+        if (Interleaved) {
+            const __m128i uv = _mm_unpacklo_epi8(_mm_packus_epi16(uu, uu), _mm_packus_epi16(vv, vv));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(u + x), uv);
+        } else {
+            const int uBytes = _mm_cvtsi128_si32(_mm_packus_epi16(uu, uu));
+            const int vBytes = _mm_cvtsi128_si32(_mm_packus_epi16(vv, vv));
+            std::memcpy(u + x / 2, &uBytes, 4);
+            std::memcpy(v + x / 2, &vBytes, 4);
+        }
+    }
+    yuvRowScalar<Interleaved>(rgba0, rgba1, x, width, y0, y1, u, v);
+}
+
+// Splits 16 RGBA pixels into 16 bit R, G and B lanes in pixel order.
+__attribute__((target("avx2"))) inline void splitRgbAvx2(const uint8_t *rgba,
+                                                         __m256i *r,
+                                                         __m256i *g,
+                                                         __m256i *b)
+{
+    const __m256i byteMask = _mm256_set1_epi32(0xff);
+    const __m256i p0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rgba));
+    const __m256i p1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rgba + 32));
+    // packs works per 128 bit lane, the permute restores the pixel order
+    *r = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(_mm256_and_si256(p0, byteMask), _mm256_and_si256(p1, byteMask)),
+        0xd8);
+    *g = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 8), byteMask),
+                           _mm256_and_si256(_mm256_srli_epi32(p1, 8), byteMask)),
+        0xd8);
+    *b = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 16), byteMask),
+                           _mm256_and_si256(_mm256_srli_epi32(p1, 16), byteMask)),
+        0xd8);
+}
+
+__attribute__((target("avx2"))) inline __m128i lumaAvx2(__m256i r, __m256i g, __m256i b)
+{
+    __m256i y = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)),
+                                 _mm256_mullo_epi16(g, _mm256_set1_epi16(129)));
+    y = _mm256_add_epi16(y, _mm256_mullo_epi16(b, _mm256_set1_epi16(25)));
+    y = _mm256_srli_epi16(_mm256_add_epi16(y, _mm256_set1_epi16(128)), 8);
+    y = _mm256_add_epi16(y, _mm256_set1_epi16(16));
+    const __m256i packed =
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(y, _mm256_setzero_si256()), 0xd8);
+    return _mm256_castsi256_si128(packed);
+}
+
+// Horizontal pair sums of 16 lanes, in order, in the returned 8 lanes.
+__attribute__((target("avx2"))) inline __m128i pairSumsAvx2(__m256i sum)
+{
+    return _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_hadd_epi16(sum, sum), 0xd8));
+}
+
+template<bool Interleaved>
+__attribute__((target("avx2"))) void yuvRowAvx2(const uint8_t *rgba0,
+                                                const uint8_t *rgba1,
+                                                uint32_t width,
+                                                uint8_t *y0,
+                                                uint8_t *y1,
+                                                uint8_t *u,
+                                                uint8_t *v)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i r0, g0, b0, r1, g1, b1;
+        splitRgbAvx2(rgba0 + size_t(x) * 4, &r0, &g0, &b0);
+        splitRgbAvx2(rgba1 + size_t(x) * 4, &r1, &g1, &b1);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y0 + x), lumaAvx2(r0, g0, b0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y1 + x), lumaAvx2(r1, g1, b1));
+
+        __m128i uu, vv;
+        chromaSse41(pairSumsAvx2(_mm256_add_epi16(r0, r1)),
+                    pairSumsAvx2(_mm256_add_epi16(g0, g1)),
+                    pairSumsAvx2(_mm256_add_epi16(b0, b1)),
+                    &uu,
+                    &vv);
+        const __m128i uBytes = _mm_packus_epi16(uu, uu);
+        const __m128i vBytes = _mm_packus_epi16(vv, vv);
+        if (Interleaved) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(u + x), _mm_unpacklo_epi8(uBytes, vBytes));
+        } else {
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), uBytes);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), vBytes);
+        }
+    }
+    yuvRowScalar<Interleaved>(rgba0, rgba1, x, width, y0, y1, u, v);
+}
+
+// dst = src + dst * inverseAlpha / 255 on 16 bytes, with the division
+// rounded exactly like blendScalar does it.
+__attribute__((target("sse4.1"))) inline __m128i blendBytesSse41(__m128i dst,
+                                                                 __m128i src,
+                                                                 __m128i inverseAlpha)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(inverseAlpha, zero));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(inverseAlpha, zero));
+    lo = _mm_add_epi16(lo, half);
+    hi = _mm_add_epi16(hi, half);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    return _mm_adds_epu8(_mm_packus_epi16(lo, hi), src);
+}
+
+__attribute__((target("sse4.1"))) size_t blendSse41(uint8_t *dst,
+                                                    const uint8_t *src,
+                                                    const uint8_t *inverseAlpha,
+                                                    size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto *d = reinterpret_cast<__m128i *>(dst + i);
+        const __m128i blended =
+            blendBytesSse41(_mm_loadu_si128(d),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(inverseAlpha + i)));
+        _mm_storeu_si128(d, blended);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t blendAvx2(uint8_t *dst,
+                                                 const uint8_t *src,
+                                                 const uint8_t *inverseAlpha,
+                                                 size_t count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi16(128);
+    size_t i = 0;
+    // unpack and pack both work per 128 bit lane, so the byte order survives
+    for (; i + 32 <= count; i += 32) {
+        auto *d = reinterpret_cast<__m256i *>(dst + i);
+        const __m256i dv = _mm256_loadu_si256(d);
+        const __m256i av = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(inverseAlpha + i));
+        __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(dv, zero), _mm256_unpacklo_epi8(av, zero));
+        __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(dv, zero), _mm256_unpackhi_epi8(av, zero));
+        lo = _mm256_add_epi16(lo, half);
+        hi = _mm256_add_epi16(hi, half);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+        const __m256i sv = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(d, _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), sv));
+    }
+    return i;
+}
+
+#endif // PIXELCONVERT_X86
+
+#ifdef PIXELCONVERT_NEON
+
+void unpack8888Neon(const FormatInfo &info,
+                    OutputOrder order,
+                    const uint8_t *src,
+                    uint8_t *dst,
+                    uint32_t width)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x4_t in = vld4q_u8(src + size_t(x) * 4);
+        uint8x16x4_t out;
+        out.val[order.red] = in.val[info.red];
+        out.val[1] = in.val[info.green];
+        out.val[order.blue] = in.val[info.blue];
+        out.val[3] = info.alpha < 0 ? vdupq_n_u8(0xff) : in.val[info.alpha];
+        vst4q_u8(dst + size_t(x) * 4, out);
+    }
+    unpack8888Scalar(info, order, src, dst, x, width);
+}
+
+void unpack2101010Neon(const FormatInfo &info,
+                       OutputOrder order,
+                       const uint8_t *src,
+                       uint8_t *dst,
+                       uint32_t width)
+{
+    // Negative shift counts shift right
+    const int32x4_t redShift = vdupq_n_s32(-(info.red + 2));
+    const int32x4_t greenShift = vdupq_n_s32(-(info.green + 2));
+    const int32x4_t blueShift = vdupq_n_s32(-(info.blue + 2));
+    const int32x4_t redPosition = vdupq_n_s32(order.red * 8);
+    const int32x4_t bluePosition = vdupq_n_s32(order.blue * 8);
+    const uint32x4_t byteMask = vdupq_n_u32(0xff);
+
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const uint32x4_t pixels = vld1q_u32(reinterpret_cast<const uint32_t *>(src + size_t(x) * 4));
+        const uint32x4_t red = vandq_u32(vshlq_u32(pixels, redShift), byteMask);
+        const uint32x4_t green = vandq_u32(vshlq_u32(pixels, greenShift), byteMask);
+        const uint32x4_t blue = vandq_u32(vshlq_u32(pixels, blueShift), byteMask);
+        uint32x4_t out = vorrq_u32(vshlq_u32(red, redPosition), vshlq_n_u32(green, 8));
+        out = vorrq_u32(out, vshlq_u32(blue, bluePosition));
+        if (info.alpha < 0) {
+            out = vorrq_u32(out, vdupq_n_u32(0xff000000u));
+        } else {
+            const uint32x4_t a = vshrq_n_u32(pixels, 30);
+            uint32x4_t alpha = vorrq_u32(a, vshlq_n_u32(a, 2));
+            alpha = vorrq_u32(alpha, vshlq_n_u32(alpha, 4));
+            out = vorrq_u32(out, vshlq_n_u32(alpha, 24));
+        }
+        vst1q_u32(reinterpret_cast<uint32_t *>(dst + size_t(x) * 4), out);
+    }
+    unpack2101010Scalar(info, order, src, dst, x, width);
+}
+
+inline uint16x8_t lumaNeon(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+    uint16x8_t y = vmull_u8(r, vdup_n_u8(66));
+    y = vmlal_u8(y, g, vdup_n_u8(129));
+    y = vmlal_u8(y, b, vdup_n_u8(25));
+    y = vshrq_n_u16(vaddq_u16(y, vdupq_n_u16(128)), 8);
+    return vaddq_u16(y, vdupq_n_u16(16));
+}
+
+inline uint8x16_t lumaNeon(uint8x16_t r, uint8x16_t g, uint8x16_t b)
+{
+    return vcombine_u8(vmovn_u16(lumaNeon(vget_low_u8(r), vget_low_u8(g), vget_low_u8(b))),
+                       vmovn_u16(lumaNeon(vget_high_u8(r), vget_high_u8(g), vget_high_u8(b))));
+}
+
+template<bool Interleaved>
+void yuvRowNeon(const uint8_t *rgba0,
+                const uint8_t *rgba1,
+                uint32_t width,
+                uint8_t *y0,
+                uint8_t *y1,
+                uint8_t *u,
+                uint8_t *v)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x4_t p0 = vld4q_u8(rgba0 + size_t(x) * 4);
+        const uint8x16x4_t p1 = vld4q_u8(rgba1 + size_t(x) * 4);
+        vst1q_u8(y0 + x, lumaNeon(p0.val[0], p0.val[1], p0.val[2]));
+        vst1q_u8(y1 + x, lumaNeon(p1.val[0], p1.val[1], p1.val[2]));
+
+        // Rounding shift is (sum + 2) >> 2 like the scalar code
+        const int16x8_t r = vreinterpretq_s16_u16(
+            vrshrq_n_u16(vaddq_u16(vpaddlq_u8(p0.val[0]), vpaddlq_u8(p1.val[0])), 2));
+        const int16x8_t g = vreinterpretq_s16_u16(
+            vrshrq_n_u16(vaddq_u16(vpaddlq_u8(p0.val[1]), vpaddlq_u8(p1.val[1])), 2));
+        const int16x8_t b = vreinterpretq_s16_u16(
+            vrshrq_n_u16(vaddq_u16(vpaddlq_u8(p0.val[2]), vpaddlq_u8(p1.val[2])), 2));
+        const int16x8_t round = vdupq_n_s16(128);
+
+        int16x8_t uu = vmulq_n_s16(r, -38);
+        uu = vmlaq_n_s16(uu, g, -74);
+        uu = vmlaq_n_s16(uu, b, 112);
+        uu = vaddq_s16(vshrq_n_s16(vaddq_s16(uu, round), 8), round);
+        int16x8_t vv = vmulq_n_s16(r, 112);
+        vv = vmlaq_n_s16(vv, g, -94);
+        vv = vmlaq_n_s16(vv, b, -18);
+        vv = vaddq_s16(vshrq_n_s16(vaddq_s16(vv, round), 8), round);
+
+        const uint8x8_t uBytes = vqmovun_s16(uu);
+        const uint8x8_t vBytes = vqmovun_s16(vv);
+        if (Interleaved) {
+            vst2_u8(u + x, uint8x8x2_t{ { uBytes, vBytes } });
+        } else {
+            vst1_u8(u + x / 2, uBytes);
+            vst1_u8(v + x / 2, vBytes);
+        }
+    }
+    yuvRowScalar<Interleaved>(rgba0, rgba1, x, width, y0, y1, u, v);
+}
+
+size_t blendNeon(uint8_t *dst, const uint8_t *src, const uint8_t *inverseAlpha, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const uint8x16_t d = vld1q_u8(dst + i);
+        const uint8x16_t a = vld1q_u8(inverseAlpha + i);
+        uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(d), vget_low_u8(a)), vdupq_n_u16(128));
+        uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(d), vget_high_u8(a)), vdupq_n_u16(128));
+        const uint8x16_t scaled = vcombine_u8(vshrn_n_u16(vsraq_n_u16(lo, lo, 8), 8),
+                                              vshrn_n_u16(vsraq_n_u16(hi, hi, 8), 8));
+        vst1q_u8(dst + i, vqaddq_u8(scaled, vld1q_u8(src + i)));
+    }
+    return i;
+}
+
+#endif // PIXELCONVERT_NEON
+
+// Exact x / 255 rounded to nearest for x in [0, 255 * 255].
+inline uint8_t divide255(uint32_t x)
+{
+    x += 128;
+    return uint8_t((x + (x >> 8)) >> 8);
+}
+
+void blendScalar(uint8_t *dst, const uint8_t *src, const uint8_t *inverseAlpha, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = uint8_t(std::min(255u, src[i] + uint32_t(divide255(dst[i] * inverseAlpha[i]))));
+}
+
+void unpackRow(SimdLevel level,
+               const FormatInfo &info,
+               OutputOrder order,
+               const uint8_t *src,
+               uint8_t *dst,
+               uint32_t width)
+{
+    const bool packed8888 = info.kind == FormatInfo::Packed8888;
+    switch (level) {
+#ifdef PIXELCONVERT_X86
+    case SimdLevel::Avx2:
+        return packed8888 ? unpack8888Avx2(info, order, src, dst, width)
+                          : unpack2101010Avx2(info, order, src, dst, width);
+    case SimdLevel::Sse41:
+        return packed8888 ? unpack8888Sse41(info, order, src, dst, width)
+                          : unpack2101010Sse41(info, order, src, dst, width);
+#endif
+#ifdef PIXELCONVERT_NEON
+    case SimdLevel::Neon:
+        return packed8888 ? unpack8888Neon(info, order, src, dst, width)
+                          : unpack2101010Neon(info, order, src, dst, width);
+#endif
+    default:
+        return packed8888 ? unpack8888Scalar(info, order, src, dst, 0, width)
+                          : unpack2101010Scalar(info, order, src, dst, 0, width);
+    }
+}
+
+template<bool Interleaved>
+void yuvRow(SimdLevel level,
+            const uint8_t *rgba0,
+            const uint8_t *rgba1,
+            uint32_t width,
+            uint8_t *y0,
+            uint8_t *y1,
+            uint8_t *u,
+            uint8_t *v)
+{
+    switch (level) {
+#ifdef PIXELCONVERT_X86
+    case SimdLevel::Avx2:
+        return yuvRowAvx2<Interleaved>(rgba0, rgba1, width, y0, y1, u, v);
+    case SimdLevel::Sse41:
+        return yuvRowSse41<Interleaved>(rgba0, rgba1, width, y0, y1, u, v);
+#endif
+#ifdef PIXELCONVERT_NEON
+    case SimdLevel::Neon:
+        return yuvRowNeon<Interleaved>(rgba0, rgba1, width, y0, y1, u, v);
+#endif
+    default:
+        return yuvRowScalar<Interleaved>(rgba0, rgba1, 0, width, y0, y1, u, v);
+    }
+}
+
+bool convertToPacked(SimdLevel level,
+                     uint32_t format,
+                     OutputOrder order,
+                     const uint8_t *src,
+                     size_t srcStride,
+                     uint32_t width,
+                     uint32_t height,
+                     uint8_t *dst,
+                     size_t dstStride)
+{
+    const FormatInfo info = formatInfo(format);
+    if (info.kind == FormatInfo::Invalid)
+        return false;
+    for (uint32_t y = 0; y < height; ++y)
+        unpackRow(level, info, order, src + srcStride * y, dst + dstStride * y, width);
+    return true;
+}
+
+// Shared by I420 and NV12, for NV12 dstU holds the UV pairs and dstV is unused.
+template<bool Interleaved>
+bool convertToYuv420(SimdLevel level,
+                     uint32_t format,
+                     const uint8_t *src,
+                     size_t srcStride,
+                     uint32_t width,
+                     uint32_t height,
+                     uint8_t *dstY,
+                     size_t strideY,
+                     uint8_t *dstU,
+                     size_t strideU,
+                     uint8_t *dstV,
+                     size_t strideV)
+{
+    const FormatInfo info = formatInfo(format);
+    if (info.kind == FormatInfo::Invalid)
+        return false;
+
+    // Sources that already are R, G, B, A in memory are read in place.
+    const bool direct = info.kind == FormatInfo::Packed8888 && info.red == 0 && info.green == 1
+        && info.blue == 2;
+    std::vector<uint8_t> rows;
+    if (!direct)
+        rows.resize(size_t(width) * 4 * 2);
+
+    for (uint32_t y = 0; y < height; y += 2) {
+        const bool pair = y + 1 < height;
+        const uint8_t *src0 = src + srcStride * y;
+        const uint8_t *src1 = pair ? src0 + srcStride : src0;
+        const uint8_t *rgba0 = src0;
+        const uint8_t *rgba1 = src1;
+        if (!direct) {
+            unpackRow(level, info, RgbaOrder, src0, rows.data(), width);
+            if (pair)
+                unpackRow(level, info, RgbaOrder, src1, rows.data() + size_t(width) * 4, width);
+            rgba0 = rows.data();
+            rgba1 = pair ? rgba0 + size_t(width) * 4 : rgba0;
+        }
+
+        uint8_t *y0 = dstY + strideY * y;
+        uint8_t *y1 = pair ? y0 + strideY : y0;
+        uint8_t *u = dstU + strideU * (y / 2);
+        uint8_t *v = Interleaved ? nullptr : dstV + strideV * (y / 2);
+        yuvRow<Interleaved>(level, rgba0, rgba1, width, y0, y1, u, v);
+    }
+    return true;
+}
+
+} // namespace
+
+bool isPixelConvertSupported(uint32_t drmFormat)
+{
+    return formatInfo(drmFormat).kind != FormatInfo::Invalid;
+}
+
+bool convertToRgba(SimdLevel level,
+                   uint32_t drmFormat,
+                   const uint8_t *src,
+                   size_t srcStride,
+                   uint32_t width,
+                   uint32_t height,
+                   uint8_t *dst,
+                   size_t dstStride)
+{
+    return convertToPacked(level, drmFormat, RgbaOrder, src, srcStride, width, height, dst, dstStride);
+}
+
+bool convertToBgra(SimdLevel level,
+                   uint32_t drmFormat,
+                   const uint8_t *src,
+                   size_t srcStride,
+                   uint32_t width,
+                   uint32_t height,
+                   uint8_t *dst,
+                   size_t dstStride)
+{
+    return convertToPacked(level, drmFormat, BgraOrder, src, srcStride, width, height, dst, dstStride);
+}
+
+bool convertToI420(SimdLevel level,
+                   uint32_t drmFormat,
+                   const uint8_t *src,
+                   size_t srcStride,
+                   uint32_t width,
+                   uint32_t height,
+                   uint8_t *dstY,
+                   size_t strideY,
+                   uint8_t *dstU,
+                   size_t strideU,
+                   uint8_t *dstV,
+                   size_t strideV)
+{
+    return convertToYuv420<false>(level,
+                                  drmFormat,
+                                  src,
+                                  srcStride,
+                                  width,
+                                  height,
+                                  dstY,
+                                  strideY,
+                                  dstU,
+                                  strideU,
+                                  dstV,
+                                  strideV);
+}
+
+bool convertToNv12(SimdLevel level,
+                   uint32_t drmFormat,
+                   const uint8_t *src,
+                   size_t srcStride,
+                   uint32_t width,
+                   uint32_t height,
+                   uint8_t *dstY,
+                   size_t strideY,
+                   uint8_t *dstUV,
+                   size_t strideUV)
+{
+    return convertToYuv420<true>(level,
+                                 drmFormat,
+                                 src,
+                                 srcStride,
+                                 width,
+                                 height,
+                                 dstY,
+                                 strideY,
+                                 dstUV,
+                                 strideUV,
+                                 nullptr,
+                                 0);
+}
+
+void blendPremultiplied(SimdLevel level,
+                        uint8_t *dst,
+                        const uint8_t *src,
+                        const uint8_t *inverseAlpha,
+                        size_t count)
+{
+    size_t done = 0;
+    switch (level) {
+#ifdef PIXELCONVERT_X86
+    case SimdLevel::Avx2:
+        done = blendAvx2(dst, src, inverseAlpha, count);
+        break;
+    case SimdLevel::Sse41:
+        done = blendSse41(dst, src, inverseAlpha, count);
+        break;
+#endif
+#ifdef PIXELCONVERT_NEON
+    case SimdLevel::Neon:
+        done = blendNeon(dst, src, inverseAlpha, count);
+        break;
+#endif
+    default:
+        break;
+    }
+    blendScalar(dst + done, src + done, inverseAlpha + done, count - done);
+}
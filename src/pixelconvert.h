@@ -0,0 +1,73 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "cpufeatures.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Conversion of captured buffers to what the preview and the encoders need.
+// Sources are the packed 8888 and 2101010 RGB DRM fourccs, src points at the
+// first pixel (mapping + plane offset) and rows are srcStride bytes apart.
+// 10 bit sources keep their 8 most significant bits. YUV output is BT.601
+// limited range with each chroma sample averaging a 2x2 block, odd sizes
+// repeat the last column and row. All functions return false for formats
+// they can't read, and every SimdLevel produces identical output.
+
+bool isPixelConvertSupported(uint32_t drmFormat);
+
+// R, G, B, A byte order, i.e. GL_RGBA / QImage::Format_RGBA8888
+bool convertToRgba(SimdLevel level,
+                   uint32_t drmFormat,
+                   const uint8_t *src,
+                   size_t srcStride,
+                   uint32_t width,
+                   uint32_t height,
+                   uint8_t *dst,
+                   size_t dstStride);
+
+// B, G, R, A byte order, i.e. QImage::Format_ARGB32 on little endian
+bool convertToBgra(SimdLevel level,
+                   uint32_t drmFormat,
+                   const uint8_t *src,
+                   size_t srcStride,
+                   uint32_t width,
+                   uint32_t height,
+                   uint8_t *dst,
+                   size_t dstStride);
+
+bool convertToI420(SimdLevel level,
+                   uint32_t drmFormat,
+                   const uint8_t *src,
+                   size_t srcStride,
+                   uint32_t width,
+                   uint32_t height,
+                   uint8_t *dstY,
+                   size_t strideY,
+                   uint8_t *dstU,
+                   size_t strideU,
+                   uint8_t *dstV,
+                   size_t strideV);
+
+bool convertToNv12(SimdLevel level,
+                   uint32_t drmFormat,
+                   const uint8_t *src,
+                   size_t srcStride,
+                   uint32_t width,
+                   uint32_t height,
+                   uint8_t *dstY,
+                   size_t strideY,
+                   uint8_t *dstUV,
+                   size_t strideUV);
+
+// Premultiplied source-over on raw bytes: dst = src + dst * inverseAlpha / 255
+// for each of the count bytes. The caller lays src and inverseAlpha out like
+// dst, so the same kernel serves packed pixels (the alpha repeated for each
+// channel) and single planes.
+void blendPremultiplied(SimdLevel level,
+                        uint8_t *dst,
+                        const uint8_t *src,
+                        const uint8_t *inverseAlpha,
+                        size_t count);
@@ -2,18 +2,35 @@
 // SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
 #include "player.h"
 #include "capture.h"
+#include "capturetrace.h"
+#include "gpuyuvconverter.h"
+#include "pixelconvert.h"
+#include "previewrenderer.h"
+#include "recorder.h"
+#include "watermark.h"
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <libdrm/drm_fourcc.h>
 
-#include <QPainter>
+#include <QEvent>
+#include <QOffscreenSurface>
+#include <QTimer>
+#include <QWindow>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 
-#include <unistd.h>
-#include <sys/mman.h>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Regions larger than this are previewed scaled down
+constexpr QSize MaxPreviewSize(960, 540);
+
+} // namespace
 
 Player::Player(QWidget *parent)
     : QWidget(parent)
@@ -24,23 +41,32 @@ Player::Player(QWidget *parent)
     setAttribute(Qt::WA_NoSystemBackground);
     setAutoFillBackground(false);
 
-    // 设置 OpenGL 格式
+    // 设置 OpenGL 格式，上下文等第一次渲染或转换时再创建
     QSurfaceFormat format;
     format.setRenderableType(QSurfaceFormat::OpenGLES);
     format.setVersion(2, 0);
     format.setSwapBehavior(QSurfaceFormat::DoubleBuffer);
     QSurfaceFormat::setDefaultFormat(format);
 
-    // 创建 OpenGL 上下文
-    m_context = new QOpenGLContext(this);
-    m_context->setFormat(format);
-    if (!m_context->create()) {
-        qWarning() << "Failed to create OpenGL context";
-        return;
-    }
-
     // 确保创建原生窗口
     winId();
+    windowHandle()->installEventFilter(this);
+
+    m_throttleTimer = new QTimer(this);
+    m_throttleTimer->setSingleShot(true);
+    connect(m_throttleTimer, &QTimer::timeout, this, [this] {
+        if (windowHandle())
+            windowHandle()->requestUpdate();
+    });
+
+    // Readbacks still in flight when frames stop coming are polled
+    m_readbackTimer = new QTimer(this);
+    m_readbackTimer->setSingleShot(true);
+    m_readbackTimer->setInterval(4);
+    connect(m_readbackTimer,
+            &QTimer::timeout,
+            this,
+            std::bind(&Player::collectReadbacks, this, false));
 
     setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
     resize(400, 300);
@@ -48,9 +74,34 @@ Player::Player(QWidget *parent)
 
 Player::~Player()
 {
-    if (m_textureId) {
-        glDeleteTextures(1, &m_textureId);
+    setDamageSession(nullptr);
+    if (m_yuvConverter && m_context->makeCurrent(m_offscreenSurface)) {
+        m_yuvConverter->release();
+        m_context->doneCurrent();
+    }
+    if ((m_previewRenderer || m_uploadTextureId || !m_importedBuffers.empty()) && windowHandle()
+        && m_context->makeCurrent(windowHandle())) {
+        if (m_previewRenderer)
+            m_previewRenderer->release();
+        releaseImportedBuffers();
+        if (m_uploadTextureId)
+            glDeleteTextures(1, &m_uploadTextureId);
+        m_context->doneCurrent();
+    }
+}
+
+bool Player::ensureContext()
+{
+    if (m_context)
+        return m_context->isValid();
+
+    m_context = new QOpenGLContext(this);
+    m_context->setFormat(QSurfaceFormat::defaultFormat());
+    if (!m_context->create()) {
+        qWarning() << "Failed to create OpenGL context";
+        return false;
     }
+    return true;
 }
 
 TreelandCaptureContext *Player::captureContext() const
@@ -65,8 +116,13 @@ void Player::setCaptureContext(TreelandCaptureContext *context)
 
     if (m_captureContext) {
         m_captureContext->disconnect(this);
+        if (m_captureContext->session())
+            m_captureContext->session()->disconnect(this);
     }
 
+    setDamageSession(nullptr);
+    m_uploadedSequence = 0;
+    m_textureFrame.reset();
     m_captureContext = context;
 
     if (m_captureContext) {
@@ -79,7 +135,7 @@ void Player::setCaptureContext(TreelandCaptureContext *context)
             connect(m_captureContext->session(),
                     &TreelandCaptureSession::ready,
                     this,
-                    [this]() { update(); });
+                    &Player::handleFrameReady);
         }
 
         connect(m_captureContext.data(),
@@ -91,10 +147,167 @@ void Player::setCaptureContext(TreelandCaptureContext *context)
     emit captureContextChanged();
 }
 
+int Player::maxPreviewFps() const
+{
+    return m_maxPreviewFps;
+}
+
+void Player::setMaxPreviewFps(int fps)
+{
+    fps = qMax(0, fps);
+    if (m_maxPreviewFps == fps)
+        return;
+    m_maxPreviewFps = fps;
+    emit maxPreviewFpsChanged();
+}
+
+bool Player::initializeYuvConverter()
+{
+    if (m_yuvConverter)
+        return true;
+    if (qEnvironmentVariable("TEST_CAPTURE_GPU_CONVERSION") == QLatin1String("0"))
+        return false;
+    if (!ensureContext())
+        return false;
+
+    if (!m_offscreenSurface) {
+        m_offscreenSurface = new QOffscreenSurface(nullptr, this);
+        m_offscreenSurface->setFormat(m_context->format());
+        m_offscreenSurface->create();
+    }
+    if (!m_context->makeCurrent(m_offscreenSurface)) {
+        qWarning() << "Failed to make OpenGL context current for YUV conversion";
+        return false;
+    }
+
+    GpuYuvConverter::Sink sink;
+    sink.acquire = [this] {
+        return m_recorder ? m_recorder->acquireFrame() : nullptr;
+    };
+    sink.submit = [this](RecordYuvFrame *frame) {
+        if (m_recorder)
+            m_recorder->submitFrame(frame);
+    };
+    sink.drop = [this] {
+        if (m_recorder)
+            m_recorder->dropFrame();
+    };
+
+    auto converter = std::make_unique<GpuYuvConverter>();
+    if (!converter->initialize(sink)) {
+        converter->release();
+        return false;
+    }
+    m_yuvConverter = std::move(converter);
+    return true;
+}
+
+void Player::setRecorder(Recorder *recorder)
+{
+    if (m_recorder == recorder)
+        return;
+    if (m_recorder)
+        m_recorder->disconnect(this);
+    m_recorder = recorder;
+    if (m_recorder) {
+        connect(m_recorder.data(),
+                &Recorder::aboutToStop,
+                this,
+                std::bind(&Player::collectReadbacks, this, true));
+    }
+}
+
+void Player::handleFrameReady()
+{
+    convertForRecorder();
+    scheduleFrame();
+}
+
+void Player::convertForRecorder()
+{
+    if (!m_yuvConverter || !m_recorder || !m_recorder->recording()
+        || m_recorder->conversion() != Recorder::Conversion::Gpu) {
+        return;
+    }
+    if (!m_captureContext || !m_captureContext->session())
+        return;
+    if (!m_context->makeCurrent(m_offscreenSurface))
+        return;
+
+    // Every frame is imported for the recording, presentation reuses the
+    // import and only picks the newest one.
+    updateTexture();
+    if (!m_textureFrame || !m_recorder->wantsFrame(*m_textureFrame))
+        return;
+    auto session = m_captureContext->session();
+    const QSize sourceSize(int(m_textureFrame->width), int(m_textureFrame->height));
+    const QSize frameSize(sourceSize.width() & ~1, sourceSize.height() & ~1);
+    const auto watermark = m_recorder->watermark();
+    if (watermark && watermark->isEnabled())
+        m_yuvConverter->setOverlay(watermark->overlay(frameSize), watermark->placement(frameSize));
+    else
+        m_yuvConverter->setOverlay(QImage(), QRect());
+    // The same clock as the frames the recorder converts itself
+    const int64_t timestampNs = Recorder::frameTimestampNs(*m_textureFrame);
+    if (m_textureId
+        && m_yuvConverter->convert(m_textureId, sourceSize, frameSize, timestampNs)) {
+        session->metrics()->add(CaptureMetrics::BytesCopied,
+                                quint64(frameSize.width()) * frameSize.height() * 3 / 2);
+    }
+    if (m_yuvConverter->asyncReadback())
+        m_readbackTimer->start();
+}
+
+void Player::collectReadbacks(bool wait)
+{
+    if (!m_yuvConverter || !m_context->makeCurrent(m_offscreenSurface))
+        return;
+    if (m_yuvConverter->collect(wait))
+        m_readbackTimer->start();
+}
+
+void Player::scheduleFrame()
+{
+    // Frames arriving while an update is pending only replace the one that
+    // will be drawn, their buffers are never imported or uploaded.
+    m_frameDirty = true;
+    if (m_updatePending || !isVisible() || !windowHandle())
+        return;
+    m_updatePending = true;
+
+    if (m_maxPreviewFps > 0 && m_presentTimer.isValid()) {
+        const qint64 minInterval = 1000 / m_maxPreviewFps;
+        const qint64 elapsed = m_presentTimer.elapsed();
+        if (elapsed < minInterval) {
+            m_throttleTimer->start(int(minInterval - elapsed));
+            return;
+        }
+    }
+    windowHandle()->requestUpdate();
+}
+
+bool Player::eventFilter(QObject *watched, QEvent *event)
+{
+    // requestUpdate() is driven by the compositor's frame callbacks, so this
+    // presents at most once per vblank of the output showing the preview.
+    if (watched == windowHandle() && event->type() == QEvent::UpdateRequest) {
+        m_updatePending = false;
+        if (m_frameDirty)
+            renderFrame();
+        return true;
+    }
+    return QWidget::eventFilter(watched, event);
+}
+
 void Player::paintEvent(QPaintEvent *event)
 {
     Q_UNUSED(event);
-    
+    CAPTURE_TRACE_SCOPE("paint");
+    renderFrame();
+}
+
+void Player::renderFrame()
+{
     if (!m_captureContext || !m_captureContext->session() || !m_captureContext->session()->started())
         return;
 
@@ -102,63 +315,53 @@ void Player::paintEvent(QPaintEvent *event)
         qWarning() << "No window handle available for OpenGL rendering";
         return;
     }
-        updateTexture();
-    
-    if (!QOpenGLContext::currentContext()) {
+
+    if (!ensureContext())
+        return;
+    if (!m_context->makeCurrent(windowHandle())) {
         qWarning() << "Failed to make OpenGL context current";
         return;
     }
 
+    m_frameDirty = false;
+    updateTexture();
 
-
-
-    QPainter painter(this);
-    painter.beginNativePainting();
+    if (!m_previewRenderer) {
+        m_previewRenderer = std::make_unique<PreviewRenderer>();
+        if (!m_previewRenderer->initialize())
+            m_previewRenderer->release();
+    }
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    // 设置视口
-    glViewport(0, 0, width(), height());
-
-    // 绘制纹理
-    if (m_textureId) {
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, m_textureId);
-
-        // 使用 OpenGL ES 2.0 兼容的方式绘制四边形
-        const GLfloat vertices[] = {
-            -1.0f, -1.0f,
-             1.0f, -1.0f,
-             1.0f,  1.0f,
-            -1.0f,  1.0f
-        };
-
-        const GLfloat texCoords[] = {
-            0.0f, 0.0f,
-            1.0f, 0.0f,
-            1.0f, 1.0f,
-            0.0f, 1.0f
-        };
-
-        glEnableClientState(GL_VERTEX_ARRAY);
-        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-        
-        glVertexPointer(2, GL_FLOAT, 0, vertices);
-        glTexCoordPointer(2, GL_FLOAT, 0, texCoords);
-        
-        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-        
-        glDisableClientState(GL_VERTEX_ARRAY);
-        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    // 按比例缩放绘制纹理，大区域经过降采样
+    auto session = m_captureContext->session();
+    const FrameRef frame = m_textureFrame;
+    if (m_textureId && frame && m_previewRenderer->isInitialized()) {
+        const qreal dpr = devicePixelRatioF();
+        m_previewRenderer->render(m_textureId,
+                                  QSize(int(frame->width), int(frame->height)),
+                                  QSize(qRound(width() * dpr), qRound(height() * dpr)));
+    }
 
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glDisable(GL_TEXTURE_2D);
+    {
+        CAPTURE_TRACE_SCOPE("swap buffers");
+        m_context->swapBuffers(windowHandle());
     }
+    m_presentTimer.start();
 
-    painter.endNativePainting();
-    
-    m_context->swapBuffers(windowHandle());
+    if (session && frame && frame->sequence != m_presentedSequence) {
+        auto metrics = session->metrics();
+        if (m_presentedSequence && frame->sequence > m_presentedSequence + 1) {
+            metrics->add(CaptureMetrics::FramesDropped,
+                         frame->sequence - m_presentedSequence - 1);
+        }
+        metrics->add(CaptureMetrics::FramesRendered);
+        metrics->record(CaptureMetrics::ReceiveToPresent,
+                        CaptureMetrics::monotonicNs() - frame->receiveTimeNs);
+        m_presentedSequence = frame->sequence;
+    }
 }
 
 void Player::resizeEvent(QResizeEvent *event)
@@ -174,155 +377,340 @@ void Player::updateTexture()
     auto session = m_captureContext->session();
     if (!session) return;
 
-     auto objects = session->objects();
-    if (objects.empty()) return;
-
-    // 获取第一个平面的 fd 和尺寸信息
-    int dma_fd = objects[0].fd;
-    int width = session->bufferWidth();
-    int height = session->bufferHeight();
-    int stride = objects[0].stride;
-
-    // 映射 DMA-BUF 内存
-    unsigned char *mapData = static_cast<unsigned char *>(mmap(nullptr, 
-                                                             stride * height, 
-                                                             PROT_READ, 
-                                                             MAP_SHARED, 
-                                                             dma_fd, 
-                                                             0));
-    
-    if (MAP_FAILED == mapData) {
-        qWarning() << "DMA-BUF mmap failed for fd:" << dma_fd 
-                  << "Error:" << strerror(errno);
+    // The reference keeps the plane fds open while importing, even if the
+    // next frame event arrives in between.
+    const FrameRef frame = session->frame();
+    if (!frame || frame->objects().isEmpty()) return;
+
+    ensureImportFunctions();
+
+    if (frame->bufferGeneration != m_bufferGeneration) {
+        releaseImportedBuffers();
+        m_bufferGeneration = frame->bufferGeneration;
+        m_uploadedSequence = 0;
+    }
+
+    if (!m_dmaBufImportSupported || !importDmaBuf(*frame))
+        uploadMappedPlane(*frame);
+    m_textureFrame = frame;
+}
+
+void Player::releaseImportedBuffers()
+{
+    for (const auto &buffer : m_importedBuffers) {
+        glDeleteTextures(1, &buffer.texture);
+        m_eglDestroyImageKHR(m_eglDisplay, buffer.image);
+    }
+    m_importedBuffers.clear();
+    if (m_textureId != m_uploadTextureId)
+        m_textureId = 0;
+}
+
+void Player::ensureImportFunctions()
+{
+    if (m_importFunctionsResolved)
+        return;
+    m_importFunctionsResolved = true;
+
+    m_eglDisplay = eglGetCurrentDisplay();
+    if (m_eglDisplay == EGL_NO_DISPLAY) {
+        qWarning() << "No current EGL display, falling back to mmap upload";
         return;
     }
 
-    // 创建 QImage 并保存副本
-    {
-        QImage currentImage = QImage(mapData,
-                              width, 
-                              height, 
-                              QImage::Format_RGBA8888).copy();
-        currentImage.save("/home/uos/test.png");
-    }
-
-    // 解除内存映射
-    munmap(mapData, stride * height);
-
-
-
-
-    // EGLAttrib attribs[47];
-    // int atti = 0;
-    // attribs[atti++] = EGL_WIDTH;
-    // attribs[atti++] = session->bufferWidth();
-    // attribs[atti++] = EGL_HEIGHT;
-    // attribs[atti++] = session->bufferHeight();
-    // attribs[atti++] = EGL_LINUX_DRM_FOURCC_EXT;
-    // attribs[atti++] = session->bufferFormat();
-
-    // auto objects = session->objects();
-    // auto nPlanes = objects.size();
-
-    // if (nPlanes > 0) {
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE0_FD_EXT;
-    //     attribs[atti++] = objects[0].fd;
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE0_OFFSET_EXT;
-    //     attribs[atti++] = objects[0].offset;
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE0_PITCH_EXT;
-    //     attribs[atti++] = objects[0].stride;
-    //     if (m_captureContext->session()->modifierUnion().modifier) {
-    //         attribs[atti++] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT;
-    //         attribs[atti++] = m_captureContext->session()->modifierUnion().modLow;
-    //         attribs[atti++] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT;
-    //         attribs[atti++] = m_captureContext->session()->modifierUnion().modHigh;
-    //     }
-    // }
-
-    // if (nPlanes > 1) {
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE1_FD_EXT;
-    //     attribs[atti++] = objects[1].fd;
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE1_OFFSET_EXT;
-    //     attribs[atti++] = objects[1].offset;
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE1_PITCH_EXT;
-    //     attribs[atti++] = objects[1].stride;
-    //     if (m_captureContext->session()->modifierUnion().modifier) {
-    //         attribs[atti++] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT;
-    //         attribs[atti++] = m_captureContext->session()->modifierUnion().modLow;
-    //         attribs[atti++] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT;
-    //         attribs[atti++] = m_captureContext->session()->modifierUnion().modHigh;
-    //     }
-    // }
-
-    // if (nPlanes > 2) {
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE2_FD_EXT;
-    //     attribs[atti++] = objects[2].fd;
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE2_OFFSET_EXT;
-    //     attribs[atti++] = objects[2].offset;
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE2_PITCH_EXT;
-    //     attribs[atti++] = objects[2].stride;
-    //     if (m_captureContext->session()->modifierUnion().modifier) {
-    //         attribs[atti++] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT;
-    //         attribs[atti++] = m_captureContext->session()->modifierUnion().modLow;
-    //         attribs[atti++] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT;
-    //         attribs[atti++] = m_captureContext->session()->modifierUnion().modHigh;
-    //     }
-    // }
-
-    // if (nPlanes > 3) {
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE3_FD_EXT;
-    //     attribs[atti++] = objects[3].fd;
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE3_OFFSET_EXT;
-    //     attribs[atti++] = objects[3].offset;
-    //     attribs[atti++] = EGL_DMA_BUF_PLANE3_PITCH_EXT;
-    //     attribs[atti++] = objects[3].stride;
-    //     if (m_captureContext->session()->modifierUnion().modifier) {
-    //         attribs[atti++] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT;
-    //         attribs[atti++] = m_captureContext->session()->modifierUnion().modLow;
-    //         attribs[atti++] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT;
-    //         attribs[atti++] = m_captureContext->session()->modifierUnion().modHigh;
-    //     }
-    // }
-
-    // attribs[atti++] = EGL_NONE;
-
-    // auto eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-    // EGLImage eglImage = eglCreateImage(eglDisplay, 
-    //                                  EGL_NO_CONTEXT,
-    //                                  EGL_LINUX_DMA_BUF_EXT,
-    //                                  nullptr,
-    //                                  attribs);
-
-    // if (eglImage == EGL_NO_IMAGE) {
-    //   qWarning() << "Failed to create EGL image. Error code:" << eglGetError();
-    //   return;
-    // }
-
-    // // 创建或更新纹理
-    // if (!m_textureId) {
-    //     glGenTextures(1, &m_textureId);
-    // }
-
-    // glBindTexture(GL_TEXTURE_2D, m_textureId);
-    // glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    // glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, eglImage);
-    // glBindTexture(GL_TEXTURE_2D, 0);
-
-    // // 清理资源
-    // eglDestroyImage(eglDisplay, eglImage);
+    const QByteArray eglExtensions(eglQueryString(m_eglDisplay, EGL_EXTENSIONS));
+    const bool hasDmaBufImport = eglExtensions.contains("EGL_EXT_image_dma_buf_import");
+    m_dmaBufModifiersSupported = eglExtensions.contains("EGL_EXT_image_dma_buf_import_modifiers");
+    const auto context = QOpenGLContext::currentContext();
+    const bool hasEglImage = context->hasExtension(QByteArrayLiteral("GL_OES_EGL_image"));
+    m_unpackRowLengthSupported = context->format().majorVersion() >= 3
+        || context->hasExtension(QByteArrayLiteral("GL_EXT_unpack_subimage"));
+
+    m_eglCreateImageKHR =
+        reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(eglGetProcAddress("eglCreateImageKHR"));
+    m_eglDestroyImageKHR =
+        reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(eglGetProcAddress("eglDestroyImageKHR"));
+    m_glEGLImageTargetTexture2DOES = reinterpret_cast<PFNGLEGLIMAGETARGETTEXTURE2DOESPROC>(
+        eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+
+    m_dmaBufImportSupported = hasDmaBufImport && hasEglImage && m_eglCreateImageKHR
+        && m_eglDestroyImageKHR && m_glEGLImageTargetTexture2DOES;
+
+    if (m_dmaBufImportSupported) {
+        qInfo() << "Using zero-copy DMA-BUF import for preview, modifiers supported:"
+                << m_dmaBufModifiersSupported;
+    } else {
+        qInfo() << "DMA-BUF import unavailable (EGL_EXT_image_dma_buf_import:" << hasDmaBufImport
+                << "GL_OES_EGL_image:" << hasEglImage << "), falling back to mmap upload";
+    }
+}
+
+bool Player::importDmaBuf(const FrameDescriptor &frame)
+{
+    CAPTURE_TRACE_SCOPE("import");
+    static const EGLint planeAttribs[4][5] = {
+        { EGL_DMA_BUF_PLANE0_FD_EXT,
+          EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+          EGL_DMA_BUF_PLANE0_PITCH_EXT,
+          EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+          EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT },
+        { EGL_DMA_BUF_PLANE1_FD_EXT,
+          EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+          EGL_DMA_BUF_PLANE1_PITCH_EXT,
+          EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+          EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT },
+        { EGL_DMA_BUF_PLANE2_FD_EXT,
+          EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+          EGL_DMA_BUF_PLANE2_PITCH_EXT,
+          EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+          EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT },
+        { EGL_DMA_BUF_PLANE3_FD_EXT,
+          EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+          EGL_DMA_BUF_PLANE3_PITCH_EXT,
+          EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+          EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT },
+    };
+
+    const auto objects = frame.objects();
+    const auto &identity = objects.first().identity;
+
+    for (auto &buffer : m_importedBuffers) {
+        if (buffer.identity == identity) {
+            buffer.lastUse = ++m_importUseCounter;
+            m_textureId = buffer.texture;
+            return true;
+        }
+    }
+
+    const uint64_t modifier = frame.modifier;
+    const bool withModifier = m_dmaBufModifiersSupported && modifier != DRM_FORMAT_MOD_INVALID;
+
+    // 6 header values, 4 planes * 10 values and the terminator
+    EGLint attribs[6 + 4 * 10 + 1];
+    int atti = 0;
+    attribs[atti++] = EGL_WIDTH;
+    attribs[atti++] = static_cast<EGLint>(frame.width);
+    attribs[atti++] = EGL_HEIGHT;
+    attribs[atti++] = static_cast<EGLint>(frame.height);
+    attribs[atti++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attribs[atti++] = static_cast<EGLint>(frame.format);
+
     for (const auto &object : objects) {
-        if (object.fd > 0)
-            ::close(object.fd);
+        if (object.planeIndex >= 4) {
+            qWarning() << "Ignoring DMA-BUF plane" << object.planeIndex;
+            continue;
+        }
+        const auto &plane = planeAttribs[object.planeIndex];
+        attribs[atti++] = plane[0];
+        attribs[atti++] = object.fd.get();
+        attribs[atti++] = plane[1];
+        attribs[atti++] = static_cast<EGLint>(object.offset);
+        attribs[atti++] = plane[2];
+        attribs[atti++] = static_cast<EGLint>(object.stride);
+        if (withModifier) {
+            attribs[atti++] = plane[3];
+            attribs[atti++] = static_cast<EGLint>(modifier & 0xffffffff);
+            attribs[atti++] = plane[4];
+            attribs[atti++] = static_cast<EGLint>(modifier >> 32);
+        }
+    }
+    attribs[atti++] = EGL_NONE;
+
+    EGLImageKHR eglImage = m_eglCreateImageKHR(m_eglDisplay,
+                                               EGL_NO_CONTEXT,
+                                               EGL_LINUX_DMA_BUF_EXT,
+                                               nullptr,
+                                               attribs);
+    if (eglImage == EGL_NO_IMAGE_KHR) {
+        qWarning() << "Failed to create EGL image. Error code:" << Qt::hex << eglGetError();
+        return false;
+    }
+
+    // Compositors cycle through a small swapchain, keep one import per buffer.
+    if (m_importedBuffers.size() >= MaxImportedBuffers) {
+        auto oldest = std::min_element(m_importedBuffers.begin(),
+                                       m_importedBuffers.end(),
+                                       [](const ImportedBuffer &a, const ImportedBuffer &b) {
+                                           return a.lastUse < b.lastUse;
+                                       });
+        glDeleteTextures(1, &oldest->texture);
+        m_eglDestroyImageKHR(m_eglDisplay, oldest->image);
+        m_importedBuffers.erase(oldest);
+    }
+
+    ImportedBuffer buffer;
+    buffer.identity = identity;
+    buffer.image = eglImage;
+    buffer.lastUse = ++m_importUseCounter;
+    glGenTextures(1, &buffer.texture);
+
+    glBindTexture(GL_TEXTURE_2D, buffer.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    m_glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, static_cast<GLeglImageOES>(eglImage));
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_importedBuffers.push_back(buffer);
+    m_textureId = buffer.texture;
+    return true;
+}
+
+void Player::uploadMappedPlane(const FrameDescriptor &frame)
+{
+    CAPTURE_TRACE_SCOPE("upload");
+    auto session = m_captureContext->session();
+    const auto &object = frame.objects().first();
+    const int width = frame.width;
+    const int height = frame.height;
+    const uint32_t format = frame.format;
+
+    if (!isPixelConvertSupported(format)) {
+        qWarning() << "Can't upload buffer format" << Qt::hex << format;
+        return;
+    }
+
+    // Recycled buffers stay mapped in the session, only new ones hit mmap
+    auto mapping = session->mapObject(frame, object);
+    if (!mapping) {
+        qWarning() << "DMA-BUF mmap failed for fd:" << object.fd.get()
+                   << "Error:" << strerror(errno);
+        return;
+    }
+
+    // The texture keeps the previous frame, so only tiles that changed since
+    // need to be uploaded.
+    setDamageSession(session);
+
+    if (!m_uploadTextureId) {
+        glGenTextures(1, &m_uploadTextureId);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, m_uploadTextureId);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    QList<QRect> damage;
+    if (m_uploadedSequence == 0 || m_uploadSize != QSize(width, height)) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        m_uploadSize = QSize(width, height);
+        damage.append(QRect(0, 0, width, height));
+    } else {
+        damage = session->damageSince(m_uploadedSequence);
+    }
+
+    const unsigned char *pixels = mapping->data() + object.offset;
+    quint64 uploaded = 0;
+    for (const auto &rect : std::as_const(damage)) {
+        uploadRect(format, pixels, object.stride, rect);
+        uploaded += quint64(rect.width()) * rect.height() * 4;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_uploadedSequence = frame.sequence;
+    m_textureId = m_uploadTextureId;
+    session->metrics()->add(CaptureMetrics::BytesCopied, uploaded);
+}
+
+void Player::uploadRect(uint32_t format,
+                        const unsigned char *pixels,
+                        uint32_t stride,
+                        const QRect &rect)
+{
+    const unsigned char *origin = pixels + size_t(stride) * rect.y() + size_t(rect.x()) * 4;
+    if (format != DRM_FORMAT_XBGR8888 && format != DRM_FORMAT_ABGR8888) {
+        // Everything else is swizzled or narrowed to R, G, B, A bytes first.
+        const size_t rowBytes = size_t(rect.width()) * 4;
+        m_uploadScratch.resize(rowBytes * rect.height());
+        convertToRgba(simdLevel(),
+                      format,
+                      origin,
+                      stride,
+                      uint32_t(rect.width()),
+                      uint32_t(rect.height()),
+                      m_uploadScratch.data(),
+                      rowBytes);
+        glTexSubImage2D(GL_TEXTURE_2D,
+                        0,
+                        rect.x(),
+                        rect.y(),
+                        rect.width(),
+                        rect.height(),
+                        GL_RGBA,
+                        GL_UNSIGNED_BYTE,
+                        m_uploadScratch.data());
+        return;
+    }
+
+    if (m_unpackRowLengthSupported) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, GLint(stride / 4));
+        glTexSubImage2D(GL_TEXTURE_2D,
+                        0,
+                        rect.x(),
+                        rect.y(),
+                        rect.width(),
+                        rect.height(),
+                        GL_RGBA,
+                        GL_UNSIGNED_BYTE,
+                        origin);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+        return;
+    }
+
+    if (stride == uint32_t(rect.width()) * 4) {
+        glTexSubImage2D(GL_TEXTURE_2D,
+                        0,
+                        rect.x(),
+                        rect.y(),
+                        rect.width(),
+                        rect.height(),
+                        GL_RGBA,
+                        GL_UNSIGNED_BYTE,
+                        origin);
+        return;
+    }
+
+    // Plain GLES2 has no GL_UNPACK_ROW_LENGTH, upload the rows one by one
+    for (int y = 0; y < rect.height(); ++y) {
+        glTexSubImage2D(GL_TEXTURE_2D,
+                        0,
+                        rect.x(),
+                        rect.y() + y,
+                        rect.width(),
+                        1,
+                        GL_RGBA,
+                        GL_UNSIGNED_BYTE,
+                        origin + size_t(stride) * y);
     }
 }
 
+void Player::setDamageSession(TreelandCaptureSession *session)
+{
+    if (m_damageSession == session)
+        return;
+    if (m_damageSession)
+        m_damageSession->releaseDamageTracking();
+    m_damageSession = session;
+    if (m_damageSession)
+        m_damageSession->retainDamageTracking();
+}
+
 void Player::updateGeometry()
 {
     if (!m_captureContext) return;
-    
-    QRect region = m_captureContext->captureRegion().toRect();
-    resize(region.width(), region.height());
+
+    // The renderer fits any widget size, large regions only get a preview
+    const QSize region = m_captureContext->captureRegion().toRect().size();
+    if (region.isEmpty())
+        return;
+    if (region.width() > MaxPreviewSize.width() || region.height() > MaxPreviewSize.height())
+        resize(region.scaled(MaxPreviewSize, Qt::KeepAspectRatio));
+    else
+        resize(region);
 }
 
 static void EGLAPIENTRY debugCallback(EGLenum error,
@@ -4,16 +4,32 @@
 
 #include <QWidget>
 #include <QPointer>
+#include <QElapsedTimer>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 
+#include "dmabufcache.h"
+#include "framedescriptor.h"
+
+#include <memory>
+#include <vector>
+
+class GpuYuvConverter;
+class PreviewRenderer;
+class QOffscreenSurface;
 class QOpenGLContext;
 class QOpenGLTexture;
+class QTimer;
+class Recorder;
 class TreelandCaptureContext;
+class TreelandCaptureSession;
 
 class Player : public QWidget
 {
     Q_OBJECT
+    Q_PROPERTY(int maxPreviewFps READ maxPreviewFps WRITE setMaxPreviewFps NOTIFY maxPreviewFpsChanged FINAL)
 
 public:
     explicit Player(QWidget *parent = nullptr);
@@ -22,22 +38,93 @@ public:
     TreelandCaptureContext *captureContext() const;
     void setCaptureContext(TreelandCaptureContext *context);
 
+    // Upper bound for preview presentation, independent of the capture rate.
+    // 0 presents at the display refresh rate.
+    int maxPreviewFps() const;
+    void setMaxPreviewFps(int fps);
+
+    // Sets up the GPU YUV conversion for recording, false if the context
+    // can't do it and the recorder has to convert on the CPU.
+    bool initializeYuvConverter();
+    // Converts every session frame for a recorder using Gpu conversion,
+    // independently of what the preview presents.
+    void setRecorder(Recorder *recorder);
+
 signals:
     void captureContextChanged();
+    void maxPreviewFpsChanged();
 
 protected:
+    bool eventFilter(QObject *watched, QEvent *event) override;
     void paintEvent(QPaintEvent *event) override;
     void resizeEvent(QResizeEvent *event) override;
 
 private:
+    void handleFrameReady();
+    void scheduleFrame();
+    void renderFrame();
+    void convertForRecorder();
+    void collectReadbacks(bool wait);
     void updateTexture();
+    void ensureImportFunctions();
+    bool importDmaBuf(const FrameDescriptor &frame);
+    void uploadMappedPlane(const FrameDescriptor &frame);
+    void uploadRect(uint32_t format, const unsigned char *pixels, uint32_t stride, const QRect &rect);
+    void setDamageSession(TreelandCaptureSession *session);
+    void releaseImportedBuffers();
     void updateGeometry();
     void ensureDebugLogger();
     void initializeGL();
+    bool ensureContext();
 
     QOpenGLContext *m_context{nullptr};
     QOpenGLTexture *m_texture{nullptr};
     QPointer<TreelandCaptureContext> m_captureContext;
     bool m_loggerInitialized{false};
+
+    QTimer *m_throttleTimer{nullptr};
+    QOffscreenSurface *m_offscreenSurface{nullptr};
+    std::unique_ptr<GpuYuvConverter> m_yuvConverter;
+    std::unique_ptr<PreviewRenderer> m_previewRenderer;
+    QPointer<Recorder> m_recorder;
+    QTimer *m_readbackTimer{nullptr};
+    QElapsedTimer m_presentTimer;
+    int m_maxPreviewFps{0};
+    bool m_frameDirty{false};
+    bool m_updatePending{false};
+
+    struct ImportedBuffer
+    {
+        DmaBufIdentity identity;
+        EGLImageKHR image{EGL_NO_IMAGE_KHR};
+        GLuint texture{0};
+        quint64 lastUse{0};
+    };
+    static constexpr size_t MaxImportedBuffers = 8;
+
+    // Texture drawn by paintEvent, owned by m_importedBuffers or the upload path
     GLuint m_textureId{0};
+    // The frame m_textureId shows, sizes and timestamps come from here since
+    // the session moves on on its own thread
+    FrameRef m_textureFrame;
+    GLuint m_uploadTextureId{0};
+    std::vector<ImportedBuffer> m_importedBuffers;
+    quint64 m_importUseCounter{0};
+    uint m_bufferGeneration{0};
+    quint64 m_presentedSequence{0};
+    // Frame whose pixels m_uploadTextureId holds, only damage since is uploaded
+    quint64 m_uploadedSequence{0};
+    QSize m_uploadSize;
+    // RGBA staging for formats GLES can't take as they are
+    std::vector<unsigned char> m_uploadScratch;
+    QPointer<TreelandCaptureSession> m_damageSession;
+
+    EGLDisplay m_eglDisplay{EGL_NO_DISPLAY};
+    PFNEGLCREATEIMAGEKHRPROC m_eglCreateImageKHR{nullptr};
+    PFNEGLDESTROYIMAGEKHRPROC m_eglDestroyImageKHR{nullptr};
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC m_glEGLImageTargetTexture2DOES{nullptr};
+    bool m_importFunctionsResolved{false};
+    bool m_dmaBufImportSupported{false};
+    bool m_dmaBufModifiersSupported{false};
+    bool m_unpackRowLengthSupported{false};
 };
@@ -0,0 +1,443 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "pngwriter.h"
+#include "capturescheduler.h"
+#include "capturetrace.h"
+
+#include <QIODevice>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Raw bytes per strip, each strip starts with an empty deflate window, so
+// smaller strips compress noticeably worse
+constexpr size_t StripTargetBytes = 2 << 20;
+constexpr int MinStripRows = 16;
+// Compressed strips that may wait to be written, per thread
+constexpr int StripsPerThread = 2;
+constexpr size_t OutputChunkBytes = 64 << 10;
+constexpr int FastFilterMaxLevel = 3;
+
+constexpr uint8_t PngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+enum Filter : uint8_t {
+    FilterNone = 0,
+    FilterSub = 1,
+    FilterUp = 2,
+    FilterAverage = 3,
+    FilterPaeth = 4,
+    FilterCount = 5,
+};
+
+inline uint8_t unpremultiply(uint32_t color, uint32_t alpha)
+{
+    return uint8_t(std::min<uint32_t>(255, (color * 255 + alpha / 2) / alpha));
+}
+
+// One row of the image as PNG pixels, RGB or RGBA
+void convertRow(QImage::Format format, const uchar *src, int width, uint8_t *dst)
+{
+    switch (format) {
+    case QImage::Format_RGB32: {
+        const auto *pixels = reinterpret_cast<const QRgb *>(src);
+        for (int x = 0; x < width; ++x, dst += 3) {
+            dst[0] = uint8_t(qRed(pixels[x]));
+            dst[1] = uint8_t(qGreen(pixels[x]));
+            dst[2] = uint8_t(qBlue(pixels[x]));
+        }
+        break;
+    }
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied: {
+        const bool premultiplied = format == QImage::Format_ARGB32_Premultiplied;
+        const auto *pixels = reinterpret_cast<const QRgb *>(src);
+        for (int x = 0; x < width; ++x, dst += 4) {
+            const QRgb pixel = premultiplied ? qUnpremultiply(pixels[x]) : pixels[x];
+            dst[0] = uint8_t(qRed(pixel));
+            dst[1] = uint8_t(qGreen(pixel));
+            dst[2] = uint8_t(qBlue(pixel));
+            dst[3] = uint8_t(qAlpha(pixel));
+        }
+        break;
+    }
+    case QImage::Format_RGBX8888:
+        for (int x = 0; x < width; ++x, src += 4, dst += 3)
+            std::memcpy(dst, src, 3);
+        break;
+    case QImage::Format_RGBA8888:
+        std::memcpy(dst, src, size_t(width) * 4);
+        break;
+    case QImage::Format_RGBA8888_Premultiplied:
+        for (int x = 0; x < width; ++x, src += 4, dst += 4) {
+            const uint32_t alpha = src[3];
+            if (alpha == 255) {
+                std::memcpy(dst, src, 4);
+            } else if (alpha == 0) {
+                std::memset(dst, 0, 4);
+            } else {
+                dst[0] = unpremultiply(src[0], alpha);
+                dst[1] = unpremultiply(src[1], alpha);
+                dst[2] = unpremultiply(src[2], alpha);
+                dst[3] = uint8_t(alpha);
+            }
+        }
+        break;
+    default:
+        Q_UNREACHABLE();
+    }
+}
+
+inline uint8_t paeth(int left, int up, int upLeft)
+{
+    const int estimate = left + up - upLeft;
+    const int distanceLeft = std::abs(estimate - left);
+    const int distanceUp = std::abs(estimate - up);
+    const int distanceUpLeft = std::abs(estimate - upLeft);
+    if (distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft)
+        return uint8_t(left);
+    return distanceUp <= distanceUpLeft ? uint8_t(up) : uint8_t(upLeft);
+}
+
+// dst gets the filter type byte followed by the filtered row
+void filterRow(Filter filter, const uint8_t *row, const uint8_t *previous, size_t size, int bpp, uint8_t *dst)
+{
+    *dst++ = filter;
+    switch (filter) {
+    case FilterNone:
+        std::memcpy(dst, row, size);
+        break;
+    case FilterSub:
+        std::memcpy(dst, row, size_t(bpp));
+        for (size_t i = size_t(bpp); i < size; ++i)
+            dst[i] = uint8_t(row[i] - row[i - bpp]);
+        break;
+    case FilterUp:
+        for (size_t i = 0; i < size; ++i)
+            dst[i] = uint8_t(row[i] - previous[i]);
+        break;
+    case FilterAverage:
+        for (size_t i = 0; i < size_t(bpp); ++i)
+            dst[i] = uint8_t(row[i] - previous[i] / 2);
+        for (size_t i = size_t(bpp); i < size; ++i)
+            dst[i] = uint8_t(row[i] - (row[i - bpp] + previous[i]) / 2);
+        break;
+    case FilterPaeth:
+        for (size_t i = 0; i < size_t(bpp); ++i)
+            dst[i] = uint8_t(row[i] - previous[i]);
+        for (size_t i = size_t(bpp); i < size; ++i)
+            dst[i] = uint8_t(row[i] - paeth(row[i - bpp], previous[i], previous[i - bpp]));
+        break;
+    default:
+        break;
+    }
+}
+
+// The usual heuristic: smallest sum of the filtered bytes taken as signed
+uint64_t filterCost(const uint8_t *filtered, size_t size)
+{
+    uint64_t cost = 0;
+    for (size_t i = 0; i < size; ++i)
+        cost += uint64_t(std::abs(int(int8_t(filtered[i]))));
+    return cost;
+}
+
+struct Strip
+{
+    std::vector<uint8_t> compressed;
+    uLong adler{ 0 };
+    uLong rawSize{ 0 };
+    bool done{ false };
+    bool failed{ false };
+};
+
+struct PngJob
+{
+    const uchar *bits{ nullptr };
+    qsizetype bytesPerLine{ 0 };
+    QImage::Format format{ QImage::Format_Invalid };
+    int width{ 0 };
+    int height{ 0 };
+    int channels{ 0 };
+    int level{ Z_DEFAULT_COMPRESSION };
+    int rowsPerStrip{ 0 };
+    int stripCount{ 0 };
+    int window{ 0 };
+    std::vector<Strip> strips;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    int nextStrip{ 0 };
+    int writtenStrips{ 0 };
+    int compressing{ 0 };
+    bool cancelled{ false };
+
+    // Claims the next strip once the window has room for it, -1 when there
+    // is nothing left to claim. Called with mutex held.
+    int claimStrip(std::unique_lock<std::mutex> &lock, bool wait);
+    void compressStrip(int index);
+    void finishStrip(int index);
+    void runHelper();
+};
+
+int PngJob::claimStrip(std::unique_lock<std::mutex> &lock, bool wait)
+{
+    for (;;) {
+        if (cancelled || nextStrip >= stripCount)
+            return -1;
+        if (nextStrip < writtenStrips + window) {
+            ++compressing;
+            return nextStrip++;
+        }
+        if (!wait)
+            return -1;
+        changed.wait(lock);
+    }
+}
+
+void PngJob::compressStrip(int index)
+{
+    CAPTURE_TRACE_SCOPE("png strip");
+    Strip &strip = strips[size_t(index)];
+    const int first = index * rowsPerStrip;
+    const int last = std::min(height, first + rowsPerStrip);
+    const size_t rowSize = size_t(width) * size_t(channels);
+    const bool finalStrip = index == stripCount - 1;
+
+    z_stream stream{};
+    // Raw deflate, the zlib header and checksum are written around the strips
+    if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        strip.failed = true;
+        return;
+    }
+
+    std::vector<uint8_t> previous(rowSize, 0);
+    std::vector<uint8_t> row(rowSize);
+    const bool adaptive = level > FastFilterMaxLevel || level == Z_DEFAULT_COMPRESSION;
+    std::vector<uint8_t> filtered((rowSize + 1) * (adaptive ? FilterCount : 1));
+    if (first > 0)
+        convertRow(format, bits + bytesPerLine * (first - 1), width, previous.data());
+
+    strip.adler = adler32(0, nullptr, 0);
+    std::vector<uint8_t> output(OutputChunkBytes);
+    auto deflateInto = [&](const uint8_t *data, size_t size, int flush) {
+        stream.next_in = const_cast<Bytef *>(data);
+        stream.avail_in = uInt(size);
+        do {
+            stream.next_out = output.data();
+            stream.avail_out = uInt(output.size());
+            if (deflate(&stream, flush) == Z_STREAM_ERROR)
+                return false;
+            strip.compressed.insert(strip.compressed.end(),
+                                    output.data(),
+                                    output.data() + output.size() - stream.avail_out);
+        } while (stream.avail_out == 0 || stream.avail_in > 0);
+        return true;
+    };
+
+    bool ok = true;
+    for (int y = first; y < last && ok; ++y) {
+        convertRow(format, bits + bytesPerLine * y, width, row.data());
+        const uint8_t *selected = filtered.data();
+        if (level == 0) {
+            filterRow(FilterNone, row.data(), previous.data(), rowSize, channels, filtered.data());
+        } else if (!adaptive) {
+            filterRow(FilterUp, row.data(), previous.data(), rowSize, channels, filtered.data());
+        } else {
+            uint64_t bestCost = UINT64_MAX;
+            for (int filter = FilterNone; filter < FilterCount; ++filter) {
+                uint8_t *dst = filtered.data() + (rowSize + 1) * size_t(filter);
+                filterRow(Filter(filter), row.data(), previous.data(), rowSize, channels, dst);
+                const uint64_t cost = filterCost(dst + 1, rowSize);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    selected = dst;
+                }
+            }
+        }
+        strip.adler = adler32(strip.adler, selected, uInt(rowSize + 1));
+        ok = deflateInto(selected, rowSize + 1, Z_NO_FLUSH);
+        std::swap(previous, row);
+    }
+    strip.rawSize = uLong(last - first) * uLong(rowSize + 1);
+
+    // A sync flush ends the strip on a byte boundary without a final block,
+    // so the next strip's stream can simply follow it
+    if (ok)
+        ok = deflateInto(nullptr, 0, finalStrip ? Z_FINISH : Z_SYNC_FLUSH);
+    deflateEnd(&stream);
+    strip.failed = !ok;
+}
+
+void PngJob::finishStrip(int index)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    strips[size_t(index)].done = true;
+    --compressing;
+    changed.notify_all();
+}
+
+void PngJob::runHelper()
+{
+    for (;;) {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            index = claimStrip(lock, true);
+        }
+        if (index < 0)
+            return;
+        compressStrip(index);
+        finishStrip(index);
+    }
+}
+
+void appendBigEndian(std::vector<uint8_t> *data, uint32_t value)
+{
+    const uint8_t bytes[4] = { uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value) };
+    data->insert(data->end(), bytes, bytes + 4);
+}
+
+bool writeChunk(QIODevice *device, const char type[4], const uint8_t *data, size_t size)
+{
+    uint8_t header[8] = { uint8_t(size >> 24), uint8_t(size >> 16), uint8_t(size >> 8), uint8_t(size) };
+    std::memcpy(header + 4, type, 4);
+    uLong crc = crc32(0, header + 4, 4);
+    // A null buffer would reset the crc instead, as for IEND
+    if (size > 0)
+        crc = crc32(crc, data, uInt(size));
+    const uint8_t trailer[4] = { uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc) };
+    return device->write(reinterpret_cast<const char *>(header), 8) == 8
+        && device->write(reinterpret_cast<const char *>(data), qint64(size)) == qint64(size)
+        && device->write(reinterpret_cast<const char *>(trailer), 4) == 4;
+}
+
+// CMF and FLG as zlib writes them for level
+void appendZlibHeader(std::vector<uint8_t> *data, int level)
+{
+    uint8_t flags = 0x9c;
+    if (level >= 0 && level < 2)
+        flags = 0x01;
+    else if (level >= 2 && level < 6)
+        flags = 0x5e;
+    else if (level > 6)
+        flags = 0xda;
+    data->push_back(0x78);
+    data->push_back(flags);
+}
+
+} // namespace
+
+bool isPngWriteSupported(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool writePng(const QImage &image, QIODevice *device, const PngWriteOptions &options)
+{
+    if (image.isNull() || !device || !isPngWriteSupported(image.format()))
+        return false;
+
+    auto job = std::make_shared<PngJob>();
+    job->bits = image.constBits();
+    job->bytesPerLine = image.bytesPerLine();
+    job->format = image.format();
+    job->width = image.width();
+    job->height = image.height();
+    job->channels = image.hasAlphaChannel() ? 4 : 3;
+    job->level = options.level < 0 ? Z_DEFAULT_COMPRESSION : std::min(options.level, 9);
+    const size_t rowSize = size_t(job->width) * size_t(job->channels) + 1;
+    job->rowsPerStrip = int(std::max<size_t>(MinStripRows, StripTargetBytes / rowSize));
+    job->stripCount = (job->height + job->rowsPerStrip - 1) / job->rowsPerStrip;
+    job->strips.resize(size_t(job->stripCount));
+
+    QThreadPool *pool = CaptureScheduler::instance()->workerPool();
+    const int threads =
+        std::min(options.threads > 0 ? options.threads : std::max(1, pool->maxThreadCount()), job->stripCount);
+    job->window = threads * StripsPerThread;
+    // The calling thread works on strips too, whether or not the pool gets
+    // to the helpers, e.g. because this already runs on it
+    for (int i = 1; i < threads; ++i)
+        pool->start([job] { job->runHelper(); });
+
+    std::vector<uint8_t> header;
+    header.insert(header.end(), PngSignature, PngSignature + sizeof(PngSignature));
+    bool ok = device->write(reinterpret_cast<const char *>(header.data()), qint64(header.size()))
+        == qint64(header.size());
+    header.clear();
+    appendBigEndian(&header, uint32_t(job->width));
+    appendBigEndian(&header, uint32_t(job->height));
+    // 8 bit depth, RGB or RGBA, deflate, adaptive filtering, no interlacing
+    header.insert(header.end(), { 8, uint8_t(job->channels == 4 ? 6 : 2), 0, 0, 0 });
+    ok = ok && writeChunk(device, "IHDR", header.data(), header.size());
+
+    uLong adler = adler32(0, nullptr, 0);
+    for (int index = 0; index < job->stripCount && ok; ++index) {
+        Strip &strip = job->strips[size_t(index)];
+        // Help out until the strip that is due is compressed
+        for (;;) {
+            int claimed;
+            {
+                std::unique_lock<std::mutex> lock(job->mutex);
+                if (strip.done)
+                    break;
+                claimed = job->claimStrip(lock, false);
+                if (claimed < 0) {
+                    job->changed.wait(lock);
+                    continue;
+                }
+            }
+            job->compressStrip(claimed);
+            job->finishStrip(claimed);
+        }
+
+        if (strip.failed) {
+            ok = false;
+            break;
+        }
+        adler = adler32_combine(adler, strip.adler, z_off_t(strip.rawSize));
+        std::vector<uint8_t> data = std::move(strip.compressed);
+        if (index == 0) {
+            std::vector<uint8_t> zlibHeader;
+            appendZlibHeader(&zlibHeader, job->level);
+            data.insert(data.begin(), zlibHeader.begin(), zlibHeader.end());
+        }
+        if (index == job->stripCount - 1)
+            appendBigEndian(&data, uint32_t(adler));
+        {
+            CAPTURE_TRACE_SCOPE("png write");
+            ok = writeChunk(device, "IDAT", data.data(), data.size());
+        }
+
+        std::lock_guard<std::mutex> lock(job->mutex);
+        ++job->writtenStrips;
+        job->changed.notify_all();
+    }
+    ok = ok && writeChunk(device, "IEND", nullptr, 0);
+
+    // Helpers still on a strip read the image, which is only borrowed
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->cancelled = true;
+    job->changed.notify_all();
+    job->changed.wait(lock, [&job] { return job->compressing == 0; });
+    return ok;
+}
@@ -0,0 +1,30 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <QImage>
+
+class QIODevice;
+
+// PNG writer for large screenshots. The image is cut into horizontal strips
+// that are filtered and deflated as separate raw deflate streams on the
+// CaptureScheduler worker pool, then stitched into one zlib stream with the
+// checksums combined. Rows are read straight from the image memory and only
+// a few strips are held compressed at a time, waiting to be written in order.
+
+struct PngWriteOptions
+{
+    // zlib level 0-9, -1 for zlib's default. Up to 3 every row uses the Up
+    // filter, above that each row gets the filter that suits it best, which
+    // compresses better but filters several times slower.
+    int level{ -1 };
+    // Strips compressed at once, 0 uses every thread of the worker pool. The
+    // calling thread is one of them.
+    int threads{ 0 };
+};
+
+// 8 bit RGB and RGBA formats, premultiplied ones are written unpremultiplied.
+bool isPngWriteSupported(QImage::Format format);
+
+bool writePng(const QImage &image, QIODevice *device, const PngWriteOptions &options = PngWriteOptions());
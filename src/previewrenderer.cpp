@@ -0,0 +1,255 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "previewrenderer.h"
+
+#include <QDebug>
+#include <QOpenGLContext>
+
+#include <algorithm>
+
+namespace {
+
+constexpr GLuint PositionAttribute = 0;
+// Reduction one pass does without skipping texels: four bilinear taps
+// cover a 4x4 footprint.
+constexpr int MaxPassRatio = 4;
+
+// flip is -1 when drawing to the window, whose bottom row comes first, and
+// 1 for pyramid levels, which keep the source's top row first.
+const char *const VertexShader = R"(
+attribute vec2 position;
+uniform float flip;
+varying vec2 texCoord;
+
+void main()
+{
+    texCoord = vec2(position.x, position.y * flip) * 0.5 + 0.5;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+// A box filter over the output pixel's footprint in the source. Each tap
+// sits between texels so GL_LINEAR averages four of them. With no offset
+// this is plain bilinear sampling, for magnification.
+const char *const FragmentShader = R"(
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+
+uniform sampler2D source;
+uniform vec2 tapOffset;
+varying vec2 texCoord;
+
+void main()
+{
+    gl_FragColor = 0.25 * (texture2D(source, texCoord + vec2(-tapOffset.x, -tapOffset.y))
+                           + texture2D(source, texCoord + vec2(tapOffset.x, -tapOffset.y))
+                           + texture2D(source, texCoord + vec2(-tapOffset.x, tapOffset.y))
+                           + texture2D(source, texCoord + vec2(tapOffset.x, tapOffset.y)));
+}
+)";
+
+} // namespace
+
+bool PreviewRenderer::initialize()
+{
+    if (!QOpenGLContext::currentContext()) {
+        qWarning() << "No current OpenGL context for the preview renderer";
+        return false;
+    }
+    initializeOpenGLFunctions();
+
+    auto compile = [this](GLenum type, const char *source) -> GLuint {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (!compiled) {
+            char log[1024] = {};
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            qWarning() << "Failed to compile preview shader:" << log;
+            glDeleteShader(shader);
+            return 0;
+        }
+        return shader;
+    };
+
+    const GLuint vertexShader = compile(GL_VERTEX_SHADER, VertexShader);
+    const GLuint fragmentShader = compile(GL_FRAGMENT_SHADER, FragmentShader);
+    if (!vertexShader || !fragmentShader) {
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return false;
+    }
+
+    m_program = glCreateProgram();
+    glAttachShader(m_program, vertexShader);
+    glAttachShader(m_program, fragmentShader);
+    glBindAttribLocation(m_program, PositionAttribute, "position");
+    glLinkProgram(m_program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char log[1024] = {};
+        glGetProgramInfoLog(m_program, sizeof(log), nullptr, log);
+        qWarning() << "Failed to link preview program:" << log;
+        release();
+        return false;
+    }
+
+    glUseProgram(m_program);
+    glUniform1i(glGetUniformLocation(m_program, "source"), 0);
+    glUseProgram(0);
+    m_tapOffsetLocation = glGetUniformLocation(m_program, "tapOffset");
+    m_flipLocation = glGetUniformLocation(m_program, "flip");
+
+    static const GLfloat quad[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+    glGenBuffers(1, &m_vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+void PreviewRenderer::release()
+{
+    releaseLevels();
+    if (m_vertexBuffer)
+        glDeleteBuffers(1, &m_vertexBuffer);
+    if (m_program)
+        glDeleteProgram(m_program);
+    m_vertexBuffer = 0;
+    m_program = 0;
+}
+
+void PreviewRenderer::releaseLevels()
+{
+    for (const auto &level : m_levels) {
+        glDeleteFramebuffers(1, &level.framebuffer);
+        glDeleteTextures(1, &level.texture);
+    }
+    m_levels.clear();
+    m_levelsSourceSize = QSize();
+    m_levelsTargetSize = QSize();
+}
+
+QRect PreviewRenderer::fitRect(const QSize &sourceSize, const QSize &viewportSize)
+{
+    if (sourceSize.isEmpty() || viewportSize.isEmpty())
+        return QRect();
+    const QSize fitted = sourceSize.scaled(viewportSize, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+    return QRect(QPoint((viewportSize.width() - fitted.width()) / 2,
+                        (viewportSize.height() - fitted.height()) / 2),
+                 fitted);
+}
+
+bool PreviewRenderer::ensureLevels(const QSize &sourceSize, const QSize &targetSize)
+{
+    if (sourceSize == m_levelsSourceSize && targetSize == m_levelsTargetSize)
+        return true;
+    releaseLevels();
+
+    QSize size = sourceSize;
+    while (size.width() > targetSize.width() * MaxPassRatio
+           || size.height() > targetSize.height() * MaxPassRatio) {
+        size = QSize(std::max(targetSize.width(), (size.width() + MaxPassRatio - 1) / MaxPassRatio),
+                     std::max(targetSize.height(), (size.height() + MaxPassRatio - 1) / MaxPassRatio));
+
+        Level level;
+        level.size = size;
+        glGenTextures(1, &level.texture);
+        glBindTexture(GL_TEXTURE_2D, level.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D,
+                     0,
+                     GL_RGBA,
+                     size.width(),
+                     size.height(),
+                     0,
+                     GL_RGBA,
+                     GL_UNSIGNED_BYTE,
+                     nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &level.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, level.framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, level.texture, 0);
+        const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        m_levels.push_back(level);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            qWarning() << "Preview downscale target incomplete:" << Qt::hex << status;
+            releaseLevels();
+            return false;
+        }
+    }
+
+    m_levelsSourceSize = sourceSize;
+    m_levelsTargetSize = targetSize;
+    return true;
+}
+
+void PreviewRenderer::render(GLuint texture, const QSize &sourceSize, const QSize &viewportSize)
+{
+    const QRect target = fitRect(sourceSize, viewportSize);
+    if (!isInitialized() || !texture || target.isEmpty())
+        return;
+
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glDisable(GL_BLEND);
+    glUseProgram(m_program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glEnableVertexAttribArray(PositionAttribute);
+    glVertexAttribPointer(PositionAttribute, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+    // Without the levels the window pass undersamples, still better than
+    // showing nothing.
+    GLuint source = texture;
+    QSize size = sourceSize;
+    if (ensureLevels(sourceSize, target.size())) {
+        for (const auto &level : m_levels) {
+            glBindFramebuffer(GL_FRAMEBUFFER, level.framebuffer);
+            glViewport(0, 0, level.size.width(), level.size.height());
+            draw(source, size, level.size, false);
+            source = level.texture;
+            size = level.size;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, GLuint(previousFramebuffer));
+    glViewport(target.x(), viewportSize.height() - target.bottom() - 1, target.width(), target.height());
+    draw(source, size, target.size(), true);
+
+    glDisableVertexAttribArray(PositionAttribute);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
+
+void PreviewRenderer::draw(GLuint texture, const QSize &sourceSize, const QSize &targetSize, bool flip)
+{
+    // Taps a quarter of the footprint away from the centre split it into
+    // four equal parts, each averaged by one bilinear fetch.
+    const GLfloat ratioX = GLfloat(sourceSize.width()) / targetSize.width();
+    const GLfloat ratioY = GLfloat(sourceSize.height()) / targetSize.height();
+    const GLfloat offsetX = ratioX > 1.0f ? ratioX / 4.0f / sourceSize.width() : 0.0f;
+    const GLfloat offsetY = ratioY > 1.0f ? ratioY / 4.0f / sourceSize.height() : 0.0f;
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glUniform2f(m_tapOffsetLocation, offsetX, offsetY);
+    glUniform1f(m_flipLocation, flip ? -1.0f : 1.0f);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
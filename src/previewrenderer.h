@@ -0,0 +1,67 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <QOpenGLFunctions>
+#include <QRect>
+#include <QSize>
+
+#include <vector>
+
+// Draws a capture texture into the current framebuffer, scaled to fit with
+// its aspect ratio kept. Sources much larger than the output, e.g. an 8K
+// region in a small preview window, are reduced through a pyramid of
+// intermediate targets, each pass averaging 4x4 source texels with four
+// GL_LINEAR taps. Imported dmabuf textures can't have mipmaps generated,
+// so the pyramid takes their place. Program, quad and pyramid levels are
+// created once and reused for every frame.
+//
+// Every call needs the context the renderer was initialized on current.
+class PreviewRenderer : protected QOpenGLFunctions
+{
+public:
+    PreviewRenderer() = default;
+
+    PreviewRenderer(const PreviewRenderer &) = delete;
+    PreviewRenderer &operator=(const PreviewRenderer &) = delete;
+
+    bool initialize();
+    // Frees the GL objects, there is no destructor doing it since the
+    // context has to be current.
+    void release();
+
+    inline bool isInitialized() const
+    {
+        return m_program != 0;
+    }
+
+    // Where a source of sourceSize ends up in a viewport of viewportSize
+    static QRect fitRect(const QSize &sourceSize, const QSize &viewportSize);
+
+    // Draws texture, sourceSize pixels with the first row at the top, into
+    // the bound framebuffer of viewportSize device pixels. The area outside
+    // the fitted image is left alone.
+    void render(GLuint texture, const QSize &sourceSize, const QSize &viewportSize);
+
+private:
+    struct Level
+    {
+        GLuint texture{ 0 };
+        GLuint framebuffer{ 0 };
+        QSize size;
+    };
+
+    bool ensureLevels(const QSize &sourceSize, const QSize &targetSize);
+    void releaseLevels();
+    void draw(GLuint texture, const QSize &sourceSize, const QSize &targetSize, bool flip);
+
+    GLuint m_program{ 0 };
+    GLuint m_vertexBuffer{ 0 };
+    GLint m_tapOffsetLocation{ -1 };
+    GLint m_flipLocation{ -1 };
+    // Largest first, the last one is at most MaxPassRatio times the target
+    std::vector<Level> m_levels;
+    QSize m_levelsSourceSize;
+    QSize m_levelsTargetSize;
+};
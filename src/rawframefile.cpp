@@ -0,0 +1,693 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "rawframefile.h"
+#include "capturetrace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char FileMagic[8] = { 'T', 'C', 'R', 'A', 'W', 'F', 'R', 'M' };
+constexpr auto WriterWakeInterval = std::chrono::milliseconds(5);
+// A batch is written once it holds this much, or the queue runs dry
+constexpr size_t BatchBytes = size_t(16) << 20;
+constexpr size_t MaxBatchFrames = 64;
+// Header, two per plane and the tail padding
+constexpr size_t MaxFrameIovecs = 2 + 2 * RawFrameMaxPlanes;
+constexpr size_t MaxBatchIovecs = 512;
+// Batches in flight, while one is written the next one is collected
+constexpr unsigned QueueDepth = 2;
+constexpr size_t FrameHeaderSize =
+    (sizeof(RawFrameHeader) + RawFramePayloadAlignment - 1) & ~size_t(RawFramePayloadAlignment - 1);
+
+alignas(RawFrameAlignment) const uint8_t s_zeros[RawFrameAlignment] = {};
+
+inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void warn(const char *what, int error)
+{
+    std::fprintf(stderr, "Raw frame dump: %s: %s\n", what, std::strerror(error));
+}
+
+// pwritev until everything from skip on is written, in IOV_MAX sized steps
+bool pwritevAll(int fd, const std::vector<iovec> &vectors, uint64_t offset, size_t skip)
+{
+    std::vector<iovec> pending;
+    pending.reserve(vectors.size());
+    for (const auto &vector : vectors) {
+        if (skip >= vector.iov_len) {
+            skip -= vector.iov_len;
+            offset += vector.iov_len;
+            continue;
+        }
+        pending.push_back({ static_cast<uint8_t *>(vector.iov_base) + skip, vector.iov_len - skip });
+        offset += skip;
+        skip = 0;
+    }
+
+    size_t first = 0;
+    while (first < pending.size()) {
+        const int count = int(std::min<size_t>(pending.size() - first, IOV_MAX));
+        const ssize_t written = ::pwritev(fd, pending.data() + first, count, off_t(offset));
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            warn("write failed", errno);
+            return false;
+        }
+        offset += uint64_t(written);
+        size_t left = size_t(written);
+        while (first < pending.size() && left >= pending[first].iov_len)
+            left -= pending[first++].iov_len;
+        if (left) {
+            pending[first].iov_base = static_cast<uint8_t *>(pending[first].iov_base) + left;
+            pending[first].iov_len -= left;
+        }
+    }
+    return true;
+}
+
+bool pwriteAll(int fd, const void *data, size_t size, uint64_t offset)
+{
+    return pwritevAll(fd, { { const_cast<void *>(data), size } }, offset, 0);
+}
+
+} // namespace
+
+// Just enough of io_uring for vectored writes, straight on the syscalls so
+// there is no liburing dependency.
+class RawFrameWriter::IoUring
+{
+public:
+    ~IoUring()
+    {
+        if (m_sqes)
+            ::munmap(m_sqes, m_sqesSize);
+        if (m_cqRing && m_cqRing != m_sqRing)
+            ::munmap(m_cqRing, m_cqRingSize);
+        if (m_sqRing)
+            ::munmap(m_sqRing, m_sqRingSize);
+        if (m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    bool init(unsigned entries)
+    {
+        io_uring_params params = {};
+        m_fd = int(::syscall(__NR_io_uring_setup, entries, &params));
+        if (m_fd < 0)
+            return false;
+
+        m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+            m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+        m_sqRing = mapRing(m_sqRingSize, IORING_OFF_SQ_RING);
+        if (!m_sqRing)
+            return false;
+        m_cqRing = singleMap ? m_sqRing : mapRing(m_cqRingSize, IORING_OFF_CQ_RING);
+        if (!m_cqRing)
+            return false;
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe *>(mapRing(m_sqesSize, IORING_OFF_SQES));
+        if (!m_sqes)
+            return false;
+
+        auto sq = static_cast<uint8_t *>(m_sqRing);
+        m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        auto cq = static_cast<uint8_t *>(m_cqRing);
+        m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // The caller keeps at most entries requests in flight
+    bool submitWritev(int fd, const iovec *vectors, unsigned count, uint64_t offset, uint64_t userData)
+    {
+        const unsigned tail = *m_sqTail;
+        const unsigned index = tail & m_sqMask;
+        io_uring_sqe *sqe = &m_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(vectors);
+        sqe->len = count;
+        sqe->off = offset;
+        sqe->user_data = userData;
+        m_sqArray[index] = index;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        for (;;) {
+            const long submitted = ::syscall(__NR_io_uring_enter, m_fd, 1, 0, 0, nullptr, 0);
+            if (submitted >= 0)
+                return submitted == 1;
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    bool waitCompletion(uint64_t *userData, int32_t *result)
+    {
+        for (;;) {
+            const unsigned head = *m_cqHead;
+            if (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+                *userData = cqe.user_data;
+                *result = cqe.res;
+                __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            if (::syscall(__NR_io_uring_enter, m_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                && errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+private:
+    void *mapRing(size_t size, off_t offset)
+    {
+        void *ring = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        return ring == MAP_FAILED ? nullptr : ring;
+    }
+
+    int m_fd{ -1 };
+    void *m_sqRing{ nullptr };
+    void *m_cqRing{ nullptr };
+    size_t m_sqRingSize{ 0 };
+    size_t m_cqRingSize{ 0 };
+    io_uring_sqe *m_sqes{ nullptr };
+    size_t m_sqesSize{ 0 };
+    unsigned *m_sqTail{ nullptr };
+    unsigned *m_sqArray{ nullptr };
+    unsigned m_sqMask{ 0 };
+    unsigned *m_cqHead{ nullptr };
+    unsigned *m_cqTail{ nullptr };
+    unsigned m_cqMask{ 0 };
+    io_uring_cqe *m_cqes{ nullptr };
+};
+
+struct RawFrameWriter::PayloadPool
+{
+    struct Block
+    {
+        uint8_t *data;
+        size_t capacity;
+    };
+
+    explicit PayloadPool(size_t budget)
+        : budget(budget)
+    {
+    }
+
+    ~PayloadPool()
+    {
+        for (const Block &block : idle)
+            std::free(block.data);
+    }
+
+    // The caller holds mutex
+    void release(Block *block)
+    {
+        std::free(block->data);
+        allocated -= block->capacity;
+    }
+
+    std::mutex mutex;
+    std::vector<Block> idle;
+    size_t budget;
+    // Capacity of every block, idle or in use
+    size_t allocated{ 0 };
+};
+
+struct RawFrameWriter::Batch
+{
+    // Keep the payloads referenced until they are written
+    std::vector<Frame> frames;
+    // Never reallocated, iovecs point into it
+    std::vector<uint8_t> headers = std::vector<uint8_t>(MaxBatchFrames * FrameHeaderSize);
+    std::vector<iovec> iov;
+    uint64_t offset{ 0 };
+    size_t bytes{ 0 };
+
+    void clear()
+    {
+        frames.clear();
+        iov.clear();
+        bytes = 0;
+    }
+};
+
+RawFrameWriter::RawFrameWriter(size_t queueCapacity, size_t payloadBudget)
+    : m_queueCapacity(queueCapacity)
+    , m_payloads(std::make_shared<PayloadPool>(payloadBudget))
+{
+}
+
+RawFrameWriter::~RawFrameWriter()
+{
+    if (isOpen())
+        close();
+}
+
+bool RawFrameWriter::open(const std::string &path)
+{
+    if (isOpen())
+        return false;
+
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        warn(path.c_str(), errno);
+        return false;
+    }
+
+    RawFileHeader header = {};
+    std::memcpy(header.magic, FileMagic, sizeof(header.magic));
+    header.version = RawFrameVersion;
+    header.alignment = RawFrameAlignment;
+    std::vector<uint8_t> block(RawFrameAlignment);
+    std::memcpy(block.data(), &header, sizeof(header));
+    if (!pwriteAll(m_fd, block.data(), block.size(), 0)) {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    // Containers often filter io_uring out with seccomp, setup fails then
+    if (!std::getenv("TEST_CAPTURE_RAW_NO_IO_URING")) {
+        m_ring = std::make_unique<IoUring>();
+        if (!m_ring->init(QueueDepth * 2))
+            m_ring.reset();
+    }
+
+    m_queue = std::make_unique<SpscQueue<Frame>>(m_queueCapacity);
+    m_batches.clear();
+    for (unsigned i = 0; i < QueueDepth; ++i)
+        m_batches.push_back(std::make_unique<Batch>());
+    m_inFlight.clear();
+    m_index.clear();
+    m_offset = RawFrameAlignment;
+    m_failed = false;
+    m_framesWritten = 0;
+    m_bytesWritten = RawFrameAlignment;
+    m_running = true;
+    m_thread = std::thread(&RawFrameWriter::writeLoop, this);
+    return true;
+}
+
+std::shared_ptr<uint8_t> RawFrameWriter::allocatePayload(size_t size)
+{
+    const size_t capacity = alignUp(std::max<size_t>(size, 1), RawFrameAlignment);
+    PayloadPool::Block block = { nullptr, 0 };
+    {
+        std::lock_guard<std::mutex> lock(m_payloads->mutex);
+        auto &idle = m_payloads->idle;
+        // Frames keep their size, anything much bigger is left for others
+        auto fit = std::find_if(idle.begin(), idle.end(), [capacity](const PayloadPool::Block &block) {
+            return block.capacity >= capacity && block.capacity / 2 < capacity;
+        });
+        if (fit != idle.end()) {
+            block = *fit;
+            idle.erase(fit);
+        } else {
+            // Blocks of another size make room after a resize
+            while (m_payloads->allocated + capacity > m_payloads->budget && !idle.empty()) {
+                m_payloads->release(&idle.back());
+                idle.pop_back();
+            }
+            if (m_payloads->allocated + capacity > m_payloads->budget)
+                return nullptr;
+            block = { static_cast<uint8_t *>(std::aligned_alloc(RawFrameAlignment, capacity)), capacity };
+            if (!block.data)
+                return nullptr;
+            m_payloads->allocated += capacity;
+        }
+    }
+
+    return std::shared_ptr<uint8_t>(block.data, [pool = m_payloads, block](uint8_t *) {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->idle.push_back(block);
+    });
+}
+
+bool RawFrameWriter::submit(Frame &&frame)
+{
+    if (!isOpen() || failed() || frame.planeCount <= 0 || frame.planeCount > RawFrameMaxPlanes)
+        return false;
+    if (!m_queue->tryPush(std::move(frame)))
+        return false;
+    m_wake.notify_one();
+    return true;
+}
+
+bool RawFrameWriter::close()
+{
+    if (!isOpen())
+        return false;
+
+    m_running = false;
+    m_wake.notify_one();
+    m_thread.join();
+
+    bool ok = !failed();
+    if (ok) {
+        RawIndexHeader indexHeader = {};
+        indexHeader.magic = RawFrameIndexMagic;
+        indexHeader.entrySize = sizeof(RawIndexEntry);
+        indexHeader.count = m_index.size();
+        ok = pwritevAll(m_fd,
+                        { { &indexHeader, sizeof(indexHeader) },
+                          { m_index.data(), m_index.size() * sizeof(RawIndexEntry) } },
+                        m_offset,
+                        0);
+    }
+    if (ok) {
+        // Last, a file with an index in its header is complete
+        RawFileHeader header = {};
+        std::memcpy(header.magic, FileMagic, sizeof(header.magic));
+        header.version = RawFrameVersion;
+        header.alignment = RawFrameAlignment;
+        header.indexOffset = m_offset;
+        header.frameCount = m_index.size();
+        ok = pwriteAll(m_fd, &header, sizeof(header), 0);
+    }
+
+    ::close(m_fd);
+    m_fd = -1;
+    m_ring.reset();
+    m_queue.reset();
+    m_batches.clear();
+
+    std::lock_guard<std::mutex> lock(m_payloads->mutex);
+    for (auto &block : m_payloads->idle)
+        m_payloads->release(&block);
+    m_payloads->idle.clear();
+    return ok;
+}
+
+void RawFrameWriter::writeLoop()
+{
+    for (;;) {
+        if (m_inFlight.size() == m_batches.size() && !completeBatch())
+            m_failed = true;
+
+        Batch *batch = nullptr;
+        for (const auto &candidate : m_batches) {
+            if (std::find(m_inFlight.cbegin(), m_inFlight.cend(), candidate.get()) == m_inFlight.cend()) {
+                batch = candidate.get();
+                break;
+            }
+        }
+
+        if (fillBatch(*batch)) {
+            if (!submitBatch(*batch))
+                m_failed = true;
+            continue;
+        }
+        if (!m_inFlight.empty()) {
+            if (!completeBatch())
+                m_failed = true;
+            continue;
+        }
+        // Re-check after seeing the flag, frames may have been submitted
+        // right before close()
+        if (!m_running && m_queue->empty())
+            break;
+        if (m_running) {
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_wake.wait_for(lock, WriterWakeInterval);
+        }
+    }
+}
+
+bool RawFrameWriter::fillBatch(Batch &batch)
+{
+    batch.clear();
+    batch.offset = m_offset;
+
+    Frame frame;
+    while (batch.bytes < BatchBytes && batch.frames.size() < MaxBatchFrames
+           && batch.iov.size() + MaxFrameIovecs <= MaxBatchIovecs && m_queue->tryPop(frame)) {
+        // After a write error the queue is only drained
+        if (failed())
+            continue;
+
+        RawFrameHeader header = {};
+        header.magic = RawFrameRecordMagic;
+        header.headerSize = sizeof(RawFrameHeader);
+        header.sequence = frame.sequence;
+        header.presentationTimeNs = frame.presentationTimeNs;
+        header.modifier = frame.modifier;
+        header.width = frame.width;
+        header.height = frame.height;
+        header.fourcc = frame.fourcc;
+        header.planeCount = uint32_t(frame.planeCount);
+
+        uint8_t *headerSlot = batch.headers.data() + batch.frames.size() * FrameHeaderSize;
+        batch.iov.push_back({ headerSlot, FrameHeaderSize });
+        uint64_t position = FrameHeaderSize;
+        for (int i = 0; i < frame.planeCount; ++i) {
+            const Plane &plane = frame.planes[i];
+            const uint64_t aligned = alignUp(position, RawFramePayloadAlignment);
+            if (aligned > position)
+                batch.iov.push_back({ const_cast<uint8_t *>(s_zeros), size_t(aligned - position) });
+            header.planes[i] = { aligned, plane.size, plane.stride, 0 };
+            if (plane.size)
+                batch.iov.push_back({ const_cast<uint8_t *>(plane.data), plane.size });
+            position = aligned + plane.size;
+        }
+        header.recordSize = alignUp(position, RawFrameAlignment);
+        if (header.recordSize > position)
+            batch.iov.push_back({ const_cast<uint8_t *>(s_zeros), size_t(header.recordSize - position) });
+        std::memset(headerSlot, 0, FrameHeaderSize);
+        std::memcpy(headerSlot, &header, sizeof(header));
+
+        m_index.push_back({ m_offset, header.recordSize, frame.presentationTimeNs, frame.sequence });
+        m_offset += header.recordSize;
+        batch.bytes += header.recordSize;
+        batch.frames.push_back(std::move(frame));
+    }
+    return !batch.frames.empty();
+}
+
+bool RawFrameWriter::submitBatch(Batch &batch)
+{
+    CAPTURE_TRACE_SCOPE("raw write");
+    if (!m_ring)
+        return finishBatch(batch, 0);
+    if (!m_ring->submitWritev(m_fd,
+                              batch.iov.data(),
+                              unsigned(batch.iov.size()),
+                              batch.offset,
+                              reinterpret_cast<uint64_t>(&batch))) {
+        warn("io_uring submission failed", errno);
+        batch.clear();
+        return false;
+    }
+    m_inFlight.push_back(&batch);
+    return true;
+}
+
+bool RawFrameWriter::completeBatch()
+{
+    uint64_t userData = 0;
+    int32_t result = 0;
+    if (!m_ring->waitCompletion(&userData, &result)) {
+        warn("io_uring wait failed", errno);
+        for (Batch *batch : std::exchange(m_inFlight, {}))
+            batch->clear();
+        return false;
+    }
+
+    auto batch = reinterpret_cast<Batch *>(userData);
+    m_inFlight.erase(std::find(m_inFlight.begin(), m_inFlight.end(), batch));
+    if (result < 0) {
+        warn("write failed", -result);
+        batch->clear();
+        return false;
+    }
+    return finishBatch(*batch, size_t(result));
+}
+
+bool RawFrameWriter::finishBatch(Batch &batch, size_t written)
+{
+    // Short writes are rare, the rest goes through pwritev
+    const bool ok = written >= batch.bytes || pwritevAll(m_fd, batch.iov, batch.offset, written);
+    if (ok) {
+        m_framesWritten.fetch_add(batch.frames.size(), std::memory_order_relaxed);
+        m_bytesWritten.fetch_add(batch.bytes, std::memory_order_relaxed);
+    }
+    batch.clear();
+    return ok;
+}
+
+RawFrameReader::~RawFrameReader()
+{
+    close();
+}
+
+bool RawFrameReader::open(const std::string &path)
+{
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat status;
+    if (::fstat(fd, &status) != 0 || size_t(status.st_size) < RawFrameAlignment) {
+        ::close(fd);
+        return false;
+    }
+    void *data = ::mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    m_data = static_cast<const uint8_t *>(data);
+    m_size = size_t(status.st_size);
+
+    RawFileHeader header;
+    std::memcpy(&header, m_data, sizeof(header));
+    if (std::memcmp(header.magic, FileMagic, sizeof(header.magic)) != 0
+        || header.version != RawFrameVersion || header.alignment != RawFrameAlignment) {
+        close();
+        return false;
+    }
+
+    if (!readIndex(header))
+        rebuildIndex();
+    return true;
+}
+
+void RawFrameReader::close()
+{
+    if (m_data)
+        ::munmap(const_cast<uint8_t *>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+    m_index.clear();
+    m_recovered = false;
+}
+
+bool RawFrameReader::readIndex(const RawFileHeader &header)
+{
+    if (!header.indexOffset || header.indexOffset > m_size
+        || m_size - header.indexOffset < sizeof(RawIndexHeader)) {
+        return false;
+    }
+    RawIndexHeader indexHeader;
+    std::memcpy(&indexHeader, m_data + header.indexOffset, sizeof(indexHeader));
+    const size_t available = m_size - header.indexOffset - sizeof(RawIndexHeader);
+    if (indexHeader.magic != RawFrameIndexMagic || indexHeader.entrySize != sizeof(RawIndexEntry)
+        || indexHeader.count != header.frameCount
+        || indexHeader.count > available / sizeof(RawIndexEntry)) {
+        return false;
+    }
+
+    m_index.resize(indexHeader.count);
+    std::memcpy(m_index.data(),
+                m_data + header.indexOffset + sizeof(RawIndexHeader),
+                m_index.size() * sizeof(RawIndexEntry));
+    for (const auto &entry : m_index) {
+        if (!record(entry)) {
+            m_index.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void RawFrameReader::rebuildIndex()
+{
+    // Up to the first torn or missing record, everything before is intact
+    m_recovered = true;
+    uint64_t offset = RawFrameAlignment;
+    while (offset + sizeof(RawFrameHeader) <= m_size) {
+        const auto header = reinterpret_cast<const RawFrameHeader *>(m_data + offset);
+        const RawIndexEntry entry{ offset, header->recordSize, header->presentationTimeNs, header->sequence };
+        if (header->recordSize % RawFrameAlignment || !record(entry))
+            break;
+        m_index.push_back(entry);
+        offset += header->recordSize;
+    }
+}
+
+const RawFrameHeader *RawFrameReader::record(const RawIndexEntry &entry) const
+{
+    if (entry.offset % RawFrameAlignment || entry.offset > m_size || entry.recordSize > m_size - entry.offset
+        || entry.recordSize < sizeof(RawFrameHeader)) {
+        return nullptr;
+    }
+    const auto header = reinterpret_cast<const RawFrameHeader *>(m_data + entry.offset);
+    if (header->magic != RawFrameRecordMagic || header->headerSize < sizeof(RawFrameHeader)
+        || header->recordSize != entry.recordSize || header->planeCount == 0
+        || header->planeCount > uint32_t(RawFrameMaxPlanes)) {
+        return nullptr;
+    }
+    for (uint32_t i = 0; i < header->planeCount; ++i) {
+        const auto &plane = header->planes[i];
+        if (plane.offset > header->recordSize || plane.size > header->recordSize - plane.offset)
+            return nullptr;
+    }
+    return header;
+}
+
+bool RawFrameReader::frame(size_t index, Frame *frame) const
+{
+    if (index >= m_index.size())
+        return false;
+    const RawIndexEntry &entry = m_index[index];
+    const RawFrameHeader *header = record(entry);
+    if (!header)
+        return false;
+
+    *frame = {};
+    frame->sequence = header->sequence;
+    frame->presentationTimeNs = header->presentationTimeNs;
+    frame->modifier = header->modifier;
+    frame->width = header->width;
+    frame->height = header->height;
+    frame->fourcc = header->fourcc;
+    frame->planeCount = int(header->planeCount);
+    for (int i = 0; i < frame->planeCount; ++i) {
+        frame->planes[i].data = m_data + entry.offset + header->planes[i].offset;
+        frame->planes[i].size = size_t(header->planes[i].size);
+        frame->planes[i].stride = header->planes[i].stride;
+    }
+    return true;
+}
+
+size_t RawFrameReader::findFrame(uint64_t presentationTimeNs) const
+{
+    const auto it = std::lower_bound(m_index.cbegin(),
+                                     m_index.cend(),
+                                     presentationTimeNs,
+                                     [](const RawIndexEntry &entry, uint64_t timestamp) {
+                                         return entry.presentationTimeNs < timestamp;
+                                     });
+    return size_t(it - m_index.cbegin());
+}
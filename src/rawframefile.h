@@ -0,0 +1,255 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "spscqueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Append-only dump of captured frames exactly as the compositor handed them
+// out, for lossless capture that is encoded later. Fields are in host byte
+// order, every record starts on a RawFrameAlignment boundary:
+//
+//   RawFileHeader, padded to RawFrameAlignment
+//   record: RawFrameHeader, padded to 64 bytes, then each plane's payload at
+//           a 64 byte aligned offset, the record padded to RawFrameAlignment
+//   ...
+//   RawIndexHeader followed by one RawIndexEntry per record
+//
+// The index is written on close and the header then points at it. A file
+// that was never closed has no index, readers rebuild it from the records.
+constexpr uint32_t RawFrameVersion = 1;
+constexpr uint32_t RawFrameAlignment = 4096;
+constexpr uint32_t RawFramePayloadAlignment = 64;
+constexpr uint32_t RawFrameRecordMagic = 0x4d415246; // "FRAM"
+constexpr uint32_t RawFrameIndexMagic = 0x58444e49; // "INDX"
+constexpr int RawFrameMaxPlanes = 4;
+
+struct RawFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t alignment;
+    // 0 while the file is being written
+    uint64_t indexOffset;
+    uint64_t frameCount;
+};
+
+struct RawPlaneLayout
+{
+    // Relative to the start of the record
+    uint64_t offset;
+    uint64_t size;
+    uint32_t stride;
+    uint32_t reserved;
+};
+
+struct RawFrameHeader
+{
+    uint32_t magic;
+    uint32_t headerSize;
+    // Including the header and the trailing padding
+    uint64_t recordSize;
+    uint64_t sequence;
+    // Compositor timestamp, CLOCK_MONOTONIC nanoseconds
+    uint64_t presentationTimeNs;
+    uint64_t modifier;
+    uint32_t width;
+    uint32_t height;
+    uint32_t fourcc;
+    uint32_t planeCount;
+    RawPlaneLayout planes[RawFrameMaxPlanes];
+};
+
+struct RawIndexHeader
+{
+    uint32_t magic;
+    uint32_t entrySize;
+    uint64_t count;
+};
+
+struct RawIndexEntry
+{
+    uint64_t offset;
+    uint64_t recordSize;
+    uint64_t presentationTimeNs;
+    uint64_t sequence;
+};
+
+static_assert(sizeof(RawFileHeader) == 32);
+static_assert(sizeof(RawFrameHeader) == 152);
+static_assert(sizeof(RawIndexHeader) == 16);
+static_assert(sizeof(RawIndexEntry) == 32);
+
+// Writes records from a thread of its own. Payloads are written straight
+// from the memory the planes point to, which stays referenced through owner
+// until its batch is on disk. Records are collected into large batches of
+// aligned offsets and written with io_uring, or pwritev where io_uring isn't
+// available.
+//
+// Memory that others may still change, like a compositor's buffers, has to be
+// copied before it is submitted, allocatePayload() hands out page aligned
+// blocks for that which are reused once written.
+class RawFrameWriter
+{
+public:
+    struct Plane
+    {
+        std::shared_ptr<const void> owner;
+        const uint8_t *data{ nullptr };
+        size_t size{ 0 };
+        uint32_t stride{ 0 };
+    };
+
+    struct Frame
+    {
+        uint64_t sequence{ 0 };
+        uint64_t presentationTimeNs{ 0 };
+        uint64_t modifier{ 0 };
+        uint32_t width{ 0 };
+        uint32_t height{ 0 };
+        uint32_t fourcc{ 0 };
+        int planeCount{ 0 };
+        Plane planes[RawFrameMaxPlanes];
+    };
+
+    explicit RawFrameWriter(size_t queueCapacity = 16, size_t payloadBudget = size_t(256) << 20);
+    ~RawFrameWriter();
+
+    RawFrameWriter(const RawFrameWriter &) = delete;
+    RawFrameWriter &operator=(const RawFrameWriter &) = delete;
+
+    bool open(const std::string &path);
+    // At least size bytes, null when the payloads not written yet use up the
+    // budget. The frame is best dropped then, the writer is behind.
+    std::shared_ptr<uint8_t> allocatePayload(size_t size);
+    // From one producer thread. False when the writer is behind and the
+    // queue is full, or after a write error.
+    bool submit(Frame &&frame);
+    // Writes what is queued, then the index. False if anything failed.
+    bool close();
+
+    inline bool isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    inline bool usesIoUring() const
+    {
+        return m_ring != nullptr;
+    }
+
+    inline bool failed() const
+    {
+        return m_failed.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t framesWritten() const
+    {
+        return m_framesWritten.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t bytesWritten() const
+    {
+        return m_bytesWritten.load(std::memory_order_relaxed);
+    }
+
+private:
+    class IoUring;
+    struct Batch;
+    struct PayloadPool;
+
+    void writeLoop();
+    bool fillBatch(Batch &batch);
+    bool submitBatch(Batch &batch);
+    bool completeBatch();
+    bool finishBatch(Batch &batch, size_t written);
+
+    int m_fd{ -1 };
+    size_t m_queueCapacity;
+    std::unique_ptr<SpscQueue<Frame>> m_queue;
+    std::unique_ptr<IoUring> m_ring;
+    // Shared with the payloads, they may outlive the writer
+    std::shared_ptr<PayloadPool> m_payloads;
+    std::vector<std::unique_ptr<Batch>> m_batches;
+    // Batches submitted to the ring and not completed yet, oldest first
+    std::vector<Batch *> m_inFlight;
+    std::vector<RawIndexEntry> m_index;
+    uint64_t m_offset{ 0 };
+
+    std::thread m_thread;
+    std::atomic_bool m_running{ false };
+    std::atomic_bool m_failed{ false };
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    std::atomic<uint64_t> m_framesWritten{ 0 };
+    std::atomic<uint64_t> m_bytesWritten{ 0 };
+};
+
+// Random access to the frames of a dump through one read-only mapping.
+class RawFrameReader
+{
+public:
+    struct Plane
+    {
+        const uint8_t *data{ nullptr };
+        size_t size{ 0 };
+        uint32_t stride{ 0 };
+    };
+
+    struct Frame
+    {
+        uint64_t sequence{ 0 };
+        uint64_t presentationTimeNs{ 0 };
+        uint64_t modifier{ 0 };
+        uint32_t width{ 0 };
+        uint32_t height{ 0 };
+        uint32_t fourcc{ 0 };
+        int planeCount{ 0 };
+        Plane planes[RawFrameMaxPlanes];
+    };
+
+    RawFrameReader() = default;
+    ~RawFrameReader();
+
+    RawFrameReader(const RawFrameReader &) = delete;
+    RawFrameReader &operator=(const RawFrameReader &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+
+    inline size_t frameCount() const
+    {
+        return m_index.size();
+    }
+
+    // The file had no index, it was rebuilt from the records
+    inline bool recovered() const
+    {
+        return m_recovered;
+    }
+
+    // The planes point into the mapping and stay valid until close().
+    bool frame(size_t index, Frame *frame) const;
+    // First frame presented at or after presentationTimeNs, frameCount() if none
+    size_t findFrame(uint64_t presentationTimeNs) const;
+
+private:
+    bool readIndex(const RawFileHeader &header);
+    void rebuildIndex();
+    const RawFrameHeader *record(const RawIndexEntry &entry) const;
+
+    const uint8_t *m_data{ nullptr };
+    size_t m_size{ 0 };
+    std::vector<RawIndexEntry> m_index;
+    bool m_recovered{ false };
+};
@@ -0,0 +1,122 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "rawrecorder.h"
+#include "capture.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <cstring>
+
+RawRecorder::RawRecorder(QObject *parent)
+    : QObject(parent)
+{
+}
+
+RawRecorder::~RawRecorder()
+{
+    stop();
+}
+
+QString RawRecorder::fileSuffix()
+{
+    return QStringLiteral("tcraw");
+}
+
+bool RawRecorder::start(TreelandCaptureSession *session, const QString &path)
+{
+    if (m_recording)
+        return false;
+    if (!session) {
+        Q_EMIT error(QStringLiteral("No capture session"));
+        return false;
+    }
+    if (!m_writer.open(QFile::encodeName(path).toStdString())) {
+        Q_EMIT error(QStringLiteral("Failed to open %1").arg(path));
+        return false;
+    }
+
+    m_session = session;
+    m_path = path;
+    m_captured = 0;
+    m_dropped = 0;
+    // Direct connection: the planes have to be copied before the compositor
+    // reuses the buffers.
+    connect(session,
+            &TreelandCaptureSession::ready,
+            this,
+            &RawRecorder::handleSessionReady,
+            Qt::DirectConnection);
+    connect(session, &TreelandCaptureSession::destroyed, this, &RawRecorder::stop);
+
+    m_recording = true;
+    qInfo() << "Dumping raw frames to" << path << (m_writer.usesIoUring() ? "with io_uring" : "with pwritev");
+    Q_EMIT recordingChanged();
+    return true;
+}
+
+void RawRecorder::stop()
+{
+    if (!m_recording)
+        return;
+
+    if (m_session) {
+        // Waits for a handleSessionReady() running on the event thread
+        QMutexLocker locker(m_session->deliveryMutex());
+        m_session->disconnect(this);
+    }
+    m_session = nullptr;
+
+    const bool ok = m_writer.close();
+    m_recording = false;
+    qInfo() << "Raw dump finished:" << m_path << "captured" << m_captured << "written"
+            << m_writer.framesWritten() << "dropped" << m_dropped << "bytes" << m_writer.bytesWritten();
+    if (!ok)
+        Q_EMIT error(QStringLiteral("Failed to write %1").arg(m_path));
+    Q_EMIT recordingChanged();
+}
+
+void RawRecorder::handleSessionReady()
+{
+    if (!m_session)
+        return;
+
+    const FrameRef captured = m_session->frame();
+    RawFrameWriter::Frame frame;
+    frame.sequence = captured->sequence;
+    frame.presentationTimeNs = captured->presentationTimeNs;
+    frame.modifier = captured->modifier;
+    frame.width = captured->width;
+    frame.height = captured->height;
+    frame.fourcc = captured->format;
+    for (const auto &object : captured->objects()) {
+        if (object.planeIndex >= RawFrameMaxPlanes)
+            continue;
+        auto mapping = m_session->mapObject(*captured, object);
+        if (!mapping || object.offset > mapping->size())
+            continue;
+        // The plane's rows as laid out in the buffer, secondary planes of
+        // subsampled formats are cut off by the end of their object.
+        const size_t size = qMin(size_t(object.stride) * frame.height, mapping->size() - object.offset);
+        auto payload = m_writer.allocatePayload(size);
+        if (!payload) {
+            frame.planeCount = 0;
+            break;
+        }
+        {
+            DmaBufReadAccess access(object.fd.get());
+            std::memcpy(payload.get(), mapping->data() + object.offset, size);
+        }
+        auto &plane = frame.planes[object.planeIndex];
+        plane.data = payload.get();
+        plane.size = size;
+        plane.stride = object.stride;
+        plane.owner = std::move(payload);
+        frame.planeCount = qMax(frame.planeCount, int(object.planeIndex) + 1);
+    }
+    ++m_captured;
+
+    if (frame.planeCount == 0 || !frame.planes[0].data || !m_writer.submit(std::move(frame)))
+        ++m_dropped;
+}
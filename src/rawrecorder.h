@@ -0,0 +1,52 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "rawframefile.h"
+
+#include <QObject>
+#include <QPointer>
+
+#include <atomic>
+
+class TreelandCaptureSession;
+
+// Dumps session frames unconverted into a raw frame file, see
+// rawframefile.h. Every plane is copied once, right when the frame is ready,
+// into the writer's payload memory. The compositor renders into its buffers
+// again a few frames later and nothing tells when, so they can't be written
+// from later. Frames are dropped while the writer is behind.
+class RawRecorder : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool recording READ recording NOTIFY recordingChanged FINAL)
+
+public:
+    explicit RawRecorder(QObject *parent = nullptr);
+    ~RawRecorder() override;
+
+    static QString fileSuffix();
+
+    inline bool recording() const
+    {
+        return m_recording;
+    }
+
+    bool start(TreelandCaptureSession *session, const QString &path);
+    void stop();
+
+Q_SIGNALS:
+    void recordingChanged();
+    void error(const QString &message);
+
+private:
+    void handleSessionReady();
+
+    QPointer<TreelandCaptureSession> m_session;
+    RawFrameWriter m_writer;
+    QString m_path;
+    bool m_recording{ false };
+    quint64 m_captured{ 0 };
+    quint64 m_dropped{ 0 };
+};
@@ -0,0 +1,89 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "recordencoder.h"
+
+#include <QDebug>
+
+std::unique_ptr<RecordEncoder> RecordEncoder::create(const QString &name)
+{
+    if (name.isEmpty() || name == QLatin1String("y4m"))
+        return std::make_unique<Y4mRecordEncoder>();
+    qWarning() << "Unknown record encoder" << name;
+    return nullptr;
+}
+
+Y4mRecordEncoder::~Y4mRecordEncoder()
+{
+    close();
+}
+
+const char *Y4mRecordEncoder::name() const
+{
+    return "y4m";
+}
+
+QString Y4mRecordEncoder::fileSuffix() const
+{
+    return QStringLiteral("y4m");
+}
+
+bool Y4mRecordEncoder::open(const QString &path, uint32_t width, uint32_t height, int fps)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed to open" << path << m_file.errorString();
+        return false;
+    }
+    const QByteArray header = QStringLiteral("YUV4MPEG2 W%1 H%2 F%3:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n")
+                                  .arg(width)
+                                  .arg(height)
+                                  .arg(fps)
+                                  .toLatin1();
+    if (m_file.write(header) != header.size())
+        return false;
+
+    // The video is still usable without, at its nominal rate
+    m_timestamps.setFileName(timestampsPath(path));
+    if (m_timestamps.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        m_timestamps.write("# timestamp format v2\n");
+    else
+        qWarning() << "Failed to open" << m_timestamps.fileName() << m_timestamps.errorString();
+    m_firstTimestampNs = 0;
+    m_lastTimestampUs = -1;
+    return true;
+}
+
+bool Y4mRecordEncoder::encode(const RecordYuvFrame &frame)
+{
+    static const QByteArray frameHeader = QByteArrayLiteral("FRAME\n");
+    if (!m_file.isOpen())
+        return false;
+    if (m_file.write(frameHeader) != frameHeader.size())
+        return false;
+    const auto size = qint64(frame.data.size());
+    if (m_file.write(reinterpret_cast<const char *>(frame.data.data()), size) != size)
+        return false;
+
+    if (m_timestamps.isOpen()) {
+        if (m_lastTimestampUs < 0)
+            m_firstTimestampNs = frame.timestampNs;
+        m_lastTimestampUs =
+            qMax(m_lastTimestampUs + 1, (frame.timestampNs - m_firstTimestampNs) / 1000);
+        m_timestamps.write(QByteArray::number(double(m_lastTimestampUs) / 1000.0, 'f', 3) + '\n');
+    }
+    return true;
+}
+
+void Y4mRecordEncoder::close()
+{
+    if (m_file.isOpen())
+        m_file.close();
+    if (m_timestamps.isOpen())
+        m_timestamps.close();
+}
+
+QString Y4mRecordEncoder::timestampsPath(const QString &path)
+{
+    return path + QStringLiteral(".timestamps.txt");
+}
@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <QFile>
+#include <QString>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct RecordYuvFrame
+{
+    uint32_t width{ 0 };
+    uint32_t height{ 0 };
+    // Presentation time on the compositor's CLOCK_MONOTONIC. Frames come at a
+    // variable rate, the fps an encoder is opened with is only nominal.
+    int64_t timestampNs{ 0 };
+    // Planar I420, Y followed by the quarter-size U and V planes
+    std::vector<uint8_t> data;
+
+    inline void resize(uint32_t newWidth, uint32_t newHeight)
+    {
+        width = newWidth;
+        height = newHeight;
+        data.resize(size_t(width) * height * 3 / 2);
+    }
+
+    inline uint8_t *planeY()
+    {
+        return data.data();
+    }
+
+    inline uint8_t *planeU()
+    {
+        return data.data() + size_t(width) * height;
+    }
+
+    inline uint8_t *planeV()
+    {
+        return planeU() + size_t(width / 2) * (height / 2);
+    }
+};
+
+// A software encoder together with the container it writes. Implementations
+// are driven from the recorder's encoder thread only.
+class RecordEncoder
+{
+public:
+    virtual ~RecordEncoder() = default;
+
+    virtual const char *name() const = 0;
+    virtual QString fileSuffix() const = 0;
+    virtual bool open(const QString &path, uint32_t width, uint32_t height, int fps) = 0;
+    virtual bool encode(const RecordYuvFrame &frame) = 0;
+    virtual void close() = 0;
+
+    static std::unique_ptr<RecordEncoder> create(const QString &name = QString());
+};
+
+// Uncompressed YUV4MPEG2 stream, readable by ffmpeg, mpv and x264 directly.
+// Y4M only knows a constant frame rate, the frame timestamps go into a
+// <path>.timestamps.txt sidecar in Matroska timestamp format v2, e.g. for
+// mkvmerge --timestamps 0:<sidecar>.
+class Y4mRecordEncoder : public RecordEncoder
+{
+public:
+    ~Y4mRecordEncoder() override;
+
+    const char *name() const override;
+    QString fileSuffix() const override;
+    bool open(const QString &path, uint32_t width, uint32_t height, int fps) override;
+    bool encode(const RecordYuvFrame &frame) override;
+    void close() override;
+
+    static QString timestampsPath(const QString &path);
+
+private:
+    QFile m_file;
+    QFile m_timestamps;
+    int64_t m_firstTimestampNs{ 0 };
+    // Microseconds, each frame gets a later one than the previous frame
+    int64_t m_lastTimestampUs{ -1 };
+};
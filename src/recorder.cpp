@@ -0,0 +1,800 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "recorder.h"
+#include "capture.h"
+#include "capturescheduler.h"
+#include "capturetrace.h"
+#include "dmabufcache.h"
+#include "pixelconvert.h"
+#include "watermark.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QTimer>
+
+#include <libdrm/drm_fourcc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+
+namespace {
+
+constexpr auto WorkerWakeInterval = std::chrono::milliseconds(5);
+constexpr int RateSampleIntervalMs = 250;
+// Conversions a pooled frame can lag behind and still be brought up to date
+// by copying what they changed
+constexpr size_t ReferenceDamageHistory = 32;
+
+int64_t steadyClockNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Both frames have the same size, rect has even coordinates
+void copyI420Rect(RecordYuvFrame &from, RecordYuvFrame *to, const QRect &rect)
+{
+    const QRect clipped = rect & QRect(0, 0, int(to->width), int(to->height));
+    if (clipped.isEmpty())
+        return;
+    const size_t x = size_t(clipped.x());
+    const size_t y = size_t(clipped.y());
+    const size_t width = size_t(clipped.width());
+    const size_t height = size_t(clipped.height());
+    for (size_t row = y; row < y + height; ++row) {
+        const size_t offset = size_t(to->width) * row + x;
+        std::memcpy(to->planeY() + offset, from.planeY() + offset, width);
+    }
+    const size_t chromaStride = to->width / 2;
+    for (size_t row = y / 2; row < (y + height + 1) / 2; ++row) {
+        const size_t offset = chromaStride * row + x / 2;
+        std::memcpy(to->planeU() + offset, from.planeU() + offset, (width + 1) / 2);
+        std::memcpy(to->planeV() + offset, from.planeV() + offset, (width + 1) / 2);
+    }
+}
+
+struct CpuTimes
+{
+    quint64 idle{ 0 };
+    quint64 total{ 0 };
+};
+
+// Summed over all CPUs from the first line of /proc/stat, zero if unreadable
+CpuTimes readCpuTimes()
+{
+    CpuTimes times;
+    QFile file(QStringLiteral("/proc/stat"));
+    if (!file.open(QIODevice::ReadOnly))
+        return times;
+    const QList<QByteArray> fields = file.readLine().simplified().split(' ');
+    if (fields.size() < 5 || fields.first() != "cpu")
+        return times;
+    for (int i = 1; i < fields.size(); ++i) {
+        const quint64 value = fields.at(i).toULongLong();
+        times.total += value;
+        // idle and iowait
+        if (i == 4 || i == 5)
+            times.idle += value;
+    }
+    return times;
+}
+
+} // namespace
+
+void Recorder::CapturedFrame::release()
+{
+    frame.reset();
+    snapshot = nullptr;
+    damage.clear();
+    complete = false;
+    metrics.reset();
+}
+
+int64_t Recorder::frameTimestampNs(const FrameDescriptor &frame)
+{
+    return frame.presentationTimeNs ? int64_t(frame.presentationTimeNs) : steadyClockNs();
+}
+
+Recorder::Recorder(QObject *parent)
+    : QObject(parent)
+    , m_encoder(RecordEncoder::create())
+{
+    qRegisterMetaType<Recorder::Statistics>();
+}
+
+Recorder::~Recorder()
+{
+    stop();
+}
+
+void Recorder::setEncoder(std::unique_ptr<RecordEncoder> encoder)
+{
+    if (m_recording) {
+        qWarning() << "Can't change the encoder while recording";
+        return;
+    }
+    m_encoder = std::move(encoder);
+}
+
+void Recorder::setQueueCapacity(int capacity)
+{
+    if (m_recording) {
+        qWarning() << "Can't change the queue capacity while recording";
+        return;
+    }
+    m_queueCapacity = qMax(2, capacity);
+}
+
+void Recorder::setFrameRate(int fps)
+{
+    m_fps = qMax(1, fps);
+}
+
+void Recorder::setAdaptiveRate(bool enabled)
+{
+    if (m_recording) {
+        qWarning() << "Can't change the adaptive rate while recording";
+        return;
+    }
+    m_adaptiveRate = enabled;
+}
+
+void Recorder::setConversion(Conversion conversion)
+{
+    if (m_recording) {
+        qWarning() << "Can't change the conversion while recording";
+        return;
+    }
+    m_conversion = conversion;
+}
+
+void Recorder::setWatermark(std::shared_ptr<const Watermark> watermark)
+{
+    if (m_recording) {
+        qWarning() << "Can't change the watermark while recording";
+        return;
+    }
+    m_watermark = std::move(watermark);
+}
+
+void Recorder::setCrop(const QRect &rect, const QSize &logicalSize)
+{
+    if (m_recording) {
+        qWarning() << "Can't change the crop while recording";
+        return;
+    }
+    m_crop = rect;
+    m_cropLogicalSize = logicalSize;
+}
+
+QString Recorder::fileSuffix() const
+{
+    return m_encoder ? m_encoder->fileSuffix() : QString();
+}
+
+bool Recorder::start(TreelandCaptureSession *session, const QString &path)
+{
+    if (m_recording)
+        return false;
+    if (!session || !m_encoder) {
+        Q_EMIT error(QStringLiteral("No capture session or encoder"));
+        return false;
+    }
+
+    m_session = session;
+    m_path = path;
+    m_captured = 0;
+    m_converted = 0;
+    m_encoded = 0;
+    m_dropped = 0;
+    m_skipped = 0;
+    m_duplicates = 0;
+    m_lastQueuedSequence = 0;
+    m_lastOfferedSequence = 0;
+    m_frameLost = false;
+    m_referenceValid = false;
+    m_referenceLost = true;
+    m_warnedTiled = false;
+    m_referenceVersion = 0;
+    m_referenceDamage.clear();
+    m_outputCopies.clear();
+
+    m_rateController.reset({ m_fps, 4 });
+    m_frameIntervalNs = 0;
+    m_nextFrameDueNs = 0;
+    m_encodeNs = 0;
+    m_rateEncoded = 0;
+    m_rateEncodeNs = 0;
+    m_rateDropped = 0;
+    const CpuTimes cpu = readCpuTimes();
+    m_cpuIdle = cpu.idle;
+    m_cpuTotal = cpu.total;
+
+    m_captureQueue = std::make_unique<SpscQueue<CapturedFrame>>(m_queueCapacity);
+    m_encodeQueue = std::make_unique<SpscQueue<RecordYuvFrame *>>(m_queueCapacity);
+    m_freeFrames = std::make_unique<SpscQueue<RecordYuvFrame *>>(m_queueCapacity);
+    m_freeSnapshots = std::make_unique<SpscQueue<Snapshot *>>(m_captureQueue->capacity() + 1);
+
+    m_running = true;
+    m_convertFinished = false;
+    m_encodeThread = std::thread(&Recorder::encodeLoop, this);
+
+    // With Gpu conversion this thread is the only producer of the encode
+    // queue, there is no capture or conversion stage.
+    if (m_conversion == Conversion::Cpu) {
+        m_convertThread = std::thread(&Recorder::convertLoop, this);
+        // Direct connection: the capture stage must run while the session
+        // still holds this frame's objects, and it never blocks.
+        connect(session,
+                &TreelandCaptureSession::ready,
+                this,
+                &Recorder::handleSessionReady,
+                Qt::DirectConnection);
+    }
+    // Tells duplicates apart, and with Cpu conversion what to convert
+    session->retainDamageTracking();
+    connect(session, &TreelandCaptureSession::destroyed, this, &Recorder::stop);
+
+    if (!m_statisticsTimer) {
+        m_statisticsTimer = new QTimer(this);
+        m_statisticsTimer->setInterval(1000);
+        connect(m_statisticsTimer, &QTimer::timeout, this, &Recorder::reportStatistics);
+    }
+    m_statisticsTimer->start();
+
+    if (m_adaptiveRate) {
+        if (!m_rateTimer) {
+            m_rateTimer = new QTimer(this);
+            m_rateTimer->setInterval(RateSampleIntervalMs);
+            connect(m_rateTimer, &QTimer::timeout, this, &Recorder::updateRate);
+        }
+        m_rateTimer->start();
+    }
+
+    m_recording = true;
+    qInfo() << "Recording to" << path << "with encoder" << m_encoder->name();
+    Q_EMIT recordingChanged();
+    return true;
+}
+
+void Recorder::stop()
+{
+    if (!m_recording)
+        return;
+
+    Q_EMIT aboutToStop();
+
+    if (m_session) {
+        // A ready handler on the event thread finishes before the lock is ours
+        QMutexLocker locker(m_session->deliveryMutex());
+        m_session->disconnect(this);
+        m_session->releaseDamageTracking();
+    }
+    m_session = nullptr;
+    m_statisticsTimer->stop();
+    if (m_rateTimer)
+        m_rateTimer->stop();
+
+    // Both workers drain their input queue before leaving.
+    m_running = false;
+    if (m_convertThread.joinable()) {
+        m_convertWake.notify_all();
+        m_convertThread.join();
+    } else {
+        m_convertFinished = true;
+        m_encodeWake.notify_one();
+    }
+    m_encodeThread.join();
+
+    CapturedFrame captured;
+    while (m_captureQueue->tryPop(captured))
+        captured.release();
+    m_framePool.clear();
+    CaptureScheduler::instance()->release(m_reservedBytes);
+    m_reservedBytes = 0;
+    m_spareSnapshot = nullptr;
+    m_snapshotPool.clear();
+    CaptureScheduler::instance()->release(m_snapshotBytes);
+    m_snapshotBytes = 0;
+    m_captureQueue.reset();
+    m_encodeQueue.reset();
+    m_freeFrames.reset();
+    m_freeSnapshots.reset();
+
+    m_recording = false;
+    reportStatistics();
+    qInfo() << "Recording finished:" << m_path;
+    Q_EMIT recordingChanged();
+}
+
+Recorder::Statistics Recorder::statistics() const
+{
+    Statistics statistics;
+    statistics.captured = m_captured;
+    statistics.converted = m_converted;
+    statistics.encoded = m_encoded;
+    statistics.dropped = m_dropped;
+    statistics.skipped = m_skipped;
+    statistics.duplicates = m_duplicates;
+    statistics.targetFps = m_rateController.targetFps();
+    if (m_captureQueue)
+        statistics.captureQueueDepth = int(m_captureQueue->size());
+    if (m_encodeQueue)
+        statistics.encodeQueueDepth = int(m_encodeQueue->size());
+    return statistics;
+}
+
+void Recorder::handleSessionReady()
+{
+    if (!m_session)
+        return;
+    CAPTURE_TRACE_SCOPE("record capture");
+
+    // Left out before anything is mapped
+    const FrameRef frame = m_session->frame();
+    if (!frame)
+        return;
+    ++m_captured;
+    // Relative to the last queued frame, so the damage of frames that were
+    // left out carries over into the next one that makes it.
+    QList<QRect> damage = m_session->damageSince(m_lastQueuedSequence);
+    if (isDuplicate(*frame, damage)) {
+        ++m_duplicates;
+        return;
+    }
+    const int64_t timestampNs = frameTimestampNs(*frame);
+    if (!admitFrame(timestampNs))
+        return;
+
+    CapturedFrame captured;
+    captured.frame = frame;
+    captured.metrics = m_session->metricsHandle();
+    captured.timestampNs = timestampNs;
+    captured.complete = m_referenceLost;
+    if (captured.complete)
+        captured.damage = { QRect(0, 0, int(frame->width), int(frame->height)) };
+    else
+        captured.damage = std::move(damage);
+
+    // Cleared before the push, a loss further down can only come after it
+    m_frameLost = false;
+    if (!snapshotFrame(&captured)) {
+        captured.release();
+        dropFrame();
+        return;
+    }
+    if (!m_captureQueue->tryPush(std::move(captured))) {
+        m_spareSnapshot = captured.snapshot;
+        captured.release();
+        dropFrame();
+        return;
+    }
+    m_lastQueuedSequence = m_session->frameSequence();
+    m_convertWake.notify_one();
+}
+
+bool Recorder::snapshotFrame(CapturedFrame *captured)
+{
+    CAPTURE_TRACE_SCOPE("record snapshot");
+    const auto &frame = *captured->frame;
+    if (!isPixelConvertSupported(frame.format)) {
+        qWarning() << "Unsupported record buffer format" << Qt::hex << frame.format;
+        return false;
+    }
+    if (frame.modifier != DRM_FORMAT_MOD_LINEAR && frame.modifier != DRM_FORMAT_MOD_INVALID
+        && !m_warnedTiled) {
+        m_warnedTiled = true;
+        qWarning() << "Recording a tiled buffer through mmap, modifier:" << Qt::hex
+                   << frame.modifier;
+    }
+
+    const auto objects = frame.objects();
+    const auto object = std::find_if(objects.begin(), objects.end(), [](const FrameObject &object) {
+        return object.planeIndex == 0;
+    });
+    if (object == objects.end())
+        return false;
+    const auto mapping = m_session->mapObject(frame, *object);
+    const size_t bytes = size_t(object->stride) * frame.height;
+    if (!mapping || size_t(object->offset) + bytes > mapping->size()) {
+        qWarning() << "Record frame doesn't fit its buffer object";
+        return false;
+    }
+    Snapshot *snapshot = takeSnapshot(bytes);
+    if (!snapshot)
+        return false;
+    snapshot->stride = object->stride;
+
+    // Only what gets converted
+    const QRect bounds = cropArea(frame.width, frame.height);
+    const uint8_t *pixels = mapping->data() + object->offset;
+    quint64 copied = 0;
+    {
+        DmaBufReadAccess access(object->fd.get());
+        for (const auto &rect : std::as_const(captured->damage)) {
+            const QRect clipped = rect & bounds;
+            if (clipped.isEmpty())
+                continue;
+            const size_t rowBytes = size_t(clipped.width()) * 4;
+            size_t offset = size_t(object->stride) * size_t(clipped.y()) + size_t(clipped.x()) * 4;
+            for (int y = 0; y < clipped.height(); ++y, offset += object->stride)
+                std::memcpy(snapshot->data.data() + offset, pixels + offset, rowBytes);
+            copied += rowBytes * size_t(clipped.height());
+        }
+    }
+    captured->snapshot = snapshot;
+    if (captured->metrics)
+        captured->metrics->add(CaptureMetrics::BytesCopied, copied);
+    return true;
+}
+
+Recorder::Snapshot *Recorder::takeSnapshot(size_t bytes)
+{
+    Snapshot *snapshot = std::exchange(m_spareSnapshot, nullptr);
+    if (!snapshot && !m_freeSnapshots->tryPop(snapshot)) {
+        // One for each queued frame and the one being converted
+        if (m_snapshotPool.size() > m_captureQueue->capacity())
+            return nullptr;
+        m_snapshotPool.push_back(std::make_unique<Snapshot>());
+        snapshot = m_snapshotPool.back().get();
+    }
+    if (snapshot->data.size() < bytes) {
+        if (!CaptureScheduler::instance()->reserve(bytes - snapshot->data.size())) {
+            m_spareSnapshot = snapshot;
+            return nullptr;
+        }
+        m_snapshotBytes += bytes - snapshot->data.size();
+        snapshot->data.resize(bytes);
+    }
+    return snapshot;
+}
+
+bool Recorder::isDuplicate(const FrameDescriptor &frame, const QList<QRect> &damage) const
+{
+    if (m_lastQueuedSequence == 0 || m_frameLost)
+        return false;
+    // Only damage inside what gets recorded counts, the crop is Cpu only
+    const QRect area = m_conversion == Conversion::Cpu
+        ? cropArea(frame.width, frame.height)
+        : QRect(0, 0, int(frame.width), int(frame.height));
+    return std::none_of(damage.cbegin(), damage.cend(), [&area](const QRect &rect) {
+        return rect.intersects(area);
+    });
+}
+
+void Recorder::dropFrame()
+{
+    ++m_dropped;
+    m_frameLost = true;
+}
+
+bool Recorder::admitFrame(int64_t timestampNs)
+{
+    const int64_t interval = m_frameIntervalNs.load(std::memory_order_relaxed);
+    if (interval <= 0)
+        return true;
+    // Frames arrive with jitter, a little early still counts as due
+    if (timestampNs + interval / 4 < m_nextFrameDueNs) {
+        ++m_skipped;
+        return false;
+    }
+    // After a gap the schedule restarts instead of letting a burst through
+    if (timestampNs - m_nextFrameDueNs > interval)
+        m_nextFrameDueNs = timestampNs + interval;
+    else
+        m_nextFrameDueNs += interval;
+    return true;
+}
+
+void Recorder::updateRate()
+{
+    if (!m_recording)
+        return;
+
+    RecordRateController::Sample sample;
+    const double capacity = double(m_encodeQueue->capacity());
+    sample.queueFill = qMax(m_captureQueue->size(), m_encodeQueue->size()) / capacity;
+
+    const quint64 encoded = m_encoded;
+    const quint64 encodeNs = m_encodeNs;
+    if (encoded > m_rateEncoded)
+        sample.encodeMs = (encodeNs - m_rateEncodeNs) / 1e6 / (encoded - m_rateEncoded);
+    m_rateEncoded = encoded;
+    m_rateEncodeNs = encodeNs;
+
+    const CpuTimes cpu = readCpuTimes();
+    if (cpu.total > m_cpuTotal)
+        sample.cpuHeadroom = double(cpu.idle - m_cpuIdle) / (cpu.total - m_cpuTotal);
+    m_cpuIdle = cpu.idle;
+    m_cpuTotal = cpu.total;
+
+    const quint64 dropped = m_dropped;
+    sample.dropped = dropped - m_rateDropped;
+    m_rateDropped = dropped;
+
+    if (!m_rateController.update(sample))
+        return;
+    const auto &level = m_rateController.level();
+    m_frameIntervalNs =
+        level.fpsDivisor > 1 ? int64_t(1000000000) / m_rateController.targetFps() : 0;
+}
+
+void Recorder::convertLoop()
+{
+    CapturedFrame captured;
+    for (;;) {
+        if (!m_captureQueue->tryPop(captured)) {
+            if (!m_running)
+                break;
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_convertWake.wait_for(lock, WorkerWakeInterval);
+            continue;
+        }
+
+        // Every queued frame goes into the reference, even when it gets
+        // dropped below, otherwise its damage would be lost.
+        const bool converted = convertFrame(captured);
+        const bool complete = captured.complete;
+        m_freeSnapshots->tryPush(std::move(captured.snapshot));
+        captured.release();
+        if (!converted) {
+            m_referenceLost = true;
+            dropFrame();
+            continue;
+        }
+        if (complete)
+            m_referenceLost = false;
+        ++m_converted;
+
+        RecordYuvFrame *frame = takeFreeFrame(m_reference.data.size());
+        if (!frame) {
+            // The encoder is behind and every frame buffer is in flight.
+            dropFrame();
+            continue;
+        }
+
+        copyReference(frame);
+        m_encodeQueue->tryPush(std::move(frame));
+        m_encodeWake.notify_one();
+    }
+
+    m_convertFinished = true;
+    m_encodeWake.notify_one();
+}
+
+void Recorder::copyReference(RecordYuvFrame *frame)
+{
+    OutputCopy &copy = m_outputCopies[frame];
+    const quint64 behind = m_referenceVersion - copy.referenceVersion;
+    if (copy.referenceVersion == 0 || frame->width != m_reference.width
+        || frame->height != m_reference.height || behind > m_referenceDamage.size()) {
+        frame->resize(m_reference.width, m_reference.height);
+        std::memcpy(frame->data.data(), m_reference.data.data(), m_reference.data.size());
+    } else {
+        // What changed since the frame was last recorded, and the watermark
+        // burnt into it back then
+        if (!copy.watermark.isEmpty())
+            copyI420Rect(m_reference, frame, copy.watermark);
+        for (size_t i = m_referenceDamage.size() - size_t(behind); i < m_referenceDamage.size(); ++i) {
+            for (const QRect &rect : std::as_const(m_referenceDamage[i]))
+                copyI420Rect(m_reference, frame, rect);
+        }
+    }
+    frame->timestampNs = m_reference.timestampNs;
+    copy.referenceVersion = m_referenceVersion;
+    copy.watermark = QRect();
+
+    // Into the copy, the reference has to stay what was captured for the
+    // tiles the next frames don't convert again.
+    if (m_watermark && m_watermark->isEnabled()) {
+        const QSize size(int(frame->width), int(frame->height));
+        // The placement follows the logical size, which may change meanwhile
+        const QRect placement = m_watermark->placement(size);
+        if (m_watermark->blend(*frame))
+            copy.watermark = placement | m_watermark->placement(size);
+    }
+}
+
+RecordYuvFrame *Recorder::takeFreeFrame(size_t frameBytes)
+{
+    RecordYuvFrame *frame = nullptr;
+    if (m_freeFrames->tryPop(frame) || m_framePool.size() >= m_encodeQueue->capacity())
+        return frame;
+
+    // Growing the pool competes with the other streams for the shared
+    // budget, when it is used up the frame is dropped instead.
+    if (!CaptureScheduler::instance()->reserve(frameBytes))
+        return nullptr;
+    m_reservedBytes += frameBytes;
+    m_framePool.push_back(std::make_unique<RecordYuvFrame>());
+    return m_framePool.back().get();
+}
+
+bool Recorder::wantsFrame(const FrameDescriptor &frame)
+{
+    if (!m_recording || m_conversion != Conversion::Gpu || !m_session)
+        return false;
+    // Asked again about the frame the preview already imported
+    if (frame.sequence <= m_lastOfferedSequence)
+        return false;
+
+    // Replaced by a newer one before the busy GUI thread got to them, their
+    // damage carries over like that of any other lost frame.
+    const quint64 missed = m_lastOfferedSequence ? frame.sequence - m_lastOfferedSequence - 1 : 0;
+    m_lastOfferedSequence = frame.sequence;
+    m_captured += missed + 1;
+    m_dropped += missed;
+    if (isDuplicate(frame, m_session->damageSince(m_lastQueuedSequence))) {
+        ++m_duplicates;
+        return false;
+    }
+    if (!admitFrame(frameTimestampNs(frame)))
+        return false;
+    m_lastQueuedSequence = frame.sequence;
+    m_frameLost = false;
+    return true;
+}
+
+RecordYuvFrame *Recorder::acquireFrame()
+{
+    if (!m_recording || m_conversion != Conversion::Gpu)
+        return nullptr;
+
+    size_t frameBytes = 0;
+    if (const FrameRef captured = m_session ? m_session->frame() : FrameRef())
+        frameBytes = size_t(captured->width & ~1u) * (captured->height & ~1u) * 3 / 2;
+    RecordYuvFrame *frame = takeFreeFrame(frameBytes);
+    if (!frame)
+        dropFrame();
+    return frame;
+}
+
+void Recorder::submitFrame(RecordYuvFrame *frame)
+{
+    Q_ASSERT(m_conversion == Conversion::Gpu);
+    ++m_converted;
+    m_encodeQueue->tryPush(std::move(frame));
+    m_encodeWake.notify_one();
+}
+
+bool Recorder::convertFrame(const CapturedFrame &captured)
+{
+    CAPTURE_TRACE_SCOPE("convert");
+    const auto &frame = *captured.frame;
+    const QRect bounds = cropArea(frame.width, frame.height);
+    if (bounds.isEmpty()) {
+        qWarning() << "Record crop is outside of the frame";
+        m_referenceValid = false;
+        return false;
+    }
+    const uint32_t width = uint32_t(bounds.width());
+    const uint32_t height = uint32_t(bounds.height());
+    QList<QRect> damage = captured.damage;
+    if (!m_referenceValid || m_reference.width != width || m_reference.height != height) {
+        // Dropped until the capture stage copies a whole frame
+        if (!captured.complete) {
+            m_referenceValid = false;
+            return false;
+        }
+        m_reference.resize(width, height);
+        damage = { bounds };
+    }
+    m_reference.timestampNs = captured.timestampNs;
+
+    const SimdLevel level = simdLevel();
+    const uint8_t *pixels = captured.snapshot->data.data();
+    const size_t stride = captured.snapshot->stride;
+    const size_t chromaStride = width / 2;
+    QList<QRect> changed;
+    for (const auto &rect : std::as_const(damage)) {
+        // Tiles and the crop start on even coordinates, clipping only trims
+        // odd edges, so every rect maps onto whole chroma samples.
+        const QRect clipped = rect & bounds;
+        if (clipped.isEmpty())
+            continue;
+        const size_t x = size_t(clipped.x() - bounds.x());
+        const size_t y = size_t(clipped.y() - bounds.y());
+        convertToI420(level,
+                      frame.format,
+                      pixels + stride * size_t(clipped.y()) + size_t(clipped.x()) * 4,
+                      stride,
+                      uint32_t(clipped.width()),
+                      uint32_t(clipped.height()),
+                      m_reference.planeY() + size_t(width) * y + x,
+                      width,
+                      m_reference.planeU() + chromaStride * (y / 2) + x / 2,
+                      chromaStride,
+                      m_reference.planeV() + chromaStride * (y / 2) + x / 2,
+                      chromaStride);
+        changed.append(QRect(int(x), int(y), clipped.width(), clipped.height()));
+    }
+    m_referenceValid = true;
+    ++m_referenceVersion;
+    m_referenceDamage.push_back(std::move(changed));
+    if (m_referenceDamage.size() > ReferenceDamageHistory)
+        m_referenceDamage.pop_front();
+    return true;
+}
+
+QRect Recorder::cropArea(uint32_t width, uint32_t height) const
+{
+    QRect area(0, 0, int(width), int(height));
+    if (!m_crop.isEmpty() && m_cropLogicalSize.width() > 0) {
+        const qreal scale = qreal(width) / m_cropLogicalSize.width();
+        area &= QRect(qRound(m_crop.x() * scale),
+                      qRound(m_crop.y() * scale),
+                      qRound(m_crop.width() * scale),
+                      qRound(m_crop.height() * scale));
+    }
+
+    // I420 needs even offsets and dimensions, odd edges are cut off.
+    const int x = area.x() & ~1;
+    const int y = area.y() & ~1;
+    return QRect(x, y, (area.x() + area.width() - x) & ~1, (area.y() + area.height() - y) & ~1);
+}
+
+void Recorder::encodeLoop()
+{
+    bool opened = false;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    RecordYuvFrame *frame = nullptr;
+
+    for (;;) {
+        if (!m_encodeQueue->tryPop(frame)) {
+            // Re-check after seeing the flag, the last frames may have been
+            // queued right before the conversion thread finished.
+            if (m_convertFinished && !m_encodeQueue->tryPop(frame))
+                break;
+            if (!m_convertFinished) {
+                std::unique_lock<std::mutex> lock(m_wakeMutex);
+                m_encodeWake.wait_for(lock, WorkerWakeInterval);
+                continue;
+            }
+        }
+
+        if (!opened) {
+            width = frame->width;
+            height = frame->height;
+            opened = m_encoder->open(m_path, width, height, m_fps);
+            if (!opened) {
+                QMetaObject::invokeMethod(this, [this] {
+                    Q_EMIT error(QStringLiteral("Failed to open %1").arg(m_path));
+                });
+            }
+        }
+
+        const int64_t encodeStartNs = steadyClockNs();
+        bool encoded = false;
+        if (opened && frame->width == width && frame->height == height) {
+            CAPTURE_TRACE_SCOPE("encode");
+            encoded = m_encoder->encode(*frame);
+        }
+        if (encoded) {
+            m_encodeNs += quint64(steadyClockNs() - encodeStartNs);
+            ++m_encoded;
+        } else {
+            dropFrame();
+        }
+        m_freeFrames->tryPush(std::move(frame));
+    }
+
+    if (opened)
+        m_encoder->close();
+}
+
+void Recorder::reportStatistics()
+{
+    const auto statistics = this->statistics();
+    qInfo() << "Record statistics: captured" << statistics.captured << "converted"
+            << statistics.converted << "encoded" << statistics.encoded << "dropped"
+            << statistics.dropped << "duplicates" << statistics.duplicates << "skipped"
+            << statistics.skipped << "at"
+            << statistics.targetFps << "fps, capture queue" << statistics.captureQueueDepth << "/"
+            << m_queueCapacity << "encode queue" << statistics.encodeQueueDepth;
+    Q_EMIT statisticsChanged(statistics);
+}
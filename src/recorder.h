@@ -0,0 +1,255 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "capturemetrics.h"
+#include "framedescriptor.h"
+#include "recordencoder.h"
+#include "recordratecontroller.h"
+#include "spscqueue.h"
+
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QRect>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+class QTimer;
+class TreelandCaptureSession;
+class Watermark;
+
+// Capture -> convert -> encode pipeline. The capture stage runs on the thread
+// dispatching the session events and copies what changed out of the session's
+// buffer, which the compositor renders into again a few frames later;
+// conversion and encoding happen on worker threads.
+class Recorder : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool recording READ recording NOTIFY recordingChanged FINAL)
+
+public:
+    // Where frames are converted to YUV. With Gpu the session frames are
+    // ignored and converted frames are pushed through acquireFrame() and
+    // submitFrame() instead, e.g. by the preview which has them as textures.
+    enum class Conversion {
+        Cpu,
+        Gpu,
+    };
+
+    struct Statistics
+    {
+        quint64 captured{ 0 };
+        quint64 converted{ 0 };
+        quint64 encoded{ 0 };
+        quint64 dropped{ 0 };
+        // Left out on purpose to lower the frame rate
+        quint64 skipped{ 0 };
+        // Nothing recorded changed since the previous recorded frame
+        quint64 duplicates{ 0 };
+        int targetFps{ 0 };
+        int captureQueueDepth{ 0 };
+        int encodeQueueDepth{ 0 };
+    };
+
+    explicit Recorder(QObject *parent = nullptr);
+    ~Recorder() override;
+
+    inline bool recording() const
+    {
+        return m_recording;
+    }
+
+    void setEncoder(std::unique_ptr<RecordEncoder> encoder);
+    void setQueueCapacity(int capacity);
+    void setFrameRate(int fps);
+    QString fileSuffix() const;
+
+    // Lowers the frame rate while the pipeline can't keep up, see
+    // RecordRateController. On by default.
+    inline bool adaptiveRate() const
+    {
+        return m_adaptiveRate;
+    }
+
+    void setAdaptiveRate(bool enabled);
+
+    inline Conversion conversion() const
+    {
+        return m_conversion;
+    }
+
+    void setConversion(Conversion conversion);
+
+    // Burnt into every recorded frame while it is enabled. With Gpu
+    // conversion the converting side applies it.
+    inline std::shared_ptr<const Watermark> watermark() const
+    {
+        return m_watermark;
+    }
+
+    void setWatermark(std::shared_ptr<const Watermark> watermark);
+
+    // Records only rect of a source that is logicalSize big, both in logical
+    // coordinates, frames are mapped onto it by their width. An empty rect
+    // records everything. Cpu conversion only.
+    void setCrop(const QRect &rect, const QSize &logicalSize);
+
+    // Gpu conversion only, all on the thread that started the recording.
+    // wantsFrame() is asked before a session frame is converted and is false
+    // for duplicates and frames over the frame rate, session frames it never
+    // saw count as dropped. acquireFrame() returns nullptr when every frame
+    // is queued for encoding. A wanted frame that gets lost on the way is
+    // reported with dropFrame().
+    bool wantsFrame(const FrameDescriptor &frame);
+    RecordYuvFrame *acquireFrame();
+    void submitFrame(RecordYuvFrame *frame);
+    void dropFrame();
+
+    // Compositor clock, steady_clock only if the compositor sent none
+    static int64_t frameTimestampNs(const FrameDescriptor &frame);
+
+    bool start(TreelandCaptureSession *session, const QString &path);
+    void stop();
+
+    Statistics statistics() const;
+
+Q_SIGNALS:
+    void recordingChanged();
+    // Last chance to submit frames still being converted elsewhere
+    void aboutToStop();
+    void statisticsChanged(const Recorder::Statistics &statistics);
+    void error(const QString &message);
+
+private:
+    // Pixels the capture stage copied out of a frame, rows keep the stride
+    // of the buffer. Only the damage of the frame it was taken for is filled.
+    struct Snapshot
+    {
+        std::vector<uint8_t> data;
+        uint32_t stride{ 0 };
+    };
+
+    struct CapturedFrame
+    {
+        // Size and format
+        FrameRef frame;
+        Snapshot *snapshot{ nullptr };
+        int64_t timestampNs{ 0 };
+        // What changed since the previously queued frame
+        QList<QRect> damage;
+        // The damage covers everything recorded
+        bool complete{ false };
+        std::shared_ptr<CaptureMetrics> metrics;
+
+        void release();
+    };
+
+    void handleSessionReady();
+    // Damage is what changed since the last queued frame
+    bool isDuplicate(const FrameDescriptor &frame, const QList<QRect> &damage) const;
+    bool admitFrame(int64_t timestampNs);
+    bool snapshotFrame(CapturedFrame *captured);
+    Snapshot *takeSnapshot(size_t bytes);
+    void updateRate();
+    RecordYuvFrame *takeFreeFrame(size_t frameBytes);
+    void copyReference(RecordYuvFrame *frame);
+    void convertLoop();
+    void encodeLoop();
+    bool convertFrame(const CapturedFrame &captured);
+    QRect cropArea(uint32_t width, uint32_t height) const;
+    void reportStatistics();
+
+    QPointer<TreelandCaptureSession> m_session;
+    std::unique_ptr<RecordEncoder> m_encoder;
+    QString m_path;
+    int m_queueCapacity{ 8 };
+    int m_fps{ 60 };
+    Conversion m_conversion{ Conversion::Cpu };
+    std::shared_ptr<const Watermark> m_watermark;
+    QRect m_crop;
+    QSize m_cropLogicalSize;
+    bool m_recording{ false };
+    QTimer *m_statisticsTimer{ nullptr };
+    bool m_adaptiveRate{ true };
+    RecordRateController m_rateController;
+    QTimer *m_rateTimer{ nullptr };
+    // 0 records every frame
+    std::atomic<int64_t> m_frameIntervalNs{ 0 };
+    // Capture stage only
+    int64_t m_nextFrameDueNs{ 0 };
+    // Spent in RecordEncoder::encode()
+    std::atomic<quint64> m_encodeNs{ 0 };
+    // Totals at the previous updateRate()
+    quint64 m_rateEncoded{ 0 };
+    quint64 m_rateEncodeNs{ 0 };
+    quint64 m_rateDropped{ 0 };
+    quint64 m_cpuIdle{ 0 };
+    quint64 m_cpuTotal{ 0 };
+
+    std::unique_ptr<SpscQueue<CapturedFrame>> m_captureQueue;
+    std::unique_ptr<SpscQueue<RecordYuvFrame *>> m_encodeQueue;
+    std::unique_ptr<SpscQueue<RecordYuvFrame *>> m_freeFrames;
+    std::vector<std::unique_ptr<RecordYuvFrame>> m_framePool;
+    // Taken from the CaptureScheduler budget for m_framePool
+    size_t m_reservedBytes{ 0 };
+    // Taken by the capture stage and given back by the conversion thread,
+    // at most one more than the capture queue holds.
+    std::unique_ptr<SpscQueue<Snapshot *>> m_freeSnapshots;
+    std::vector<std::unique_ptr<Snapshot>> m_snapshotPool;
+    // Capture stage only: a snapshot that didn't make it into the queue, and
+    // what the pool took from the CaptureScheduler budget
+    Snapshot *m_spareSnapshot{ nullptr };
+    size_t m_snapshotBytes{ 0 };
+    bool m_warnedTiled{ false };
+    // Set by the conversion thread while it has no reference to convert
+    // damage into, the capture stage then copies everything recorded.
+    std::atomic_bool m_referenceLost{ true };
+    // Sequence of the last frame that made it into the capture queue
+    quint64 m_lastQueuedSequence{ 0 };
+    // Gpu conversion only: the last frame wantsFrame() was asked about
+    quint64 m_lastOfferedSequence{ 0 };
+    // Set when a frame got lost after the capture stage, the next one is
+    // recorded even if nothing changed since the last queued frame
+    std::atomic_bool m_frameLost{ false };
+    // Conversion thread only: the last converted picture, damaged tiles of
+    // the next frame are converted into it and then copied out.
+    RecordYuvFrame m_reference;
+    bool m_referenceValid{ false };
+    // Counts the conversions into the reference, the rects the most recent
+    // ones changed are kept in reference coordinates, newest last.
+    quint64 m_referenceVersion{ 0 };
+    std::deque<QList<QRect>> m_referenceDamage;
+    // Pooled frames still hold the reference they were last copied from,
+    // apart from the watermark blended into them.
+    struct OutputCopy
+    {
+        quint64 referenceVersion{ 0 };
+        QRect watermark;
+    };
+    std::unordered_map<const RecordYuvFrame *, OutputCopy> m_outputCopies;
+
+    std::thread m_convertThread;
+    std::thread m_encodeThread;
+    std::atomic_bool m_running{ false };
+    std::atomic_bool m_convertFinished{ false };
+    std::mutex m_wakeMutex;
+    std::condition_variable m_convertWake;
+    std::condition_variable m_encodeWake;
+
+    std::atomic<quint64> m_captured{ 0 };
+    std::atomic<quint64> m_converted{ 0 };
+    std::atomic<quint64> m_encoded{ 0 };
+    std::atomic<quint64> m_dropped{ 0 };
+    std::atomic<quint64> m_skipped{ 0 };
+    std::atomic<quint64> m_duplicates{ 0 };
+};
+
+Q_DECLARE_METATYPE(Recorder::Statistics)
@@ -0,0 +1,140 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "recordratecontroller.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+namespace {
+
+// Degrading reacts quickly, recovering waits for load to stay low
+constexpr int DegradeAfterSamples = 2;
+constexpr int RecoverAfterSamples = 8;
+constexpr int HoldSamples = 4;
+
+constexpr double QueueFillHigh = 0.75;
+constexpr double QueueFillLow = 0.25;
+// Share of the frame interval that encoding one frame may take
+constexpr double EncodeShareHigh = 0.9;
+constexpr double EncodeShareLow = 0.5;
+constexpr double CpuHeadroomLow = 0.05;
+constexpr double CpuHeadroomHigh = 0.2;
+
+} // namespace
+
+RecordRateController::RecordRateController(const Limits &limits)
+{
+    reset(limits);
+}
+
+void RecordRateController::reset(const Limits &limits)
+{
+    m_limits = limits;
+    m_limits.fps = std::max(1, m_limits.fps);
+    m_limits.maxFpsDivisor = std::clamp(m_limits.maxFpsDivisor, 1, m_limits.fps);
+    m_level = Level();
+    m_overloadedSamples = 0;
+    m_relaxedSamples = 0;
+    m_holdSamples = 0;
+    m_reportedLimit = false;
+}
+
+bool RecordRateController::update(const Sample &sample)
+{
+    if (m_holdSamples > 0) {
+        --m_holdSamples;
+        return false;
+    }
+
+    Level next = m_level;
+    const QString reason = overloadReason(sample);
+    if (!reason.isEmpty()) {
+        m_relaxedSamples = 0;
+        if (++m_overloadedSamples < DegradeAfterSamples)
+            return false;
+        m_overloadedSamples = 0;
+        if (!degraded(&next)) {
+            if (!m_reportedLimit) {
+                qWarning().noquote()
+                    << QStringLiteral("Recording can't keep up (%1) at %2 and can't degrade further")
+                           .arg(reason, describe(m_level));
+                m_reportedLimit = true;
+            }
+            return false;
+        }
+        qInfo().noquote() << QStringLiteral("Recording can't keep up (%1), going from %2 to %3")
+                                 .arg(reason, describe(m_level), describe(next));
+    } else {
+        m_overloadedSamples = 0;
+        if (!recovered(&next) || !isRelaxed(sample)) {
+            m_relaxedSamples = 0;
+            return false;
+        }
+        if (++m_relaxedSamples < RecoverAfterSamples)
+            return false;
+        m_relaxedSamples = 0;
+        qInfo().noquote() << QStringLiteral("Recording load eased, going from %1 to %2")
+                                 .arg(describe(m_level), describe(next));
+    }
+
+    m_level = next;
+    m_holdSamples = HoldSamples;
+    m_reportedLimit = false;
+    return true;
+}
+
+QString RecordRateController::describe(const Level &level) const
+{
+    return QStringLiteral("%1 fps").arg(targetFps(level));
+}
+
+int RecordRateController::targetFps(const Level &level) const
+{
+    return std::max(1, m_limits.fps / level.fpsDivisor);
+}
+
+bool RecordRateController::degraded(Level *level) const
+{
+    if (level->fpsDivisor >= m_limits.maxFpsDivisor)
+        return false;
+    ++level->fpsDivisor;
+    return true;
+}
+
+bool RecordRateController::recovered(Level *level) const
+{
+    if (level->fpsDivisor <= 1)
+        return false;
+    --level->fpsDivisor;
+    return true;
+}
+
+QString RecordRateController::overloadReason(const Sample &sample) const
+{
+    if (sample.dropped > 0)
+        return QStringLiteral("%1 frames dropped").arg(sample.dropped);
+    if (sample.queueFill >= QueueFillHigh)
+        return QStringLiteral("queues %1% full").arg(qRound(sample.queueFill * 100));
+    const double intervalMs = 1000.0 / targetFps();
+    if (sample.encodeMs > EncodeShareHigh * intervalMs) {
+        return QStringLiteral("encoding takes %1 of %2 ms per frame")
+            .arg(sample.encodeMs, 0, 'f', 1)
+            .arg(intervalMs, 0, 'f', 1);
+    }
+    if (sample.cpuHeadroom < CpuHeadroomLow)
+        return QStringLiteral("%1% CPU idle").arg(sample.cpuHeadroom * 100, 0, 'f', 1);
+    return QString();
+}
+
+bool RecordRateController::isRelaxed(const Sample &sample) const
+{
+    // Judged against the level to recover to, a higher frame rate leaves
+    // encoding less time per frame
+    Level next = m_level;
+    recovered(&next);
+    const double intervalMs = 1000.0 / targetFps(next);
+    return sample.dropped == 0 && sample.queueFill <= QueueFillLow
+        && sample.cpuHeadroom >= CpuHeadroomHigh && sample.encodeMs < EncodeShareLow * intervalMs;
+}
@@ -0,0 +1,87 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <QString>
+
+#include <cstdint>
+
+// Lowers the frame rate of a recording one step at a time while the pipeline
+// can't keep up, and raises it again step by step once it can. The owner sets
+// how low it may go. Every change is logged together with what caused it.
+class RecordRateController
+{
+public:
+    struct Limits
+    {
+        int fps{ 60 };
+        // The lowest frame rate is fps divided by this
+        int maxFpsDivisor{ 4 };
+    };
+
+    // What the pipeline did during one sample period
+    struct Sample
+    {
+        // Fullest of the queues between the stages, 0 to 1
+        double queueFill{ 0.0 };
+        // Mean encode time per frame, 0 when nothing was encoded
+        double encodeMs{ 0.0 };
+        // Idle share of all CPUs
+        double cpuHeadroom{ 1.0 };
+        // Frames the pipeline lost, not the ones left out on purpose
+        uint64_t dropped{ 0 };
+    };
+
+    struct Level
+    {
+        int fpsDivisor{ 1 };
+
+        inline bool operator==(const Level &other) const
+        {
+            return fpsDivisor == other.fpsDivisor;
+        }
+
+        inline bool operator!=(const Level &other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    RecordRateController() = default;
+    explicit RecordRateController(const Limits &limits);
+
+    // Back to full quality, e.g. for a new recording
+    void reset(const Limits &limits);
+
+    inline const Level &level() const
+    {
+        return m_level;
+    }
+
+    inline int targetFps() const
+    {
+        return targetFps(m_level);
+    }
+
+    // True when the level changed
+    bool update(const Sample &sample);
+
+    QString describe(const Level &level) const;
+
+private:
+    int targetFps(const Level &level) const;
+    bool degraded(Level *level) const;
+    bool recovered(Level *level) const;
+    QString overloadReason(const Sample &sample) const;
+    bool isRelaxed(const Sample &sample) const;
+
+    Limits m_limits;
+    Level m_level;
+    int m_overloadedSamples{ 0 };
+    int m_relaxedSamples{ 0 };
+    // Samples to wait after a change, until the queues reflect it
+    int m_holdSamples{ 0 };
+    // Logged once until the level changes again
+    bool m_reportedLimit{ false };
+};
@@ -0,0 +1,210 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "shmbufferpool.h"
+#include "capturescheduler.h"
+
+#include <QDebug>
+
+#include <wayland-client-protocol.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+std::unique_ptr<TreelandShmBuffer>
+TreelandShmBuffer::create(::wl_shm *shm, uint32_t format, const QSize &size, uint32_t stride)
+{
+    const size_t byteCount = size_t(stride) * size.height();
+    if (!shm || byteCount == 0)
+        return nullptr;
+
+    int fd = memfd_create("treeland-capture-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        qWarning() << "memfd_create failed:" << strerror(errno);
+        return nullptr;
+    }
+    if (ftruncate(fd, off_t(byteCount)) < 0) {
+        qWarning() << "Failed to size shm buffer:" << strerror(errno);
+        ::close(fd);
+        return nullptr;
+    }
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+
+    void *data = mmap(nullptr, byteCount, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        qWarning() << "Failed to map shm buffer:" << strerror(errno);
+        ::close(fd);
+        return nullptr;
+    }
+
+    auto pool = wl_shm_create_pool(shm, fd, int32_t(byteCount));
+    auto buffer = wl_shm_pool_create_buffer(pool,
+                                            0,
+                                            size.width(),
+                                            size.height(),
+                                            int32_t(stride),
+                                            format);
+    // The buffer keeps the pool's memory alive on the compositor side.
+    wl_shm_pool_destroy(pool);
+
+    std::unique_ptr<TreelandShmBuffer> result(new TreelandShmBuffer);
+    result->m_buffer = buffer;
+    result->m_format = format;
+    result->m_size = size;
+    result->m_stride = stride;
+    result->m_data = static_cast<uchar *>(data);
+    result->m_byteCount = byteCount;
+    result->m_fd = fd;
+    return result;
+}
+
+TreelandShmBuffer::~TreelandShmBuffer()
+{
+    if (m_buffer)
+        wl_buffer_destroy(m_buffer);
+    if (m_data)
+        munmap(m_data, m_byteCount);
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+QImage TreelandShmBuffer::image() const
+{
+    return QImage(m_data, m_size.width(), m_size.height(), m_stride, imageFormat(m_format));
+}
+
+QImage::Format TreelandShmBuffer::imageFormat(uint32_t format)
+{
+    switch (format) {
+    case WL_SHM_FORMAT_XRGB8888:
+        return QImage::Format_RGB32;
+    case WL_SHM_FORMAT_ARGB8888:
+        return QImage::Format_ARGB32_Premultiplied;
+    case WL_SHM_FORMAT_XBGR8888:
+        return QImage::Format_RGBX8888;
+    case WL_SHM_FORMAT_ABGR8888:
+        return QImage::Format_RGBA8888_Premultiplied;
+    case WL_SHM_FORMAT_XRGB2101010:
+        return QImage::Format_RGB30;
+    case WL_SHM_FORMAT_ARGB2101010:
+        return QImage::Format_A2RGB30_Premultiplied;
+    case WL_SHM_FORMAT_XBGR2101010:
+        return QImage::Format_BGR30;
+    case WL_SHM_FORMAT_ABGR2101010:
+        return QImage::Format_A2BGR30_Premultiplied;
+    case WL_SHM_FORMAT_RGB565:
+        return QImage::Format_RGB16;
+    default:
+        return QImage::Format_Invalid;
+    }
+}
+
+TreelandShmBufferPool *TreelandShmBufferPool::instance()
+{
+    static TreelandShmBufferPool pool;
+    return &pool;
+}
+
+int TreelandShmBufferPool::formatRank(uint32_t format)
+{
+    // Compositors render into 8 bit BGRA-ordered buffers, those formats are a
+    // plain copy; everything further down needs a swizzle or repack first.
+    switch (format) {
+    case WL_SHM_FORMAT_XRGB8888:
+        return 0;
+    case WL_SHM_FORMAT_ARGB8888:
+        return 1;
+    case WL_SHM_FORMAT_XBGR8888:
+        return 2;
+    case WL_SHM_FORMAT_ABGR8888:
+        return 3;
+    case WL_SHM_FORMAT_XRGB2101010:
+        return 4;
+    case WL_SHM_FORMAT_ARGB2101010:
+        return 5;
+    case WL_SHM_FORMAT_XBGR2101010:
+        return 6;
+    case WL_SHM_FORMAT_ABGR2101010:
+        return 7;
+    case WL_SHM_FORMAT_RGB565:
+        return 8;
+    default:
+        return -1;
+    }
+}
+
+TreelandShmBufferPool::Handle
+TreelandShmBufferPool::acquire(::wl_shm *shm, uint32_t format, const QSize &size, uint32_t stride)
+{
+    std::unique_ptr<TreelandShmBuffer> buffer;
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = std::find_if(m_idle.begin(), m_idle.end(), [&](const auto &idle) {
+            return idle->format() == format && idle->size() == size && idle->stride() == stride;
+        });
+        if (it != m_idle.end()) {
+            buffer = std::move(*it);
+            m_idle.erase(it);
+        }
+    }
+
+    if (!buffer) {
+        // New buffers count against the budget shared with every other
+        // stream, idle ones of other sizes are given up first.
+        const size_t byteCount = size_t(stride) * size.height();
+        auto scheduler = CaptureScheduler::instance();
+        if (!scheduler->reserve(byteCount)) {
+            {
+                QMutexLocker locker(&m_mutex);
+                trimIdle(0);
+            }
+            if (!scheduler->reserve(byteCount)) {
+                qWarning() << "Capture buffer budget exhausted, in use:" << scheduler->bufferUsage()
+                           << "budget:" << scheduler->bufferBudget();
+                return nullptr;
+            }
+        }
+        buffer = TreelandShmBuffer::create(shm, format, size, stride);
+        if (!buffer) {
+            scheduler->release(byteCount);
+            return nullptr;
+        }
+    }
+
+    return Handle(buffer.release(), [this](TreelandShmBuffer *released) {
+        release(released);
+    });
+}
+
+void TreelandShmBufferPool::release(TreelandShmBuffer *buffer)
+{
+    QMutexLocker locker(&m_mutex);
+    m_idle.emplace(m_idle.begin(), buffer);
+    // The most recently released buffers are at the front, drop the oldest.
+    trimIdle(size_t(m_maxIdleBuffers));
+}
+
+void TreelandShmBufferPool::trimIdle(size_t count)
+{
+    while (m_idle.size() > count) {
+        CaptureScheduler::instance()->release(m_idle.back()->byteCount());
+        m_idle.pop_back();
+    }
+}
+
+void TreelandShmBufferPool::setMaxIdleBuffers(int count)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maxIdleBuffers = qMax(0, count);
+    trimIdle(size_t(m_maxIdleBuffers));
+}
+
+void TreelandShmBufferPool::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    trimIdle(0);
+}
@@ -0,0 +1,103 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <QImage>
+#include <QMutex>
+#include <QSize>
+
+#include <memory>
+#include <vector>
+
+struct wl_buffer;
+struct wl_shm;
+
+// A memfd backed wl_buffer with an arbitrary stride, unlike QWaylandShmBuffer
+// which always derives the stride from the width.
+class TreelandShmBuffer
+{
+public:
+    static std::unique_ptr<TreelandShmBuffer>
+    create(::wl_shm *shm, uint32_t format, const QSize &size, uint32_t stride);
+    ~TreelandShmBuffer();
+
+    TreelandShmBuffer(const TreelandShmBuffer &) = delete;
+    TreelandShmBuffer &operator=(const TreelandShmBuffer &) = delete;
+
+    inline ::wl_buffer *buffer() const
+    {
+        return m_buffer;
+    }
+
+    inline uint32_t format() const
+    {
+        return m_format;
+    }
+
+    inline QSize size() const
+    {
+        return m_size;
+    }
+
+    inline uint32_t stride() const
+    {
+        return m_stride;
+    }
+
+    inline uchar *data() const
+    {
+        return m_data;
+    }
+
+    inline size_t byteCount() const
+    {
+        return m_byteCount;
+    }
+
+    // Wraps the shared memory, valid for as long as the buffer is alive.
+    QImage image() const;
+
+    // The QImage format matching a wl_shm format, Format_Invalid if none does.
+    static QImage::Format imageFormat(uint32_t format);
+
+private:
+    TreelandShmBuffer() = default;
+
+    ::wl_buffer *m_buffer{ nullptr };
+    uint32_t m_format{ 0 };
+    QSize m_size;
+    uint32_t m_stride{ 0 };
+    uchar *m_data{ nullptr };
+    size_t m_byteCount{ 0 };
+    int m_fd{ -1 };
+};
+
+// Keeps released buffers around so repeated captures of the same size and
+// format reuse the memfd, the mapping and the wl_buffer. Every buffer, idle
+// or in use, is accounted against the CaptureScheduler buffer budget.
+class TreelandShmBufferPool
+{
+public:
+    using Handle = std::shared_ptr<TreelandShmBuffer>;
+
+    static TreelandShmBufferPool *instance();
+
+    Handle acquire(::wl_shm *shm, uint32_t format, const QSize &size, uint32_t stride);
+    void setMaxIdleBuffers(int count);
+    void clear();
+
+    // Lower is better: formats the compositor renders in natively come first,
+    // formats QImage can't wrap without converting are rejected with -1.
+    static int formatRank(uint32_t format);
+
+private:
+    TreelandShmBufferPool() = default;
+    void release(TreelandShmBuffer *buffer);
+    // Drops the oldest idle buffers beyond count, m_mutex must be held.
+    void trimIdle(size_t count);
+
+    QMutex m_mutex;
+    std::vector<std::unique_ptr<TreelandShmBuffer>> m_idle;
+    int m_maxIdleBuffers{ 4 };
+};
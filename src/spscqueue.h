@@ -0,0 +1,93 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring. Neither side ever blocks,
+// tryPush() fails when the ring is full and tryPop() fails when it is empty.
+template<typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity)
+        : m_capacity(roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity))
+        , m_mask(m_capacity - 1)
+        , m_slots(m_capacity)
+    {
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    inline size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    // A snapshot from any thread. Head first: it never passes the tail, so
+    // a tail loaded after it isn't behind, only pushes in between can make
+    // the difference exceed the capacity.
+    inline size_t size() const
+    {
+        const size_t head = m_head.load(std::memory_order_acquire);
+        const size_t tail = m_tail.load(std::memory_order_acquire);
+        const size_t size = tail - head;
+        return size < m_capacity ? size : m_capacity;
+    }
+
+    inline bool empty() const
+    {
+        return size() == 0;
+    }
+
+    bool tryPush(T &&value)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_headCache == m_capacity) {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headCache == m_capacity)
+                return false;
+        }
+        m_slots[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T &value)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailCache) {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailCache)
+                return false;
+        }
+        value = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static size_t roundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 1;
+        while (result < value)
+            result <<= 1;
+        return result;
+    }
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::vector<T> m_slots;
+
+    // Producer and consumer indices live on separate cache lines, each side
+    // keeps a private copy of the other index to avoid touching it per call.
+    alignas(64) std::atomic<size_t> m_tail{ 0 };
+    size_t m_headCache{ 0 };
+    alignas(64) std::atomic<size_t> m_head{ 0 };
+    size_t m_tailCache{ 0 };
+};
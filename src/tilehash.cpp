@@ -0,0 +1,273 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "tilehash.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TILEHASH_X86 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TILEHASH_NEON 1
+#endif
+
+namespace {
+
+constexpr uint32_t Lanes = 32;
+constexpr uint32_t LaneSeed = 0x811c9dc5u;
+constexpr uint32_t LanePrime = 0x9e3779b1u;
+constexpr uint32_t TileSize = TileDamageTracker::TileSize;
+
+uint64_t finalizeTile(const uint32_t *lanes, uint32_t width, uint32_t rows)
+{
+    uint64_t hash = 0xcbf29ce484222325ull ^ (uint64_t(width) << 32 | rows);
+    for (uint32_t i = 0; i < Lanes; ++i)
+        hash = (hash ^ lanes[i]) * 0x100000001b3ull;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Reference definition, pixel x of a row goes to lane x % 32.
+uint64_t hashTileScalar(const uint8_t *data, size_t stride, uint32_t width, uint32_t rows)
+{
+    uint32_t lanes[Lanes];
+    std::fill(lanes, lanes + Lanes, LaneSeed);
+    for (uint32_t y = 0; y < rows; ++y) {
+        const uint8_t *row = data + stride * y;
+        for (uint32_t x = 0; x < width; ++x) {
+            uint32_t pixel;
+            std::memcpy(&pixel, row + size_t(x) * 4, sizeof(pixel));
+            uint32_t &lane = lanes[x % Lanes];
+            lane = (lane ^ pixel) * LanePrime;
+        }
+    }
+    return finalizeTile(lanes, width, rows);
+}
+
+#ifdef TILEHASH_X86
+// The vector kernels only handle full 64 pixel wide tiles, each row feeds
+// pixels 0-31 and then 32-63 into the same lanes like the scalar loop does.
+__attribute__((target("avx2"))) uint64_t hashTileAvx2(const uint8_t *data,
+                                                       size_t stride,
+                                                       uint32_t rows)
+{
+    const __m256i prime = _mm256_set1_epi32(int(LanePrime));
+    __m256i a0 = _mm256_set1_epi32(int(LaneSeed));
+    __m256i a1 = a0;
+    __m256i a2 = a0;
+    __m256i a3 = a0;
+
+    for (uint32_t y = 0; y < rows; ++y) {
+        const auto *p = reinterpret_cast<const __m256i *>(data + stride * y);
+        a0 = _mm256_mullo_epi32(_mm256_xor_si256(a0, _mm256_loadu_si256(p + 0)), prime);
+        a1 = _mm256_mullo_epi32(_mm256_xor_si256(a1, _mm256_loadu_si256(p + 1)), prime);
+        a2 = _mm256_mullo_epi32(_mm256_xor_si256(a2, _mm256_loadu_si256(p + 2)), prime);
+        a3 = _mm256_mullo_epi32(_mm256_xor_si256(a3, _mm256_loadu_si256(p + 3)), prime);
+        a0 = _mm256_mullo_epi32(_mm256_xor_si256(a0, _mm256_loadu_si256(p + 4)), prime);
+        a1 = _mm256_mullo_epi32(_mm256_xor_si256(a1, _mm256_loadu_si256(p + 5)), prime);
+        a2 = _mm256_mullo_epi32(_mm256_xor_si256(a2, _mm256_loadu_si256(p + 6)), prime);
+        a3 = _mm256_mullo_epi32(_mm256_xor_si256(a3, _mm256_loadu_si256(p + 7)), prime);
+    }
+
+    uint32_t lanes[Lanes];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes + 0), a0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes + 8), a1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes + 16), a2);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes + 24), a3);
+    return finalizeTile(lanes, TileSize, rows);
+}
+
+__attribute__((target("sse4.1"))) uint64_t hashTileSse41(const uint8_t *data,
+                                                          size_t stride,
+                                                          uint32_t rows)
+{
+    const __m128i prime = _mm_set1_epi32(int(LanePrime));
+    __m128i a[8];
+    for (auto &lane : a)
+        lane = _mm_set1_epi32(int(LaneSeed));
+
+    for (uint32_t y = 0; y < rows; ++y) {
+        const auto *p = reinterpret_cast<const __m128i *>(data + stride * y);
+        for (int half = 0; half < 2; ++half) {
+            for (int i = 0; i < 8; ++i)
+                a[i] = _mm_mullo_epi32(_mm_xor_si128(a[i], _mm_loadu_si128(p + half * 8 + i)),
+                                       prime);
+        }
+    }
+
+    uint32_t lanes[Lanes];
+    for (int i = 0; i < 8; ++i)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + i * 4), a[i]);
+    return finalizeTile(lanes, TileSize, rows);
+}
+#endif
+
+#ifdef TILEHASH_NEON
+uint64_t hashTileNeon(const uint8_t *data, size_t stride, uint32_t rows)
+{
+    const uint32x4_t prime = vdupq_n_u32(LanePrime);
+    uint32x4_t a[8];
+    for (auto &lane : a)
+        lane = vdupq_n_u32(LaneSeed);
+
+    for (uint32_t y = 0; y < rows; ++y) {
+        const auto *p = reinterpret_cast<const uint32_t *>(data + stride * y);
+        for (int half = 0; half < 2; ++half) {
+            for (int i = 0; i < 8; ++i)
+                a[i] = vmulq_u32(veorq_u32(a[i], vld1q_u32(p + (half * 8 + i) * 4)), prime);
+        }
+    }
+
+    uint32_t lanes[Lanes];
+    for (int i = 0; i < 8; ++i)
+        vst1q_u32(lanes + i * 4, a[i]);
+    return finalizeTile(lanes, TileSize, rows);
+}
+#endif
+
+uint64_t hashFullTile(SimdLevel level, const uint8_t *data, size_t stride, uint32_t rows)
+{
+    switch (level) {
+#ifdef TILEHASH_X86
+    case SimdLevel::Avx2:
+        return hashTileAvx2(data, stride, rows);
+    case SimdLevel::Sse41:
+        return hashTileSse41(data, stride, rows);
+#endif
+#ifdef TILEHASH_NEON
+    case SimdLevel::Neon:
+        return hashTileNeon(data, stride, rows);
+#endif
+    default:
+        return hashTileScalar(data, stride, TileSize, rows);
+    }
+}
+
+} // namespace
+
+void hashTileStrip(SimdLevel level,
+                   const uint8_t *data,
+                   size_t stride,
+                   uint32_t width,
+                   uint32_t rows,
+                   uint64_t *hashes)
+{
+    const uint32_t columns = (width + TileSize - 1) / TileSize;
+    for (uint32_t column = 0; column < columns; ++column) {
+        const uint32_t x = column * TileSize;
+        const uint8_t *tile = data + size_t(x) * 4;
+        const uint32_t tileWidth = std::min(TileSize, width - x);
+        hashes[column] = tileWidth == TileSize ? hashFullTile(level, tile, stride, rows)
+                                               : hashTileScalar(tile, stride, tileWidth, rows);
+    }
+}
+
+size_t TileDamageTracker::update(uint64_t sequence,
+                                 const uint8_t *data,
+                                 uint32_t width,
+                                 uint32_t height,
+                                 size_t stride)
+{
+    if (width != m_width || height != m_height)
+        resizeGrid(width, height);
+
+    const SimdLevel level = simdLevel();
+    std::vector<uint64_t> strip(m_columns);
+    size_t changed = 0;
+
+    for (uint32_t row = 0; row < m_rows; ++row) {
+        const uint32_t y = row * TileSize;
+        hashTileStrip(level,
+                      data + stride * y,
+                      stride,
+                      width,
+                      std::min(TileSize, height - y),
+                      strip.data());
+
+        uint64_t *hashes = m_hashes.data() + size_t(row) * m_columns;
+        uint64_t *stamps = m_changed.data() + size_t(row) * m_columns;
+        for (uint32_t column = 0; column < m_columns; ++column) {
+            if (m_hashesValid && hashes[column] == strip[column])
+                continue;
+            hashes[column] = strip[column];
+            stamps[column] = sequence;
+            ++changed;
+        }
+    }
+
+    m_hashesValid = true;
+    return changed;
+}
+
+void TileDamageTracker::invalidate(uint64_t sequence, uint32_t width, uint32_t height)
+{
+    if (width != m_width || height != m_height)
+        resizeGrid(width, height);
+    std::fill(m_changed.begin(), m_changed.end(), sequence);
+    m_hashesValid = false;
+}
+
+void TileDamageTracker::reset()
+{
+    m_hashesValid = false;
+}
+
+std::vector<TileRect> TileDamageTracker::damageSince(uint64_t since) const
+{
+    std::vector<TileRect> rects;
+    // Rects that end at the previous tile row and may grow into this one
+    std::vector<size_t> open;
+    std::vector<size_t> next;
+
+    for (uint32_t row = 0; row < m_rows; ++row) {
+        const uint64_t *stamps = m_changed.data() + size_t(row) * m_columns;
+        const uint32_t y = row * TileSize;
+        const uint32_t height = std::min(TileSize, m_height - y);
+        next.clear();
+
+        uint32_t column = 0;
+        while (column < m_columns) {
+            if (stamps[column] <= since) {
+                ++column;
+                continue;
+            }
+            const uint32_t first = column;
+            while (column < m_columns && stamps[column] > since)
+                ++column;
+
+            const uint32_t x = first * TileSize;
+            const uint32_t width = std::min(column * TileSize, m_width) - x;
+            auto extended = std::find_if(open.begin(), open.end(), [&](size_t index) {
+                return rects[index].x == x && rects[index].width == width;
+            });
+            if (extended != open.end()) {
+                rects[*extended].height += height;
+                next.push_back(*extended);
+            } else {
+                next.push_back(rects.size());
+                rects.push_back({ x, y, width, height });
+            }
+        }
+        open.swap(next);
+    }
+
+    return rects;
+}
+
+void TileDamageTracker::resizeGrid(uint32_t width, uint32_t height)
+{
+    m_width = width;
+    m_height = height;
+    m_columns = (width + TileSize - 1) / TileSize;
+    m_rows = (height + TileSize - 1) / TileSize;
+    m_hashes.assign(size_t(m_columns) * m_rows, 0);
+    m_changed.assign(size_t(m_columns) * m_rows, 0);
+    m_hashesValid = false;
+}
@@ -0,0 +1,76 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include "cpufeatures.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct TileRect
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Fingerprints one strip of up to TileDamageTracker::TileSize rows of a packed
+// 32 bpp image, writing one hash per tile column. Every pixel is folded into
+// one of 32 lanes as h = (h ^ pixel) * P, a single changed pixel therefore
+// always changes the hash. All levels return identical hashes.
+void hashTileStrip(SimdLevel level,
+                   const uint8_t *data,
+                   size_t stride,
+                   uint32_t width,
+                   uint32_t rows,
+                   uint64_t *hashes);
+
+// Client-side damage for frames the compositor sends without any. Each
+// update() hashes the frame in 64x64 tiles and stamps the tiles whose hash
+// changed with the frame's sequence, so a consumer that skipped frames can
+// still ask for everything that changed since the last frame it used.
+class TileDamageTracker
+{
+public:
+    static constexpr uint32_t TileSize = 64;
+
+    // Returns the number of tiles that changed. A new size, or the first
+    // frame after reset() or invalidate(), marks every tile.
+    size_t update(uint64_t sequence,
+                  const uint8_t *data,
+                  uint32_t width,
+                  uint32_t height,
+                  size_t stride);
+    // For frames that can't be hashed, every tile counts as changed.
+    void invalidate(uint64_t sequence, uint32_t width, uint32_t height);
+    void reset();
+
+    // Changed tiles of frames newer than since, merged into rects and
+    // clipped to the frame. Empty when nothing changed.
+    std::vector<TileRect> damageSince(uint64_t since) const;
+
+    inline size_t tileCount() const
+    {
+        return m_hashes.size();
+    }
+
+    inline const std::vector<uint64_t> &hashes() const
+    {
+        return m_hashes;
+    }
+
+private:
+    void resizeGrid(uint32_t width, uint32_t height);
+
+    uint32_t m_width{ 0 };
+    uint32_t m_height{ 0 };
+    uint32_t m_columns{ 0 };
+    uint32_t m_rows{ 0 };
+    bool m_hashesValid{ false };
+    std::vector<uint64_t> m_hashes;
+    // Sequence of the frame in which each tile last changed
+    std::vector<uint64_t> m_changed;
+};
@@ -0,0 +1,254 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "watermark.h"
+#include "pixelconvert.h"
+#include "recordencoder.h"
+
+#include <QPainter>
+
+#include <algorithm>
+
+namespace {
+
+constexpr size_t CacheSize = 4;
+
+// BT.601 limited range, the same coefficients pixelconvert uses
+inline int lumaOf(QRgb rgb)
+{
+    return ((66 * qRed(rgb) + 129 * qGreen(rgb) + 25 * qBlue(rgb) + 128) >> 8) + 16;
+}
+
+inline int chromaUOf(QRgb rgb)
+{
+    return ((-38 * qRed(rgb) - 74 * qGreen(rgb) + 112 * qBlue(rgb) + 128) >> 8) + 128;
+}
+
+inline int chromaVOf(QRgb rgb)
+{
+    return ((112 * qRed(rgb) - 94 * qGreen(rgb) - 18 * qBlue(rgb) + 128) >> 8) + 128;
+}
+
+inline uint8_t premultiply(int value, int alpha)
+{
+    return uint8_t((value * alpha + 127) / 255);
+}
+
+} // namespace
+
+Watermark::Watermark(const QImage &image)
+    : m_source(image.convertToFormat(QImage::Format_RGBA8888_Premultiplied))
+{
+}
+
+void Watermark::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Watermark::setLogicalSize(const QSize &size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_logicalSize == size)
+        return;
+    m_logicalSize = size;
+    m_cache.clear();
+}
+
+QRect Watermark::placement(const QSize &frameSize) const
+{
+    return prepare(frameSize, Layout::Rgba8888)->rect;
+}
+
+QImage Watermark::overlay(const QSize &frameSize) const
+{
+    return prepare(frameSize, Layout::Rgba8888)->image;
+}
+
+bool Watermark::blend(uchar *bits,
+                      qsizetype bytesPerLine,
+                      const QSize &size,
+                      QImage::Format format) const
+{
+    Layout layout;
+    switch (format) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        layout = Layout::Argb32;
+        break;
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+        layout = Layout::Rgba8888;
+        break;
+    case QImage::Format_Invalid:
+        return false;
+    default: {
+        // 10 bit and 565 buffers are rare enough for the generic path
+        const auto prepared = prepare(size, Layout::Rgba8888);
+        QImage target(bits, size.width(), size.height(), bytesPerLine, format);
+        QPainter painter(&target);
+        painter.drawImage(prepared->rect.topLeft(), prepared->image);
+        return true;
+    }
+    }
+
+    const auto prepared = prepare(size, layout);
+    const QRect &rect = prepared->rect;
+    const SimdLevel level = simdLevel();
+    const size_t rowBytes = size_t(rect.width()) * 4;
+    for (int row = 0; row < rect.height(); ++row) {
+        blendPremultiplied(level,
+                           bits + bytesPerLine * (rect.y() + row) + size_t(rect.x()) * 4,
+                           prepared->pixels.data() + rowBytes * row,
+                           prepared->inverseAlpha.data() + rowBytes * row,
+                           rowBytes);
+    }
+    return true;
+}
+
+bool Watermark::blend(RecordYuvFrame &frame) const
+{
+    if (frame.data.empty())
+        return false;
+
+    const auto prepared = prepare(QSize(int(frame.width), int(frame.height)), Layout::I420);
+    const QRect &rect = prepared->rect;
+    const SimdLevel level = simdLevel();
+    const size_t width = size_t(rect.width());
+    const size_t height = size_t(rect.height());
+    const uint8_t *pixels = prepared->pixels.data();
+    const uint8_t *inverseAlpha = prepared->inverseAlpha.data();
+
+    for (size_t row = 0; row < height; ++row) {
+        blendPremultiplied(level,
+                           frame.planeY() + size_t(frame.width) * (rect.y() + row) + rect.x(),
+                           pixels + width * row,
+                           inverseAlpha + width * row,
+                           width);
+    }
+
+    const size_t chromaWidth = width / 2;
+    const size_t chromaHeight = height / 2;
+    const size_t chromaStride = frame.width / 2;
+    const size_t chromaOffset = chromaStride * (rect.y() / 2) + rect.x() / 2;
+    uint8_t *planes[] = { frame.planeU() + chromaOffset, frame.planeV() + chromaOffset };
+    size_t offset = width * height;
+    for (uint8_t *plane : planes) {
+        for (size_t row = 0; row < chromaHeight; ++row) {
+            blendPremultiplied(level,
+                               plane + chromaStride * row,
+                               pixels + offset + chromaWidth * row,
+                               inverseAlpha + offset + chromaWidth * row,
+                               chromaWidth);
+        }
+        offset += chromaWidth * chromaHeight;
+    }
+    return true;
+}
+
+std::shared_ptr<const Watermark::Prepared> Watermark::prepare(const QSize &frameSize,
+                                                              Layout layout) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto cached = std::find_if(m_cache.begin(), m_cache.end(), [&](const auto &prepared) {
+        return prepared->frameSize == frameSize && prepared->layout == layout;
+    });
+    if (cached != m_cache.end()) {
+        std::rotate(m_cache.begin(), cached, cached + 1);
+        return m_cache.front();
+    }
+
+    m_cache.insert(m_cache.begin(), build(frameSize, layout));
+    if (m_cache.size() > CacheSize)
+        m_cache.pop_back();
+    return m_cache.front();
+}
+
+// Called with m_mutex held
+std::shared_ptr<Watermark::Prepared> Watermark::build(const QSize &frameSize, Layout layout) const
+{
+    auto prepared = std::make_shared<Prepared>();
+    prepared->frameSize = frameSize;
+    prepared->layout = layout;
+
+    const qreal scale = m_logicalSize.width() > 0 ? qreal(frameSize.width()) / m_logicalSize.width()
+                                                  : 1.0;
+    const QSize scaledSize = (QSizeF(m_source.size()) * scale).toSize().expandedTo(QSize(1, 1));
+    // Even size and position, so the I420 chroma samples cover whole blocks
+    const QSize canvasSize((scaledSize.width() + 1) & ~1, (scaledSize.height() + 1) & ~1);
+    const QRect canvasRect(QPoint(0, ((frameSize.height() - canvasSize.height()) / 2) & ~1),
+                           canvasSize);
+    const QRect rect = canvasRect & QRect(QPoint(0, 0), frameSize);
+    if (rect.isEmpty() || m_source.isNull())
+        return prepared;
+
+    QImage canvas(canvasSize, QImage::Format_RGBA8888_Premultiplied);
+    canvas.fill(Qt::transparent);
+    {
+        QPainter painter(&canvas);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(QRect(QPoint(0, 0), scaledSize), m_source);
+    }
+    prepared->rect = rect;
+    prepared->image = canvas.copy(rect.translated(-canvasRect.topLeft()));
+
+    const int width = rect.width();
+    const int height = rect.height();
+    auto &pixels = prepared->pixels;
+    auto &inverseAlpha = prepared->inverseAlpha;
+
+    if (layout != Layout::I420) {
+        const QImage source = layout == Layout::Argb32
+            ? prepared->image.convertToFormat(QImage::Format_ARGB32_Premultiplied)
+            : prepared->image;
+        const size_t rowBytes = size_t(width) * 4;
+        pixels.resize(rowBytes * height);
+        inverseAlpha.resize(rowBytes * height);
+        for (int y = 0; y < height; ++y) {
+            std::copy_n(source.constScanLine(y), rowBytes, pixels.data() + rowBytes * y);
+            for (int x = 0; x < width; ++x) {
+                const uint8_t inverse = uint8_t(255 - qAlpha(source.pixel(x, y)));
+                std::fill_n(inverseAlpha.data() + rowBytes * y + size_t(x) * 4, 4, inverse);
+            }
+        }
+        return prepared;
+    }
+
+    // Colors are converted unpremultiplied and weighted by their own alpha,
+    // each chroma sample by the 2x2 block it covers.
+    const QImage source = prepared->image.convertToFormat(QImage::Format_RGBA8888);
+    const size_t lumaSize = size_t(width) * height;
+    const size_t chromaWidth = size_t(width) / 2;
+    const size_t chromaSize = chromaWidth * (height / 2);
+    pixels.resize(lumaSize + chromaSize * 2);
+    inverseAlpha.resize(pixels.size());
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const QRgb rgb = source.pixel(x, y);
+            const size_t index = size_t(width) * y + x;
+            pixels[index] = premultiply(lumaOf(rgb), qAlpha(rgb));
+            inverseAlpha[index] = uint8_t(255 - qAlpha(rgb));
+        }
+    }
+
+    for (int y = 0; y < height / 2; ++y) {
+        for (size_t x = 0; x < chromaWidth; ++x) {
+            int alpha = 0;
+            int u = 0;
+            int v = 0;
+            for (int i = 0; i < 4; ++i) {
+                const QRgb rgb = source.pixel(int(x) * 2 + (i & 1), y * 2 + (i >> 1));
+                alpha += qAlpha(rgb);
+                u += chromaUOf(rgb) * qAlpha(rgb);
+                v += chromaVOf(rgb) * qAlpha(rgb);
+            }
+            const size_t index = lumaSize + chromaWidth * y + x;
+            pixels[index] = uint8_t((u + 510) / 1020);
+            pixels[index + chromaSize] = uint8_t((v + 510) / 1020);
+            inverseAlpha[index] = uint8_t(255 - (alpha + 2) / 4);
+            inverseAlpha[index + chromaSize] = inverseAlpha[index];
+        }
+    }
+    return prepared;
+}
@@ -0,0 +1,75 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <QImage>
+#include <QRect>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct RecordYuvFrame;
+
+// Burns the watermark into captured frames. It is placed like the QLabel
+// overlay shows it on screen, at the left edge and vertically centred in the
+// capture region, scaled by the ratio of the frame to the region's logical
+// size. The premultiplied pixels are prepared once per frame size and
+// layout, blending then only touches the watermark's rectangle.
+//
+// Thread safe, the screenshot workers and the recorder's conversion thread
+// share one instance with the GUI thread.
+class Watermark
+{
+public:
+    explicit Watermark(const QImage &image);
+
+    inline bool isEnabled() const
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool enabled);
+    // Logical size of the capture region, frames with more pixels are HiDPI.
+    void setLogicalSize(const QSize &size);
+
+    // Area covered in a frame of frameSize pixels, with even coordinates.
+    QRect placement(const QSize &frameSize) const;
+    // Premultiplied RGBA8888 pixels of placement(frameSize), for the GL path.
+    QImage overlay(const QSize &frameSize) const;
+
+    // In place on 8888 images, any other format goes through QPainter.
+    bool blend(uchar *bits, qsizetype bytesPerLine, const QSize &size, QImage::Format format) const;
+    bool blend(RecordYuvFrame &frame) const;
+
+private:
+    enum class Layout {
+        Rgba8888,
+        Argb32,
+        I420,
+    };
+
+    struct Prepared
+    {
+        QSize frameSize;
+        Layout layout;
+        QRect rect;
+        QImage image;
+        // Premultiplied source and 255 - alpha for every byte blended, for
+        // I420 the Y rows followed by the U and V rows.
+        std::vector<uint8_t> pixels;
+        std::vector<uint8_t> inverseAlpha;
+    };
+
+    std::shared_ptr<const Prepared> prepare(const QSize &frameSize, Layout layout) const;
+    std::shared_ptr<Prepared> build(const QSize &frameSize, Layout layout) const;
+
+    const QImage m_source;
+    std::atomic_bool m_enabled{ false };
+    mutable std::mutex m_mutex;
+    QSize m_logicalSize;
+    // Most recently used first, emptied when the logical size changes
+    mutable std::vector<std::shared_ptr<const Prepared>> m_cache;
+};
@@ -0,0 +1,227 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "mockcompositor.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <getopt.h>
+
+namespace {
+
+MockCompositor *s_compositor = nullptr;
+
+void handleSignal(int)
+{
+    if (s_compositor)
+        s_compositor->terminate();
+}
+
+bool parseFormat(const char *name, uint32_t *drmFormat)
+{
+    static const struct
+    {
+        const char *name;
+        uint32_t fourcc;
+    } formats[] = {
+        { "xrgb8888", 0x34325258 },    { "argb8888", 0x34325241 },
+        { "xbgr8888", 0x34324258 },    { "abgr8888", 0x34324241 },
+        { "xrgb2101010", 0x30335258 }, { "argb2101010", 0x30335241 },
+        { "nv12", 0x3231564e },
+    };
+    for (const auto &format : formats) {
+        if (std::strcmp(format.name, name) == 0) {
+            *drmFormat = format.fourcc;
+            return true;
+        }
+    }
+    return false;
+}
+
+// wl_shm uses the DRM fourccs except for the two formats defined by the core protocol.
+uint32_t shmFormat(uint32_t drmFormat)
+{
+    if (drmFormat == 0x34325241)
+        return 0;
+    if (drmFormat == 0x34325258)
+        return 1;
+    return drmFormat;
+}
+
+void usage(const char *program)
+{
+    std::printf("Usage: %s [options]\n"
+                "  --socket NAME          Wayland socket name (default: first free wayland-N)\n"
+                "  --size WxH             Capture region size (default: 1920x1080)\n"
+                "  --offset X,Y           Capture region position (default: 0,0)\n"
+                "  --format NAME          Session buffer format: xrgb8888, argb8888, xbgr8888,\n"
+                "                         abgr8888, xrgb2101010, argb2101010 or nv12\n"
+                "  --shm-formats A,B,...  Formats offered to screenshot frames, in order\n"
+                "  --stride-align N       Pad every row to a multiple of N bytes\n"
+                "  --fps N                Session frame rate (default: 60)\n"
+                "  --swapchain N          Number of recycled session buffers (default: 3)\n"
+                "  --separate-planes      One object per plane for multi-planar formats\n"
+                "  --no-udmabuf           Hand out plain memfds instead of udmabuf dma-bufs\n"
+                "  --static               Keep the session content unchanged\n"
+                "  --fail-source          Fail every source selection\n"
+                "  --fail-every N         Fail every Nth frame copy\n"
+                "  --cancel-after N       Cancel sessions after N frames\n"
+                "  --cancel-reason N      Reason sent with the cancel event\n"
+                "  --exit-after N         Quit after sending N session frames\n",
+                program);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    enum {
+        OptSocket = 1,
+        OptSize,
+        OptOffset,
+        OptFormat,
+        OptShmFormats,
+        OptStrideAlign,
+        OptFps,
+        OptSwapchain,
+        OptSeparatePlanes,
+        OptNoUdmabuf,
+        OptStatic,
+        OptFailSource,
+        OptFailEvery,
+        OptCancelAfter,
+        OptCancelReason,
+        OptExitAfter,
+        OptHelp,
+    };
+    static const option longOptions[] = {
+        { "socket", required_argument, nullptr, OptSocket },
+        { "size", required_argument, nullptr, OptSize },
+        { "offset", required_argument, nullptr, OptOffset },
+        { "format", required_argument, nullptr, OptFormat },
+        { "shm-formats", required_argument, nullptr, OptShmFormats },
+        { "stride-align", required_argument, nullptr, OptStrideAlign },
+        { "fps", required_argument, nullptr, OptFps },
+        { "swapchain", required_argument, nullptr, OptSwapchain },
+        { "separate-planes", no_argument, nullptr, OptSeparatePlanes },
+        { "no-udmabuf", no_argument, nullptr, OptNoUdmabuf },
+        { "static", no_argument, nullptr, OptStatic },
+        { "fail-source", no_argument, nullptr, OptFailSource },
+        { "fail-every", required_argument, nullptr, OptFailEvery },
+        { "cancel-after", required_argument, nullptr, OptCancelAfter },
+        { "cancel-reason", required_argument, nullptr, OptCancelReason },
+        { "exit-after", required_argument, nullptr, OptExitAfter },
+        { "help", no_argument, nullptr, OptHelp },
+        { nullptr, 0, nullptr, 0 },
+    };
+
+    MockCompositor::Options options;
+    int option;
+    while ((option = getopt_long(argc, argv, "", longOptions, nullptr)) != -1) {
+        switch (option) {
+        case OptSocket:
+            options.socketName = optarg;
+            break;
+        case OptSize:
+            if (std::sscanf(optarg, "%ux%u", &options.width, &options.height) != 2) {
+                std::fprintf(stderr, "Invalid size %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OptOffset:
+            if (std::sscanf(optarg, "%d,%d", &options.regionX, &options.regionY) != 2) {
+                std::fprintf(stderr, "Invalid offset %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OptFormat:
+            if (!parseFormat(optarg, &options.drmFormat)) {
+                std::fprintf(stderr, "Unknown format %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OptShmFormats: {
+            options.shmFormats.clear();
+            std::string list = optarg;
+            size_t start = 0;
+            while (start <= list.size()) {
+                const size_t end = list.find(',', start);
+                const std::string name =
+                    list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+                uint32_t format;
+                if (!parseFormat(name.c_str(), &format) || format == 0x3231564e) {
+                    std::fprintf(stderr, "Unknown shm format %s\n", name.c_str());
+                    return EXIT_FAILURE;
+                }
+                options.shmFormats.push_back(shmFormat(format));
+                if (end == std::string::npos)
+                    break;
+                start = end + 1;
+            }
+            break;
+        }
+        case OptStrideAlign:
+            options.strideAlignment = uint32_t(std::strtoul(optarg, nullptr, 10));
+            break;
+        case OptFps:
+            options.fps = std::strtod(optarg, nullptr);
+            break;
+        case OptSwapchain:
+            options.swapchainLength = uint32_t(std::strtoul(optarg, nullptr, 10));
+            break;
+        case OptSeparatePlanes:
+            options.separatePlaneObjects = true;
+            break;
+        case OptNoUdmabuf:
+            options.useUdmabuf = false;
+            break;
+        case OptStatic:
+            options.staticContent = true;
+            break;
+        case OptFailSource:
+            options.failSourceSelection = true;
+            break;
+        case OptFailEvery:
+            options.failEveryNthCopy = uint32_t(std::strtoul(optarg, nullptr, 10));
+            break;
+        case OptCancelAfter:
+            options.cancelSessionAfter = uint32_t(std::strtoul(optarg, nullptr, 10));
+            break;
+        case OptCancelReason:
+            options.cancelReason = uint32_t(std::strtoul(optarg, nullptr, 10));
+            break;
+        case OptExitAfter:
+            options.exitAfterFrames = uint32_t(std::strtoul(optarg, nullptr, 10));
+            break;
+        case OptHelp:
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    MockCompositor compositor(options);
+    if (!compositor.initialize())
+        return EXIT_FAILURE;
+
+    s_compositor = &compositor;
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+
+    std::printf("%s\n", compositor.socketName().c_str());
+    std::fflush(stdout);
+    const int result = compositor.run();
+
+    std::fprintf(stderr,
+                 "mock-compositor: sent %llu session frames, served %llu copies\n",
+                 static_cast<unsigned long long>(compositor.framesSent()),
+                 static_cast<unsigned long long>(compositor.copiesServed()));
+    s_compositor = nullptr;
+    return result;
+}
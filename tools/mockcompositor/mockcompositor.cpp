@@ -0,0 +1,486 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#include "mockcompositor.h"
+
+#include "treeland-capture-unstable-v1-server-protocol.h"
+
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+
+#include <linux/udmabuf.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t fourcc(char a, char b, char c, char d)
+{
+    return uint32_t(a) | uint32_t(b) << 8 | uint32_t(c) << 16 | uint32_t(d) << 24;
+}
+
+constexpr uint32_t DrmFormatNV12 = fourcc('N', 'V', '1', '2');
+constexpr uint32_t ShmFormatRGB565 = fourcc('R', 'G', '1', '6');
+
+inline uint32_t alignUp(uint32_t value, uint32_t alignment)
+{
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+inline size_t pageAlign(size_t size)
+{
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    return (size + page - 1) / page * page;
+}
+
+inline uint32_t shmBytesPerPixel(uint32_t format)
+{
+    return format == ShmFormatRGB565 ? 2 : 4;
+}
+
+inline bool isInterface(wl_resource *resource, const wl_interface *interface)
+{
+    return std::strcmp(wl_resource_get_class(resource), interface->name) == 0;
+}
+
+inline uint32_t gradientPixel(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    const uint32_t r = x * 255 / (width ? width : 1);
+    const uint32_t g = y * 255 / (height ? height : 1);
+    return 0xff000000u | r << 16 | g << 8 | 0x80u;
+}
+
+} // namespace
+
+MockCompositor::MockCompositor(const Options &options)
+    : m_options(options)
+{
+}
+
+MockCompositor::~MockCompositor()
+{
+    if (m_display) {
+        wl_display_destroy_clients(m_display);
+        wl_display_destroy(m_display);
+    }
+    for (auto &buffer : m_swapchain) {
+        for (auto &object : buffer.objects) {
+            if (object.data)
+                munmap(object.data, object.size);
+            if (object.fd >= 0)
+                ::close(object.fd);
+        }
+    }
+}
+
+bool MockCompositor::initialize()
+{
+    m_display = wl_display_create();
+    if (!m_display)
+        return false;
+
+    if (m_options.socketName.empty()) {
+        const char *name = wl_display_add_socket_auto(m_display);
+        if (!name) {
+            std::fprintf(stderr, "mock-compositor: failed to create a socket\n");
+            return false;
+        }
+        m_socketName = name;
+    } else {
+        if (wl_display_add_socket(m_display, m_options.socketName.c_str()) != 0) {
+            std::fprintf(stderr,
+                         "mock-compositor: failed to add socket %s\n",
+                         m_options.socketName.c_str());
+            return false;
+        }
+        m_socketName = m_options.socketName;
+    }
+
+    wl_display_init_shm(m_display);
+    for (uint32_t format : m_options.shmFormats) {
+        if (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888)
+            wl_display_add_shm_format(m_display, format);
+    }
+
+    m_compositorGlobal =
+        wl_global_create(m_display, &wl_compositor_interface, 4, this, &MockCompositor::bindCompositor);
+    m_managerGlobal = wl_global_create(m_display,
+                                       &treeland_capture_manager_v1_interface,
+                                       1,
+                                       this,
+                                       &MockCompositor::bindManager);
+    if (!m_compositorGlobal || !m_managerGlobal)
+        return false;
+
+    return allocateSwapchain();
+}
+
+int MockCompositor::run()
+{
+    wl_display_run(m_display);
+    return 0;
+}
+
+void MockCompositor::terminate()
+{
+    if (m_display)
+        wl_display_terminate(m_display);
+}
+
+void MockCompositor::bindCompositor(wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    auto self = static_cast<MockCompositor *>(data);
+    self->createResource(client, &wl_compositor_interface, version, id);
+}
+
+void MockCompositor::bindManager(wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    auto self = static_cast<MockCompositor *>(data);
+    self->createResource(client, &treeland_capture_manager_v1_interface, version, id);
+}
+
+wl_resource *MockCompositor::createResource(wl_client *client,
+                                            const wl_interface *interface,
+                                            uint32_t version,
+                                            uint32_t id,
+                                            void *data,
+                                            void (*destroy)(wl_resource *))
+{
+    wl_resource *resource = wl_resource_create(client, interface, int(version), id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return nullptr;
+    }
+    wl_resource_set_dispatcher(resource, &MockCompositor::dispatch, this, data, destroy);
+    return resource;
+}
+
+// Every resource shares this dispatcher and requests are told apart by name,
+// which keeps the mock independent of the generated vtable layouts.
+int MockCompositor::dispatch(const void *implementation,
+                             void *target,
+                             uint32_t opcode,
+                             const wl_message *message,
+                             wl_argument *args)
+{
+    (void)opcode;
+    auto self = const_cast<MockCompositor *>(static_cast<const MockCompositor *>(implementation));
+    self->handleRequest(static_cast<wl_resource *>(target), message, args);
+    return 0;
+}
+
+void MockCompositor::createGenericObjects(wl_resource *resource,
+                                          const wl_message *message,
+                                          wl_argument *args)
+{
+    wl_client *client = wl_resource_get_client(resource);
+    const uint32_t version = uint32_t(wl_resource_get_version(resource));
+    int index = 0;
+    for (const char *signature = message->signature; *signature; ++signature) {
+        if (*signature == '?' || (*signature >= '0' && *signature <= '9'))
+            continue;
+        if (*signature == 'n' && message->types[index]) {
+            wl_resource *created =
+                createResource(client, message->types[index], version, args[index].n);
+            if (created && message->types[index] == &wl_callback_interface) {
+                // wl_surface.frame and friends, nothing is ever presented here
+                wl_callback_send_done(created, 0);
+                wl_resource_destroy(created);
+            } else if (created && message->types[index] == &treeland_capture_frame_v1_interface) {
+                sendBufferOffers(created);
+            } else if (created && message->types[index] == &treeland_capture_session_v1_interface) {
+                auto session = new Session;
+                session->compositor = this;
+                session->resource = created;
+                wl_resource_set_user_data(created, session);
+                wl_resource_set_destructor(created, &MockCompositor::destroySession);
+            }
+        }
+        ++index;
+    }
+}
+
+void MockCompositor::handleRequest(wl_resource *resource, const wl_message *message, wl_argument *args)
+{
+    const std::string name = message->name;
+
+    if (name == "destroy" || name == "release") {
+        wl_resource_destroy(resource);
+        return;
+    }
+
+    createGenericObjects(resource, message, args);
+
+    if (isInterface(resource, &treeland_capture_context_v1_interface) && name == "select_source") {
+        if (m_options.failSourceSelection) {
+            treeland_capture_context_v1_send_source_failed(resource, 0);
+        } else {
+            treeland_capture_context_v1_send_source_ready(resource,
+                                                          m_options.regionX,
+                                                          m_options.regionY,
+                                                          m_options.width,
+                                                          m_options.height,
+                                                          m_options.sourceType);
+        }
+    } else if (isInterface(resource, &treeland_capture_frame_v1_interface) && name == "copy") {
+        copyFrame(resource, reinterpret_cast<wl_resource *>(args[0].o));
+    } else if (isInterface(resource, &treeland_capture_session_v1_interface) && name == "start") {
+        startSession(resource);
+    }
+}
+
+void MockCompositor::sendBufferOffers(wl_resource *frame)
+{
+    for (uint32_t format : m_options.shmFormats) {
+        const uint32_t stride =
+            alignUp(m_options.width * shmBytesPerPixel(format), m_options.strideAlignment);
+        treeland_capture_frame_v1_send_buffer(frame, format, m_options.width, m_options.height, stride);
+    }
+}
+
+void MockCompositor::copyFrame(wl_resource *frame, wl_resource *buffer)
+{
+    const uint64_t copy = ++m_copyCount;
+    wl_shm_buffer *shmBuffer = buffer ? wl_shm_buffer_get(buffer) : nullptr;
+    const bool injectFailure =
+        m_options.failEveryNthCopy && copy % m_options.failEveryNthCopy == 0;
+    if (!shmBuffer || injectFailure) {
+        treeland_capture_frame_v1_send_failed(frame);
+        return;
+    }
+
+    const auto width = uint32_t(wl_shm_buffer_get_width(shmBuffer));
+    const auto height = uint32_t(wl_shm_buffer_get_height(shmBuffer));
+    const auto stride = uint32_t(wl_shm_buffer_get_stride(shmBuffer));
+    const uint32_t format = wl_shm_buffer_get_format(shmBuffer);
+    if (width != m_options.width || height != m_options.height) {
+        treeland_capture_frame_v1_send_failed(frame);
+        return;
+    }
+
+    wl_shm_buffer_begin_access(shmBuffer);
+    paintShm(static_cast<uint8_t *>(wl_shm_buffer_get_data(shmBuffer)), width, height, stride, format);
+    wl_shm_buffer_end_access(shmBuffer);
+
+    ++m_copiesServed;
+    treeland_capture_frame_v1_send_flags(frame, 0);
+    treeland_capture_frame_v1_send_ready(frame);
+}
+
+void MockCompositor::paintShm(uint8_t *data, uint32_t width, uint32_t height, uint32_t stride, uint32_t format)
+{
+    for (uint32_t y = 0; y < height; ++y) {
+        uint8_t *row = data + size_t(stride) * y;
+        if (shmBytesPerPixel(format) == 2) {
+            auto pixels = reinterpret_cast<uint16_t *>(row);
+            for (uint32_t x = 0; x < width; ++x)
+                pixels[x] = uint16_t((x * 31 / width) << 11 | (y * 63 / height) << 5 | 0x10);
+        } else {
+            auto pixels = reinterpret_cast<uint32_t *>(row);
+            for (uint32_t x = 0; x < width; ++x)
+                pixels[x] = gradientPixel(x, y, width, height);
+        }
+    }
+}
+
+bool MockCompositor::allocateObject(Object *object, size_t size)
+{
+    size = pageAlign(size);
+    int memfd = memfd_create("mock-compositor-buffer", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0 || ftruncate(memfd, off_t(size)) < 0) {
+        std::fprintf(stderr, "mock-compositor: memfd allocation failed: %s\n", std::strerror(errno));
+        if (memfd >= 0)
+            ::close(memfd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (data == MAP_FAILED) {
+        ::close(memfd);
+        return false;
+    }
+
+    object->data = static_cast<uint8_t *>(data);
+    object->size = size;
+    object->fd = memfd;
+
+    if (!m_options.useUdmabuf)
+        return true;
+
+    // udmabuf turns the memfd into a real dma-buf, clients then see the same
+    // fd type and inode behaviour as with a GPU compositor.
+    int device = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (device < 0)
+        return true;
+    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK);
+    udmabuf_create create{};
+    create.memfd = uint32_t(memfd);
+    create.flags = UDMABUF_FLAGS_CLOEXEC;
+    create.offset = 0;
+    create.size = size;
+    int dmabuf = ioctl(device, UDMABUF_CREATE, &create);
+    ::close(device);
+    if (dmabuf >= 0) {
+        ::close(memfd);
+        object->fd = dmabuf;
+    }
+    return true;
+}
+
+bool MockCompositor::allocateSwapchain()
+{
+    m_swapchain.resize(m_options.swapchainLength ? m_options.swapchainLength : 1);
+    for (auto &buffer : m_swapchain) {
+        if (m_options.drmFormat == DrmFormatNV12) {
+            const uint32_t stride = alignUp(m_options.width, m_options.strideAlignment);
+            const uint32_t chromaHeight = (m_options.height + 1) / 2;
+            if (m_options.separatePlaneObjects) {
+                buffer.objects.resize(2);
+                buffer.planes = { { 0, 0, stride, m_options.height }, { 1, 0, stride, chromaHeight } };
+            } else {
+                buffer.objects.resize(1);
+                buffer.planes = { { 0, 0, stride, m_options.height },
+                                  { 0, stride * m_options.height, stride, chromaHeight } };
+            }
+        } else {
+            const uint32_t stride = alignUp(m_options.width * 4, m_options.strideAlignment);
+            buffer.objects.resize(1);
+            buffer.planes = { { 0, 0, stride, m_options.height } };
+        }
+
+        std::vector<size_t> sizes(buffer.objects.size(), 0);
+        for (const auto &plane : buffer.planes) {
+            const size_t end = size_t(plane.offset) + size_t(plane.stride) * plane.height;
+            if (end > sizes[plane.objectIndex])
+                sizes[plane.objectIndex] = end;
+        }
+        for (size_t i = 0; i < buffer.objects.size(); ++i) {
+            if (!allocateObject(&buffer.objects[i], sizes[i]))
+                return false;
+        }
+        paint(&buffer, 0);
+    }
+    return true;
+}
+
+void MockCompositor::paint(SwapchainBuffer *buffer, uint64_t frame)
+{
+    const uint32_t width = m_options.width;
+    const uint32_t height = m_options.height;
+    const uint32_t bandHeight = height < 32 ? height : 32;
+    // Frame 0 paints the whole buffer, later frames only move a band so that
+    // most tiles stay untouched like on a mostly static desktop.
+    const uint32_t firstRow = frame == 0 ? 0 : uint32_t(frame * 8 % (height - bandHeight + 1));
+    const uint32_t lastRow = frame == 0 ? height : firstRow + bandHeight;
+
+    for (size_t planeIndex = 0; planeIndex < buffer->planes.size(); ++planeIndex) {
+        const Plane &plane = buffer->planes[planeIndex];
+        uint8_t *base = buffer->objects[plane.objectIndex].data + plane.offset;
+        if (m_options.drmFormat == DrmFormatNV12) {
+            const uint32_t div = planeIndex == 0 ? 1 : 2;
+            for (uint32_t y = firstRow / div; y < lastRow / div && y < plane.height; ++y) {
+                uint8_t *row = base + size_t(plane.stride) * y;
+                for (uint32_t x = 0; x < width; ++x)
+                    row[x] = planeIndex == 0 ? uint8_t(16 + (x + y + frame) % 220) : 128;
+            }
+        } else {
+            for (uint32_t y = firstRow; y < lastRow; ++y) {
+                auto row = reinterpret_cast<uint32_t *>(base + size_t(plane.stride) * y);
+                for (uint32_t x = 0; x < width; ++x) {
+                    row[x] = frame == 0 ? gradientPixel(x, y, width, height)
+                                        : 0xff000000u | uint32_t(frame * 2654435761u) >> 8;
+                }
+            }
+        }
+    }
+}
+
+void MockCompositor::startSession(wl_resource *resource)
+{
+    auto session = static_cast<Session *>(wl_resource_get_user_data(resource));
+    if (!session || session->timer)
+        return;
+    wl_event_loop *loop = wl_display_get_event_loop(m_display);
+    session->timer = wl_event_loop_add_timer(loop, &MockCompositor::sessionTimer, session);
+    wl_event_source_timer_update(session->timer, 1);
+}
+
+int MockCompositor::sessionTimer(void *data)
+{
+    auto session = static_cast<Session *>(data);
+    MockCompositor *self = session->compositor;
+    self->sendSessionFrame(session);
+    if (!session->cancelled) {
+        const int interval = int(std::lround(1000.0 / (self->m_options.fps > 0 ? self->m_options.fps : 60.0)));
+        wl_event_source_timer_update(session->timer, interval > 0 ? interval : 1);
+    }
+    return 0;
+}
+
+void MockCompositor::sendSessionFrame(Session *session)
+{
+    SwapchainBuffer &buffer = m_swapchain[session->frameCount % m_swapchain.size()];
+    ++session->frameCount;
+    if (!m_options.staticContent)
+        paint(&buffer, session->frameCount);
+
+    const uint64_t modifier = 0; // DRM_FORMAT_MOD_LINEAR
+    treeland_capture_session_v1_send_frame(session->resource,
+                                           m_options.regionX,
+                                           m_options.regionY,
+                                           m_options.width,
+                                           m_options.height,
+                                           0,
+                                           0,
+                                           m_options.drmFormat,
+                                           uint32_t(modifier >> 32),
+                                           uint32_t(modifier & 0xffffffff),
+                                           uint32_t(buffer.planes.size()));
+    for (size_t planeIndex = 0; planeIndex < buffer.planes.size(); ++planeIndex) {
+        const Plane &plane = buffer.planes[planeIndex];
+        const Object &object = buffer.objects[plane.objectIndex];
+        // libwayland duplicates the fd while marshalling, the buffer keeps its own
+        treeland_capture_session_v1_send_object(session->resource,
+                                                plane.objectIndex,
+                                                object.fd,
+                                                uint32_t(object.size),
+                                                plane.offset,
+                                                plane.stride,
+                                                uint32_t(planeIndex));
+    }
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const uint64_t seconds = uint64_t(now.tv_sec);
+    treeland_capture_session_v1_send_ready(session->resource,
+                                           uint32_t(seconds >> 32),
+                                           uint32_t(seconds & 0xffffffff),
+                                           uint32_t(now.tv_nsec));
+    ++m_framesSent;
+
+    if (m_options.cancelSessionAfter && session->frameCount >= m_options.cancelSessionAfter) {
+        treeland_capture_session_v1_send_cancel(session->resource, m_options.cancelReason);
+        session->cancelled = true;
+    }
+    if (m_options.exitAfterFrames && m_framesSent >= m_options.exitAfterFrames)
+        terminate();
+}
+
+void MockCompositor::destroySession(wl_resource *resource)
+{
+    auto session = static_cast<Session *>(wl_resource_get_user_data(resource));
+    if (!session)
+        return;
+    if (session->timer)
+        wl_event_source_remove(session->timer);
+    delete session;
+}
@@ -0,0 +1,150 @@
+// SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+// SPDX-License-Identifier: Apache-2.0 OR LGPL-3.0-only OR GPL-2.0-only OR GPL-3.0-only
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct wl_client;
+struct wl_display;
+struct wl_event_source;
+struct wl_global;
+struct wl_interface;
+struct wl_message;
+struct wl_resource;
+union wl_argument;
+
+// Headless Wayland server implementing treeland-capture-unstable-v1 with
+// synthetic frames, so the capture client can be driven without Treeland.
+class MockCompositor
+{
+public:
+    struct Options
+    {
+        std::string socketName;
+        int32_t regionX{ 0 };
+        int32_t regionY{ 0 };
+        uint32_t width{ 1920 };
+        uint32_t height{ 1080 };
+        // DRM fourcc of the session buffers, see drm_fourcc.h
+        uint32_t drmFormat{ 0x34325258 }; // DRM_FORMAT_XRGB8888
+        // wl_shm formats offered to frames, in offer order
+        std::vector<uint32_t> shmFormats{ 1 /* XRGB8888 */, 0 /* ARGB8888 */ };
+        uint32_t strideAlignment{ 4 };
+        double fps{ 60.0 };
+        uint32_t swapchainLength{ 3 };
+        // Put every plane of a multi-planar format into its own object
+        bool separatePlaneObjects{ false };
+        // Try real dma-bufs through /dev/udmabuf before falling back to memfd
+        bool useUdmabuf{ true };
+        // Keep the content static so consecutive frames are identical
+        bool staticContent{ false };
+        uint32_t sourceType{ 1 };
+        bool failSourceSelection{ false };
+        // Send failed for every Nth frame copy, 0 disables it
+        uint32_t failEveryNthCopy{ 0 };
+        // Cancel the session after N frames, 0 disables it
+        uint32_t cancelSessionAfter{ 0 };
+        uint32_t cancelReason{ 0 };
+        // Stop the server after N session frames, 0 runs until terminated
+        uint32_t exitAfterFrames{ 0 };
+    };
+
+    explicit MockCompositor(const Options &options);
+    ~MockCompositor();
+
+    MockCompositor(const MockCompositor &) = delete;
+    MockCompositor &operator=(const MockCompositor &) = delete;
+
+    bool initialize();
+    // Runs the event loop until terminate() is called, from any thread.
+    int run();
+    void terminate();
+
+    inline const std::string &socketName() const
+    {
+        return m_socketName;
+    }
+
+    inline uint64_t framesSent() const
+    {
+        return m_framesSent;
+    }
+
+    inline uint64_t copiesServed() const
+    {
+        return m_copiesServed;
+    }
+
+private:
+    struct Plane
+    {
+        uint32_t objectIndex;
+        uint32_t offset;
+        uint32_t stride;
+        uint32_t height;
+    };
+
+    struct Object
+    {
+        int fd{ -1 };
+        uint8_t *data{ nullptr };
+        size_t size{ 0 };
+    };
+
+    struct SwapchainBuffer
+    {
+        std::vector<Object> objects;
+        std::vector<Plane> planes;
+    };
+
+    struct Session
+    {
+        MockCompositor *compositor{ nullptr };
+        wl_resource *resource{ nullptr };
+        wl_event_source *timer{ nullptr };
+        uint64_t frameCount{ 0 };
+        bool cancelled{ false };
+    };
+
+    static int dispatch(const void *implementation,
+                        void *target,
+                        uint32_t opcode,
+                        const wl_message *message,
+                        wl_argument *args);
+    static void bindCompositor(wl_client *client, void *data, uint32_t version, uint32_t id);
+    static void bindManager(wl_client *client, void *data, uint32_t version, uint32_t id);
+    static int sessionTimer(void *data);
+    static void destroySession(wl_resource *resource);
+
+    wl_resource *createResource(wl_client *client,
+                                const wl_interface *interface,
+                                uint32_t version,
+                                uint32_t id,
+                                void *data = nullptr,
+                                void (*destroy)(wl_resource *) = nullptr);
+    void handleRequest(wl_resource *resource, const wl_message *message, wl_argument *args);
+    void createGenericObjects(wl_resource *resource, const wl_message *message, wl_argument *args);
+    void sendBufferOffers(wl_resource *frame);
+    void copyFrame(wl_resource *frame, wl_resource *buffer);
+    void startSession(wl_resource *resource);
+    void sendSessionFrame(Session *session);
+    bool allocateSwapchain();
+    bool allocateObject(Object *object, size_t size);
+    void paint(SwapchainBuffer *buffer, uint64_t frame);
+    void paintShm(uint8_t *data, uint32_t width, uint32_t height, uint32_t stride, uint32_t format);
+
+    Options m_options;
+    std::string m_socketName;
+    wl_display *m_display{ nullptr };
+    wl_global *m_compositorGlobal{ nullptr };
+    wl_global *m_managerGlobal{ nullptr };
+    std::vector<SwapchainBuffer> m_swapchain;
+    uint64_t m_copyCount{ 0 };
+    std::atomic<uint64_t> m_framesSent{ 0 };
+    std::atomic<uint64_t> m_copiesServed{ 0 };
+};